@@ -28,8 +28,6 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
-#include <sys/epoll.h>
-#include <sys/signalfd.h>
 #include "wpa.h"
 
 #ifdef __cplusplus
@@ -53,24 +51,6 @@ void owfd_p2pd_init_config(struct owfd_p2pd_config *conf);
 void owfd_p2pd_clear_config(struct owfd_p2pd_config *conf);
 int owfd_p2pd_parse_argv(struct owfd_p2pd_config *conf, int argc, char **argv);
 
-/* main */
-
-enum owfd_p2pd_ep_action {
-	OWFD_P2PD_EP_HANDLED,
-	OWFD_P2PD_EP_NOT_HANDLED,
-	OWFD_P2PD_EP_QUIT,
-};
-
-struct owfd_p2pd_ep {
-	struct epoll_event *ev;
-	struct epoll_event *evs;
-	size_t num;
-};
-
-int owfd_p2pd_ep_add(int efd, int *fd, unsigned int events);
-void owfd_p2pd_ep_update(int efd, int *fd, unsigned int events);
-void owfd_p2pd_ep_remove(int efd, int fd);
-
 /* interface handling */
 
 struct owfd_p2pd_interface;
@@ -80,12 +60,9 @@ typedef void (*owfd_p2pd_interface_event_fn) (struct owfd_p2pd_interface *ifc,
 					      void *data);
 
 int owfd_p2pd_interface_new(struct owfd_p2pd_interface **out,
-			    struct owfd_p2pd_config *conf, int efd);
+			    struct owfd_p2pd_config *conf,
+			    struct shl_loop *loop);
 void owfd_p2pd_interface_free(struct owfd_p2pd_interface *iface);
-int owfd_p2pd_interface_dispatch(struct owfd_p2pd_interface *iface,
-				 struct owfd_p2pd_ep *ep);
-int owfd_p2pd_interface_dispatch_chld(struct owfd_p2pd_interface *iface,
-				      struct signalfd_siginfo *info);
 
 int owfd_p2pd_interface_register_event_fn(struct owfd_p2pd_interface *iface,
 					  owfd_p2pd_interface_event_fn event_fn,
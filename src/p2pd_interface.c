@@ -32,7 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/inotify.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -40,6 +40,7 @@
 #include "shared.h"
 #include "shl_dlist.h"
 #include "shl_log.h"
+#include "shl_loop.h"
 #include "wpa.h"
 
 struct event_user {
@@ -51,7 +52,8 @@ struct event_user {
 struct owfd_p2pd_interface {
 	struct owfd_wpa_ctrl *wpa;
 	struct owfd_p2pd_config *config;
-	int wpa_fd;
+	struct shl_loop *loop;
+	struct shl_loop_signal chld;
 	pid_t pid;
 
 	struct shl_dlist event_users;
@@ -60,6 +62,9 @@ struct owfd_p2pd_interface {
 static int wpa_setup(struct owfd_p2pd_interface *iface);
 static void wpa_event(struct owfd_wpa_ctrl *wpa, void *buf,
 		      size_t len, void *data);
+static void wpa_error(struct owfd_wpa_ctrl *wpa, int error, void *data);
+static void chld_fn(struct shl_loop_signal *sig,
+		    const struct signalfd_siginfo *info, void *data);
 
 /*
  * Execute wpa_supplicant. This is called after fork(). It shall initialize the
@@ -358,7 +363,8 @@ static void kill_wpa(struct owfd_p2pd_interface *iface)
 }
 
 int owfd_p2pd_interface_new(struct owfd_p2pd_interface **out,
-			    struct owfd_p2pd_config *conf, int efd)
+			    struct owfd_p2pd_config *conf,
+			    struct shl_loop *loop)
 {
 	struct owfd_p2pd_interface *iface;
 	int r;
@@ -369,22 +375,27 @@ int owfd_p2pd_interface_new(struct owfd_p2pd_interface **out,
 	if (!iface)
 		return log_ENOMEM();
 	iface->config = conf;
+	iface->loop = loop;
 	shl_dlist_init(&iface->event_users);
 
-	r = owfd_wpa_ctrl_new(&iface->wpa);
+	r = owfd_wpa_ctrl_new_loop(&iface->wpa, loop);
 	if (r < 0) {
 		errno = -r;
 		log_vERRNO();
 		goto err_iface;
 	}
 	owfd_wpa_ctrl_set_data(iface->wpa, iface);
+	owfd_wpa_ctrl_set_error_cb(iface->wpa, wpa_error);
 
-	r = fork_wpa(iface);
-	if (r < 0)
-		goto err_kill;
+	/* SIGCHLD must be watched before the child can exit */
+	shl_loop_signal_init(&iface->chld, SIGCHLD, chld_fn, iface);
+	r = shl_loop_signal_add(loop, &iface->chld);
+	if (r < 0) {
+		r = log_ERR(r);
+		goto err_wpa;
+	}
 
-	iface->wpa_fd = owfd_wpa_ctrl_get_fd(iface->wpa);
-	r = owfd_p2pd_ep_add(efd, &iface->wpa_fd, EPOLLIN);
+	r = fork_wpa(iface);
 	if (r < 0)
 		goto err_kill;
 
@@ -394,6 +405,8 @@ int owfd_p2pd_interface_new(struct owfd_p2pd_interface **out,
 err_kill:
 	kill_wpa(iface);
 	owfd_wpa_ctrl_close(iface->wpa);
+	shl_loop_signal_del(loop, &iface->chld);
+err_wpa:
 	owfd_wpa_ctrl_unref(iface->wpa);
 err_iface:
 	free(iface);
@@ -417,36 +430,32 @@ void owfd_p2pd_interface_free(struct owfd_p2pd_interface *iface)
 	kill_wpa(iface);
 	owfd_wpa_ctrl_close(iface->wpa);
 	owfd_wpa_ctrl_unref(iface->wpa);
+	shl_loop_signal_del(iface->loop, &iface->chld);
 	free(iface);
 }
 
-int owfd_p2pd_interface_dispatch(struct owfd_p2pd_interface *iface,
-				 struct owfd_p2pd_ep *ep)
+static void chld_fn(struct shl_loop_signal *sig,
+		    const struct signalfd_siginfo *info, void *data)
 {
-	int r;
-
-	if (ep->ev->data.ptr != &iface->wpa_fd)
-		return OWFD_P2PD_EP_NOT_HANDLED;
-
-	r = owfd_wpa_ctrl_dispatch(iface->wpa, 0);
-	if (r < 0)
-		return r;
-
-	return OWFD_P2PD_EP_HANDLED;
-}
+	struct owfd_p2pd_interface *iface = data;
 
-int owfd_p2pd_interface_dispatch_chld(struct owfd_p2pd_interface *iface,
-				      struct signalfd_siginfo *info)
-{
 	if (iface->pid <= 0 || info->ssi_pid != iface->pid)
-		return OWFD_P2PD_EP_NOT_HANDLED;
+		return;
 
 	log_info("wpa_supplicant exited");
 
 	owfd_wpa_ctrl_close(iface->wpa);
 	iface->pid = 0;
 
-	return OWFD_P2PD_EP_QUIT;
+	shl_loop_exit(iface->loop, 0);
+}
+
+static void wpa_error(struct owfd_wpa_ctrl *wpa, int error, void *data)
+{
+	struct owfd_p2pd_interface *iface = data;
+
+	log_error("wpa_supplicant connection failed (%d)", error);
+	shl_loop_exit(iface->loop, error);
 }
 
 int owfd_p2pd_interface_register_event_fn(struct owfd_p2pd_interface *iface,
@@ -31,9 +31,11 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,28 +43,174 @@ extern "C" {
 
 /* common definitions */
 
+enum owfd_rtsp_header {
+	OWFD_RTSP_HEADER_UNKNOWN,
+	OWFD_RTSP_HEADER_ACCEPT,
+	OWFD_RTSP_HEADER_ALLOW,
+	OWFD_RTSP_HEADER_CONTENT_ENCODING,
+	OWFD_RTSP_HEADER_CONTENT_LENGTH,
+	OWFD_RTSP_HEADER_CONTENT_TYPE,
+	OWFD_RTSP_HEADER_CSEQ,
+	OWFD_RTSP_HEADER_DATE,
+	OWFD_RTSP_HEADER_PUBLIC,
+	OWFD_RTSP_HEADER_RANGE,
+	OWFD_RTSP_HEADER_REQUIRE,
+	OWFD_RTSP_HEADER_RTP_INFO,
+	OWFD_RTSP_HEADER_SERVER,
+	OWFD_RTSP_HEADER_SESSION,
+	OWFD_RTSP_HEADER_TRANSPORT,
+	OWFD_RTSP_HEADER_UNSUPPORTED,
+	OWFD_RTSP_HEADER_USER_AGENT,
+	OWFD_RTSP_HEADER_WWW_AUTHENTICATE,
+	OWFD_RTSP_HEADER_CNT,
+};
+
+enum owfd_rtsp_msg_type {
+	OWFD_RTSP_MSG_UNKNOWN,
+	OWFD_RTSP_MSG_REQUEST,
+	OWFD_RTSP_MSG_RESPONSE,
+};
+
+enum owfd_rtsp_method {
+	OWFD_RTSP_METHOD_UNKNOWN,
+	OWFD_RTSP_METHOD_ANNOUNCE,
+	OWFD_RTSP_METHOD_DESCRIBE,
+	OWFD_RTSP_METHOD_GET_PARAMETER,
+	OWFD_RTSP_METHOD_OPTIONS,
+	OWFD_RTSP_METHOD_PAUSE,
+	OWFD_RTSP_METHOD_PLAY,
+	OWFD_RTSP_METHOD_RECORD,
+	OWFD_RTSP_METHOD_REDIRECT,
+	OWFD_RTSP_METHOD_SET_PARAMETER,
+	OWFD_RTSP_METHOD_SETUP,
+	OWFD_RTSP_METHOD_TEARDOWN,
+	OWFD_RTSP_METHOD_CNT,
+};
+
+/* position of a well-known header; @line is 1-based, 0 if not present */
+struct owfd_rtsp_header_pos {
+	size_t line;
+	size_t value;
+};
+
 struct owfd_rtsp_msg {
 	size_t header_num;
 	char **header;
 	size_t *header_len;
 	void *body;
 	size_t body_len;
+
+	struct owfd_rtsp_header_pos known[OWFD_RTSP_HEADER_CNT];
+	unsigned long cseq;
+
+	/* parsed start line; @uri and @phrase are offsets into header[0] */
+	unsigned int type;
+	unsigned int method;
+	unsigned int status;
+	unsigned int major;
+	unsigned int minor;
+	size_t uri;
+	size_t uri_len;
+	size_t phrase;
 };
 
+unsigned int owfd_rtsp_method_lookup(const char *name, size_t len);
+const char *owfd_rtsp_method_name(unsigned int method);
+unsigned int owfd_rtsp_header_lookup(const char *name, size_t len);
+const char *owfd_rtsp_msg_get_header(const struct owfd_rtsp_msg *msg,
+				     unsigned int id, size_t *len);
+
 /* rtsp control channel */
 
 struct owfd_rtsp_ctrl;
 
+struct owfd_rtsp_decoder;
+struct owfd_rtsp_uring;
+struct shl_chain_pool;
+struct shl_loop;
+struct shl_wheel;
+
+/* statistics of a control channel, counted since it was created */
+struct owfd_rtsp_ctrl_stats {
+	uint64_t bytes_sent;
+	uint64_t writes;		/* sendmsg() calls */
+	uint64_t short_writes;		/* writes that took only part */
+	uint64_t stalls;		/* writes that failed with EAGAIN */
+	uint64_t reads;			/* read() calls */
+	uint64_t polls;			/* epoll_ctl() calls */
+	uint64_t budget_stops;		/* wakeups cut short by the budget */
+
+	uint64_t bytes_received;
+	uint64_t msgs_received;		/* decoded messages */
+	uint64_t msgs_sent;		/* owfd_rtsp_ctrl_send_msg() calls */
+	uint64_t requests;		/* owfd_rtsp_ctrl_request() calls */
+	uint64_t replies;		/* responses matched to requests */
+	uint64_t timeouts;		/* requests that timed out */
+	uint64_t blocked_usec;		/* time output waited for the socket */
+
+	/* current state */
+	size_t out_queued;		/* bytes waiting to be sent */
+	size_t out_peak;		/* highest @out_queued so far */
+	size_t pending;			/* requests in flight */
+};
+
+/* round trip times of requests of one method, in microseconds */
+struct owfd_rtsp_ctrl_rtt {
+	uint64_t count;
+	uint64_t min;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t max;
+};
+
+enum owfd_rtsp_ctrl_flags {
+	OWFD_RTSP_CTRL_EDGE		= 0x01,
+};
+
+/* timers of a control channel, see owfd_rtsp_ctrl_set_keepalive() */
+enum owfd_rtsp_ctrl_timer {
+	OWFD_RTSP_CTRL_KEEPALIVE,
+	OWFD_RTSP_CTRL_TIMEOUT,
+};
+
+/* transports of owfd_rtsp_ctrl_open_pair() */
+enum owfd_rtsp_ctrl_pair {
+	OWFD_RTSP_CTRL_PAIR_SOCKET,
+	OWFD_RTSP_CTRL_PAIR_MEM,
+};
+
 typedef void (*owfd_rtsp_ctrl_cb) (struct owfd_rtsp_ctrl *ctrl,
 				   char *buf, size_t len, void *data);
+typedef void (*owfd_rtsp_ctrl_msg_cb) (struct owfd_rtsp_ctrl *ctrl,
+				       struct owfd_rtsp_msg *msg,
+				       void *data);
+typedef void (*owfd_rtsp_ctrl_timer_cb) (struct owfd_rtsp_ctrl *ctrl,
+					 unsigned int timer,
+					 void *data);
+typedef void (*owfd_rtsp_ctrl_error_cb) (struct owfd_rtsp_ctrl *ctrl,
+					 int error,
+					 void *data);
 
 int owfd_rtsp_ctrl_new(struct owfd_rtsp_ctrl **out);
+int owfd_rtsp_ctrl_new_shared(struct owfd_rtsp_ctrl **out, int efd,
+			      void *tag);
+int owfd_rtsp_ctrl_new_loop(struct owfd_rtsp_ctrl **out, struct shl_loop *loop);
 void owfd_rtsp_ctrl_ref(struct owfd_rtsp_ctrl *ctrl);
 void owfd_rtsp_ctrl_unref(struct owfd_rtsp_ctrl *ctrl);
 
 void owfd_rtsp_ctrl_set_data(struct owfd_rtsp_ctrl *ctrl, void *data);
 void *owfd_rtsp_ctrl_get_data(struct owfd_rtsp_ctrl *ctrl);
 
+int owfd_rtsp_ctrl_set_flags(struct owfd_rtsp_ctrl *ctrl, unsigned int flags);
+unsigned int owfd_rtsp_ctrl_get_flags(struct owfd_rtsp_ctrl *ctrl);
+void owfd_rtsp_ctrl_set_budget(struct owfd_rtsp_ctrl *ctrl, size_t bytes,
+			       size_t msgs);
+bool owfd_rtsp_ctrl_is_pending(struct owfd_rtsp_ctrl *ctrl);
+int owfd_rtsp_ctrl_set_chain_pool(struct owfd_rtsp_ctrl *ctrl,
+				  struct shl_chain_pool *pool);
+
 bool owfd_rtsp_ctrl_is_open(struct owfd_rtsp_ctrl *ctrl);
 bool owfd_rtsp_ctrl_is_connected(struct owfd_rtsp_ctrl *ctrl);
 void owfd_rtsp_ctrl_close(struct owfd_rtsp_ctrl *ctrl);
@@ -72,24 +220,252 @@ int owfd_rtsp_ctrl_open_tcp(struct owfd_rtsp_ctrl *ctrl,
 			    const struct sockaddr_in6 *src,
 			    const struct sockaddr_in6 *dst,
 			    owfd_rtsp_ctrl_cb cb);
+int owfd_rtsp_ctrl_open_pair(struct owfd_rtsp_ctrl *a,
+			     struct owfd_rtsp_ctrl *b,
+			     unsigned int mode,
+			     owfd_rtsp_ctrl_cb cb);
+
+int owfd_rtsp_ctrl_set_msg_cb(struct owfd_rtsp_ctrl *ctrl,
+			      owfd_rtsp_ctrl_msg_cb cb);
+struct owfd_rtsp_decoder *owfd_rtsp_ctrl_get_decoder(struct owfd_rtsp_ctrl *ctrl);
+
+void owfd_rtsp_ctrl_set_wheel(struct owfd_rtsp_ctrl *ctrl,
+			      struct shl_wheel *w);
+void owfd_rtsp_ctrl_set_timer_cb(struct owfd_rtsp_ctrl *ctrl,
+				 owfd_rtsp_ctrl_timer_cb cb, void *data);
+int owfd_rtsp_ctrl_set_keepalive(struct owfd_rtsp_ctrl *ctrl,
+				 unsigned int msec);
+int owfd_rtsp_ctrl_set_timeout(struct owfd_rtsp_ctrl *ctrl,
+			       unsigned int msec);
+
+int owfd_rtsp_ctrl_set_uring(struct owfd_rtsp_ctrl *ctrl,
+			     struct owfd_rtsp_uring *uring);
+struct owfd_rtsp_uring *owfd_rtsp_ctrl_get_uring(struct owfd_rtsp_ctrl *ctrl);
 
 int owfd_rtsp_ctrl_get_fd(struct owfd_rtsp_ctrl *ctrl);
 int owfd_rtsp_ctrl_dispatch(struct owfd_rtsp_ctrl *ctrl, int timeout);
+int owfd_rtsp_ctrl_dispatch_events(struct owfd_rtsp_ctrl *ctrl,
+				   uint32_t events);
+void owfd_rtsp_ctrl_set_error_cb(struct owfd_rtsp_ctrl *ctrl,
+				 owfd_rtsp_ctrl_error_cb cb);
+void owfd_rtsp_ctrl_cork(struct owfd_rtsp_ctrl *ctrl);
+int owfd_rtsp_ctrl_uncork(struct owfd_rtsp_ctrl *ctrl);
+void owfd_rtsp_ctrl_get_stats(struct owfd_rtsp_ctrl *ctrl,
+			      struct owfd_rtsp_ctrl_stats *stats);
+int owfd_rtsp_ctrl_get_rtt(struct owfd_rtsp_ctrl *ctrl, unsigned int method,
+			   struct owfd_rtsp_ctrl_rtt *rtt);
+int owfd_rtsp_ctrl_format_stats(struct owfd_rtsp_ctrl *ctrl, char *buf,
+				size_t size);
+size_t owfd_rtsp_ctrl_get_memory(struct owfd_rtsp_ctrl *ctrl);
 
 int owfd_rtsp_ctrl_send(struct owfd_rtsp_ctrl *ctrl,
 			const char *buf, size_t len);
+int owfd_rtsp_ctrl_send_iov(struct owfd_rtsp_ctrl *ctrl,
+			    const struct iovec *vec, size_t n);
+int owfd_rtsp_ctrl_send_owned(struct owfd_rtsp_ctrl *ctrl, void *buf,
+			      size_t len, void (*free_fn) (void *buf));
 int owfd_rtsp_ctrl_vsendf(struct owfd_rtsp_ctrl *ctrl,
 			  const char *format, va_list args);
 int owfd_rtsp_ctrl_sendf(struct owfd_rtsp_ctrl *ctrl,
 			 const char *format, ...);
 
+/* io_uring backend of control channels */
+
+struct owfd_rtsp_uring_stats {
+	uint64_t enters;		/* io_uring_enter() calls */
+	uint64_t completions;
+	uint64_t recv_bufs;		/* buffers filled by receives */
+	uint64_t rearms;		/* multishot receives re-armed */
+};
+
+typedef void (*owfd_rtsp_uring_cb) (struct owfd_rtsp_uring *uring,
+				    void *tag, void *data);
+
+int owfd_rtsp_uring_new(struct owfd_rtsp_uring **out, owfd_rtsp_uring_cb cb,
+			void *data);
+void owfd_rtsp_uring_free(struct owfd_rtsp_uring *uring);
+int owfd_rtsp_uring_get_fd(struct owfd_rtsp_uring *uring);
+int owfd_rtsp_uring_dispatch(struct owfd_rtsp_uring *uring);
+void owfd_rtsp_uring_get_stats(struct owfd_rtsp_uring *uring,
+			       struct owfd_rtsp_uring_stats *stats);
+
+/* rtsp message builder */
+
+#define OWFD_RTSP_BUILDER_IOV_MAX 48
+
+/*
+ * All iovecs point into the builder or to the caller's strings, so neither
+ * may change or move until the message was sent.
+ */
+struct owfd_rtsp_msg_builder {
+	/* kept across messages */
+	unsigned long cseq;
+	const char *session;
+	const char *content_type;
+
+	/* current message */
+	unsigned long msg_cseq;
+	unsigned int msg_method;
+	const void *body;
+	size_t body_len;
+	struct iovec vec[OWFD_RTSP_BUILDER_IOV_MAX];
+	size_t n;
+	int error;
+
+	char status_buf[16];
+	char cseq_buf[24];
+	char length_buf[24];
+};
+
+void owfd_rtsp_msg_builder_init(struct owfd_rtsp_msg_builder *b);
+void owfd_rtsp_msg_builder_set_session(struct owfd_rtsp_msg_builder *b,
+				       const char *session);
+void owfd_rtsp_msg_builder_set_content_type(struct owfd_rtsp_msg_builder *b,
+					    const char *type);
+
+int owfd_rtsp_msg_builder_request(struct owfd_rtsp_msg_builder *b,
+				  unsigned int method, const char *uri);
+int owfd_rtsp_msg_builder_response(struct owfd_rtsp_msg_builder *b,
+				   unsigned int status, const char *phrase,
+				   unsigned long cseq);
+void owfd_rtsp_msg_builder_header(struct owfd_rtsp_msg_builder *b,
+				  const char *name, const char *value);
+void owfd_rtsp_msg_builder_body(struct owfd_rtsp_msg_builder *b,
+				const void *body, size_t len);
+int owfd_rtsp_msg_builder_finish(struct owfd_rtsp_msg_builder *b,
+				 struct iovec **vec);
+
+const char *owfd_rtsp_status_phrase(unsigned int status);
+
+int owfd_rtsp_ctrl_send_msg(struct owfd_rtsp_ctrl *ctrl,
+			    struct owfd_rtsp_msg_builder *b);
+
+/* @reply is NULL if @error is set */
+typedef void (*owfd_rtsp_ctrl_reply_cb) (struct owfd_rtsp_ctrl *ctrl,
+					 struct owfd_rtsp_msg *reply,
+					 int error,
+					 void *data);
+
+int owfd_rtsp_ctrl_request(struct owfd_rtsp_ctrl *ctrl,
+			   struct owfd_rtsp_msg_builder *b,
+			   unsigned int timeout,
+			   owfd_rtsp_ctrl_reply_cb cb, void *data);
+int owfd_rtsp_ctrl_cancel(struct owfd_rtsp_ctrl *ctrl, unsigned long cseq);
+size_t owfd_rtsp_ctrl_get_pending(struct owfd_rtsp_ctrl *ctrl);
+
+/* rtsp server */
+
+struct owfd_rtsp_server;
+struct owfd_rtsp_session;
+
+enum owfd_rtsp_server_flags {
+	OWFD_RTSP_SERVER_REUSEPORT		= 0x01,
+	OWFD_RTSP_SERVER_URING			= 0x02,
+	OWFD_RTSP_SERVER_EDGE			= 0x04,
+};
+
+enum owfd_rtsp_server_event {
+	OWFD_RTSP_SERVER_CONNECT,
+	OWFD_RTSP_SERVER_CLOSE,
+	OWFD_RTSP_SERVER_KEEPALIVE,
+	OWFD_RTSP_SERVER_TIMEOUT,
+};
+
+struct owfd_rtsp_server_stats {
+	uint64_t accepted;
+	uint64_t rejected;		/* over the session limit */
+	uint64_t closed;
+	size_t sessions;
+	size_t peak_sessions;
+	size_t memory;			/* bytes held by open sessions */
+};
+
+typedef void (*owfd_rtsp_server_cb) (struct owfd_rtsp_server *srv,
+				     struct owfd_rtsp_session *sess,
+				     unsigned int event,
+				     void *data);
+
+int owfd_rtsp_server_new(struct owfd_rtsp_server **out,
+			 owfd_rtsp_server_cb cb);
+void owfd_rtsp_server_ref(struct owfd_rtsp_server *srv);
+void owfd_rtsp_server_unref(struct owfd_rtsp_server *srv);
+
+void owfd_rtsp_server_set_data(struct owfd_rtsp_server *srv, void *data);
+void *owfd_rtsp_server_get_data(struct owfd_rtsp_server *srv);
+void owfd_rtsp_server_set_flags(struct owfd_rtsp_server *srv,
+				unsigned int flags);
+unsigned int owfd_rtsp_server_get_flags(struct owfd_rtsp_server *srv);
+void owfd_rtsp_server_set_max_sessions(struct owfd_rtsp_server *srv,
+				       size_t max);
+void owfd_rtsp_server_set_budget(struct owfd_rtsp_server *srv, size_t bytes,
+				 size_t msgs);
+void owfd_rtsp_server_set_timeouts(struct owfd_rtsp_server *srv,
+				   unsigned int keepalive, unsigned int timeout);
+
+int owfd_rtsp_server_listen(struct owfd_rtsp_server *srv,
+			    const struct sockaddr_in6 *addr);
+int owfd_rtsp_server_listen_fd(struct owfd_rtsp_server *srv, int fd);
+int owfd_rtsp_server_get_addr(struct owfd_rtsp_server *srv,
+			      struct sockaddr_in6 *addr);
+void owfd_rtsp_server_close(struct owfd_rtsp_server *srv);
+
+int owfd_rtsp_server_get_fd(struct owfd_rtsp_server *srv);
+int owfd_rtsp_server_dispatch(struct owfd_rtsp_server *srv, int timeout);
+void owfd_rtsp_server_wake(struct owfd_rtsp_server *srv);
+void owfd_rtsp_server_get_stats(struct owfd_rtsp_server *srv,
+				struct owfd_rtsp_server_stats *stats);
+
+struct owfd_rtsp_ctrl *owfd_rtsp_session_get_ctrl(struct owfd_rtsp_session *sess);
+void owfd_rtsp_session_set_data(struct owfd_rtsp_session *sess, void *data);
+void *owfd_rtsp_session_get_data(struct owfd_rtsp_session *sess);
+void owfd_rtsp_session_close(struct owfd_rtsp_session *sess);
+
+/* rtsp reactor pool */
+
+struct owfd_rtsp_reactor;
+
+int owfd_rtsp_reactor_new(struct owfd_rtsp_reactor **out,
+			  unsigned int threads, owfd_rtsp_server_cb cb,
+			  void *data);
+void owfd_rtsp_reactor_free(struct owfd_rtsp_reactor *pool);
+
+unsigned int owfd_rtsp_reactor_get_threads(struct owfd_rtsp_reactor *pool);
+struct owfd_rtsp_server *owfd_rtsp_reactor_get_server(struct owfd_rtsp_reactor *pool,
+						      unsigned int idx);
+int owfd_rtsp_reactor_listen(struct owfd_rtsp_reactor *pool,
+			     const struct sockaddr_in6 *addr);
+int owfd_rtsp_reactor_get_addr(struct owfd_rtsp_reactor *pool,
+			       struct sockaddr_in6 *addr);
+
+int owfd_rtsp_reactor_start(struct owfd_rtsp_reactor *pool);
+int owfd_rtsp_reactor_stop(struct owfd_rtsp_reactor *pool);
+void owfd_rtsp_reactor_get_stats(struct owfd_rtsp_reactor *pool,
+				 struct owfd_rtsp_server_stats *stats);
+
 /* rtsp decoder */
 
 struct owfd_rtsp_decoder;
 
+enum owfd_rtsp_decoder_flags {
+	OWFD_RTSP_DECODER_SPANS			= 0x01,
+	OWFD_RTSP_DECODER_MIRROR		= 0x02,
+};
+
+/* resource limits of a decoder, 0 means unlimited */
+struct owfd_rtsp_decoder_limits {
+	size_t max_line;
+	size_t max_headers;
+	size_t max_body;
+	size_t max_msg;
+};
+
 typedef void (*owfd_rtsp_decoder_cb) (struct owfd_rtsp_decoder *dec,
 				      struct owfd_rtsp_msg *msg,
 				      void *data);
+typedef void (*owfd_rtsp_decoder_body_cb) (struct owfd_rtsp_decoder *dec,
+					   struct owfd_rtsp_msg *msg,
+					   const void *buf, size_t len,
+					   void *data);
 
 int owfd_rtsp_decoder_new(struct owfd_rtsp_decoder **out,
 			  owfd_rtsp_decoder_cb cb);
@@ -97,15 +473,151 @@ void owfd_rtsp_decoder_free(struct owfd_rtsp_decoder *dec);
 
 void owfd_rtsp_decoder_set_data(struct owfd_rtsp_decoder *dec, void *data);
 void *owfd_rtsp_decoder_get_data(struct owfd_rtsp_decoder *dec);
+void owfd_rtsp_decoder_set_flags(struct owfd_rtsp_decoder *dec,
+				 unsigned int flags);
+unsigned int owfd_rtsp_decoder_get_flags(struct owfd_rtsp_decoder *dec);
+void owfd_rtsp_decoder_set_limits(struct owfd_rtsp_decoder *dec,
+			const struct owfd_rtsp_decoder_limits *limits);
+void owfd_rtsp_decoder_get_limits(struct owfd_rtsp_decoder *dec,
+				  struct owfd_rtsp_decoder_limits *limits);
+size_t owfd_rtsp_decoder_get_memory(struct owfd_rtsp_decoder *dec);
+void owfd_rtsp_decoder_set_stream(struct owfd_rtsp_decoder *dec,
+				  owfd_rtsp_decoder_cb head_cb,
+				  owfd_rtsp_decoder_body_cb body_cb,
+				  owfd_rtsp_decoder_cb end_cb);
 
 void owfd_rtsp_decoder_flush(struct owfd_rtsp_decoder *dec);
 int owfd_rtsp_decoder_feed(struct owfd_rtsp_decoder *dec,
 			   const char *buf, size_t len);
+int owfd_rtsp_decoder_reserve(struct owfd_rtsp_decoder *dec, size_t min,
+			      struct iovec *vec);
+int owfd_rtsp_decoder_commit(struct owfd_rtsp_decoder *dec, size_t len);
 
 /* rtsp tokenizer */
 
 ssize_t owfd_rtsp_tokenize(const char *line, char **out);
 
+struct owfd_rtsp_token {
+	size_t off;
+	size_t len;
+	bool quoted;
+};
+
+struct owfd_rtsp_token_iter {
+	const char *line;
+	size_t len;
+	size_t pos;
+};
+
+void owfd_rtsp_token_iter_init(struct owfd_rtsp_token_iter *iter,
+			       const char *line, size_t len);
+bool owfd_rtsp_token_next(struct owfd_rtsp_token_iter *iter,
+			  struct owfd_rtsp_token *tok);
+size_t owfd_rtsp_tokenize_spans(const char *line, size_t len,
+				struct owfd_rtsp_token *toks, size_t max);
+size_t owfd_rtsp_token_unescape(const char *line,
+				const struct owfd_rtsp_token *tok, char *dst);
+
+/* wfd parameters */
+
+enum owfd_rtsp_param {
+	OWFD_RTSP_PARAM_UNKNOWN,
+	OWFD_RTSP_PARAM_3D_VIDEO_FORMATS,
+	OWFD_RTSP_PARAM_AUDIO_CODECS,
+	OWFD_RTSP_PARAM_AV_FORMAT_CHANGE_TIMING,
+	OWFD_RTSP_PARAM_CLIENT_RTP_PORTS,
+	OWFD_RTSP_PARAM_CONNECTOR_TYPE,
+	OWFD_RTSP_PARAM_CONTENT_PROTECTION,
+	OWFD_RTSP_PARAM_COUPLED_SINK,
+	OWFD_RTSP_PARAM_DISPLAY_EDID,
+	OWFD_RTSP_PARAM_I2C,
+	OWFD_RTSP_PARAM_IDR_REQUEST,
+	OWFD_RTSP_PARAM_PREFERRED_DISPLAY_MODE,
+	OWFD_RTSP_PARAM_PRESENTATION_URL,
+	OWFD_RTSP_PARAM_ROUTE,
+	OWFD_RTSP_PARAM_STANDBY,
+	OWFD_RTSP_PARAM_STANDBY_RESUME_CAPABILITY,
+	OWFD_RTSP_PARAM_TRIGGER_METHOD,
+	OWFD_RTSP_PARAM_UIBC_CAPABILITY,
+	OWFD_RTSP_PARAM_UIBC_SETTING,
+	OWFD_RTSP_PARAM_VIDEO_FORMATS,
+	OWFD_RTSP_PARAM_CNT,
+};
+
+struct owfd_rtsp_params {
+	const char *body;
+	size_t len;
+
+	unsigned long present;
+	size_t unknown;
+	size_t off[OWFD_RTSP_PARAM_CNT];
+	size_t val_len[OWFD_RTSP_PARAM_CNT];
+};
+
+#define OWFD_RTSP_VIDEO_CODECS_MAX 8
+
+/* field values use the OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_* masks */
+struct owfd_rtsp_video_codec {
+	uint8_t profile;
+	uint8_t level;
+	uint32_t cea_modes;
+	uint32_t vesa_modes;
+	uint32_t hh_modes;
+	uint8_t latency;
+	uint16_t slice_min;
+	uint16_t slice_enc;
+	uint8_t frame_rate_control;
+	uint16_t max_hres;		/* 0 if none */
+	uint16_t max_vres;		/* 0 if none */
+};
+
+struct owfd_rtsp_video_formats {
+	bool none;
+	uint8_t native;
+	uint8_t preferred_display_mode;
+	size_t codec_num;
+	struct owfd_rtsp_video_codec codecs[OWFD_RTSP_VIDEO_CODECS_MAX];
+};
+
+/* modes use the OPENWFD_WFD_IE_SUB_AUDIO_FORMATS_* masks, 0 if unsupported */
+struct owfd_rtsp_audio_codecs {
+	uint32_t lpcm_modes;
+	uint8_t lpcm_latency;
+	uint32_t aac_modes;
+	uint8_t aac_latency;
+	uint32_t ac3_modes;
+	uint8_t ac3_latency;
+};
+
+enum owfd_rtsp_rtp_transport {
+	OWFD_RTSP_RTP_UDP,
+	OWFD_RTSP_RTP_TCP,
+};
+
+struct owfd_rtsp_client_rtp_ports {
+	unsigned int transport;
+	uint16_t port0;
+	uint16_t port1;
+	bool play;
+};
+
+unsigned int owfd_rtsp_param_lookup(const char *name, size_t len);
+const char *owfd_rtsp_param_name(unsigned int param);
+
+int owfd_rtsp_params_parse(struct owfd_rtsp_params *params,
+			   const char *body, size_t len);
+bool owfd_rtsp_params_has(const struct owfd_rtsp_params *params,
+			  unsigned int param);
+const char *owfd_rtsp_params_get(const struct owfd_rtsp_params *params,
+				 unsigned int param, size_t *len);
+int owfd_rtsp_params_get_video_formats(const struct owfd_rtsp_params *params,
+				       struct owfd_rtsp_video_formats *out);
+int owfd_rtsp_params_get_audio_codecs(const struct owfd_rtsp_params *params,
+				      struct owfd_rtsp_audio_codecs *out);
+int owfd_rtsp_params_get_client_rtp_ports(
+				const struct owfd_rtsp_params *params,
+				struct owfd_rtsp_client_rtp_ports *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,294 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Message Builder
+ * The builder assembles outgoing messages as a list of iovecs that point to
+ * constant strings, the caller's strings and a few number buffers inside the
+ * builder. Nothing is formatted into intermediate strings or allocated; the
+ * result is meant to be passed to owfd_rtsp_ctrl_send_iov(), which copies
+ * only what the socket does not take right away.
+ * CSeq numbering as well as the Session and Content-Type headers are kept
+ * across messages, so they are set once per session.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "shared.h"
+#include "rtsp.h"
+
+static const struct {
+	unsigned int status;
+	const char *phrase;
+} status_table[] = {
+	{ 100, "Continue" },
+	{ 200, "OK" },
+	{ 201, "Created" },
+	{ 250, "Low on Storage Space" },
+	{ 300, "Multiple Choices" },
+	{ 301, "Moved Permanently" },
+	{ 302, "Moved Temporarily" },
+	{ 303, "See Other" },
+	{ 304, "Not Modified" },
+	{ 305, "Use Proxy" },
+	{ 400, "Bad Request" },
+	{ 401, "Unauthorized" },
+	{ 402, "Payment Required" },
+	{ 403, "Forbidden" },
+	{ 404, "Not Found" },
+	{ 405, "Method Not Allowed" },
+	{ 406, "Not Acceptable" },
+	{ 407, "Proxy Authentication Required" },
+	{ 408, "Request Time-out" },
+	{ 410, "Gone" },
+	{ 411, "Length Required" },
+	{ 412, "Precondition Failed" },
+	{ 413, "Request Entity Too Large" },
+	{ 414, "Request-URI Too Large" },
+	{ 415, "Unsupported Media Type" },
+	{ 451, "Parameter Not Understood" },
+	{ 452, "Conference Not Found" },
+	{ 453, "Not Enough Bandwidth" },
+	{ 454, "Session Not Found" },
+	{ 455, "Method Not Valid in This State" },
+	{ 456, "Header Field Not Valid for Resource" },
+	{ 457, "Invalid Range" },
+	{ 458, "Parameter Is Read-Only" },
+	{ 459, "Aggregate operation not allowed" },
+	{ 460, "Only aggregate operation allowed" },
+	{ 461, "Unsupported transport" },
+	{ 462, "Destination unreachable" },
+	{ 500, "Internal Server Error" },
+	{ 501, "Not Implemented" },
+	{ 502, "Bad Gateway" },
+	{ 503, "Service Unavailable" },
+	{ 504, "Gateway Time-out" },
+	{ 505, "RTSP Version not supported" },
+	{ 551, "Option not supported" },
+};
+
+/* reason phrase of well-known status codes, NULL if unknown */
+const char *owfd_rtsp_status_phrase(unsigned int status)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(status_table) / sizeof(*status_table); ++i) {
+		if (status_table[i].status == status)
+			return status_table[i].phrase;
+	}
+
+	return NULL;
+}
+
+/* write @v in decimal followed by @suffix into @buf, returns the length */
+static size_t fmt_ulong(char *buf, unsigned long v, const char *suffix)
+{
+	char tmp[24];
+	size_t n, l;
+
+	n = 0;
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	for (l = 0; l < n; ++l)
+		buf[l] = tmp[n - 1 - l];
+
+	n = strlen(suffix);
+	memcpy(&buf[l], suffix, n);
+	return l + n;
+}
+
+static void push(struct owfd_rtsp_msg_builder *b, const void *buf,
+		 size_t len)
+{
+	if (b->n >= OWFD_RTSP_BUILDER_IOV_MAX) {
+		b->error = -ENOBUFS;
+		return;
+	}
+
+	b->vec[b->n].iov_base = (void*)buf;
+	b->vec[b->n].iov_len = len;
+	++b->n;
+}
+
+static void push_str(struct owfd_rtsp_msg_builder *b, const char *str)
+{
+	push(b, str, strlen(str));
+}
+
+#define push_const(_b, _str) push((_b), (_str), sizeof(_str) - 1)
+
+static void builder_reset(struct owfd_rtsp_msg_builder *b)
+{
+	b->n = 0;
+	b->error = 0;
+	b->msg_method = OWFD_RTSP_METHOD_UNKNOWN;
+	b->body = NULL;
+	b->body_len = 0;
+}
+
+void owfd_rtsp_msg_builder_init(struct owfd_rtsp_msg_builder *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->cseq = 1;
+}
+
+/* @session is not copied and must stay valid while the builder is used */
+void owfd_rtsp_msg_builder_set_session(struct owfd_rtsp_msg_builder *b,
+				       const char *session)
+{
+	b->session = session;
+}
+
+/* @type is not copied; it is only sent with messages that have a body */
+void owfd_rtsp_msg_builder_set_content_type(struct owfd_rtsp_msg_builder *b,
+					    const char *type)
+{
+	b->content_type = type;
+}
+
+static void push_session(struct owfd_rtsp_msg_builder *b)
+{
+	if (!b->session)
+		return;
+
+	push_const(b, "Session: ");
+	push_str(b, b->session);
+	push_const(b, "\r\n");
+}
+
+/*
+ * Start a new request. The next CSeq is assigned automatically and can be
+ * read from @msg_cseq afterwards to match the response.
+ */
+int owfd_rtsp_msg_builder_request(struct owfd_rtsp_msg_builder *b,
+				  unsigned int method, const char *uri)
+{
+	const char *name;
+	size_t l;
+
+	name = owfd_rtsp_method_name(method);
+	if (!name || !uri)
+		return -EINVAL;
+
+	builder_reset(b);
+	b->msg_cseq = b->cseq++;
+	b->msg_method = method;
+
+	push_str(b, name);
+	push_const(b, " ");
+	push_str(b, uri);
+	push_const(b, " RTSP/1.0\r\nCSeq: ");
+	l = fmt_ulong(b->cseq_buf, b->msg_cseq, "\r\n");
+	push(b, b->cseq_buf, l);
+	push_session(b);
+
+	return 0;
+}
+
+/*
+ * Start a new response to the request with @cseq. If @phrase is NULL, the
+ * standard reason phrase of @status is used.
+ */
+int owfd_rtsp_msg_builder_response(struct owfd_rtsp_msg_builder *b,
+				   unsigned int status, const char *phrase,
+				   unsigned long cseq)
+{
+	size_t l;
+
+	if (status < 100 || status > 999)
+		return -EINVAL;
+
+	if (!phrase)
+		phrase = owfd_rtsp_status_phrase(status) ? : "Unknown";
+
+	builder_reset(b);
+	b->msg_cseq = cseq;
+
+	push_const(b, "RTSP/1.0 ");
+	l = fmt_ulong(b->status_buf, status, " ");
+	push(b, b->status_buf, l);
+	push_str(b, phrase);
+	push_const(b, "\r\nCSeq: ");
+	l = fmt_ulong(b->cseq_buf, cseq, "\r\n");
+	push(b, b->cseq_buf, l);
+	push_session(b);
+
+	return 0;
+}
+
+/* add a header line; @name and @value are not copied */
+void owfd_rtsp_msg_builder_header(struct owfd_rtsp_msg_builder *b,
+				  const char *name, const char *value)
+{
+	push_str(b, name);
+	push_const(b, ": ");
+	push_str(b, value);
+	push_const(b, "\r\n");
+}
+
+/* set the body of the current message; @body is not copied */
+void owfd_rtsp_msg_builder_body(struct owfd_rtsp_msg_builder *b,
+				const void *body, size_t len)
+{
+	b->body = body;
+	b->body_len = len;
+}
+
+/*
+ * Terminate the header block and append the body. Returns the number of
+ * iovecs stored in @vec, or -ENOBUFS if the message has too many parts.
+ */
+int owfd_rtsp_msg_builder_finish(struct owfd_rtsp_msg_builder *b,
+				 struct iovec **vec)
+{
+	size_t l;
+
+	if (b->body_len > 0) {
+		if (b->content_type) {
+			push_const(b, "Content-Type: ");
+			push_str(b, b->content_type);
+			push_const(b, "\r\n");
+		}
+
+		push_const(b, "Content-Length: ");
+		l = fmt_ulong(b->length_buf, b->body_len, "\r\n\r\n");
+		push(b, b->length_buf, l);
+		push(b, b->body, b->body_len);
+	} else {
+		push_const(b, "\r\n");
+	}
+
+	if (b->error)
+		return b->error;
+
+	*vec = b->vec;
+	return b->n;
+}
@@ -25,9 +25,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,31 +40,381 @@
 #include <time.h>
 #include <unistd.h>
 #include "shared.h"
-#include "shl_ring.h"
+#include "shl_chain.h"
+#include "shl_dlist.h"
+#include "shl_hist.h"
+#include "shl_loop.h"
+#include "shl_wheel.h"
 #include "rtsp.h"
+#include "rtsp_internal.h"
 
-struct owfd_rtsp_ctrl {
-	unsigned long ref;
+/*
+ * Outstanding requests: An open-addressed table maps CSeq values to requests.
+ * CSeq values are handed out sequentially, so using their low bits as hash
+ * spreads them perfectly. Collisions (after wrap-arounds or with foreign CSeq
+ * values) are resolved by linear probing; removal shifts the following
+ * entries back, so no tombstones are needed. Slots hold the CSeq next to the
+ * request pointer, so lookups only touch the request they find.
+ */
+struct ctrl_slot {
+	unsigned long cseq;
+	struct ctrl_req *req;
+};
+
+struct ctrl_req {
+	struct shl_wheel_timer timer;
+	struct owfd_rtsp_ctrl *ctrl;
+	unsigned long cseq;
+	unsigned int timeout;
+	unsigned int method;
+	int64_t sent;
+	owfd_rtsp_ctrl_reply_cb cb;
 	void *data;
-	int efd;
-	int fd;
-	owfd_rtsp_ctrl_cb cb;
-	struct shl_ring out_ring;
+};
+
+/* initial size of the request table, and free requests kept for reuse */
+#define CTRL_REQ_SLOTS 16
+#define CTRL_REQ_CACHE 16
+
+/* resolution of the wheel a standalone ctrl creates for its timers */
+#define CTRL_WHEEL_TICK 10
+
+/* default input budget per wakeup, see owfd_rtsp_ctrl_set_budget() */
+#define CTRL_RX_BUDGET (128 * 4096)
+
+/* events fetched by a single owfd_rtsp_ctrl_dispatch() */
+#define CTRL_EVENTS 4
+
+/*
+ * Edge-triggered mode: With OWFD_RTSP_CTRL_EDGE, the socket is registered
+ * with EPOLLET and EPOLLOUT once and never modified. Output is written right
+ * away unless an earlier write found the socket full (@out_blocked), in which
+ * case the next EPOLLOUT edge is waited for. Input is read until the socket
+ * is drained, which a short read tells without another read() (unless the
+ * peer hung up, then the final EOF is read, too), or until the wakeup's
+ * budget is used up. Input left over then is remembered in @rx_pending, as
+ * there will be no further edge for it.
+ */
 
-	unsigned int connected : 1;
+/*
+ * Output queue: Each entry is either an owned buffer passed to
+ * owfd_rtsp_ctrl_send_owned() (@buf set) or a run of @len bytes that were
+ * copied into @out. Consecutive copies share an entry.
+ */
+struct ctrl_out {
+	struct shl_dlist list;
+	char *buf;
+	char *pos;
+	size_t len;
+	void (*free_fn) (void *buf);
 };
 
-int owfd_rtsp_ctrl_new(struct owfd_rtsp_ctrl **out)
+static void out_free(struct ctrl_out *o)
 {
-	struct owfd_rtsp_ctrl *ctrl;
+	shl_dlist_unlink(&o->list);
+	if (o->buf && o->free_fn)
+		o->free_fn(o->buf);
+	free(o);
+}
+
+/* drop all queued data, owned buffers are released */
+void ctrl_out_flush(struct owfd_rtsp_ctrl *ctrl)
+{
+	while (!shl_dlist_empty(&ctrl->out_list))
+		out_free(shl_dlist_first_entry(&ctrl->out_list,
+					       struct ctrl_out, list));
+
+	shl_chain_clear(&ctrl->out);
+	ctrl->out_len = 0;
+}
+
+/* account for @len bytes added to the output queue */
+static void out_grow(struct owfd_rtsp_ctrl *ctrl, size_t len)
+{
+	ctrl->out_len += len;
+	if (ctrl->out_len > ctrl->stats.out_peak)
+		ctrl->stats.out_peak = ctrl->out_len;
+}
+
+/* the socket refused data, output waits from now on */
+void ctrl_out_block(struct owfd_rtsp_ctrl *ctrl)
+{
+	ctrl->out_blocked = 1;
+	if (!ctrl->blocked_since)
+		ctrl->blocked_since = get_time_us();
+}
+
+/* the queue drained, stop the clock started by ctrl_out_block() */
+void ctrl_out_unblock(struct owfd_rtsp_ctrl *ctrl)
+{
+	if (!ctrl->blocked_since)
+		return;
+
+	ctrl->stats.blocked_usec += get_time_us() - ctrl->blocked_since;
+	ctrl->blocked_since = 0;
+}
+
+/* remove @len sent bytes from the front of the output queue */
+void ctrl_out_advance(struct owfd_rtsp_ctrl *ctrl, size_t len)
+{
+	struct ctrl_out *o;
+	size_t l;
+
+	while (len > 0 && !shl_dlist_empty(&ctrl->out_list)) {
+		o = shl_dlist_first_entry(&ctrl->out_list, struct ctrl_out,
+					  list);
+		l = o->len < len ? o->len : len;
+
+		if (o->buf)
+			o->pos += l;
+		else
+			shl_chain_pull(&ctrl->out, l);
+
+		o->len -= l;
+		len -= l;
+		ctrl->out_len -= l;
+		if (!o->len)
+			out_free(o);
+	}
+}
+
+/*
+ * Fill @vec with the queued data, in order. Returns the number of iovecs
+ * filled, at most CTRL_IOV_MAX. @more is set if not everything fit.
+ */
+size_t ctrl_out_peek(struct owfd_rtsp_ctrl *ctrl, struct iovec *vec,
+		     bool *more)
+{
+	struct iovec cvec[CTRL_IOV_MAX];
+	struct shl_dlist *iter;
+	struct ctrl_out *o;
+	size_t n, cn, ci, coff, l, t;
+
+	cn = shl_chain_peek(&ctrl->out, cvec, CTRL_IOV_MAX);
+	ci = 0;
+	coff = 0;
+	n = 0;
+	*more = true;
+
+	shl_dlist_for_each(iter, &ctrl->out_list) {
+		o = shl_dlist_entry(iter, struct ctrl_out, list);
+		if (o->buf) {
+			if (n >= CTRL_IOV_MAX)
+				return n;
+			vec[n].iov_base = o->pos;
+			vec[n].iov_len = o->len;
+			++n;
+			continue;
+		}
+
+		/* copied data is spread across the segments of @out */
+		for (l = o->len; l > 0 && ci < cn && n < CTRL_IOV_MAX; ) {
+			t = cvec[ci].iov_len - coff;
+			if (t > l)
+				t = l;
+
+			vec[n].iov_base = (char*)cvec[ci].iov_base + coff;
+			vec[n].iov_len = t;
+			++n;
+
+			l -= t;
+			coff += t;
+			if (coff == cvec[ci].iov_len) {
+				++ci;
+				coff = 0;
+			}
+		}
+
+		if (l > 0)
+			return n;
+	}
+
+	*more = false;
+	return n;
+}
+
+/*
+ * In-memory pipes: Sends append to the input chain of the peer, which takes
+ * everything at once, and queue its defer. The peer reads the chain like a
+ * socket; once it is empty and the sender is gone, it sees the hangup.
+ */
+static ssize_t mem_send(struct owfd_rtsp_ctrl *ctrl,
+			const struct iovec *vec, size_t n)
+{
+	struct owfd_rtsp_ctrl *peer = ctrl->peer;
+	size_t i, len;
 	int r;
 
+	if (!peer)
+		return -EPIPE;
+
+	r = shl_chain_pushv(&peer->mem_in, vec, n);
+	if (r < 0)
+		return r;
+
+	for (i = 0, len = 0; i < n; ++i)
+		len += vec[i].iov_len;
+	ctrl->stats.bytes_sent += len;
+	shl_loop_defer_add(peer->loop, &peer->defer);
+
+	return len;
+}
+
+static ssize_t mem_read(struct owfd_rtsp_ctrl *ctrl,
+			const struct iovec *vec, int n)
+{
+	size_t l, len = 0;
+	int i;
+
+	if (!shl_chain_length(&ctrl->mem_in)) {
+		if (!ctrl->peer)
+			return 0;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (i = 0; i < n; ++i) {
+		l = shl_chain_read(&ctrl->mem_in, vec[i].iov_base,
+				   vec[i].iov_len);
+		shl_chain_pull(&ctrl->mem_in, l);
+		len += l;
+		if (l < vec[i].iov_len)
+			break;
+	}
+
+	return len;
+}
+
+static void mem_close(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct owfd_rtsp_ctrl *peer = ctrl->peer;
+
+	shl_chain_clear(&ctrl->mem_in);
+	ctrl->peer = NULL;
+	ctrl->mem = 0;
+	if (!peer)
+		return;
+
+	/* the peer reads what is left, then sees the hangup */
+	peer->peer = NULL;
+	shl_loop_defer_add(peer->loop, &peer->defer);
+}
+
+/*
+ * Returns the number of bytes sent, 0 if the socket is busy, or -errno. With
+ * @more, the kernel holds back a partial packet for the data that follows.
+ */
+static ssize_t out_sendmsg(struct owfd_rtsp_ctrl *ctrl,
+			   const struct iovec *vec, size_t n, bool more)
+{
+	struct msghdr msg;
+	size_t i, len;
+	ssize_t l;
+	int flags;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec*)vec;
+	msg.msg_iovlen = n;
+
+	flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+	if (more)
+		flags |= MSG_MORE;
+
+	++ctrl->stats.writes;
+	if (ctrl->mem)
+		return mem_send(ctrl, vec, n);
+
+	l = sendmsg(ctrl->fd, &msg, flags);
+	if (l < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			++ctrl->stats.stalls;
+			ctrl_out_block(ctrl);
+			return 0;
+		}
+		return -errno;
+	}
+
+	for (i = 0, len = 0; i < n; ++i)
+		len += vec[i].iov_len;
+	if ((size_t)l < len) {
+		/* the socket is full, so there will be an EPOLLOUT edge */
+		++ctrl->stats.short_writes;
+		ctrl_out_block(ctrl);
+	}
+	ctrl->stats.bytes_sent += l;
+
+	return l;
+}
+
+/* poll for EPOLLOUT only while data is queued (or to detect the connect) */
+static int out_arm(struct owfd_rtsp_ctrl *ctrl, bool on)
+{
+	struct epoll_event ev;
+	int r;
+
+	/* edge-triggered sockets poll for EPOLLOUT all the time */
+	if (ctrl->out_armed == on || (ctrl->flags & OWFD_RTSP_CTRL_EDGE) ||
+	    ctrl->mem)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLRDHUP;
+	if (on)
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = ctrl->tag;
+
+	++ctrl->stats.polls;
+	if (ctrl->loop) {
+		r = shl_loop_io_update(ctrl->loop, &ctrl->io, ev.events);
+		if (r < 0)
+			return r;
+	} else {
+		r = epoll_ctl(ctrl->efd, EPOLL_CTL_MOD, ctrl->fd, &ev);
+		if (r < 0)
+			return -errno;
+	}
+
+	ctrl->out_armed = on;
+	return 0;
+}
+
+static void keepalive_fn(struct shl_wheel_timer *t, void *data);
+static void timeout_fn(struct shl_wheel_timer *t, void *data);
+static void req_fail_all(struct owfd_rtsp_ctrl *ctrl, int error);
+static void req_clear(struct owfd_rtsp_ctrl *ctrl);
+static void loop_settle(struct owfd_rtsp_ctrl *ctrl, int r);
+static void loop_io_fn(struct shl_loop_io *io, uint32_t events, void *data);
+static void loop_defer_fn(struct shl_loop_defer *d, void *data);
+
+static struct owfd_rtsp_ctrl *ctrl_alloc(void)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+
 	ctrl = calloc(1, sizeof(*ctrl));
 	if (!ctrl)
-		return -ENOMEM;
-	ctrl->ref = 1;
+		return NULL;
+	atomic_init(&ctrl->ref, 1);
 	ctrl->efd = -1;
 	ctrl->fd = -1;
+	ctrl->tag = ctrl;
+	ctrl->rx_budget = CTRL_RX_BUDGET;
+	shl_chain_init(&ctrl->out, NULL);
+	shl_chain_init(&ctrl->mem_in, NULL);
+	shl_dlist_init(&ctrl->out_list);
+	shl_wheel_timer_init(&ctrl->keepalive, keepalive_fn, ctrl);
+	shl_wheel_timer_init(&ctrl->timeout, timeout_fn, ctrl);
+
+	return ctrl;
+}
+
+int owfd_rtsp_ctrl_new(struct owfd_rtsp_ctrl **out)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+	int r;
+
+	ctrl = ctrl_alloc();
+	if (!ctrl)
+		return -ENOMEM;
 
 	ctrl->efd = epoll_create1(EPOLL_CLOEXEC);
 	if (ctrl->efd < 0) {
@@ -78,23 +430,105 @@ err_ctrl:
 	return r;
 }
 
+/*
+ * Shared event loops: Instead of creating its own epoll fd, the ctrl adds its
+ * socket to @efd with @tag as epoll data pointer. The owner of @efd must pass
+ * all events for @tag to owfd_rtsp_ctrl_dispatch_events().
+ * owfd_rtsp_ctrl_get_fd() returns @efd and owfd_rtsp_ctrl_dispatch() must not
+ * be used.
+ */
+int owfd_rtsp_ctrl_new_shared(struct owfd_rtsp_ctrl **out, int efd,
+			      void *tag)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+
+	if (efd < 0)
+		return -EINVAL;
+
+	ctrl = ctrl_alloc();
+	if (!ctrl)
+		return -ENOMEM;
+
+	ctrl->efd = efd;
+	ctrl->shared = 1;
+	if (tag)
+		ctrl->tag = tag;
+
+	*out = ctrl;
+	return 0;
+}
+
+/*
+ * Register the ctrl directly on @loop: the socket becomes an io source of the
+ * loop, timers run on its wheel and input left over by the budget is read
+ * from a defer. Errors close the ctrl and are reported to the callback of
+ * owfd_rtsp_ctrl_set_error_cb(). @loop must outlive the ctrl.
+ */
+int owfd_rtsp_ctrl_new_loop(struct owfd_rtsp_ctrl **out, struct shl_loop *loop)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+	int r;
+
+	if (!loop)
+		return -EINVAL;
+
+	r = owfd_rtsp_ctrl_new_shared(&ctrl, shl_loop_get_fd(loop), NULL);
+	if (r < 0)
+		return r;
+
+	ctrl->loop = loop;
+	ctrl->tag = &ctrl->io;
+	shl_loop_defer_init(&ctrl->defer, loop_defer_fn, ctrl);
+	owfd_rtsp_ctrl_set_wheel(ctrl, shl_loop_get_wheel(loop));
+
+	*out = ctrl;
+	return 0;
+}
+
+void ctrl_destroy(struct owfd_rtsp_ctrl *ctrl)
+{
+	size_t i;
+
+	owfd_rtsp_ctrl_set_wheel(ctrl, NULL);
+	req_clear(ctrl);
+	if (ctrl->own_uring)
+		owfd_rtsp_uring_free(ctrl->uring);
+	if (!ctrl->shared)
+		close(ctrl->efd);
+	owfd_rtsp_decoder_free(ctrl->dec);
+	ctrl_out_flush(ctrl);
+	for (i = 0; i < OWFD_RTSP_METHOD_CNT; ++i)
+		free(ctrl->rtt[i]);
+	free(ctrl->uring_send);
+	free(ctrl);
+}
+
+/*
+ * References may be taken and dropped from any thread. All other calls must
+ * come from the thread that runs the ctrl's event loop, and so must the last
+ * unref unless the ctrl was closed before.
+ */
 void owfd_rtsp_ctrl_ref(struct owfd_rtsp_ctrl *ctrl)
 {
-	if (!ctrl || !ctrl->ref)
+	if (!ctrl || !atomic_load_explicit(&ctrl->ref, memory_order_relaxed))
 		return;
 
-	++ctrl->ref;
+	atomic_fetch_add_explicit(&ctrl->ref, 1, memory_order_relaxed);
 }
 
 void owfd_rtsp_ctrl_unref(struct owfd_rtsp_ctrl *ctrl)
 {
-	if (!ctrl || !ctrl->ref || --ctrl->ref)
+	if (!ctrl || !atomic_load_explicit(&ctrl->ref, memory_order_relaxed))
+		return;
+	if (atomic_fetch_sub_explicit(&ctrl->ref, 1, memory_order_acq_rel) != 1)
 		return;
 
 	owfd_rtsp_ctrl_close(ctrl);
-	close(ctrl->efd);
-	shl_ring_clear(&ctrl->out_ring);
-	free(ctrl);
+
+	/* released by rtsp_uring.c once all requests completed */
+	ctrl->freeing = 1;
+	if (!ctrl->uring_ops || ctrl->own_uring)
+		ctrl_destroy(ctrl);
 }
 
 void owfd_rtsp_ctrl_set_data(struct owfd_rtsp_ctrl *ctrl, void *data)
@@ -107,9 +541,67 @@ void *owfd_rtsp_ctrl_get_data(struct owfd_rtsp_ctrl *ctrl)
 	return ctrl->data;
 }
 
+/* flags can only be changed while the ctrl is closed */
+int owfd_rtsp_ctrl_set_flags(struct owfd_rtsp_ctrl *ctrl, unsigned int flags)
+{
+	if (owfd_rtsp_ctrl_is_open(ctrl))
+		return -EBUSY;
+
+	ctrl->flags = flags;
+	return 0;
+}
+
+unsigned int owfd_rtsp_ctrl_get_flags(struct owfd_rtsp_ctrl *ctrl)
+{
+	return ctrl->flags;
+}
+
+/*
+ * Take buffer segments from @pool instead of the default pool of the thread
+ * that created the ctrl. The pool must outlive the ctrl, or at least its
+ * connection, as closing releases all segments. Only possible while closed.
+ */
+int owfd_rtsp_ctrl_set_chain_pool(struct owfd_rtsp_ctrl *ctrl,
+				  struct shl_chain_pool *pool)
+{
+	/* a send in flight may still use the old segments */
+	if (owfd_rtsp_ctrl_is_open(ctrl) || ctrl->uring_sending)
+		return -EBUSY;
+
+	shl_chain_clear(&ctrl->out);
+	shl_chain_clear(&ctrl->mem_in);
+	shl_chain_init(&ctrl->out, pool);
+	shl_chain_init(&ctrl->mem_in, pool);
+	return 0;
+}
+
+/*
+ * A single wakeup reads at most @bytes bytes (rounded up to the next read)
+ * and stops once @msgs messages were decoded, so a chatty peer cannot starve
+ * the other ctrls of an event loop. 0 disables either limit. The default is
+ * 512KiB and no message limit. Receives of the io_uring backend are not
+ * budgeted.
+ */
+void owfd_rtsp_ctrl_set_budget(struct owfd_rtsp_ctrl *ctrl, size_t bytes,
+			       size_t msgs)
+{
+	ctrl->rx_budget = bytes;
+	ctrl->msg_budget = msgs;
+}
+
+/*
+ * An edge-triggered ctrl that used up its budget may have input left, for
+ * which there will be no new event. Owners of shared ctrls must call
+ * owfd_rtsp_ctrl_dispatch_events() with EPOLLIN for it, without waiting.
+ */
+bool owfd_rtsp_ctrl_is_pending(struct owfd_rtsp_ctrl *ctrl)
+{
+	return ctrl->rx_pending;
+}
+
 bool owfd_rtsp_ctrl_is_open(struct owfd_rtsp_ctrl *ctrl)
 {
-	return ctrl->fd >= 0;
+	return ctrl->fd >= 0 || ctrl->mem;
 }
 
 bool owfd_rtsp_ctrl_is_connected(struct owfd_rtsp_ctrl *ctrl)
@@ -122,11 +614,540 @@ void owfd_rtsp_ctrl_close(struct owfd_rtsp_ctrl *ctrl)
 	if (!owfd_rtsp_ctrl_is_open(ctrl))
 		return;
 
-	close(ctrl->fd);
+	if (ctrl->wheel) {
+		shl_wheel_del(ctrl->wheel, &ctrl->keepalive);
+		shl_wheel_del(ctrl->wheel, &ctrl->timeout);
+	}
+
+	if (ctrl->uring)
+		ctrl_uring_cancel(ctrl);
+	else if (ctrl->mem)
+		mem_close(ctrl);
+	else if (ctrl->loop)
+		shl_loop_io_del(ctrl->loop, &ctrl->io);
+	else
+		epoll_ctl(ctrl->efd, EPOLL_CTL_DEL, ctrl->fd, NULL);
+	if (ctrl->loop)
+		shl_loop_defer_del(ctrl->loop, &ctrl->defer);
+	if (ctrl->fd >= 0)
+		close(ctrl->fd);
 	ctrl->fd = -1;
 	ctrl->connected = 0;
+	ctrl->rx_pending = 0;
 	ctrl->cb = NULL;
-	shl_ring_flush(&ctrl->out_ring);
+
+	/* the kernel may still read from a send in flight */
+	ctrl_out_unblock(ctrl);
+	if (!ctrl->uring_sending)
+		ctrl_out_flush(ctrl);
+
+	/* callbacks see the ctrl closed and cannot queue new requests */
+	req_fail_all(ctrl, -EPIPE);
+}
+
+/*
+ * Timers: Keepalive and timeout timers of all ctrls sharing an event loop live
+ * on one shl_wheel, so arming and re-arming them is O(1) and costs no fds or
+ * syscalls. Standalone ctrls create their own wheel on demand and handle it in
+ * owfd_rtsp_ctrl_dispatch(). Shared ctrls need owfd_rtsp_ctrl_set_wheel().
+ */
+
+static void ctrl_timer(struct owfd_rtsp_ctrl *ctrl, unsigned int timer)
+{
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+	owfd_rtsp_ctrl_cork(ctrl);
+
+	if (ctrl->timer_cb) {
+		ctrl->timer_cb(ctrl, timer, ctrl->timer_data);
+	} else if (timer == OWFD_RTSP_CTRL_TIMEOUT) {
+		owfd_rtsp_ctrl_close(ctrl);
+		if (ctrl->loop)
+			loop_settle(ctrl, -ETIMEDOUT);
+	}
+
+	/* errors show up on the next dispatch, see out_direct() */
+	owfd_rtsp_ctrl_uncork(ctrl);
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+
+/* timers are re-armed first, so callbacks can change or stop them */
+static void keepalive_fn(struct shl_wheel_timer *t, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = data;
+
+	shl_wheel_add(ctrl->wheel, t, ctrl->keepalive_ms);
+	if (ctrl->connected)
+		ctrl_timer(ctrl, OWFD_RTSP_CTRL_KEEPALIVE);
+}
+
+/*
+ * Incoming data only updates @last_rx. Once the timer runs, it is moved to
+ * the end of the remaining idle period if there was any since it was armed.
+ */
+static void timeout_fn(struct shl_wheel_timer *t, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = data;
+	uint64_t idle;
+
+	idle = shl_wheel_time(ctrl->wheel) - ctrl->last_rx;
+	if (idle < ctrl->timeout_ms) {
+		shl_wheel_add(ctrl->wheel, t, ctrl->timeout_ms - idle);
+		return;
+	}
+
+	shl_wheel_add(ctrl->wheel, t, ctrl->timeout_ms);
+	ctrl_timer(ctrl, OWFD_RTSP_CTRL_TIMEOUT);
+}
+
+static void timers_start(struct owfd_rtsp_ctrl *ctrl)
+{
+	if (!ctrl->wheel || !owfd_rtsp_ctrl_is_open(ctrl))
+		return;
+
+	if (ctrl->keepalive_ms)
+		shl_wheel_add(ctrl->wheel, &ctrl->keepalive,
+			      ctrl->keepalive_ms);
+	else
+		shl_wheel_del(ctrl->wheel, &ctrl->keepalive);
+
+	ctrl->last_rx = shl_wheel_time(ctrl->wheel);
+	if (ctrl->timeout_ms)
+		shl_wheel_add(ctrl->wheel, &ctrl->timeout, ctrl->timeout_ms);
+	else
+		shl_wheel_del(ctrl->wheel, &ctrl->timeout);
+}
+
+/* create a timerfd wheel on the epoll fd of a standalone ctrl */
+static int wheel_own(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct epoll_event ev;
+	struct shl_wheel *w;
+	int r;
+
+	if (ctrl->wheel)
+		return 0;
+	if (ctrl->shared)
+		return -EINVAL;
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	r = shl_wheel_init(w, CTRL_WHEEL_TICK, SHL_WHEEL_TIMERFD);
+	if (r < 0)
+		goto err_free;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &ctrl->wheel;
+
+	r = epoll_ctl(ctrl->efd, EPOLL_CTL_ADD, shl_wheel_get_fd(w), &ev);
+	if (r < 0) {
+		r = -errno;
+		goto err_wheel;
+	}
+
+	ctrl->wheel = w;
+	ctrl->own_wheel = 1;
+	return 0;
+
+err_wheel:
+	shl_wheel_destroy(w);
+err_free:
+	free(w);
+	return r;
+}
+
+/*
+ * Run the timers of @ctrl on @w, which is driven by the caller. This is
+ * required before shared ctrls can use timers. Pass NULL to detach the ctrl;
+ * it must be detached before @w is destroyed.
+ */
+void owfd_rtsp_ctrl_set_wheel(struct owfd_rtsp_ctrl *ctrl,
+			      struct shl_wheel *w)
+{
+	struct ctrl_req *req;
+	size_t i;
+
+	if (ctrl->wheel == w)
+		return;
+
+	if (ctrl->wheel) {
+		shl_wheel_del(ctrl->wheel, &ctrl->keepalive);
+		shl_wheel_del(ctrl->wheel, &ctrl->timeout);
+	}
+
+	/* pending requests restart their timeouts on the new wheel */
+	for (i = 0; ctrl->req_num && i <= ctrl->req_mask; ++i) {
+		req = ctrl->req_slots[i].req;
+		if (!req || !req->timeout)
+			continue;
+
+		if (ctrl->wheel)
+			shl_wheel_del(ctrl->wheel, &req->timer);
+		if (w)
+			shl_wheel_add(w, &req->timer, req->timeout);
+	}
+
+	if (ctrl->own_wheel) {
+		epoll_ctl(ctrl->efd, EPOLL_CTL_DEL,
+			  shl_wheel_get_fd(ctrl->wheel), NULL);
+		shl_wheel_destroy(ctrl->wheel);
+		free(ctrl->wheel);
+		ctrl->own_wheel = 0;
+	}
+
+	ctrl->wheel = w;
+	timers_start(ctrl);
+}
+
+/*
+ * @cb is called for each timer that runs on a connected ctrl, corked like
+ * other callbacks. Without a callback, timeouts close the ctrl.
+ */
+void owfd_rtsp_ctrl_set_timer_cb(struct owfd_rtsp_ctrl *ctrl,
+				 owfd_rtsp_ctrl_timer_cb cb, void *data)
+{
+	ctrl->timer_cb = cb;
+	ctrl->timer_data = data;
+}
+
+/* run OWFD_RTSP_CTRL_KEEPALIVE every @msec milliseconds, 0 disables it */
+int owfd_rtsp_ctrl_set_keepalive(struct owfd_rtsp_ctrl *ctrl,
+				 unsigned int msec)
+{
+	int r;
+
+	if (msec) {
+		r = wheel_own(ctrl);
+		if (r < 0)
+			return r;
+	}
+
+	ctrl->keepalive_ms = msec;
+	if (!ctrl->wheel)
+		return 0;
+
+	if (msec && owfd_rtsp_ctrl_is_open(ctrl))
+		shl_wheel_add(ctrl->wheel, &ctrl->keepalive, msec);
+	else
+		shl_wheel_del(ctrl->wheel, &ctrl->keepalive);
+
+	return 0;
+}
+
+/*
+ * Run OWFD_RTSP_CTRL_TIMEOUT once nothing was received for @msec milliseconds
+ * (and again after each further @msec), 0 disables it. Use it to bound the
+ * time a peer may take to answer a request or keepalive.
+ */
+int owfd_rtsp_ctrl_set_timeout(struct owfd_rtsp_ctrl *ctrl,
+			       unsigned int msec)
+{
+	int r;
+
+	if (msec) {
+		r = wheel_own(ctrl);
+		if (r < 0)
+			return r;
+	}
+
+	ctrl->timeout_ms = msec;
+	if (!ctrl->wheel)
+		return 0;
+
+	ctrl->last_rx = shl_wheel_time(ctrl->wheel);
+	if (msec && owfd_rtsp_ctrl_is_open(ctrl))
+		shl_wheel_add(ctrl->wheel, &ctrl->timeout, msec);
+	else
+		shl_wheel_del(ctrl->wheel, &ctrl->timeout);
+
+	return 0;
+}
+
+static struct ctrl_slot *req_find(struct owfd_rtsp_ctrl *ctrl,
+				  unsigned long cseq)
+{
+	size_t i;
+
+	if (!ctrl->req_num)
+		return NULL;
+
+	for (i = cseq & ctrl->req_mask; ctrl->req_slots[i].req;
+	     i = (i + 1) & ctrl->req_mask) {
+		if (ctrl->req_slots[i].cseq == cseq)
+			return &ctrl->req_slots[i];
+	}
+
+	return NULL;
+}
+
+static void req_insert(struct ctrl_slot *slots, size_t mask,
+		       struct ctrl_req *req)
+{
+	size_t i;
+
+	for (i = req->cseq & mask; slots[i].req; i = (i + 1) & mask)
+		/* empty */ ;
+
+	slots[i].cseq = req->cseq;
+	slots[i].req = req;
+}
+
+/* keep the table at most 3/4 full, so probe sequences stay short */
+static int req_grow(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct ctrl_slot *slots;
+	size_t i, size;
+
+	size = ctrl->req_slots ? ctrl->req_mask + 1 : 0;
+	if ((ctrl->req_num + 1) * 4 <= size * 3)
+		return 0;
+
+	size = size ? size * 2 : CTRL_REQ_SLOTS;
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; ctrl->req_slots && i <= ctrl->req_mask; ++i) {
+		if (ctrl->req_slots[i].req)
+			req_insert(slots, size - 1, ctrl->req_slots[i].req);
+	}
+
+	free(ctrl->req_slots);
+	ctrl->req_slots = slots;
+	ctrl->req_mask = size - 1;
+	return 0;
+}
+
+/* unlink the request in @slot, later entries of its cluster move back */
+static struct ctrl_req *req_remove(struct owfd_rtsp_ctrl *ctrl,
+				   struct ctrl_slot *slot)
+{
+	struct ctrl_slot *slots = ctrl->req_slots;
+	struct ctrl_req *req = slot->req;
+	size_t i, j, home, mask = ctrl->req_mask;
+
+	i = slot - slots;
+	for (j = (i + 1) & mask; slots[j].req; j = (j + 1) & mask) {
+		home = slots[j].cseq & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+
+	slots[i].req = NULL;
+	--ctrl->req_num;
+
+	if (ctrl->wheel)
+		shl_wheel_del(ctrl->wheel, &req->timer);
+
+	return req;
+}
+
+static void req_release(struct owfd_rtsp_ctrl *ctrl, struct ctrl_req *req)
+{
+	if (ctrl->req_cached >= CTRL_REQ_CACHE) {
+		free(req);
+		return;
+	}
+
+	/* cached requests are linked through @data */
+	req->data = ctrl->req_cache;
+	ctrl->req_cache = req;
+	++ctrl->req_cached;
+}
+
+static void req_complete(struct owfd_rtsp_ctrl *ctrl, struct ctrl_req *req,
+			 struct owfd_rtsp_msg *reply, int error)
+{
+	owfd_rtsp_ctrl_reply_cb cb = req->cb;
+	void *data = req->data;
+
+	/* released first, so @cb may send new requests right away */
+	req_release(ctrl, req);
+	if (cb)
+		cb(ctrl, reply, error, data);
+}
+
+static void req_timeout_fn(struct shl_wheel_timer *t, void *data)
+{
+	struct ctrl_req *req = data;
+	struct owfd_rtsp_ctrl *ctrl = req->ctrl;
+	struct ctrl_slot *slot;
+
+	slot = req_find(ctrl, req->cseq);
+	if (!slot)
+		return;
+
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+	owfd_rtsp_ctrl_cork(ctrl);
+
+	++ctrl->stats.timeouts;
+	req_complete(ctrl, req_remove(ctrl, slot), NULL, -ETIMEDOUT);
+
+	owfd_rtsp_ctrl_uncork(ctrl);
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+
+static void req_fail_all(struct owfd_rtsp_ctrl *ctrl, int error)
+{
+	struct ctrl_slot *slot;
+	size_t i;
+
+	for (i = 0; ctrl->req_num && i <= ctrl->req_mask; ) {
+		slot = &ctrl->req_slots[i];
+		if (!slot->req) {
+			++i;
+			continue;
+		}
+
+		/* removal may shift another request into this slot */
+		req_complete(ctrl, req_remove(ctrl, slot), NULL, error);
+	}
+}
+
+static void req_clear(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct ctrl_req *req;
+
+	while ((req = ctrl->req_cache)) {
+		ctrl->req_cache = req->data;
+		free(req);
+	}
+	ctrl->req_cached = 0;
+
+	free(ctrl->req_slots);
+	ctrl->req_slots = NULL;
+	ctrl->req_mask = 0;
+}
+
+/* record the round trip time of @req; histograms are allocated on demand */
+static void req_rtt(struct owfd_rtsp_ctrl *ctrl, struct ctrl_req *req)
+{
+	struct shl_hist *h = ctrl->rtt[req->method];
+	int64_t t;
+
+	if (!h) {
+		h = malloc(sizeof(*h));
+		if (!h)
+			return;
+		shl_hist_init(h);
+		ctrl->rtt[req->method] = h;
+	}
+
+	t = get_time_us() - req->sent;
+	shl_hist_add(h, t > 0 ? t : 0);
+}
+
+/* pass responses to pending requests to their callbacks */
+static bool req_reply(struct owfd_rtsp_ctrl *ctrl, struct owfd_rtsp_msg *msg)
+{
+	struct ctrl_slot *slot;
+	struct ctrl_req *req;
+
+	if (msg->type != OWFD_RTSP_MSG_RESPONSE || !msg->cseq)
+		return false;
+
+	slot = req_find(ctrl, msg->cseq);
+	if (!slot)
+		return false;
+
+	++ctrl->stats.replies;
+	req = req_remove(ctrl, slot);
+	req_rtt(ctrl, req);
+	req_complete(ctrl, req, msg, 0);
+	return true;
+}
+
+/*
+ * Asynchronous requests: Send the request in @b (started with
+ * owfd_rtsp_msg_builder_request()) and call @cb with the response carrying
+ * the same CSeq. Any number of requests may be in flight; responses are
+ * matched in any order and are not passed to the message callback. If no
+ * response arrives within @timeout milliseconds (0 waits forever), @cb gets
+ * -ETIMEDOUT instead; on close, all pending requests get -EPIPE.
+ * Requires a message callback, see owfd_rtsp_ctrl_set_msg_cb().
+ */
+int owfd_rtsp_ctrl_request(struct owfd_rtsp_ctrl *ctrl,
+			   struct owfd_rtsp_msg_builder *b,
+			   unsigned int timeout,
+			   owfd_rtsp_ctrl_reply_cb cb, void *data)
+{
+	struct ctrl_req *req;
+	int r;
+
+	if (!owfd_rtsp_ctrl_is_open(ctrl))
+		return -ENODEV;
+	if (!ctrl->msg_cb || !b->msg_cseq)
+		return -EINVAL;
+	if (req_find(ctrl, b->msg_cseq))
+		return -EEXIST;
+
+	if (timeout) {
+		r = wheel_own(ctrl);
+		if (r < 0)
+			return r;
+	}
+
+	r = req_grow(ctrl);
+	if (r < 0)
+		return r;
+
+	req = ctrl->req_cache;
+	if (req) {
+		ctrl->req_cache = req->data;
+		--ctrl->req_cached;
+	} else {
+		req = malloc(sizeof(*req));
+		if (!req)
+			return -ENOMEM;
+	}
+
+	shl_wheel_timer_init(&req->timer, req_timeout_fn, req);
+	req->ctrl = ctrl;
+	req->cseq = b->msg_cseq;
+	req->timeout = timeout;
+	req->method = b->msg_method < OWFD_RTSP_METHOD_CNT ? b->msg_method :
+						OWFD_RTSP_METHOD_UNKNOWN;
+	req->sent = get_time_us();
+	req->cb = cb;
+	req->data = data;
+
+	r = owfd_rtsp_ctrl_send_msg(ctrl, b);
+	if (r < 0) {
+		req_release(ctrl, req);
+		return r;
+	}
+
+	req_insert(ctrl->req_slots, ctrl->req_mask, req);
+	++ctrl->req_num;
+	++ctrl->stats.requests;
+	if (timeout)
+		shl_wheel_add(ctrl->wheel, &req->timer, timeout);
+
+	return 0;
+}
+
+/* forget the pending request @cseq, its callback is not called */
+int owfd_rtsp_ctrl_cancel(struct owfd_rtsp_ctrl *ctrl, unsigned long cseq)
+{
+	struct ctrl_slot *slot;
+
+	slot = req_find(ctrl, cseq);
+	if (!slot)
+		return -ENOENT;
+
+	req_release(ctrl, req_remove(ctrl, slot));
+	return 0;
+}
+
+size_t owfd_rtsp_ctrl_get_pending(struct owfd_rtsp_ctrl *ctrl)
+{
+	return ctrl->req_num;
 }
 
 int owfd_rtsp_ctrl_open_tcp_fd(struct owfd_rtsp_ctrl *ctrl, int fd,
@@ -140,6 +1161,9 @@ int owfd_rtsp_ctrl_open_tcp_fd(struct owfd_rtsp_ctrl *ctrl, int fd,
 	if (fd < 0)
 		return -EINVAL;
 
+	if (ctrl->uring_ops)
+		return -EBUSY;
+
 	set = fcntl(fd, F_GETFL);
 	if (set < 0)
 		return -errno;
@@ -147,19 +1171,47 @@ int owfd_rtsp_ctrl_open_tcp_fd(struct owfd_rtsp_ctrl *ctrl, int fd,
 	if (r < 0)
 		return -errno;
 
-	/* wait for EPOLLOUT as "CONNECTED" event */
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT;
-	ev.data.ptr = &ctrl->fd;
-
-	r = epoll_ctl(ctrl->efd, EPOLL_CTL_ADD, fd, &ev);
-	if (r < 0)
-		return -errno;
-
+	if (ctrl->uring) {
+		/* the same, as a single-shot poll request */
+		ctrl->fd = fd;
+		r = ctrl_uring_poll(ctrl);
+		if (r < 0) {
+			ctrl->fd = -1;
+			return r;
+		}
+	} else {
+		/* wait for EPOLLOUT as "CONNECTED" event */
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT |
+			    EPOLLRDHUP;
+		if (ctrl->flags & OWFD_RTSP_CTRL_EDGE)
+			ev.events |= EPOLLET;
+		ev.data.ptr = ctrl->tag;
+
+		if (ctrl->loop) {
+			shl_loop_io_init(&ctrl->io, fd, loop_io_fn, ctrl);
+			r = shl_loop_io_add(ctrl->loop, &ctrl->io, ev.events);
+			if (r < 0)
+				return r;
+		} else {
+			r = epoll_ctl(ctrl->efd, EPOLL_CTL_ADD, fd, &ev);
+			if (r < 0)
+				return -errno;
+		}
+	}
+
 	ctrl->fd = fd;
 	ctrl->connected = 0;
+	ctrl->out_armed = 1;
+	ctrl->out_blocked = 0;
+	ctrl->rx_pending = 0;
 	ctrl->cb = cb;
 
+	/* drop partial messages of a previous connection */
+	if (ctrl->dec)
+		owfd_rtsp_decoder_flush(ctrl->dec);
+
+	timers_start(ctrl);
 	return 0;
 }
 
@@ -202,12 +1254,132 @@ int owfd_rtsp_ctrl_open_tcp(struct owfd_rtsp_ctrl *ctrl,
 	return 0;
 }
 
+static void mem_open(struct owfd_rtsp_ctrl *ctrl, struct owfd_rtsp_ctrl *peer,
+		     owfd_rtsp_ctrl_cb cb)
+{
+	ctrl->mem = 1;
+	ctrl->peer = peer;
+	ctrl->connected = 0;
+	ctrl->out_armed = 0;
+	ctrl->out_blocked = 0;
+	ctrl->rx_pending = 0;
+	ctrl->cb = cb;
+
+	if (ctrl->dec)
+		owfd_rtsp_decoder_flush(ctrl->dec);
+
+	timers_start(ctrl);
+
+	/* "connected" is reported from the first defer */
+	shl_loop_defer_add(ctrl->loop, &ctrl->defer);
+}
+
+/*
+ * Connect @a and @b with each other, without any network in between. With
+ * OWFD_RTSP_CTRL_PAIR_SOCKET, both sides get an end of an AF_UNIX socketpair
+ * and behave exactly as with TCP. OWFD_RTSP_CTRL_PAIR_MEM skips the kernel
+ * altogether: data is handed over in userspace and both sides are driven by
+ * defers of their loop, so it requires controllers from
+ * owfd_rtsp_ctrl_new_loop() without io_uring. Closing one side lets the other
+ * read what is left and then fail with -EPIPE, like a socket would.
+ * @cb is installed on both sides.
+ */
+int owfd_rtsp_ctrl_open_pair(struct owfd_rtsp_ctrl *a,
+			     struct owfd_rtsp_ctrl *b,
+			     unsigned int mode,
+			     owfd_rtsp_ctrl_cb cb)
+{
+	int r, fds[2];
+
+	if (a == b)
+		return -EINVAL;
+	if (owfd_rtsp_ctrl_is_open(a) || owfd_rtsp_ctrl_is_open(b))
+		return -EALREADY;
+
+	switch (mode) {
+	case OWFD_RTSP_CTRL_PAIR_SOCKET:
+		r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+		if (r < 0)
+			return -errno;
+
+		r = owfd_rtsp_ctrl_open_tcp_fd(a, fds[0], cb);
+		if (r < 0) {
+			close(fds[0]);
+			close(fds[1]);
+			return r;
+		}
+
+		r = owfd_rtsp_ctrl_open_tcp_fd(b, fds[1], cb);
+		if (r < 0) {
+			owfd_rtsp_ctrl_close(a);
+			close(fds[1]);
+			return r;
+		}
+
+		return 0;
+	case OWFD_RTSP_CTRL_PAIR_MEM:
+		if (!a->loop || !b->loop || a->uring || b->uring)
+			return -EOPNOTSUPP;
+
+		mem_open(a, b, cb);
+		mem_open(b, a, cb);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static void ctrl_decoder_event(struct owfd_rtsp_decoder *dec,
+			       struct owfd_rtsp_msg *msg,
+			       void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = data;
+
+	++ctrl->rx_msgs;
+	++ctrl->stats.msgs_received;
+	if (!ctrl->connected || req_reply(ctrl, msg))
+		return;
+
+	if (ctrl->msg_cb)
+		ctrl->msg_cb(ctrl, msg, ctrl->data);
+}
+
+/*
+ * Integrated decoder: If a message callback is set, the ctrl owns an
+ * owfd_rtsp_decoder and reads incoming data directly into its input buffer.
+ * Parsed messages are passed to @cb and the raw callback only sees the
+ * connect notification. The decoder can be configured via
+ * owfd_rtsp_ctrl_get_decoder(), but its data pointer must not be changed.
+ * Pass NULL to switch back to raw delivery.
+ */
+int owfd_rtsp_ctrl_set_msg_cb(struct owfd_rtsp_ctrl *ctrl,
+			      owfd_rtsp_ctrl_msg_cb cb)
+{
+	int r;
+
+	if (cb && !ctrl->dec) {
+		r = owfd_rtsp_decoder_new(&ctrl->dec, ctrl_decoder_event);
+		if (r < 0)
+			return r;
+
+		owfd_rtsp_decoder_set_data(ctrl->dec, ctrl);
+	}
+
+	ctrl->msg_cb = cb;
+	return 0;
+}
+
+struct owfd_rtsp_decoder *owfd_rtsp_ctrl_get_decoder(struct owfd_rtsp_ctrl *ctrl)
+{
+	return ctrl->dec;
+}
+
 int owfd_rtsp_ctrl_get_fd(struct owfd_rtsp_ctrl *ctrl)
 {
 	return ctrl->efd;
 }
 
-static int connect_done(struct owfd_rtsp_ctrl *ctrl)
+int ctrl_connect_done(struct owfd_rtsp_ctrl *ctrl)
 {
 	if (ctrl->connected)
 		return 0;
@@ -220,80 +1392,309 @@ static int connect_done(struct owfd_rtsp_ctrl *ctrl)
 	return ctrl->connected ? 0 : -EPIPE;
 }
 
-static int recv_all(struct owfd_rtsp_ctrl *ctrl)
+/*
+ * Returns true once the wakeup used up its budget of @bytes read and
+ * messages decoded. Edge-triggered ctrls remember that input may be left.
+ */
+static bool recv_spent(struct owfd_rtsp_ctrl *ctrl, size_t bytes)
+{
+	if ((!ctrl->rx_budget || bytes < ctrl->rx_budget) &&
+	    (!ctrl->msg_budget || ctrl->rx_msgs < ctrl->msg_budget))
+		return false;
+
+	++ctrl->stats.budget_stops;
+	if ((ctrl->flags & OWFD_RTSP_CTRL_EDGE) || ctrl->mem)
+		ctrl->rx_pending = 1;
+	return true;
+}
+
+/* read directly into the decoder, see owfd_rtsp_ctrl_set_msg_cb() */
+static int recv_msgs(struct owfd_rtsp_ctrl *ctrl, bool hup)
+{
+	struct iovec vec[2];
+	size_t bytes, want;
+	ssize_t l;
+	int r, n;
+
+	bytes = 0;
+	do {
+		n = owfd_rtsp_decoder_reserve(ctrl->dec, 4096, vec);
+		if (n < 0)
+			return n;
+		want = vec[0].iov_len + (n > 1 ? vec[1].iov_len : 0);
+
+		++ctrl->stats.reads;
+		if (ctrl->mem)
+			l = mem_read(ctrl, vec, n);
+		else
+			l = readv(ctrl->fd, vec, n);
+		if (l < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return -errno;
+		} else if (!l) {
+			/* remote side closed the connection */
+			return -EPIPE;
+		} else {
+			bytes += l;
+			ctrl->stats.bytes_received += l;
+
+			/* the decoder recovers from malformed messages */
+			r = owfd_rtsp_decoder_commit(ctrl->dec, l);
+			if (r == -ENOMEM)
+				return r;
+
+			/* a short read drained the socket */
+			if ((size_t)l < want && !hup)
+				break;
+		}
+	} while (l > 0 && ctrl->connected && ctrl->msg_cb &&
+		 !recv_spent(ctrl, bytes));
+
+	return ctrl->connected ? 0 : -EPIPE;
+}
+
+static int recv_all(struct owfd_rtsp_ctrl *ctrl, bool hup)
 {
 	ssize_t l;
 	char buf[4096];
-	size_t rounds;
+	struct iovec vec = { buf, sizeof(buf) };
+	size_t bytes;
+
+	ctrl->rx_pending = 0;
+	ctrl->rx_msgs = 0;
+	if (ctrl->msg_cb)
+		return recv_msgs(ctrl, hup);
 
-	rounds = 128;
+	bytes = 0;
 	do {
-		l = read(ctrl->fd, buf, sizeof(buf));
+		++ctrl->stats.reads;
+		if (ctrl->mem)
+			l = mem_read(ctrl, &vec, 1);
+		else
+			l = read(ctrl->fd, buf, sizeof(buf));
 		if (l < 0) {
 			if (errno != EAGAIN && errno != EINTR)
 				return -errno;
-		} else if (l > 0) {
+		} else if (!l) {
+			return -EPIPE;
+		} else {
 			if (l > sizeof(buf))
 				l = sizeof(buf);
+			bytes += l;
+			ctrl->stats.bytes_received += l;
 
 			if (ctrl->cb)
 				ctrl->cb(ctrl, buf, l, ctrl->data);
+			if ((size_t)l < sizeof(buf) && !hup)
+				break;
 		}
-	} while (--rounds && l > 0 && ctrl->connected);
+	} while (l > 0 && ctrl->connected && !recv_spent(ctrl, bytes));
 
 	return ctrl->connected ? 0 : -EPIPE;
 }
 
+/*
+ * Write queued data until the socket is busy or the queue is empty. Bytes are
+ * removed from the queue exactly as the kernel accepted them.
+ */
 static int send_all(struct owfd_rtsp_ctrl *ctrl)
 {
-	struct epoll_event ev;
-	bool done = true;
-	struct iovec vec[2];
-	size_t n, sum;
+	struct iovec vec[CTRL_IOV_MAX];
 	ssize_t l;
-	int r;
+	size_t n, i, len;
+	bool more;
 
-	n = shl_ring_peek(&ctrl->out_ring, vec);
-	if (n > 0) {
-		sum = vec[0].iov_len;
-		if (n > 1)
-			sum += vec[1].iov_len;
+	if (ctrl->uring)
+		return ctrl_uring_send(ctrl);
 
-		l = writev(ctrl->fd, vec, n);
-		if (l < 0 && errno != EAGAIN && errno != EINTR)
-			return -errno;
-		else if (l < (ssize_t)sum)
-			done = false;
-	}
+	ctrl->out_blocked = 0;
+	while (!shl_dlist_empty(&ctrl->out_list)) {
+		n = ctrl_out_peek(ctrl, vec, &more);
+		for (i = 0, len = 0; i < n; ++i)
+			len += vec[i].iov_len;
 
-	if (done) {
-		memset(&ev, 0, sizeof(ev));
-		ev.events = EPOLLHUP | EPOLLERR | EPOLLIN;
-		ev.data.ptr = &ctrl->fd;
+		l = out_sendmsg(ctrl, vec, n, more);
+		if (l < 0)
+			return l;
 
-		r = epoll_ctl(ctrl->efd, EPOLL_CTL_MOD, ctrl->fd, &ev);
-		if (r < 0)
-			return -errno;
+		ctrl_out_advance(ctrl, l);
+		if ((size_t)l < len)
+			break;
 	}
 
+	if (shl_dlist_empty(&ctrl->out_list))
+		ctrl_out_unblock(ctrl);
+	return out_arm(ctrl, !shl_dlist_empty(&ctrl->out_list));
+}
+
+/*
+ * Corking: While corked, sends are only queued. The last uncork writes all
+ * queued messages with as few calls as possible (using MSG_MORE if they need
+ * more than one). owfd_rtsp_ctrl_dispatch() corks while callbacks run, so
+ * replies to a batch of requests leave in as few packets as possible.
+ */
+void owfd_rtsp_ctrl_cork(struct owfd_rtsp_ctrl *ctrl)
+{
+	++ctrl->corked;
+}
+
+int owfd_rtsp_ctrl_uncork(struct owfd_rtsp_ctrl *ctrl)
+{
+	if (!ctrl->corked || --ctrl->corked)
+		return 0;
+
+	/* before the connection is up, EPOLLOUT is armed anyway */
+	if (!owfd_rtsp_ctrl_is_connected(ctrl) ||
+	    shl_dlist_empty(&ctrl->out_list))
+		return 0;
+
+	return send_all(ctrl);
+}
+
+void owfd_rtsp_ctrl_get_stats(struct owfd_rtsp_ctrl *ctrl,
+			      struct owfd_rtsp_ctrl_stats *stats)
+{
+	*stats = ctrl->stats;
+	stats->out_queued = ctrl->out_len;
+	stats->pending = ctrl->req_num;
+	if (ctrl->blocked_since)
+		stats->blocked_usec += get_time_us() - ctrl->blocked_since;
+}
+
+/*
+ * Summary of the round trip times of all requests of @method that got a
+ * response (see owfd_rtsp_ctrl_request()). Quantiles are exact to within
+ * 1/8 of their value.
+ */
+int owfd_rtsp_ctrl_get_rtt(struct owfd_rtsp_ctrl *ctrl, unsigned int method,
+			   struct owfd_rtsp_ctrl_rtt *rtt)
+{
+	struct shl_hist *h;
+
+	if (method >= OWFD_RTSP_METHOD_CNT)
+		return -EINVAL;
+
+	memset(rtt, 0, sizeof(*rtt));
+	h = ctrl->rtt[method];
+	if (!h)
+		return 0;
+
+	rtt->count = h->count;
+	rtt->min = h->min;
+	rtt->mean = shl_hist_mean(h);
+	rtt->p50 = shl_hist_quantile(h, 0.5);
+	rtt->p90 = shl_hist_quantile(h, 0.9);
+	rtt->p99 = shl_hist_quantile(h, 0.99);
+	rtt->max = h->max;
 	return 0;
 }
 
-static int dispatch_ctrl(struct owfd_rtsp_ctrl *ctrl, struct epoll_event *e)
+/*
+ * Write all statistics of @ctrl as text into @buf, one "key: value" group
+ * per line. Like snprintf(), the output is truncated to @size bytes and the
+ * length of the full text is returned.
+ */
+int owfd_rtsp_ctrl_format_stats(struct owfd_rtsp_ctrl *ctrl, char *buf,
+				size_t size)
+{
+	struct owfd_rtsp_ctrl_stats s;
+	struct owfd_rtsp_ctrl_rtt rtt;
+	unsigned int i;
+	size_t len;
+	int l;
+
+	owfd_rtsp_ctrl_get_stats(ctrl, &s);
+	l = snprintf(buf, size,
+		     "bytes: sent=%" PRIu64 " received=%" PRIu64 "\n"
+		     "msgs: sent=%" PRIu64 " received=%" PRIu64 "\n"
+		     "requests: sent=%" PRIu64 " replies=%" PRIu64
+		     " timeouts=%" PRIu64 " pending=%zu\n"
+		     "output: queued=%zu peak=%zu blocked_usec=%" PRIu64 "\n"
+		     "syscalls: writes=%" PRIu64 " short_writes=%" PRIu64
+		     " stalls=%" PRIu64 " reads=%" PRIu64 " polls=%" PRIu64
+		     " budget_stops=%" PRIu64 "\n",
+		     s.bytes_sent, s.bytes_received,
+		     s.msgs_sent, s.msgs_received,
+		     s.requests, s.replies, s.timeouts, s.pending,
+		     s.out_queued, s.out_peak, s.blocked_usec,
+		     s.writes, s.short_writes, s.stalls, s.reads, s.polls,
+		     s.budget_stops);
+	if (l < 0)
+		return -EINVAL;
+	len = l;
+
+	for (i = 0; i < OWFD_RTSP_METHOD_CNT; ++i) {
+		owfd_rtsp_ctrl_get_rtt(ctrl, i, &rtt);
+		if (!rtt.count)
+			continue;
+
+		l = snprintf(len < size ? &buf[len] : NULL,
+			     len < size ? size - len : 0,
+			     "rtt %s: count=%" PRIu64 " min=%" PRIu64
+			     " mean=%" PRIu64 " p50=%" PRIu64 " p90=%" PRIu64
+			     " p99=%" PRIu64 " max=%" PRIu64 "\n",
+			     owfd_rtsp_method_name(i) ? : "UNKNOWN",
+			     rtt.count, rtt.min, rtt.mean, rtt.p50, rtt.p90,
+			     rtt.p99, rtt.max);
+		if (l < 0)
+			return -EINVAL;
+		len += l;
+	}
+
+	return len;
+}
+
+/*
+ * Approximate number of bytes allocated for @ctrl, including queued output
+ * and the decoder buffers.
+ */
+size_t owfd_rtsp_ctrl_get_memory(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct shl_dlist *iter;
+	struct ctrl_out *o;
+	size_t mem, i;
+
+	mem = sizeof(*ctrl) + shl_chain_length(&ctrl->out);
+	shl_dlist_for_each(iter, &ctrl->out_list) {
+		o = shl_dlist_entry(iter, struct ctrl_out, list);
+		mem += sizeof(*o);
+		if (o->buf)
+			mem += o->len;
+	}
+
+	if (ctrl->dec)
+		mem += owfd_rtsp_decoder_get_memory(ctrl->dec);
+
+	if (ctrl->req_slots)
+		mem += (ctrl->req_mask + 1) * sizeof(struct ctrl_slot);
+	if (ctrl->uring_send)
+		mem += sizeof(*ctrl->uring_send);
+	mem += ctrl->req_num * sizeof(struct ctrl_req);
+	for (i = 0; i < OWFD_RTSP_METHOD_CNT; ++i)
+		if (ctrl->rtt[i])
+			mem += sizeof(*ctrl->rtt[i]);
+
+	return mem;
+}
+
+static int dispatch_ctrl(struct owfd_rtsp_ctrl *ctrl, uint32_t events)
 {
 	int r;
 
-	if (e->events & EPOLLIN) {
-		r = connect_done(ctrl);
+	if (events & (EPOLLIN | EPOLLRDHUP)) {
+		if (ctrl->timeout_ms && ctrl->wheel)
+			ctrl->last_rx = shl_wheel_time(ctrl->wheel);
+
+		r = ctrl_connect_done(ctrl);
 		if (r < 0)
 			return r;
-		r = recv_all(ctrl);
+		r = recv_all(ctrl, events & EPOLLRDHUP);
 		if (r < 0)
 			return r;
 	}
 
-	if (e->events & EPOLLOUT) {
-		r = connect_done(ctrl);
+	if (events & EPOLLOUT) {
+		r = ctrl_connect_done(ctrl);
 		if (r < 0)
 			return r;
 		r = send_all(ctrl);
@@ -301,7 +1702,7 @@ static int dispatch_ctrl(struct owfd_rtsp_ctrl *ctrl, struct epoll_event *e)
 			return r;
 	}
 
-	if (e->events & (EPOLLHUP | EPOLLERR))
+	if (events & (EPOLLHUP | EPOLLERR))
 		return -EPIPE;
 
 	return 0;
@@ -309,12 +1710,19 @@ static int dispatch_ctrl(struct owfd_rtsp_ctrl *ctrl, struct epoll_event *e)
 
 int owfd_rtsp_ctrl_dispatch(struct owfd_rtsp_ctrl *ctrl, int timeout)
 {
-	struct epoll_event evs[1];
+	struct epoll_event evs[CTRL_EVENTS];
 	const size_t max = sizeof(evs) / sizeof(*evs);
-	int n, r;
+	bool sock = false;
+	int i, n, r = 0;
 
 	if (!owfd_rtsp_ctrl_is_open(ctrl))
 		return -ENODEV;
+	if (ctrl->shared)
+		return -EOPNOTSUPP;
+
+	/* input left over from the last budget does not wait */
+	if (ctrl->rx_pending)
+		timeout = 0;
 
 	n = epoll_wait(ctrl->efd, evs, max, timeout);
 	if (n < 0) {
@@ -322,61 +1730,340 @@ int owfd_rtsp_ctrl_dispatch(struct owfd_rtsp_ctrl *ctrl, int timeout)
 			return 0;
 		else
 			return -errno;
-	} else if (!n) {
-		return 0;
 	} else if (n > max) {
 		n = max;
 	}
 
-	if (evs[0].data.ptr != &ctrl->fd)
-		return 0;
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+
+	for (i = 0; i < n && r >= 0; ++i) {
+		if (evs[i].data.ptr == &ctrl->uring) {
+			r = owfd_rtsp_uring_dispatch(ctrl->uring);
+			if (r >= 0 && !owfd_rtsp_ctrl_is_open(ctrl))
+				r = -EPIPE;
+		} else if (evs[i].data.ptr == &ctrl->wheel) {
+			r = shl_wheel_dispatch(ctrl->wheel);
+			if (r >= 0 && !owfd_rtsp_ctrl_is_open(ctrl))
+				r = -ENODEV;
+		} else if (evs[i].data.ptr == ctrl->tag) {
+			sock = true;
+			r = owfd_rtsp_ctrl_dispatch_events(ctrl,
+							   evs[i].events);
+		}
+	}
 
-	r = dispatch_ctrl(ctrl, evs);
+	if (r >= 0 && !sock && ctrl->rx_pending)
+		r = owfd_rtsp_ctrl_dispatch_events(ctrl, EPOLLIN);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	return r < 0 ? r : 0;
+}
+
+/*
+ * Handle the epoll events @events of the ctrl socket. On errors or hangups,
+ * the ctrl is closed and a negative error code is returned.
+ */
+int owfd_rtsp_ctrl_dispatch_events(struct owfd_rtsp_ctrl *ctrl,
+				   uint32_t events)
+{
+	int r;
+
+	if (!owfd_rtsp_ctrl_is_open(ctrl))
+		return -ENODEV;
+
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+
+	/* everything sent by callbacks goes out together afterwards */
+	owfd_rtsp_ctrl_cork(ctrl);
+	r = dispatch_ctrl(ctrl, events);
+	if (r >= 0)
+		r = owfd_rtsp_ctrl_uncork(ctrl);
+	else
+		--ctrl->corked;
 	if (r < 0)
 		owfd_rtsp_ctrl_close(ctrl);
 
+	owfd_rtsp_ctrl_unref(ctrl);
 	return r;
 }
 
-int owfd_rtsp_ctrl_send(struct owfd_rtsp_ctrl *ctrl,
-			const char *buf, size_t len)
+void owfd_rtsp_ctrl_set_error_cb(struct owfd_rtsp_ctrl *ctrl,
+				 owfd_rtsp_ctrl_error_cb cb)
 {
-	struct epoll_event ev;
-	bool empty;
+	ctrl->error_cb = cb;
+}
+
+/* report errors of ctrls on a shl_loop and pick up input left for later */
+static void loop_settle(struct owfd_rtsp_ctrl *ctrl, int r)
+{
+	if (r < 0) {
+		if (ctrl->error_cb)
+			ctrl->error_cb(ctrl, r, ctrl->data);
+	} else if (ctrl->rx_pending) {
+		shl_loop_defer_add(ctrl->loop, &ctrl->defer);
+	}
+}
+
+static void loop_io_fn(struct shl_loop_io *io, uint32_t events, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = data;
+
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+	loop_settle(ctrl, owfd_rtsp_ctrl_dispatch_events(ctrl, events));
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+
+/*
+ * In-memory pipes are always writable, so queued output goes out, too. Once
+ * the peer is gone, reads continue until the hangup is seen.
+ */
+static void loop_defer_fn(struct shl_loop_defer *d, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = data;
+	uint32_t events = EPOLLIN;
+
+	if (ctrl->mem)
+		events |= EPOLLOUT;
+	if (ctrl->mem && !ctrl->peer)
+		events |= EPOLLRDHUP;
+
+	owfd_rtsp_ctrl_ref(ctrl);
+	loop_settle(ctrl, owfd_rtsp_ctrl_dispatch_events(ctrl, events));
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+
+/* wait for EPOLLOUT once the queue becomes non-empty, unless corked */
+static int out_queued(struct owfd_rtsp_ctrl *ctrl)
+{
+	if (ctrl->corked)
+		return 0;
+	if (ctrl->uring)
+		return ctrl_uring_send(ctrl);
+	if ((ctrl->flags & OWFD_RTSP_CTRL_EDGE) || ctrl->mem)
+		return ctrl->connected && !ctrl->out_blocked ?
+							send_all(ctrl) : 0;
+
+	return out_arm(ctrl, true);
+}
+
+/* return the trailing copy entry, a new one is linked if needed */
+static struct ctrl_out *out_tail(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct ctrl_out *o;
+
+	if (!shl_dlist_empty(&ctrl->out_list)) {
+		o = shl_dlist_last_entry(&ctrl->out_list, struct ctrl_out,
+					 list);
+		if (!o->buf)
+			return o;
+	}
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return NULL;
+
+	shl_dlist_link_tail(&ctrl->out_list, &o->list);
+	return o;
+}
+
+/*
+ * If nothing is queued, try to send @vec right away. Returns the number of
+ * bytes sent. Errors are not reported here; the data is queued instead and
+ * the next dispatch notices the broken connection.
+ */
+static size_t out_direct(struct owfd_rtsp_ctrl *ctrl,
+			 const struct iovec *vec, size_t n)
+{
+	ssize_t l;
+
+	/* with io_uring, all sends of a dispatch are submitted together */
+	if (!ctrl->connected || ctrl->corked || ctrl->uring ||
+	    !shl_dlist_empty(&ctrl->out_list) || !n)
+		return 0;
+
+	l = out_sendmsg(ctrl, vec, n > CTRL_IOV_MAX ? CTRL_IOV_MAX : n,
+			false);
+	return l > 0 ? l : 0;
+}
+
+/*
+ * Send the data of @n iovecs in @vec as one message. If the output queue is
+ * empty, the data is written directly from the caller's buffers; whatever the
+ * socket does not take right away is copied into the queue. Only
+ * owfd_rtsp_ctrl_send_owned() never copies.
+ */
+int owfd_rtsp_ctrl_send_iov(struct owfd_rtsp_ctrl *ctrl,
+			    const struct iovec *vec, size_t n)
+{
+	struct ctrl_out *o;
+	size_t i, done, len;
 	int r;
 
 	if (!owfd_rtsp_ctrl_is_open(ctrl))
 		return -ENODEV;
 
-	empty = !shl_ring_peek(&ctrl->out_ring, NULL);
+	len = 0;
+	for (i = 0; i < n; ++i)
+		len += vec[i].iov_len;
 
-	r = shl_ring_push(&ctrl->out_ring, buf, len);
-	if (r >= 0 && empty) {
-		memset(&ev, 0, sizeof(ev));
-		ev.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT;
-		ev.data.ptr = &ctrl->fd;
+	done = out_direct(ctrl, vec, n);
+	if (done >= len)
+		return 0;
 
-		r = epoll_ctl(ctrl->efd, EPOLL_CTL_MOD, ctrl->fd, &ev);
-		if (r < 0)
-			r = -errno;
+	o = out_tail(ctrl);
+	if (!o)
+		return -ENOMEM;
+
+	/* queue the rest, starting in the middle of the first partial iovec */
+	r = shl_chain_pushv_skip(&ctrl->out, vec, n, done);
+	if (r < 0) {
+		if (!o->len)
+			out_free(o);
+		return r;
+	}
+
+	len -= done;
+	o->len += len;
+	out_grow(ctrl, len);
+	return out_queued(ctrl);
+}
+
+int owfd_rtsp_ctrl_send(struct owfd_rtsp_ctrl *ctrl,
+			const char *buf, size_t len)
+{
+	struct iovec vec = { (void*)buf, len };
+
+	return owfd_rtsp_ctrl_send_iov(ctrl, &vec, 1);
+}
+
+/* send the message assembled in @b, see owfd_rtsp_msg_builder_finish() */
+int owfd_rtsp_ctrl_send_msg(struct owfd_rtsp_ctrl *ctrl,
+			    struct owfd_rtsp_msg_builder *b)
+{
+	struct iovec *vec;
+	int n;
+
+	n = owfd_rtsp_msg_builder_finish(b, &vec);
+	if (n < 0)
+		return n;
+
+	n = owfd_rtsp_ctrl_send_iov(ctrl, vec, n);
+	if (n >= 0)
+		++ctrl->stats.msgs_sent;
+	return n;
+}
+
+/*
+ * Send @len bytes of @buf without copying them. The ctrl takes ownership of
+ * @buf and calls @free_fn (if not NULL) once it was sent or dropped. This
+ * also happens if the call fails.
+ */
+int owfd_rtsp_ctrl_send_owned(struct owfd_rtsp_ctrl *ctrl, void *buf,
+			      size_t len, void (*free_fn) (void *buf))
+{
+	struct iovec vec = { buf, len };
+	struct ctrl_out *o;
+	size_t done;
+	int r;
+
+	if (!owfd_rtsp_ctrl_is_open(ctrl)) {
+		r = -ENODEV;
+		goto err_free;
+	}
+
+	done = out_direct(ctrl, &vec, 1);
+	if (done >= len) {
+		r = 0;
+		goto err_free;
+	}
+
+	o = calloc(1, sizeof(*o));
+	if (!o) {
+		r = -ENOMEM;
+		goto err_free;
 	}
 
+	o->buf = buf;
+	o->pos = (char*)buf + done;
+	o->len = len - done;
+	o->free_fn = free_fn;
+	out_grow(ctrl, o->len);
+
+	shl_dlist_link_tail(&ctrl->out_list, &o->list);
+	return out_queued(ctrl);
+
+err_free:
+	if (free_fn)
+		free_fn(buf);
 	return r;
 }
 
+/*
+ * The message is formatted straight into the output queue: first into the
+ * free space of its last segment and, if that is too small, once more into
+ * contiguous space of the exact size. If the queue was empty, it is then
+ * written right away.
+ */
 int owfd_rtsp_ctrl_vsendf(struct owfd_rtsp_ctrl *ctrl,
 			  const char *format, va_list args)
 {
-	int r;
+	struct iovec vec;
+	struct ctrl_out *o;
+	va_list copy;
+	bool empty;
 	char *buf;
+	int r, l;
 
-	r = vasprintf(&buf, format, args);
-	if (r < 0)
+	if (!owfd_rtsp_ctrl_is_open(ctrl))
+		return -ENODEV;
+
+	empty = shl_dlist_empty(&ctrl->out_list);
+	o = out_tail(ctrl);
+	if (!o)
 		return -ENOMEM;
 
-	r = owfd_rtsp_ctrl_send(ctrl, buf, (size_t)r);
-	free(buf);
+	r = shl_chain_reserve(&ctrl->out, 1, &vec, 1);
+	if (r < 0)
+		goto err_out;
+
+	va_copy(copy, args);
+	l = vsnprintf(vec.iov_base, vec.iov_len, format, copy);
+	va_end(copy);
+	if (l < 0) {
+		r = -EINVAL;
+		goto err_out;
+	}
+
+	if ((size_t)l >= vec.iov_len) {
+		buf = shl_chain_reserve_contig(&ctrl->out, (size_t)l + 1);
+		if (!buf) {
+			r = -ENOMEM;
+			goto err_out;
+		}
+		vsnprintf(buf, (size_t)l + 1, format, args);
+	}
+
+	shl_chain_commit(&ctrl->out, l);
+	o->len += l;
+	out_grow(ctrl, l);
+	if (!o->len) {
+		out_free(o);
+		return 0;
+	}
+
+	/* errors show up on the next dispatch, see out_direct() */
+	if (empty && ctrl->connected && !ctrl->corked &&
+	    send_all(ctrl) >= 0)
+		return 0;
+
+	return out_queued(ctrl);
 
+err_out:
+	if (!o->len)
+		out_free(o);
 	return r;
 }
 
@@ -32,6 +32,11 @@
 #include "shl_ring.h"
 #include "rtsp.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define SCAN_X86 1
+#endif
+
 enum state {
 	STATE_NEW,
 	STATE_HEADER,
@@ -40,20 +45,143 @@ enum state {
 	STATE_BODY,
 };
 
+/* longest line we still look at while discarding a message */
+#define DISCARD_LINE_MAX 128
+
+/* bytes kept of longer lines, enough for a squeezed content-length */
+#define DISCARD_KEEP 64
+
 struct owfd_rtsp_decoder {
 	void *data;
 	owfd_rtsp_decoder_cb cb;
+	owfd_rtsp_decoder_cb head_cb;
+	owfd_rtsp_decoder_body_cb body_cb;
+	owfd_rtsp_decoder_cb end_cb;
 
 	struct shl_ring ring;
 	unsigned int state;
 	char last_chr;
 	size_t remaining_body;
 	unsigned int quoted : 1;
+	unsigned int stream : 1;
+	unsigned int head_done : 1;
+	unsigned int discard : 1;
+	unsigned int discard_trunc : 1;
+	unsigned int limit_hit : 1;
+
+	struct owfd_rtsp_decoder_limits limits;
+	size_t msg_bytes;
 
+	/* what is kept of an overlong line while discarding */
+	char discard_line[DISCARD_KEEP + 1];
+	size_t discard_len;
+
+	unsigned int flags;
 	size_t header_size;
 	struct owfd_rtsp_msg msg;
+
+	/* message buffer for OWFD_RTSP_DECODER_SPANS */
+	char *mbuf;
+	size_t mbuf_size;
+	size_t mbuf_len;
 };
 
+static void msg_reset(struct owfd_rtsp_decoder *dec);
+
+/*
+ * Delimiter Scanning
+ * scan_delim() returns the index of the first byte in @buf that matches any of
+ * the 4 bytes in @set, or @len if there is none. Sets with less than 4
+ * delimiters simply repeat one of them. Vectorized variants are selected at
+ * runtime, the scalar variant is used on all other machines.
+ */
+
+typedef size_t (*scan_fn) (const char *buf, size_t len, const char *set);
+
+static size_t scan_scalar(const char *buf, size_t len, const char *set)
+{
+	size_t i;
+	char c;
+
+	for (i = 0; i < len; ++i) {
+		c = buf[i];
+		if (c == set[0] || c == set[1] || c == set[2] || c == set[3])
+			return i;
+	}
+
+	return len;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *buf, size_t len, const char *set)
+{
+	__m128i s0, s1, s2, s3, v, m;
+	unsigned int mask;
+	size_t i;
+
+	s0 = _mm_set1_epi8(set[0]);
+	s1 = _mm_set1_epi8(set[1]);
+	s2 = _mm_set1_epi8(set[2]);
+	s3 = _mm_set1_epi8(set[3]);
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i*)&buf[i]);
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, s0),
+					      _mm_cmpeq_epi8(v, s1)),
+				 _mm_or_si128(_mm_cmpeq_epi8(v, s2),
+					      _mm_cmpeq_epi8(v, s3)));
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scan_scalar(&buf[i], len - i, set);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, const char *set)
+{
+	__m256i s0, s1, s2, s3, v, m;
+	unsigned int mask;
+	size_t i;
+
+	s0 = _mm256_set1_epi8(set[0]);
+	s1 = _mm256_set1_epi8(set[1]);
+	s2 = _mm256_set1_epi8(set[2]);
+	s3 = _mm256_set1_epi8(set[3]);
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i*)&buf[i]);
+		m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, s0),
+						    _mm256_cmpeq_epi8(v, s1)),
+				    _mm256_or_si256(_mm256_cmpeq_epi8(v, s2),
+						    _mm256_cmpeq_epi8(v, s3)));
+		mask = _mm256_movemask_epi8(m);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scan_sse2(&buf[i], len - i, set);
+}
+
+#endif /* SCAN_X86 */
+
+static scan_fn scan_delim = scan_scalar;
+
+/* runs at load time, so decoders can be created from any thread */
+static void __attribute__((constructor)) scan_init(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan_delim = scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan_delim = scan_sse2;
+#endif
+}
+
 int owfd_rtsp_decoder_new(struct owfd_rtsp_decoder **out,
 			  owfd_rtsp_decoder_cb cb)
 {
@@ -90,17 +218,14 @@ err_dec:
 
 void owfd_rtsp_decoder_free(struct owfd_rtsp_decoder *dec)
 {
-	size_t i;
-
 	if (!dec)
 		return;
 
-	for (i = 0; i < dec->msg.header_num; ++i)
-		free(dec->msg.header[i]);
+	msg_reset(dec);
 
 	free(dec->msg.header);
 	free(dec->msg.header_len);
-	free(dec->msg.body);
+	free(dec->mbuf);
 
 	shl_ring_clear(&dec->ring);
 	free(dec);
@@ -116,32 +241,257 @@ void *owfd_rtsp_decoder_get_data(struct owfd_rtsp_decoder *dec)
 	return dec->data;
 }
 
+/*
+ * By default, each header line and the body are delivered as separately
+ * allocated strings. With OWFD_RTSP_DECODER_SPANS, the decoder instead
+ * assembles the whole message in a single buffer that it owns and reuses for
+ * all following messages. @header[i] and @body then point into this buffer
+ * (still zero-terminated) and are only valid during the callback. No
+ * allocations are done per line or body in this mode.
+ * OWFD_RTSP_DECODER_MIRROR backs the input ring with a mirrored mapping (see
+ * shl_ring_mirror()) so buffered data never has to be glued back together.
+ * Changing flags drops any partially parsed message.
+ */
+void owfd_rtsp_decoder_set_flags(struct owfd_rtsp_decoder *dec,
+				 unsigned int flags)
+{
+	owfd_rtsp_decoder_flush(dec);
+	dec->flags = flags;
+
+	/* falls back to a normal ring if memfds are not supported */
+	if (flags & OWFD_RTSP_DECODER_MIRROR)
+		shl_ring_mirror(&dec->ring);
+}
+
+unsigned int owfd_rtsp_decoder_get_flags(struct owfd_rtsp_decoder *dec)
+{
+	return dec->flags;
+}
+
+/*
+ * Limits: Each decoder can limit the length of a single header line
+ * (@max_line, including continuation lines and the line terminator), the
+ * number of lines including the start line (@max_headers), the size of the
+ * body (@max_body) and the overall message size (@max_msg, headers plus body).
+ * Limits are enforced while data arrives; a Content-Length that exceeds
+ * @max_body or @max_msg is rejected before any body data is read.
+ * If a message violates a limit, it is not delivered and the rest of it is
+ * skipped without buffering. owfd_rtsp_decoder_feed() returns -EMSGSIZE in
+ * that case, but the decoder stays usable and continues with the next
+ * message. Pass NULL to remove all limits.
+ */
+void owfd_rtsp_decoder_set_limits(struct owfd_rtsp_decoder *dec,
+			const struct owfd_rtsp_decoder_limits *limits)
+{
+	if (limits)
+		dec->limits = *limits;
+	else
+		memset(&dec->limits, 0, sizeof(dec->limits));
+}
+
+void owfd_rtsp_decoder_get_limits(struct owfd_rtsp_decoder *dec,
+				  struct owfd_rtsp_decoder_limits *limits)
+{
+	*limits = dec->limits;
+}
+
+/* approximate number of bytes allocated for @dec and its buffers */
+size_t owfd_rtsp_decoder_get_memory(struct owfd_rtsp_decoder *dec)
+{
+	return sizeof(*dec) + dec->ring.size + dec->mbuf_size +
+	       dec->header_size * (sizeof(char*) + sizeof(size_t));
+}
+
+/*
+ * Streaming mode: If any of the callbacks is set, messages are no longer
+ * delivered as a whole via the main callback. Instead, @head_cb is called once
+ * all headers are parsed (@body_len is set to the announced content-length,
+ * @body is NULL), @body_cb is called for each chunk of body data and @end_cb
+ * once the message is complete. Body chunks point into the buffer passed to
+ * owfd_rtsp_decoder_feed() (or into the decoder) and are only valid during
+ * the callback. Body data is never buffered, so memory usage is bounded by
+ * the size of the fed buffers rather than the size of the body.
+ * Pass NULL for all callbacks to disable streaming again. Any partially
+ * parsed message is dropped.
+ */
+void owfd_rtsp_decoder_set_stream(struct owfd_rtsp_decoder *dec,
+				  owfd_rtsp_decoder_cb head_cb,
+				  owfd_rtsp_decoder_body_cb body_cb,
+				  owfd_rtsp_decoder_cb end_cb)
+{
+	owfd_rtsp_decoder_flush(dec);
+	dec->head_cb = head_cb;
+	dec->body_cb = body_cb;
+	dec->end_cb = end_cb;
+	dec->stream = head_cb || body_cb || end_cb;
+}
+
 void owfd_rtsp_decoder_flush(struct owfd_rtsp_decoder *dec)
 {
 	shl_ring_flush(&dec->ring);
 	dec->state = STATE_NEW;
 	dec->last_chr = 0;
 	dec->remaining_body = 0;
+	dec->discard = 0;
+	dec->discard_trunc = 0;
+	dec->limit_hit = 0;
+	msg_reset(dec);
 }
 
-static void msg_done(struct owfd_rtsp_decoder *dec)
+static void msg_reset(struct owfd_rtsp_decoder *dec)
 {
+	bool spans = dec->flags & OWFD_RTSP_DECODER_SPANS;
 	size_t i;
 
-	if (dec->cb)
-		dec->cb(dec, &dec->msg, dec->data);
-
 	for (i = 0; i < dec->msg.header_num; ++i) {
-		free(dec->msg.header[i]);
+		if (!spans)
+			free(dec->msg.header[i]);
 		dec->msg.header[i] = NULL;
 		dec->msg.header_len[i] = 0;
 	}
 
 	dec->msg.header_num = 0;
-
-	free(dec->msg.body);
+	memset(dec->msg.known, 0, sizeof(dec->msg.known));
+	dec->msg.cseq = 0;
+	dec->msg.type = OWFD_RTSP_MSG_UNKNOWN;
+	dec->msg.method = OWFD_RTSP_METHOD_UNKNOWN;
+	dec->msg.status = 0;
+	dec->msg.major = 0;
+	dec->msg.minor = 0;
+	dec->msg.uri = 0;
+	dec->msg.uri_len = 0;
+	dec->msg.phrase = 0;
+
+	if (!spans)
+		free(dec->msg.body);
 	dec->msg.body = NULL;
 	dec->msg.body_len = 0;
+
+	dec->mbuf_len = 0;
+	dec->msg_bytes = 0;
+	dec->head_done = 0;
+}
+
+/*
+ * Drop the current message because it violates a limit. Framing continues as
+ * usual, but nothing is stored until the message is complete.
+ */
+static void msg_discard(struct owfd_rtsp_decoder *dec)
+{
+	msg_reset(dec);
+	dec->discard = 1;
+	dec->discard_trunc = 0;
+	dec->limit_hit = 1;
+}
+
+/*
+ * In span-mode, header lines are stored back-to-back in the message buffer,
+ * each terminated by a binary zero and followed by the body. We only store
+ * lengths while parsing (the buffer might get reallocated) and compute the
+ * pointers right before the message is delivered.
+ */
+static void msg_finalize(struct owfd_rtsp_decoder *dec)
+{
+	char *p;
+	size_t i;
+
+	if (!(dec->flags & OWFD_RTSP_DECODER_SPANS))
+		return;
+
+	p = dec->mbuf;
+	for (i = 0; i < dec->msg.header_num; ++i) {
+		dec->msg.header[i] = p;
+		p += dec->msg.header_len[i] + 1;
+	}
+
+	if (dec->msg.body_len)
+		dec->msg.body = p;
+}
+
+/* called in streaming mode once all headers are parsed */
+static void msg_head(struct owfd_rtsp_decoder *dec)
+{
+	if (!dec->stream || dec->head_done || dec->discard)
+		return;
+
+	dec->head_done = 1;
+	msg_finalize(dec);
+	dec->msg.body_len = dec->remaining_body;
+
+	if (dec->head_cb)
+		dec->head_cb(dec, &dec->msg, dec->data);
+}
+
+static void msg_done(struct owfd_rtsp_decoder *dec)
+{
+	if (dec->discard) {
+		dec->discard = 0;
+		dec->discard_trunc = 0;
+	} else if (dec->stream) {
+		msg_head(dec);
+		if (dec->end_cb)
+			dec->end_cb(dec, &dec->msg, dec->data);
+	} else {
+		msg_finalize(dec);
+		if (dec->cb)
+			dec->cb(dec, &dec->msg, dec->data);
+	}
+
+	msg_reset(dec);
+}
+
+static void msg_body(struct owfd_rtsp_decoder *dec, const char *buf,
+		     size_t len)
+{
+	if (dec->body_cb && !dec->discard)
+		dec->body_cb(dec, &dec->msg, buf, len, dec->data);
+}
+
+/*
+ * Make sure the message buffer has room for @add more bytes. The buffer is
+ * never shrunk so it can be reused for all following messages.
+ */
+static int mbuf_grow(struct owfd_rtsp_decoder *dec, size_t add)
+{
+	char *buf;
+	size_t n;
+
+	if (dec->mbuf_size - dec->mbuf_len >= add)
+		return 0;
+
+	n = dec->mbuf_size ? dec->mbuf_size : 1024;
+	while (n - dec->mbuf_len < add) {
+		if (n * 2 < n)
+			return -ENOMEM;
+		n *= 2;
+	}
+
+	buf = realloc(dec->mbuf, n);
+	if (!buf)
+		return -ENOMEM;
+
+	dec->mbuf = buf;
+	dec->mbuf_size = n;
+
+	return 0;
+}
+
+/* copy the first @len bytes of the ring-buffer into @dst */
+static void ring_read(struct owfd_rtsp_decoder *dec, char *dst, size_t len)
+{
+	struct iovec vec[2];
+	size_t n, l;
+
+	n = shl_ring_peek(&dec->ring, vec);
+	if (n > 0) {
+		l = vec[0].iov_len < len ? vec[0].iov_len : len;
+		memcpy(dst, vec[0].iov_base, l);
+		dst += l;
+		len -= l;
+	}
+
+	if (n > 1 && len > 0)
+		memcpy(dst, vec[1].iov_base, len);
 }
 
 static int push_header_line(struct owfd_rtsp_decoder *dec, char *line,
@@ -246,27 +596,392 @@ static size_t sanitize_header_line(struct owfd_rtsp_decoder *dec,
 	return dst - line;
 }
 
+/*
+ * Well-known Headers
+ * Header names are classified via a perfect hash over the name length and its
+ * first and last character. Each slot holds at most one name, which is then
+ * verified with a single strncasecmp(). The hash parameters were chosen so
+ * all names below map to distinct slots; keep it that way when adding names
+ * (the test-suite checks that each name is found again).
+ */
+
+#define HEADER_HASH(_len, _first, _last) \
+	(((_len) * 2 + ((_first) | 0x20) * 5 + ((_last) | 0x20)) & 31)
+
+static const struct {
+	const char *name;
+	size_t len;
+	unsigned int id;
+} header_table[32] = {
+#define HEADER_ENTRY(_name, _first, _last, _id) \
+	[HEADER_HASH(sizeof(_name) - 1, _first, _last)] = \
+		{ _name, sizeof(_name) - 1, OWFD_RTSP_HEADER_ ## _id }
+	HEADER_ENTRY("accept", 'a', 't', ACCEPT),
+	HEADER_ENTRY("allow", 'a', 'w', ALLOW),
+	HEADER_ENTRY("content-encoding", 'c', 'g', CONTENT_ENCODING),
+	HEADER_ENTRY("content-length", 'c', 'h', CONTENT_LENGTH),
+	HEADER_ENTRY("content-type", 'c', 'e', CONTENT_TYPE),
+	HEADER_ENTRY("cseq", 'c', 'q', CSEQ),
+	HEADER_ENTRY("date", 'd', 'e', DATE),
+	HEADER_ENTRY("public", 'p', 'c', PUBLIC),
+	HEADER_ENTRY("range", 'r', 'e', RANGE),
+	HEADER_ENTRY("require", 'r', 'e', REQUIRE),
+	HEADER_ENTRY("rtp-info", 'r', 'o', RTP_INFO),
+	HEADER_ENTRY("server", 's', 'r', SERVER),
+	HEADER_ENTRY("session", 's', 'n', SESSION),
+	HEADER_ENTRY("transport", 't', 't', TRANSPORT),
+	HEADER_ENTRY("unsupported", 'u', 'd', UNSUPPORTED),
+	HEADER_ENTRY("user-agent", 'u', 't', USER_AGENT),
+	HEADER_ENTRY("www-authenticate", 'w', 'e', WWW_AUTHENTICATE),
+#undef HEADER_ENTRY
+};
+
+unsigned int owfd_rtsp_header_lookup(const char *name, size_t len)
+{
+	unsigned int h;
+
+	if (!len)
+		return OWFD_RTSP_HEADER_UNKNOWN;
+
+	h = HEADER_HASH(len, name[0], name[len - 1]);
+	if (header_table[h].len != len ||
+	    strncasecmp(header_table[h].name, name, len))
+		return OWFD_RTSP_HEADER_UNKNOWN;
+
+	return header_table[h].id;
+}
+
+/*
+ * Return the value of the well-known header @id of @msg or NULL if the
+ * message has no such header. If a header is given multiple times, the first
+ * occurrence is returned. @len is set to the length of the value.
+ */
+const char *owfd_rtsp_msg_get_header(const struct owfd_rtsp_msg *msg,
+				     unsigned int id, size_t *len)
+{
+	const struct owfd_rtsp_header_pos *pos;
+
+	if (id <= OWFD_RTSP_HEADER_UNKNOWN || id >= OWFD_RTSP_HEADER_CNT)
+		return NULL;
+
+	pos = &msg->known[id];
+	if (!pos->line)
+		return NULL;
+
+	if (len)
+		*len = msg->header_len[pos->line - 1] - pos->value;
+
+	return msg->header[pos->line - 1] + pos->value;
+}
+
+/*
+ * Start Line
+ * The first line of each message is either a request line
+ * ("METHOD URI RTSP/1.0") or a status line ("RTSP/1.0 200 OK"). It is parsed
+ * right when it is complete. Messages with unparseable start lines are still
+ * delivered with @type set to OWFD_RTSP_MSG_UNKNOWN so callers can reply with
+ * an error.
+ */
+
+static const struct {
+	const char *name;
+	size_t len;
+} method_table[OWFD_RTSP_METHOD_CNT] = {
+#define METHOD_ENTRY(_name) \
+	[OWFD_RTSP_METHOD_ ## _name] = { #_name, sizeof(#_name) - 1 }
+	METHOD_ENTRY(ANNOUNCE),
+	METHOD_ENTRY(DESCRIBE),
+	METHOD_ENTRY(GET_PARAMETER),
+	METHOD_ENTRY(OPTIONS),
+	METHOD_ENTRY(PAUSE),
+	METHOD_ENTRY(PLAY),
+	METHOD_ENTRY(RECORD),
+	METHOD_ENTRY(REDIRECT),
+	METHOD_ENTRY(SET_PARAMETER),
+	METHOD_ENTRY(SETUP),
+	METHOD_ENTRY(TEARDOWN),
+#undef METHOD_ENTRY
+};
+
+/* methods are case-sensitive */
+unsigned int owfd_rtsp_method_lookup(const char *name, size_t len)
+{
+	unsigned int i;
+
+	for (i = 1; i < OWFD_RTSP_METHOD_CNT; ++i) {
+		if (method_table[i].len == len &&
+		    !memcmp(method_table[i].name, name, len))
+			return i;
+	}
+
+	return OWFD_RTSP_METHOD_UNKNOWN;
+}
+
+const char *owfd_rtsp_method_name(unsigned int method)
+{
+	if (method <= OWFD_RTSP_METHOD_UNKNOWN ||
+	    method >= OWFD_RTSP_METHOD_CNT)
+		return NULL;
+
+	return method_table[method].name;
+}
+
+/* parse "RTSP/<major>.<minor>" and return pointer behind it or NULL */
+static const char *parse_version(const char *s, unsigned int *major,
+				 unsigned int *minor)
+{
+	char *e;
+
+	if (strncmp(s, "RTSP/", 5) || s[5] < '0' || s[5] > '9')
+		return NULL;
+
+	*major = strtoul(&s[5], &e, 10);
+	if (*e != '.' || e[1] < '0' || e[1] > '9')
+		return NULL;
+
+	*minor = strtoul(&e[1], &e, 10);
+	return e;
+}
+
+static void parse_start_line(struct owfd_rtsp_msg *msg, const char *line)
+{
+	unsigned int major, minor, status;
+	const char *c, *e;
+
+	c = parse_version(line, &major, &minor);
+	if (c) {
+		/* status line: three digits followed by optional phrase */
+		if (*c != ' ' || c[1] < '1' || c[1] > '9' ||
+		    c[2] < '0' || c[2] > '9' || c[3] < '0' || c[3] > '9' ||
+		    (c[4] && c[4] != ' '))
+			return;
+
+		status = (c[1] - '0') * 100 + (c[2] - '0') * 10 + c[3] - '0';
+		c += 4;
+		if (*c)
+			++c;
+
+		msg->type = OWFD_RTSP_MSG_RESPONSE;
+		msg->status = status;
+		msg->phrase = c - line;
+	} else {
+		/* request line: method SP uri SP version */
+		c = strchr(line, ' ');
+		if (!c || c == line)
+			return;
+
+		e = strchr(c + 1, ' ');
+		if (!e || e == c + 1)
+			return;
+
+		if (parse_version(e + 1, &major, &minor) != line + strlen(line))
+			return;
+
+		msg->type = OWFD_RTSP_MSG_REQUEST;
+		msg->method = owfd_rtsp_method_lookup(line, c - line);
+		msg->uri = c + 1 - line;
+		msg->uri_len = e - c - 1;
+	}
+
+	msg->major = major;
+	msg->minor = minor;
+}
+
+/* classify header line @line (sanitized) and remember its position */
+static void index_header_line(struct owfd_rtsp_decoder *dec, char *line)
+{
+	struct owfd_rtsp_header_pos *pos;
+	unsigned int id;
+	size_t n, v;
+	char *c, *e;
+
+	/* the first line is the request/status line, not a header */
+	if (!dec->msg.header_num) {
+		parse_start_line(&dec->msg, line);
+		return;
+	}
+
+	c = strchr(line, ':');
+	if (!c)
+		return;
+
+	v = c - line + 1;
+	n = c - line;
+	if (n > 0 && line[n - 1] == ' ')
+		--n;
+
+	id = owfd_rtsp_header_lookup(line, n);
+	if (id == OWFD_RTSP_HEADER_UNKNOWN)
+		return;
+
+	pos = &dec->msg.known[id];
+	if (pos->line)
+		return;
+
+	/* whitespace is collapsed during sanitizing, so skip at most one */
+	if (line[v] == ' ')
+		++v;
+
+	pos->line = dec->msg.header_num + 1;
+	pos->value = v;
+
+	/* CSeq stays 0 if it cannot be parsed; callers see the raw value */
+	if (id == OWFD_RTSP_HEADER_CSEQ) {
+		dec->msg.cseq = strtoul(&line[v], &e, 10);
+		if (e == &line[v] || *e)
+			dec->msg.cseq = 0;
+	}
+}
+
+/* returns 1 if @line is a valid content-length header, 0 if not, <0 on error */
+static int parse_content_length(const char *line, unsigned long *out)
+{
+	char *e;
+
+	if (strncasecmp(line, "content-length:", 15))
+		return 0;
+
+	*out = strtoul(&line[15], &e, 10);
+	if (!line[15] || *e)
+		return -EINVAL;
+
+	return 1;
+}
+
+/*
+ * Parse header line @line which took @rlen raw bytes. Returns -EMSGSIZE if
+ * the line makes the message exceed any limit.
+ */
 static int parse_header_line(struct owfd_rtsp_decoder *dec,
-			     char *line)
+			     char *line, size_t rlen)
 {
+	const struct owfd_rtsp_decoder_limits *lim = &dec->limits;
 	unsigned long l;
-	char *e;
+	int r;
 
-	if (!strncasecmp(line, "content-length:", 15)) {
-		l = strtoul(&line[15], &e, 10);
-		if (!line[15] || *e)
-			return -EINVAL;
+	index_header_line(dec, line);
 
+	r = parse_content_length(line, &l);
+	if (r < 0)
+		return r;
+
+	if (r > 0) {
 		if (dec->remaining_body && dec->remaining_body != l)
 			return -EINVAL;
 
 		dec->remaining_body = l;
 	}
 
+	dec->msg_bytes += rlen;
+
+	if (lim->max_headers && dec->msg.header_num >= lim->max_headers)
+		return -EMSGSIZE;
+	if (lim->max_body && dec->remaining_body > lim->max_body)
+		return -EMSGSIZE;
+	if (lim->max_msg && (dec->msg_bytes > lim->max_msg ||
+			     dec->remaining_body > lim->max_msg -
+						   dec->msg_bytes))
+		return -EMSGSIZE;
+
 	return 0;
 }
 
-static int finish_header_line(struct owfd_rtsp_decoder *dec, size_t rlen)
+/*
+ * Overlong lines of a discarded message are dropped piece by piece, but a
+ * content-length hidden in them must still be seen. So only a squeezed form
+ * is kept: whitespace and line breaks are dropped, and so are leading zeros
+ * of the value. If even that does not fit, the line is no content-length of
+ * any sane size and is marked unusable.
+ */
+static void discard_keep(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	struct iovec vec[2];
+	size_t n, i, j, l;
+	const char *p;
+	char c, *line = dec->discard_line;
+
+	n = shl_ring_peek(&dec->ring, vec);
+	for (i = 0; i < n && rlen; ++i) {
+		p = vec[i].iov_base;
+		l = vec[i].iov_len < rlen ? vec[i].iov_len : rlen;
+		rlen -= l;
+
+		for (j = 0; j < l && dec->discard_len <= DISCARD_KEEP; ++j) {
+			c = p[j];
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+			    c == '\0')
+				continue;
+
+			/* a single leading zero is replaced by the next digit */
+			if (dec->discard_len >= 2 &&
+			    line[dec->discard_len - 1] == '0' &&
+			    line[dec->discard_len - 2] == ':' &&
+			    c >= '0' && c <= '9')
+				--dec->discard_len;
+
+			if (dec->discard_len < DISCARD_KEEP)
+				line[dec->discard_len] = c;
+			++dec->discard_len;
+		}
+	}
+}
+
+/*
+ * While discarding, lines are only checked for the content-length so we know
+ * how much body to skip. Overlong lines were squeezed by discard_keep().
+ */
+static void discard_header_line(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	char line[DISCARD_LINE_MAX + 1];
+	unsigned long l;
+
+	if (dec->discard_trunc) {
+		discard_keep(dec, rlen);
+		if (dec->discard_len <= DISCARD_KEEP) {
+			dec->discard_line[dec->discard_len] = 0;
+			if (parse_content_length(dec->discard_line, &l) > 0)
+				dec->remaining_body = l;
+		}
+	} else if (rlen <= DISCARD_LINE_MAX) {
+		ring_read(dec, line, rlen);
+		sanitize_header_line(dec, line, rlen);
+		if (parse_content_length(line, &l) > 0)
+			dec->remaining_body = l;
+	}
+
+	shl_ring_pull(&dec->ring, rlen);
+	dec->discard_trunc = 0;
+}
+
+static int finish_header_span(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	char *line;
+	size_t l;
+	int r;
+
+	/* +1 for terminating zero */
+	r = mbuf_grow(dec, rlen + 1);
+	if (r < 0)
+		return r;
+
+	line = &dec->mbuf[dec->mbuf_len];
+	ring_read(dec, line, rlen);
+	shl_ring_pull(&dec->ring, rlen);
+
+	l = sanitize_header_line(dec, line, rlen);
+	r = parse_header_line(dec, line, rlen);
+	if (r < 0)
+		return r;
+
+	r = push_header_line(dec, NULL, l);
+	if (r < 0)
+		return r;
+
+	dec->mbuf_len += l + 1;
+	return 0;
+}
+
+static int finish_header_copy(struct owfd_rtsp_decoder *dec, size_t rlen)
 {
 	char *line;
 	size_t l;
@@ -280,7 +995,7 @@ static int finish_header_line(struct owfd_rtsp_decoder *dec, size_t rlen)
 	shl_ring_pull(&dec->ring, rlen);
 
 	l = sanitize_header_line(dec, line, l);
-	r = parse_header_line(dec, line);
+	r = parse_header_line(dec, line, rlen);
 	if (r < 0) {
 		free(line);
 		return r;
@@ -295,6 +1010,29 @@ static int finish_header_line(struct owfd_rtsp_decoder *dec, size_t rlen)
 	return 0;
 }
 
+static int finish_header_line(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	int r;
+
+	if (dec->discard) {
+		discard_header_line(dec, rlen);
+		return 0;
+	}
+
+	if (dec->flags & OWFD_RTSP_DECODER_SPANS)
+		r = finish_header_span(dec, rlen);
+	else
+		r = finish_header_copy(dec, rlen);
+
+	/* the line has been consumed already, skip the rest of the message */
+	if (r == -EMSGSIZE) {
+		msg_discard(dec);
+		r = 0;
+	}
+
+	return r;
+}
+
 static ssize_t feed_char_new(struct owfd_rtsp_decoder *dec,
 			     char ch, size_t rlen)
 {
@@ -350,6 +1088,8 @@ static ssize_t feed_char_header(struct owfd_rtsp_decoder *dec,
 			/* No remaining body. Finish message! */
 			if (!dec->remaining_body)
 				msg_done(dec);
+			else
+				msg_head(dec);
 
 			++rlen;
 		} else {
@@ -377,6 +1117,8 @@ static ssize_t feed_char_header(struct owfd_rtsp_decoder *dec,
 			if (!dec->remaining_body) {
 				dec->state = STATE_NEW;
 				msg_done(dec);
+			} else {
+				msg_head(dec);
 			}
 
 			/* discard \n */
@@ -461,11 +1203,40 @@ static ssize_t feed_char_header_quote(struct owfd_rtsp_decoder *dec,
 	return rlen;
 }
 
+static int finish_body(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	char *body;
+	size_t l;
+	int r;
+
+	if (dec->flags & OWFD_RTSP_DECODER_SPANS) {
+		r = mbuf_grow(dec, rlen + 1);
+		if (r < 0)
+			return r;
+
+		body = &dec->mbuf[dec->mbuf_len];
+		ring_read(dec, body, rlen);
+		body[rlen] = 0;
+
+		dec->mbuf_len += rlen + 1;
+		dec->msg.body_len = rlen;
+	} else {
+		l = rlen;
+		body = shl_ring_copy(&dec->ring, &l);
+		if (!body)
+			return -ENOMEM;
+
+		dec->msg.body = body;
+		dec->msg.body_len = l;
+	}
+
+	return 0;
+}
+
 static ssize_t feed_char_body(struct owfd_rtsp_decoder *dec,
 			      char ch, size_t rlen)
 {
-	char *line;
-	size_t l;
+	int r;
 
 	/* If remaining_body was already 0, the message had no body. Note that
 	 * messages without body are finished early, so no need to call
@@ -476,17 +1247,26 @@ static ssize_t feed_char_body(struct owfd_rtsp_decoder *dec,
 		return feed_char_new(dec, ch, rlen);
 	}
 
+	/* in streaming mode, pass the body through without buffering it */
+	if (dec->stream || dec->discard) {
+		msg_body(dec, &ch, 1);
+		shl_ring_pull(&dec->ring, rlen + 1);
+		if (!--dec->remaining_body) {
+			msg_done(dec);
+			dec->state = STATE_NEW;
+		}
+
+		return 0;
+	}
+
 	/* *any* character is allowed as body */
 	++rlen;
 	if (!--dec->remaining_body) {
 		/* full body received, copy it and go to STATE_NEW */
-		l = (size_t)rlen;
-		line = shl_ring_copy(&dec->ring, &l);
-		if (!line)
-			return -ENOMEM;
+		r = finish_body(dec, rlen);
+		if (r < 0)
+			return r;
 
-		dec->msg.body = line;
-		dec->msg.body_len = l;
 		msg_done(dec);
 
 		dec->state = STATE_NEW;
@@ -553,33 +1333,252 @@ static ssize_t feed_char(struct owfd_rtsp_decoder *dec, char ch, size_t rlen)
 	return r;
 }
 
-int owfd_rtsp_decoder_feed(struct owfd_rtsp_decoder *dec,
-			   const char *buf, size_t len)
+/* bodies that are passed to the callback instead of being buffered */
+static bool body_direct(struct owfd_rtsp_decoder *dec)
+{
+	return dec->state == STATE_BODY && (dec->stream || dec->discard) &&
+	       dec->remaining_body;
+}
+
+/* pass up to @len bytes of body at @buf through, returns the bytes taken */
+static size_t body_pass(struct owfd_rtsp_decoder *dec, const char *buf,
+			size_t len)
 {
-	size_t rlen, i;
+	size_t n;
+
+	n = dec->remaining_body;
+	if (n > len)
+		n = len;
+
+	dec->last_chr = buf[n - 1];
+	dec->remaining_body -= n;
+	msg_body(dec, buf, n);
+
+	if (!dec->remaining_body) {
+		msg_done(dec);
+		dec->state = STATE_NEW;
+	}
+
+	return n;
+}
+
+/*
+ * Fast-path for runs of bytes that cannot change the parser state. This
+ * consumes plain header text up to the next delimiter and body data up to the
+ * last byte of the body (which is left for feed_char_body() to finish the
+ * message). In streaming mode, body data is passed through directly. The
+ * result is exactly what feeding each byte through feed_char() would produce.
+ * Returns the number of bytes consumed, which is 0 if @buf[0] has to go
+ * through feed_char().
+ */
+static size_t feed_run(struct owfd_rtsp_decoder *dec, const char *buf,
+		       size_t len, size_t *rlen)
+{
+	size_t n;
+
+	switch (dec->state) {
+	case STATE_HEADER:
+		/* any character after a new-line may end the header-line */
+		if (dec->last_chr == '\r' || dec->last_chr == '\n')
+			return 0;
+
+		n = scan_delim(buf, len, "\r\n\"\"");
+		break;
+	case STATE_HEADER_QUOTE:
+		/* escaped characters are handled by feed_char() */
+		if (dec->last_chr == '\\' && !dec->quoted)
+			return 0;
+
+		n = scan_delim(buf, len, "\"\\\"\\");
+		if (n > 0)
+			dec->quoted = 0;
+		break;
+	case STATE_BODY:
+		if (body_direct(dec)) {
+			n = body_pass(dec, buf, len);
+			shl_ring_pull(&dec->ring, *rlen + n);
+			*rlen = 0;
+			return n;
+		}
+
+		if (dec->remaining_body < 2)
+			return 0;
+
+		n = dec->remaining_body - 1;
+		if (n > len)
+			n = len;
+		dec->remaining_body -= n;
+		break;
+	default:
+		return 0;
+	}
+
+	if (n > 0) {
+		*rlen += n;
+		dec->last_chr = buf[n - 1];
+	}
+
+	return n;
+}
+
+/*
+ * Enforce limits on the pending header line of @rlen bytes. While discarding,
+ * long lines are dropped from the ring right away so a single huge line cannot
+ * make it grow; discard_keep() remembers what matters of them. Returns the new
+ * @rlen.
+ */
+static size_t check_line(struct owfd_rtsp_decoder *dec, size_t rlen)
+{
+	const struct owfd_rtsp_decoder_limits *lim = &dec->limits;
+
+	if (!dec->discard) {
+		if ((lim->max_line && rlen > lim->max_line) ||
+		    (lim->max_msg && rlen > lim->max_msg - dec->msg_bytes))
+			msg_discard(dec);
+		else
+			return rlen;
+	}
+
+	if (rlen > DISCARD_LINE_MAX) {
+		if (!dec->discard_trunc) {
+			dec->discard_trunc = 1;
+			dec->discard_len = 0;
+		}
+		discard_keep(dec, rlen);
+		shl_ring_pull(&dec->ring, rlen);
+		rlen = 0;
+	}
+
+	return rlen;
+}
+
+/*
+ * Parse @len new bytes at @buf. They must already be the last bytes in the
+ * ring, preceded by @rlen pending bytes. @rlen is updated.
+ */
+static int feed_data(struct owfd_rtsp_decoder *dec, const char *buf,
+		     size_t len, size_t *prlen)
+{
+	size_t rlen = *prlen, i, n;
 	ssize_t l;
-	int r;
+	int r = 0;
 
-	rlen = shl_ring_length(&dec->ring);
-	r = shl_ring_push(&dec->ring, buf, len);
-	if (r < 0)
-		return -ENOMEM;
+	for (i = 0; i < len; ) {
+		n = feed_run(dec, &buf[i], len - i, &rlen);
+		if (n > 0) {
+			i += n;
+		} else {
+			l = feed_char(dec, buf[i], rlen);
+			if (l < 0) {
+				r = l;
+				break;
+			}
 
-	for (i = 0; i < len; ++i) {
-		l = feed_char(dec, buf[i], rlen);
-		if (l < 0) {
-			r = l;
-			break;
+			rlen = l;
+			dec->last_chr = buf[i];
+			++i;
 		}
 
-		rlen = l;
-		dec->last_chr = buf[i];
+		if (dec->state != STATE_NEW && dec->state != STATE_BODY)
+			rlen = check_line(dec, rlen);
 	}
 
+	*prlen = rlen;
+	return r;
+}
+
+static int feed_finish(struct owfd_rtsp_decoder *dec, int r, size_t rlen)
+{
 	if (r < 0) {
 		/* ring buffer may be corrupted, flush it */
 		owfd_rtsp_decoder_flush(dec);
+		return r;
 	}
 
-	return r;
+	/* drop leading white-space between messages right away */
+	if (dec->state == STATE_NEW && rlen)
+		shl_ring_pull(&dec->ring, rlen);
+
+	if (dec->limit_hit) {
+		dec->limit_hit = 0;
+		return -EMSGSIZE;
+	}
+
+	return 0;
+}
+
+/*
+ * Only data the parser has to look at again goes into the ring. Streamed and
+ * discarded bodies are passed to the callback straight from @buf; as a body
+ * can only start after a line-break, headers are pushed a line at a time in
+ * those modes so the ring never holds body data that follows them.
+ */
+int owfd_rtsp_decoder_feed(struct owfd_rtsp_decoder *dec,
+			   const char *buf, size_t len)
+{
+	size_t rlen, i, n;
+	int r = 0;
+
+	rlen = shl_ring_length(&dec->ring);
+	for (i = 0; i < len && r >= 0; i += n) {
+		if (body_direct(dec)) {
+			n = body_pass(dec, &buf[i], len - i);
+			shl_ring_pull(&dec->ring, rlen);
+			rlen = 0;
+			continue;
+		}
+
+		n = len - i;
+		if (dec->stream || dec->discard) {
+			n = scan_delim(&buf[i], n, "\r\n\r\n");
+			if (n < len - i)
+				++n;
+		}
+
+		r = shl_ring_push(&dec->ring, &buf[i], n);
+		if (r < 0)
+			return -ENOMEM;
+
+		r = feed_data(dec, &buf[i], n, &rlen);
+	}
+
+	return feed_finish(dec, r, rlen);
+}
+
+/*
+ * Zero-copy input: owfd_rtsp_decoder_reserve() returns the free space of the
+ * input buffer in @vec (2 iovecs), with room for at least @min bytes. Read
+ * data directly into it and pass the number of bytes written to
+ * owfd_rtsp_decoder_commit(), which parses them just like
+ * owfd_rtsp_decoder_feed() would. Returns the number of iovecs filled.
+ */
+int owfd_rtsp_decoder_reserve(struct owfd_rtsp_decoder *dec, size_t min,
+			      struct iovec *vec)
+{
+	return shl_ring_reserve(&dec->ring, min, vec);
+}
+
+int owfd_rtsp_decoder_commit(struct owfd_rtsp_decoder *dec, size_t len)
+{
+	struct shl_ring *ring = &dec->ring;
+	size_t rlen, pos, l;
+	int r;
+
+	if (!len)
+		return 0;
+
+	rlen = shl_ring_length(ring);
+	pos = ring->end;
+	shl_ring_commit(ring, len);
+
+	/* new data might wrap around the end of the ring, unless mirrored */
+	l = ring->size - pos;
+	if (l > len || ring->mirror)
+		l = len;
+
+	r = feed_data(dec, &ring->buf[pos], l, &rlen);
+	if (r >= 0 && len > l)
+		r = feed_data(dec, ring->buf, len - l, &rlen);
+
+	return feed_finish(dec, r, rlen);
 }
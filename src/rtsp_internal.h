@@ -0,0 +1,138 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP internals
+ * Shared by the control channel and its io_uring backend, not part of the
+ * library interface.
+ */
+
+#ifndef OWFD_RTSP_INTERNAL_H
+#define OWFD_RTSP_INTERNAL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "shl_chain.h"
+#include "shl_dlist.h"
+#include "shl_hist.h"
+#include "shl_loop.h"
+#include "shl_wheel.h"
+#include "rtsp.h"
+
+/* maximum number of iovecs passed to a single sendmsg() */
+#define CTRL_IOV_MAX 64
+
+struct owfd_rtsp_ctrl {
+	atomic_ulong ref;
+	void *data;
+	int efd;
+	int fd;
+	owfd_rtsp_ctrl_cb cb;
+	owfd_rtsp_ctrl_msg_cb msg_cb;
+	struct owfd_rtsp_decoder *dec;
+	struct shl_chain out;
+	struct shl_dlist out_list;
+	struct owfd_rtsp_ctrl_stats stats;
+	unsigned int corked;
+	void *tag;
+	unsigned int flags;
+
+	struct shl_loop *loop;
+	struct shl_loop_io io;
+	struct shl_loop_defer defer;
+	owfd_rtsp_ctrl_error_cb error_cb;
+
+	/* in-memory pipe, see owfd_rtsp_ctrl_open_pair() */
+	struct owfd_rtsp_ctrl *peer;
+	struct shl_chain mem_in;
+
+	size_t out_len;
+	int64_t blocked_since;
+	struct shl_hist *rtt[OWFD_RTSP_METHOD_CNT];
+
+	size_t rx_budget;
+	size_t msg_budget;
+	size_t rx_msgs;
+
+	struct shl_wheel *wheel;
+	struct shl_wheel_timer keepalive;
+	struct shl_wheel_timer timeout;
+	unsigned int keepalive_ms;
+	unsigned int timeout_ms;
+	uint64_t last_rx;
+	owfd_rtsp_ctrl_timer_cb timer_cb;
+	void *timer_data;
+
+	struct ctrl_slot *req_slots;
+	size_t req_mask;
+	size_t req_num;
+	struct ctrl_req *req_cache;
+	size_t req_cached;
+
+	struct owfd_rtsp_uring *uring;
+	struct ctrl_send *uring_send;
+	unsigned int uring_ops;
+
+	unsigned int connected : 1;
+	unsigned int out_armed : 1;
+	unsigned int out_blocked : 1;
+	unsigned int rx_pending : 1;
+	unsigned int shared : 1;
+	unsigned int own_wheel : 1;
+	unsigned int own_uring : 1;
+	unsigned int uring_sending : 1;
+	unsigned int freeing : 1;
+	unsigned int mem : 1;
+};
+
+/* the sendmsg() arguments of the io_uring request in flight */
+struct ctrl_send {
+	struct msghdr msg;
+	struct iovec vec[CTRL_IOV_MAX];
+	size_t len;
+};
+
+/* rtsp_ctrl.c */
+
+void ctrl_destroy(struct owfd_rtsp_ctrl *ctrl);
+int ctrl_connect_done(struct owfd_rtsp_ctrl *ctrl);
+void ctrl_out_flush(struct owfd_rtsp_ctrl *ctrl);
+void ctrl_out_block(struct owfd_rtsp_ctrl *ctrl);
+void ctrl_out_unblock(struct owfd_rtsp_ctrl *ctrl);
+void ctrl_out_advance(struct owfd_rtsp_ctrl *ctrl, size_t len);
+size_t ctrl_out_peek(struct owfd_rtsp_ctrl *ctrl, struct iovec *vec,
+		     bool *more);
+
+/* rtsp_uring.c */
+
+int ctrl_uring_poll(struct owfd_rtsp_ctrl *ctrl);
+int ctrl_uring_send(struct owfd_rtsp_ctrl *ctrl);
+void ctrl_uring_cancel(struct owfd_rtsp_ctrl *ctrl);
+
+#endif /* OWFD_RTSP_INTERNAL_H */
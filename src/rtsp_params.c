@@ -0,0 +1,509 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <openwfd/wfd_defs.h>
+#include "shared.h"
+#include "rtsp.h"
+
+/*
+ * WFD Parameters
+ * GET_PARAMETER and SET_PARAMETER bodies carry one "wfd_key: value" line per
+ * parameter. owfd_rtsp_params_parse() only builds an index of the value spans
+ * in a single pass over the body, it does not copy or decode anything. Values
+ * are decoded by the typed getters only when a caller asks for them. The body
+ * must stay valid as long as the index is used.
+ */
+
+static const struct param_type {
+	const char *name;
+	size_t len;
+	unsigned int code;
+} param_list[] = {
+
+#define PARAM(_name, _suffix) { \
+		.name = _name, \
+		.len = sizeof(_name) - 1, \
+		.code = OWFD_RTSP_PARAM_ ## _suffix \
+	}
+
+	/* MUST BE ORDER ALPHABETICALLY (LOWER-CASE) FOR BINARY SEARCH! */
+
+	PARAM("wfd_3d_video_formats", 3D_VIDEO_FORMATS),
+	PARAM("wfd_audio_codecs", AUDIO_CODECS),
+	PARAM("wfd_av_format_change_timing", AV_FORMAT_CHANGE_TIMING),
+	PARAM("wfd_client_rtp_ports", CLIENT_RTP_PORTS),
+	PARAM("wfd_connector_type", CONNECTOR_TYPE),
+	PARAM("wfd_content_protection", CONTENT_PROTECTION),
+	PARAM("wfd_coupled_sink", COUPLED_SINK),
+	PARAM("wfd_display_edid", DISPLAY_EDID),
+	PARAM("wfd_I2C", I2C),
+	PARAM("wfd_idr_request", IDR_REQUEST),
+	PARAM("wfd_preferred_display_mode", PREFERRED_DISPLAY_MODE),
+	PARAM("wfd_presentation_URL", PRESENTATION_URL),
+	PARAM("wfd_route", ROUTE),
+	PARAM("wfd_standby", STANDBY),
+	PARAM("wfd_standby_resume_capability", STANDBY_RESUME_CAPABILITY),
+	PARAM("wfd_trigger_method", TRIGGER_METHOD),
+	PARAM("wfd_uibc_capability", UIBC_CAPABILITY),
+	PARAM("wfd_uibc_setting", UIBC_SETTING),
+	PARAM("wfd_video_formats", VIDEO_FORMATS),
+
+#undef PARAM
+};
+
+struct param_key {
+	const char *name;
+	size_t len;
+};
+
+static int param_comp(const void *key, const void *type)
+{
+	const struct param_key *k = key;
+	const struct param_type *t = type;
+	int r;
+
+	r = strncasecmp(k->name, t->name, k->len < t->len ? k->len : t->len);
+	if (r)
+		return r;
+
+	if (k->len < t->len)
+		return -1;
+	if (k->len > t->len)
+		return 1;
+
+	return 0;
+}
+
+unsigned int owfd_rtsp_param_lookup(const char *name, size_t len)
+{
+	const struct param_type *t;
+	struct param_key k = { name, len };
+
+	t = bsearch(&k, param_list,
+		    sizeof(param_list) / sizeof(*param_list),
+		    sizeof(*param_list),
+		    param_comp);
+
+	return t ? t->code : OWFD_RTSP_PARAM_UNKNOWN;
+}
+
+const char *owfd_rtsp_param_name(unsigned int param)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(param_list) / sizeof(*param_list); ++i) {
+		if (param_list[i].code == param)
+			return param_list[i].name;
+	}
+
+	return NULL;
+}
+
+static bool is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*
+ * Index all parameters of @body. Lines without a value (as sent in
+ * GET_PARAMETER requests) are recorded with an empty value. Unknown
+ * parameters are counted in @unknown, duplicates are ignored.
+ */
+int owfd_rtsp_params_parse(struct owfd_rtsp_params *params,
+			   const char *body, size_t len)
+{
+	const char *e, *c;
+	size_t pos, end, next, k, v;
+	unsigned int p;
+
+	memset(params, 0, sizeof(*params));
+	params->body = body;
+	params->len = len;
+
+	for (pos = 0; pos < len; pos = next) {
+		e = memchr(&body[pos], '\n', len - pos);
+		end = e ? (size_t)(e - body) : len;
+		next = e ? end + 1 : len;
+
+		while (pos < end && is_lws(body[pos]))
+			++pos;
+		while (end > pos && is_lws(body[end - 1]))
+			--end;
+		if (pos == end)
+			continue;
+
+		c = memchr(&body[pos], ':', end - pos);
+		k = c ? (size_t)(c - body) : end;
+		v = c ? k + 1 : end;
+		while (k > pos && is_lws(body[k - 1]))
+			--k;
+		while (v < end && is_lws(body[v]))
+			++v;
+
+		p = owfd_rtsp_param_lookup(&body[pos], k - pos);
+		if (p == OWFD_RTSP_PARAM_UNKNOWN) {
+			++params->unknown;
+			continue;
+		}
+
+		if (params->present & (1UL << p))
+			continue;
+
+		params->present |= 1UL << p;
+		params->off[p] = v;
+		params->val_len[p] = end - v;
+	}
+
+	return 0;
+}
+
+bool owfd_rtsp_params_has(const struct owfd_rtsp_params *params,
+			  unsigned int param)
+{
+	if (param >= OWFD_RTSP_PARAM_CNT)
+		return false;
+
+	return params->present & (1UL << param);
+}
+
+/* return raw value of @param (not zero-terminated) or NULL if not present */
+const char *owfd_rtsp_params_get(const struct owfd_rtsp_params *params,
+				 unsigned int param, size_t *len)
+{
+	if (!owfd_rtsp_params_has(params, param))
+		return NULL;
+
+	if (len)
+		*len = params->val_len[param];
+
+	return &params->body[params->off[param]];
+}
+
+/*
+ * Value Decoding
+ * Values are split with the span tokenizer. Each getter walks the tokens of
+ * a single value, nothing is cached.
+ */
+
+struct cursor {
+	struct owfd_rtsp_token_iter iter;
+	struct owfd_rtsp_token tok;
+	const char *val;
+};
+
+static int cursor_init(struct cursor *c, const struct owfd_rtsp_params *params,
+		       unsigned int param)
+{
+	size_t len;
+
+	c->val = owfd_rtsp_params_get(params, param, &len);
+	if (!c->val)
+		return -ENOENT;
+
+	owfd_rtsp_token_iter_init(&c->iter, c->val, len);
+	return 0;
+}
+
+static bool cursor_next(struct cursor *c)
+{
+	return owfd_rtsp_token_next(&c->iter, &c->tok);
+}
+
+static bool cursor_is(struct cursor *c, const char *str)
+{
+	return c->tok.len == strlen(str) &&
+	       !memcmp(&c->val[c->tok.off], str, c->tok.len);
+}
+
+static bool cursor_expect(struct cursor *c, const char *str)
+{
+	return cursor_next(c) && cursor_is(c, str);
+}
+
+static bool cursor_at_end(struct cursor *c)
+{
+	struct owfd_rtsp_token_iter iter = c->iter;
+	struct owfd_rtsp_token tok;
+
+	return !owfd_rtsp_token_next(&iter, &tok);
+}
+
+/* read next token as number in @base with at most @max_digits digits */
+static int cursor_num(struct cursor *c, unsigned int base,
+		      size_t max_digits, uint32_t *out)
+{
+	const char *s;
+	uint32_t v = 0;
+	unsigned int d;
+	size_t i;
+	char ch;
+
+	if (!cursor_next(c) || c->tok.quoted || !c->tok.len ||
+	    c->tok.len > max_digits)
+		return -EINVAL;
+
+	s = &c->val[c->tok.off];
+	for (i = 0; i < c->tok.len; ++i) {
+		ch = s[i];
+		if (ch >= '0' && ch <= '9')
+			d = ch - '0';
+		else if (ch >= 'a' && ch <= 'f')
+			d = ch - 'a' + 10;
+		else if (ch >= 'A' && ch <= 'F')
+			d = ch - 'A' + 10;
+		else
+			return -EINVAL;
+
+		if (d >= base)
+			return -EINVAL;
+
+		v = v * base + d;
+	}
+
+	*out = v;
+	return 0;
+}
+
+/* hex field that might be "none" instead */
+static int cursor_hex_or_none(struct cursor *c, size_t max_digits,
+			      uint32_t *out)
+{
+	struct cursor save = *c;
+
+	if (cursor_expect(c, "none")) {
+		*out = 0;
+		return 0;
+	}
+
+	*c = save;
+	return cursor_num(c, 16, max_digits, out);
+}
+
+#define VIDEO_PROFILE_MASK (OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_PROFILE_CBP | \
+			    OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_PROFILE_CHP)
+#define VIDEO_LEVEL_MASK (OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_3_1 | \
+			  OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_3_2 | \
+			  OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_4_0 | \
+			  OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_4_1 | \
+			  OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_4_2)
+
+static int parse_video_codec(struct cursor *c, struct owfd_rtsp_video_codec *v)
+{
+	uint32_t f[11];
+	int r;
+
+	r = cursor_num(c, 16, 2, &f[0]);
+	r = r ? : cursor_num(c, 16, 2, &f[1]);
+	r = r ? : cursor_num(c, 16, 8, &f[2]);
+	r = r ? : cursor_num(c, 16, 8, &f[3]);
+	r = r ? : cursor_num(c, 16, 8, &f[4]);
+	r = r ? : cursor_num(c, 16, 2, &f[5]);
+	r = r ? : cursor_num(c, 16, 4, &f[6]);
+	r = r ? : cursor_num(c, 16, 4, &f[7]);
+	r = r ? : cursor_num(c, 16, 2, &f[8]);
+	r = r ? : cursor_hex_or_none(c, 4, &f[9]);
+	r = r ? : cursor_hex_or_none(c, 4, &f[10]);
+	if (r < 0)
+		return r;
+
+	if (!f[0] || (f[0] & ~VIDEO_PROFILE_MASK) ||
+	    !f[1] || (f[1] & ~VIDEO_LEVEL_MASK))
+		return -EINVAL;
+
+	v->profile = f[0];
+	v->level = f[1];
+	v->cea_modes = f[2];
+	v->vesa_modes = f[3];
+	v->hh_modes = f[4];
+	v->latency = f[5];
+	v->slice_min = f[6];
+	v->slice_enc = f[7];
+	v->frame_rate_control = f[8];
+	v->max_hres = f[9];
+	v->max_vres = f[10];
+
+	return 0;
+}
+
+/*
+ * wfd_video_formats: none
+ * wfd_video_formats: <native> <preferred-display-mode> <codec>[, <codec>]*
+ * <codec>: <profile> <level> <cea> <vesa> <hh> <latency> <min-slice-size>
+ *          <slice-enc-params> <frame-rate-control> <max-hres> <max-vres>
+ */
+int owfd_rtsp_params_get_video_formats(const struct owfd_rtsp_params *params,
+				       struct owfd_rtsp_video_formats *out)
+{
+	struct cursor c;
+	uint32_t native, pref;
+	int r;
+
+	r = cursor_init(&c, params, OWFD_RTSP_PARAM_VIDEO_FORMATS);
+	if (r < 0)
+		return r;
+
+	memset(out, 0, sizeof(*out));
+
+	if (cursor_expect(&c, "none")) {
+		out->none = true;
+		return cursor_at_end(&c) ? 0 : -EINVAL;
+	}
+
+	cursor_init(&c, params, OWFD_RTSP_PARAM_VIDEO_FORMATS);
+	r = cursor_num(&c, 16, 2, &native);
+	r = r ? : cursor_num(&c, 16, 2, &pref);
+	if (r < 0)
+		return r;
+
+	if ((native & OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_NATIVE_MODE_TABLE_MASK) >
+	    OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_NATIVE_MODE_HH_TABLE)
+		return -EINVAL;
+
+	out->native = native;
+	out->preferred_display_mode = pref;
+
+	do {
+		if (out->codec_num >= OWFD_RTSP_VIDEO_CODECS_MAX)
+			return -E2BIG;
+
+		r = parse_video_codec(&c, &out->codecs[out->codec_num++]);
+		if (r < 0)
+			return r;
+
+		if (cursor_at_end(&c))
+			return 0;
+	} while (cursor_expect(&c, ","));
+
+	return -EINVAL;
+}
+
+/*
+ * wfd_audio_codecs: none
+ * wfd_audio_codecs: <format> <modes> <latency>[, <format> <modes> <latency>]*
+ */
+int owfd_rtsp_params_get_audio_codecs(const struct owfd_rtsp_params *params,
+				      struct owfd_rtsp_audio_codecs *out)
+{
+	struct cursor c;
+	uint32_t modes, latency;
+	uint32_t *m;
+	uint8_t *l;
+	int r;
+
+	r = cursor_init(&c, params, OWFD_RTSP_PARAM_AUDIO_CODECS);
+	if (r < 0)
+		return r;
+
+	memset(out, 0, sizeof(*out));
+
+	if (!cursor_next(&c))
+		return -EINVAL;
+	if (cursor_is(&c, "none"))
+		return cursor_at_end(&c) ? 0 : -EINVAL;
+
+	for (;;) {
+		if (cursor_is(&c, "LPCM")) {
+			m = &out->lpcm_modes;
+			l = &out->lpcm_latency;
+		} else if (cursor_is(&c, "AAC")) {
+			m = &out->aac_modes;
+			l = &out->aac_latency;
+		} else if (cursor_is(&c, "AC3")) {
+			m = &out->ac3_modes;
+			l = &out->ac3_latency;
+		} else {
+			return -EINVAL;
+		}
+
+		r = cursor_num(&c, 16, 8, &modes);
+		r = r ? : cursor_num(&c, 16, 2, &latency);
+		if (r < 0)
+			return r;
+
+		*m = modes;
+		*l = latency;
+
+		if (cursor_at_end(&c))
+			return 0;
+		if (!cursor_expect(&c, ",") || !cursor_next(&c))
+			return -EINVAL;
+	}
+}
+
+/*
+ * wfd_client_rtp_ports: RTP/AVP/<UDP|TCP>;unicast <port0> <port1> mode=play
+ */
+int owfd_rtsp_params_get_client_rtp_ports(
+				const struct owfd_rtsp_params *params,
+				struct owfd_rtsp_client_rtp_ports *out)
+{
+	struct cursor c;
+	uint32_t p0, p1;
+	int r;
+
+	r = cursor_init(&c, params, OWFD_RTSP_PARAM_CLIENT_RTP_PORTS);
+	if (r < 0)
+		return r;
+
+	memset(out, 0, sizeof(*out));
+
+	if (!cursor_expect(&c, "RTP") || !cursor_expect(&c, "/") ||
+	    !cursor_expect(&c, "AVP") || !cursor_expect(&c, "/") ||
+	    !cursor_next(&c))
+		return -EINVAL;
+
+	if (cursor_is(&c, "UDP"))
+		out->transport = OWFD_RTSP_RTP_UDP;
+	else if (cursor_is(&c, "TCP"))
+		out->transport = OWFD_RTSP_RTP_TCP;
+	else
+		return -EINVAL;
+
+	if (!cursor_expect(&c, ";") || !cursor_expect(&c, "unicast"))
+		return -EINVAL;
+
+	r = cursor_num(&c, 10, 5, &p0);
+	r = r ? : cursor_num(&c, 10, 5, &p1);
+	if (r < 0)
+		return r;
+	if (p0 > 65535 || p1 > 65535)
+		return -EINVAL;
+
+	out->port0 = p0;
+	out->port1 = p1;
+
+	if (!cursor_expect(&c, "mode") || !cursor_expect(&c, "=") ||
+	    !cursor_next(&c))
+		return -EINVAL;
+
+	out->play = cursor_is(&c, "play");
+
+	return cursor_at_end(&c) ? 0 : -EINVAL;
+}
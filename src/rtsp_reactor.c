@@ -0,0 +1,281 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Reactor Pool
+ * A reactor pool runs one owfd_rtsp_server per thread. All servers listen on
+ * the same address with SO_REUSEPORT, so the kernel spreads new connections
+ * across the threads and each session stays on the thread that accepted it.
+ * Threads share no state besides the pool itself; buffers come from the chain
+ * pool of each server, which is not bound to a thread.
+ * Server callbacks run on the reactor threads. While the pool is running,
+ * its servers must only be touched from within these callbacks.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "shared.h"
+#include "shl_chain.h"
+#include "rtsp.h"
+
+struct reactor {
+	struct owfd_rtsp_reactor *pool;
+	struct owfd_rtsp_server *srv;
+	pthread_t thread;
+	int error;
+};
+
+struct owfd_rtsp_reactor {
+	unsigned int num;
+	struct reactor *reactors;
+	atomic_bool stop;
+	unsigned int running : 1;
+};
+
+/*
+ * Create a pool of @threads reactors, or one per online CPU if 0. @cb and
+ * @data are passed to every server.
+ */
+int owfd_rtsp_reactor_new(struct owfd_rtsp_reactor **out,
+			  unsigned int threads, owfd_rtsp_server_cb cb,
+			  void *data)
+{
+	struct owfd_rtsp_reactor *pool;
+	unsigned int i;
+	long n;
+	int r;
+
+	if (!threads) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n > 0 ? n : 1;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return -ENOMEM;
+	atomic_init(&pool->stop, false);
+
+	pool->reactors = calloc(threads, sizeof(*pool->reactors));
+	if (!pool->reactors) {
+		r = -ENOMEM;
+		goto err_pool;
+	}
+
+	for (i = 0; i < threads; ++i) {
+		pool->reactors[i].pool = pool;
+		r = owfd_rtsp_server_new(&pool->reactors[i].srv, cb);
+		if (r < 0)
+			goto err_srv;
+
+		pool->num = i + 1;
+		owfd_rtsp_server_set_data(pool->reactors[i].srv, data);
+		owfd_rtsp_server_set_flags(pool->reactors[i].srv,
+					   OWFD_RTSP_SERVER_REUSEPORT);
+	}
+
+	*out = pool;
+	return 0;
+
+err_srv:
+	owfd_rtsp_reactor_free(pool);
+	return r;
+
+err_pool:
+	free(pool);
+	return r;
+}
+
+void owfd_rtsp_reactor_free(struct owfd_rtsp_reactor *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	owfd_rtsp_reactor_stop(pool);
+	for (i = 0; i < pool->num; ++i)
+		owfd_rtsp_server_unref(pool->reactors[i].srv);
+
+	free(pool->reactors);
+	free(pool);
+}
+
+unsigned int owfd_rtsp_reactor_get_threads(struct owfd_rtsp_reactor *pool)
+{
+	return pool->num;
+}
+
+struct owfd_rtsp_server *owfd_rtsp_reactor_get_server(struct owfd_rtsp_reactor *pool,
+						      unsigned int idx)
+{
+	if (idx >= pool->num)
+		return NULL;
+
+	return pool->reactors[idx].srv;
+}
+
+/*
+ * Let all reactors listen on @addr (see owfd_rtsp_server_listen()). If the
+ * port is 0, the port picked for the first reactor is used for all others.
+ */
+int owfd_rtsp_reactor_listen(struct owfd_rtsp_reactor *pool,
+			     const struct sockaddr_in6 *addr)
+{
+	struct sockaddr_in6 bound;
+	unsigned int i;
+	int r;
+
+	if (pool->running)
+		return -EBUSY;
+
+	for (i = 0; i < pool->num; ++i) {
+		r = owfd_rtsp_server_listen(pool->reactors[i].srv, addr);
+		if (r < 0)
+			goto err_close;
+
+		if (!i) {
+			r = owfd_rtsp_server_get_addr(pool->reactors[0].srv,
+						      &bound);
+			if (r < 0)
+				goto err_close;
+			addr = &bound;
+		}
+	}
+
+	return 0;
+
+err_close:
+	while (i--)
+		owfd_rtsp_server_close(pool->reactors[i].srv);
+	return r;
+}
+
+int owfd_rtsp_reactor_get_addr(struct owfd_rtsp_reactor *pool,
+			       struct sockaddr_in6 *addr)
+{
+	return owfd_rtsp_server_get_addr(pool->reactors[0].srv, addr);
+}
+
+static void *reactor_thread(void *data)
+{
+	struct reactor *re = data;
+	int r;
+
+	while (!atomic_load(&re->pool->stop)) {
+		r = owfd_rtsp_server_dispatch(re->srv, -1);
+		if (r < 0) {
+			re->error = r;
+			break;
+		}
+	}
+
+	/* callbacks may have used the default pool of this thread */
+	shl_chain_pool_trim(shl_chain_pool_default(), 0);
+	return NULL;
+}
+
+/* spawn one thread per reactor */
+int owfd_rtsp_reactor_start(struct owfd_rtsp_reactor *pool)
+{
+	unsigned int i;
+	int r;
+
+	if (pool->running)
+		return -EALREADY;
+
+	atomic_store(&pool->stop, false);
+	for (i = 0; i < pool->num; ++i) {
+		pool->reactors[i].error = 0;
+		r = pthread_create(&pool->reactors[i].thread, NULL,
+				   reactor_thread, &pool->reactors[i]);
+		if (r) {
+			r = -r;
+			goto err_stop;
+		}
+	}
+
+	pool->running = 1;
+	return 0;
+
+err_stop:
+	atomic_store(&pool->stop, true);
+	while (i--) {
+		owfd_rtsp_server_wake(pool->reactors[i].srv);
+		pthread_join(pool->reactors[i].thread, NULL);
+	}
+	return r;
+}
+
+/*
+ * Stop and join all reactor threads. Sessions stay open and are served again
+ * after the next owfd_rtsp_reactor_start(). Returns the first error a
+ * reactor stopped with, or 0.
+ */
+int owfd_rtsp_reactor_stop(struct owfd_rtsp_reactor *pool)
+{
+	unsigned int i;
+	int r = 0;
+
+	if (!pool->running)
+		return 0;
+
+	atomic_store(&pool->stop, true);
+	for (i = 0; i < pool->num; ++i)
+		owfd_rtsp_server_wake(pool->reactors[i].srv);
+
+	for (i = 0; i < pool->num; ++i) {
+		pthread_join(pool->reactors[i].thread, NULL);
+		if (!r)
+			r = pool->reactors[i].error;
+	}
+
+	pool->running = 0;
+	return r;
+}
+
+/* sum of all server stats; only valid while the pool is stopped */
+void owfd_rtsp_reactor_get_stats(struct owfd_rtsp_reactor *pool,
+				 struct owfd_rtsp_server_stats *stats)
+{
+	struct owfd_rtsp_server_stats s;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < pool->num; ++i) {
+		owfd_rtsp_server_get_stats(pool->reactors[i].srv, &s);
+		stats->accepted += s.accepted;
+		stats->rejected += s.rejected;
+		stats->closed += s.closed;
+		stats->sessions += s.sessions;
+		stats->peak_sessions += s.peak_sessions;
+		stats->memory += s.memory;
+	}
+}
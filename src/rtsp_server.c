@@ -0,0 +1,730 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Server
+ * A server accepts connections on a listening socket and wraps each of them
+ * in a session with its own owfd_rtsp_ctrl. The listening socket and all
+ * session sockets share a single epoll fd, so thousands of sessions cost one
+ * epoll_wait() per dispatch instead of one epoll fd each.
+ * Closed sessions are unlinked right away but only freed once the current
+ * dispatch finished, as later events of the same batch may still refer to
+ * them.
+ * Keepalive, timeout and request timers of all sessions share one timing
+ * wheel, which is driven by a single timerfd on the same epoll fd.
+ * With OWFD_RTSP_SERVER_URING, session I/O runs through one owfd_rtsp_uring
+ * instead, whose fd sits on the epoll fd in place of the session sockets.
+ * With OWFD_RTSP_SERVER_EDGE, session sockets are edge-triggered. Sessions
+ * that used up their input budget are queued on @ready and served again in
+ * the next dispatch, after the sessions that have new events.
+ * Output and loopback buffers of all sessions come from the server's own
+ * chain pool rather than the default pool of a thread, so the server may be
+ * dispatched from different threads over its lifetime (one at a time).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <openwfd/wfd_defs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "shared.h"
+#include "shl_chain.h"
+#include "shl_dlist.h"
+#include "shl_wheel.h"
+#include "rtsp.h"
+
+/* connections accepted per wakeup, the rest waits for the next dispatch */
+#define SERVER_ACCEPT_BATCH 64
+
+/* resolution of session timers */
+#define SERVER_WHEEL_TICK 10
+
+/* idle buffer segments kept by the server's chain pool */
+#define SERVER_POOL_HIGH 64
+
+struct owfd_rtsp_server {
+	unsigned long ref;
+	void *data;
+	owfd_rtsp_server_cb cb;
+	int efd;
+	int fd;
+	int wake_fd;
+	unsigned int flags;
+
+	struct shl_wheel wheel;
+	struct shl_chain_pool pool;
+	struct owfd_rtsp_uring *uring;
+	unsigned int keepalive_ms;
+	unsigned int timeout_ms;
+
+	bool budget;
+	size_t rx_budget;
+	size_t msg_budget;
+
+	struct shl_dlist sessions;
+	struct shl_dlist dead;
+	struct shl_dlist ready;
+	size_t max_sessions;
+	unsigned int dispatching;
+	struct owfd_rtsp_server_stats stats;
+};
+
+struct owfd_rtsp_session {
+	struct shl_dlist list;
+	struct shl_dlist ready;
+	struct owfd_rtsp_server *srv;
+	struct owfd_rtsp_ctrl *ctrl;
+	void *data;
+	bool dead;
+};
+
+int owfd_rtsp_server_new(struct owfd_rtsp_server **out,
+			 owfd_rtsp_server_cb cb)
+{
+	struct owfd_rtsp_server *srv;
+	struct epoll_event ev;
+	int r;
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		return -ENOMEM;
+	srv->ref = 1;
+	srv->cb = cb;
+	srv->fd = -1;
+	shl_dlist_init(&srv->sessions);
+	shl_dlist_init(&srv->dead);
+	shl_dlist_init(&srv->ready);
+	shl_dlist_init(&srv->pool.free);
+	shl_chain_pool_set_high(&srv->pool, SERVER_POOL_HIGH);
+
+	srv->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv->efd < 0) {
+		r = -errno;
+		goto err_srv;
+	}
+
+	srv->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (srv->wake_fd < 0) {
+		r = -errno;
+		goto err_efd;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv->wake_fd;
+	r = epoll_ctl(srv->efd, EPOLL_CTL_ADD, srv->wake_fd, &ev);
+	if (r < 0) {
+		r = -errno;
+		goto err_wake;
+	}
+
+	r = shl_wheel_init(&srv->wheel, SERVER_WHEEL_TICK, SHL_WHEEL_TIMERFD);
+	if (r < 0)
+		goto err_wake;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv->wheel;
+	r = epoll_ctl(srv->efd, EPOLL_CTL_ADD, shl_wheel_get_fd(&srv->wheel),
+		      &ev);
+	if (r < 0) {
+		r = -errno;
+		goto err_wheel;
+	}
+
+	*out = srv;
+	return 0;
+
+err_wheel:
+	shl_wheel_destroy(&srv->wheel);
+err_wake:
+	close(srv->wake_fd);
+err_efd:
+	close(srv->efd);
+err_srv:
+	free(srv);
+	return r;
+}
+
+void owfd_rtsp_server_ref(struct owfd_rtsp_server *srv)
+{
+	if (!srv || !srv->ref)
+		return;
+
+	++srv->ref;
+}
+
+static void session_reap(struct owfd_rtsp_server *srv)
+{
+	struct owfd_rtsp_session *sess;
+
+	while (!shl_dlist_empty(&srv->dead)) {
+		sess = shl_dlist_first_entry(&srv->dead,
+					     struct owfd_rtsp_session, list);
+		shl_dlist_unlink(&sess->list);
+		owfd_rtsp_ctrl_unref(sess->ctrl);
+		free(sess);
+	}
+}
+
+void owfd_rtsp_server_unref(struct owfd_rtsp_server *srv)
+{
+	if (!srv || !srv->ref || --srv->ref)
+		return;
+
+	owfd_rtsp_server_close(srv);
+	session_reap(srv);
+	owfd_rtsp_uring_free(srv->uring);
+	shl_chain_pool_trim(&srv->pool, 0);
+	shl_wheel_destroy(&srv->wheel);
+	close(srv->wake_fd);
+	close(srv->efd);
+	free(srv);
+}
+
+void owfd_rtsp_server_set_data(struct owfd_rtsp_server *srv, void *data)
+{
+	srv->data = data;
+}
+
+void *owfd_rtsp_server_get_data(struct owfd_rtsp_server *srv)
+{
+	return srv->data;
+}
+
+void owfd_rtsp_server_set_flags(struct owfd_rtsp_server *srv,
+				unsigned int flags)
+{
+	srv->flags = flags;
+}
+
+unsigned int owfd_rtsp_server_get_flags(struct owfd_rtsp_server *srv)
+{
+	return srv->flags;
+}
+
+/* connections beyond @max sessions are closed right away, 0 means no limit */
+void owfd_rtsp_server_set_max_sessions(struct owfd_rtsp_server *srv,
+				       size_t max)
+{
+	srv->max_sessions = max;
+}
+
+static void session_timer(struct owfd_rtsp_ctrl *ctrl, unsigned int timer,
+			  void *data)
+{
+	struct owfd_rtsp_session *sess = data;
+	struct owfd_rtsp_server *srv = sess->srv;
+	unsigned int event;
+
+	if (sess->dead)
+		return;
+
+	if (timer == OWFD_RTSP_CTRL_KEEPALIVE)
+		event = OWFD_RTSP_SERVER_KEEPALIVE;
+	else
+		event = OWFD_RTSP_SERVER_TIMEOUT;
+
+	if (srv->cb)
+		srv->cb(srv, sess, event, srv->data);
+
+	if (timer == OWFD_RTSP_CTRL_TIMEOUT)
+		owfd_rtsp_session_close(sess);
+}
+
+/* cannot fail once the ctrl runs on the server wheel */
+static void session_timers(struct owfd_rtsp_session *sess)
+{
+	struct owfd_rtsp_server *srv = sess->srv;
+
+	owfd_rtsp_ctrl_set_wheel(sess->ctrl, &srv->wheel);
+	owfd_rtsp_ctrl_set_timer_cb(sess->ctrl, session_timer, sess);
+	owfd_rtsp_ctrl_set_keepalive(sess->ctrl, srv->keepalive_ms);
+	owfd_rtsp_ctrl_set_timeout(sess->ctrl, srv->timeout_ms);
+}
+
+/*
+ * Input budget per wakeup of each session, see owfd_rtsp_ctrl_set_budget().
+ * This applies to open sessions as well as to new ones.
+ */
+void owfd_rtsp_server_set_budget(struct owfd_rtsp_server *srv, size_t bytes,
+				 size_t msgs)
+{
+	struct owfd_rtsp_session *sess;
+	struct shl_dlist *iter;
+
+	srv->budget = true;
+	srv->rx_budget = bytes;
+	srv->msg_budget = msgs;
+
+	shl_dlist_for_each(iter, &srv->sessions) {
+		sess = shl_dlist_entry(iter, struct owfd_rtsp_session, list);
+		owfd_rtsp_ctrl_set_budget(sess->ctrl, bytes, msgs);
+	}
+}
+
+/*
+ * Every @keepalive milliseconds, each session sees a KEEPALIVE event (to send
+ * an M16 request, for instance). Sessions that received nothing for @timeout
+ * milliseconds see a TIMEOUT event and are closed. 0 disables either. This
+ * applies to open sessions as well as to new ones.
+ */
+void owfd_rtsp_server_set_timeouts(struct owfd_rtsp_server *srv,
+				   unsigned int keepalive, unsigned int timeout)
+{
+	struct owfd_rtsp_session *sess;
+	struct shl_dlist *iter;
+
+	srv->keepalive_ms = keepalive;
+	srv->timeout_ms = timeout;
+
+	shl_dlist_for_each(iter, &srv->sessions) {
+		sess = shl_dlist_entry(iter, struct owfd_rtsp_session, list);
+		session_timers(sess);
+	}
+}
+
+/* io_uring closed the ctrl of @tag due to an error or hangup */
+static void server_uring_event(struct owfd_rtsp_uring *uring, void *tag,
+			       void *data)
+{
+	struct owfd_rtsp_session *sess = tag;
+
+	if (!sess->dead)
+		owfd_rtsp_session_close(sess);
+}
+
+/* without io_uring, the server silently keeps using epoll */
+static void server_uring(struct owfd_rtsp_server *srv)
+{
+	struct epoll_event ev;
+	int r;
+
+	if (srv->uring || !(srv->flags & OWFD_RTSP_SERVER_URING))
+		return;
+
+	r = owfd_rtsp_uring_new(&srv->uring, server_uring_event, srv);
+	if (r < 0)
+		goto err_flag;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv->uring;
+	r = epoll_ctl(srv->efd, EPOLL_CTL_ADD,
+		      owfd_rtsp_uring_get_fd(srv->uring), &ev);
+	if (r < 0)
+		goto err_uring;
+
+	return;
+
+err_uring:
+	owfd_rtsp_uring_free(srv->uring);
+	srv->uring = NULL;
+err_flag:
+	srv->flags &= ~OWFD_RTSP_SERVER_URING;
+}
+
+/*
+ * Listen on the bound stream socket @fd. The server takes ownership of @fd
+ * only on success.
+ */
+int owfd_rtsp_server_listen_fd(struct owfd_rtsp_server *srv, int fd)
+{
+	struct epoll_event ev;
+	int r, set;
+
+	if (srv->fd >= 0)
+		return -EALREADY;
+	if (fd < 0)
+		return -EINVAL;
+
+	set = fcntl(fd, F_GETFL);
+	if (set < 0)
+		return -errno;
+	r = fcntl(fd, F_SETFL, set | O_NONBLOCK);
+	if (r < 0)
+		return -errno;
+
+	r = listen(fd, SOMAXCONN);
+	if (r < 0)
+		return -errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv->fd;
+
+	r = epoll_ctl(srv->efd, EPOLL_CTL_ADD, fd, &ev);
+	if (r < 0)
+		return -errno;
+
+	srv->fd = fd;
+	server_uring(srv);
+	return 0;
+}
+
+/*
+ * Listen on @addr, or on the default WFD port of all addresses if NULL. With
+ * OWFD_RTSP_SERVER_REUSEPORT, several servers can listen on the same address
+ * and the kernel spreads new connections across them.
+ */
+int owfd_rtsp_server_listen(struct owfd_rtsp_server *srv,
+			    const struct sockaddr_in6 *addr)
+{
+	struct sockaddr_in6 any;
+	int r, fd, set;
+
+	if (srv->fd >= 0)
+		return -EALREADY;
+
+	if (!addr) {
+		memset(&any, 0, sizeof(any));
+		any.sin6_family = AF_INET6;
+		any.sin6_addr = in6addr_any;
+		any.sin6_port = htons(OPENWFD_WFD_IE_SUB_DEV_INFO_DEFAULT_PORT);
+		addr = &any;
+	}
+
+	fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -errno;
+
+	set = 1;
+	r = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set));
+	if (r < 0) {
+		r = -errno;
+		goto err_fd;
+	}
+
+	if (srv->flags & OWFD_RTSP_SERVER_REUSEPORT) {
+		r = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &set,
+			       sizeof(set));
+		if (r < 0) {
+			r = -errno;
+			goto err_fd;
+		}
+	}
+
+	r = bind(fd, (struct sockaddr*)addr, sizeof(*addr));
+	if (r < 0) {
+		r = -errno;
+		goto err_fd;
+	}
+
+	r = owfd_rtsp_server_listen_fd(srv, fd);
+	if (r < 0)
+		goto err_fd;
+
+	return 0;
+
+err_fd:
+	close(fd);
+	return r;
+}
+
+int owfd_rtsp_server_get_addr(struct owfd_rtsp_server *srv,
+			      struct sockaddr_in6 *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int r;
+
+	if (srv->fd < 0)
+		return -ENOTCONN;
+
+	r = getsockname(srv->fd, (struct sockaddr*)addr, &len);
+	if (r < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* stop listening and close all sessions */
+void owfd_rtsp_server_close(struct owfd_rtsp_server *srv)
+{
+	struct owfd_rtsp_session *sess;
+
+	if (srv->fd >= 0) {
+		epoll_ctl(srv->efd, EPOLL_CTL_DEL, srv->fd, NULL);
+		close(srv->fd);
+		srv->fd = -1;
+	}
+
+	while (!shl_dlist_empty(&srv->sessions)) {
+		sess = shl_dlist_first_entry(&srv->sessions,
+					     struct owfd_rtsp_session, list);
+		owfd_rtsp_session_close(sess);
+	}
+}
+
+int owfd_rtsp_server_get_fd(struct owfd_rtsp_server *srv)
+{
+	return srv->efd;
+}
+
+/*
+ * Make a (concurrent or the next) owfd_rtsp_server_dispatch() return early.
+ * This is the only server function that may be called from any thread.
+ */
+void owfd_rtsp_server_wake(struct owfd_rtsp_server *srv)
+{
+	uint64_t v = 1;
+	ssize_t l;
+
+	/* EAGAIN means the counter is saturated, so it is readable */
+	l = write(srv->wake_fd, &v, sizeof(v));
+	(void)l;
+}
+
+static int session_new(struct owfd_rtsp_server *srv, int fd)
+{
+	struct owfd_rtsp_session *sess;
+	int r;
+
+	sess = calloc(1, sizeof(*sess));
+	if (!sess)
+		return -ENOMEM;
+	sess->srv = srv;
+
+	r = owfd_rtsp_ctrl_new_shared(&sess->ctrl, srv->efd, sess);
+	if (r < 0)
+		goto err_sess;
+	owfd_rtsp_ctrl_set_chain_pool(sess->ctrl, &srv->pool);
+
+	if (srv->uring) {
+		r = owfd_rtsp_ctrl_set_uring(sess->ctrl, srv->uring);
+		if (r < 0)
+			goto err_ctrl;
+	} else if (srv->flags & OWFD_RTSP_SERVER_EDGE) {
+		owfd_rtsp_ctrl_set_flags(sess->ctrl, OWFD_RTSP_CTRL_EDGE);
+	}
+	if (srv->budget)
+		owfd_rtsp_ctrl_set_budget(sess->ctrl, srv->rx_budget,
+					  srv->msg_budget);
+
+	r = owfd_rtsp_ctrl_open_tcp_fd(sess->ctrl, fd, NULL);
+	if (r < 0)
+		goto err_ctrl;
+
+	session_timers(sess);
+	shl_dlist_link_tail(&srv->sessions, &sess->list);
+	++srv->stats.accepted;
+	if (++srv->stats.sessions > srv->stats.peak_sessions)
+		srv->stats.peak_sessions = srv->stats.sessions;
+
+	if (srv->cb)
+		srv->cb(srv, sess, OWFD_RTSP_SERVER_CONNECT, srv->data);
+
+	return 0;
+
+err_ctrl:
+	owfd_rtsp_ctrl_unref(sess->ctrl);
+err_sess:
+	free(sess);
+	return r;
+}
+
+static void accept_all(struct owfd_rtsp_server *srv)
+{
+	size_t i;
+	int fd, r;
+
+	for (i = 0; i < SERVER_ACCEPT_BATCH && srv->fd >= 0; ++i) {
+		fd = accept4(srv->fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/* EAGAIN, or out of fds/memory: retry next time */
+			break;
+		}
+
+		if (srv->max_sessions &&
+		    srv->stats.sessions >= srv->max_sessions) {
+			++srv->stats.rejected;
+			close(fd);
+			continue;
+		}
+
+		r = session_new(srv, fd);
+		if (r < 0) {
+			++srv->stats.rejected;
+			close(fd);
+		}
+	}
+}
+
+static void session_dispatch(struct owfd_rtsp_session *sess, uint32_t events)
+{
+	struct owfd_rtsp_server *srv = sess->srv;
+	int r;
+
+	if (sess->ready.next)
+		shl_dlist_unlink(&sess->ready);
+
+	r = owfd_rtsp_ctrl_dispatch_events(sess->ctrl, events);
+	if (r < 0 || !owfd_rtsp_ctrl_is_open(sess->ctrl))
+		owfd_rtsp_session_close(sess);
+	else if (owfd_rtsp_ctrl_is_pending(sess->ctrl))
+		shl_dlist_link_tail(&srv->ready, &sess->ready);
+}
+
+int owfd_rtsp_server_dispatch(struct owfd_rtsp_server *srv, int timeout)
+{
+	struct epoll_event evs[64];
+	const size_t max = sizeof(evs) / sizeof(*evs);
+	struct owfd_rtsp_session *sess;
+	struct shl_dlist todo;
+	uint64_t v;
+	ssize_t l;
+	int i, n;
+
+	/* sessions with input left over do not wait */
+	if (!shl_dlist_empty(&srv->ready))
+		timeout = 0;
+
+	n = epoll_wait(srv->efd, evs, max, timeout);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		else
+			return -errno;
+	} else if (n > max) {
+		n = max;
+	}
+
+	/* callbacks may drop the last reference */
+	owfd_rtsp_server_ref(srv);
+	++srv->dispatching;
+
+	/* sessions queued now are served after this batch of events */
+	shl_dlist_init(&todo);
+	while (!shl_dlist_empty(&srv->ready)) {
+		sess = shl_dlist_first_entry(&srv->ready,
+					     struct owfd_rtsp_session, ready);
+		shl_dlist_unlink(&sess->ready);
+		shl_dlist_link_tail(&todo, &sess->ready);
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (evs[i].data.ptr == &srv->fd) {
+			accept_all(srv);
+			continue;
+		} else if (evs[i].data.ptr == &srv->wheel) {
+			shl_wheel_dispatch(&srv->wheel);
+			continue;
+		} else if (evs[i].data.ptr == &srv->uring) {
+			owfd_rtsp_uring_dispatch(srv->uring);
+			continue;
+		} else if (evs[i].data.ptr == &srv->wake_fd) {
+			l = read(srv->wake_fd, &v, sizeof(v));
+			(void)l;
+			continue;
+		}
+
+		sess = evs[i].data.ptr;
+		if (!sess->dead)
+			session_dispatch(sess, evs[i].events);
+	}
+
+	while (!shl_dlist_empty(&todo)) {
+		sess = shl_dlist_first_entry(&todo, struct owfd_rtsp_session,
+					     ready);
+		session_dispatch(sess, EPOLLIN);
+	}
+
+	if (!--srv->dispatching)
+		session_reap(srv);
+
+	owfd_rtsp_server_unref(srv);
+	return 0;
+}
+
+void owfd_rtsp_server_get_stats(struct owfd_rtsp_server *srv,
+				struct owfd_rtsp_server_stats *stats)
+{
+	struct owfd_rtsp_session *sess;
+	struct shl_dlist *iter;
+
+	*stats = srv->stats;
+	stats->memory = 0;
+	shl_dlist_for_each(iter, &srv->sessions) {
+		sess = shl_dlist_entry(iter, struct owfd_rtsp_session, list);
+		stats->memory += sizeof(*sess) +
+				 owfd_rtsp_ctrl_get_memory(sess->ctrl);
+	}
+}
+
+struct owfd_rtsp_ctrl *owfd_rtsp_session_get_ctrl(struct owfd_rtsp_session *sess)
+{
+	return sess->ctrl;
+}
+
+void owfd_rtsp_session_set_data(struct owfd_rtsp_session *sess, void *data)
+{
+	sess->data = data;
+}
+
+void *owfd_rtsp_session_get_data(struct owfd_rtsp_session *sess)
+{
+	return sess->data;
+}
+
+/*
+ * Close the connection of @sess. The server callback sees the CLOSE event
+ * before the ctrl is closed. @sess must not be used afterwards; it is freed
+ * once the current dispatch finished (or right away outside of dispatches).
+ */
+void owfd_rtsp_session_close(struct owfd_rtsp_session *sess)
+{
+	struct owfd_rtsp_server *srv = sess->srv;
+
+	if (sess->dead)
+		return;
+
+	sess->dead = true;
+	if (sess->ready.next)
+		shl_dlist_unlink(&sess->ready);
+	shl_dlist_unlink(&sess->list);
+	shl_dlist_link_tail(&srv->dead, &sess->list);
+	--srv->stats.sessions;
+	++srv->stats.closed;
+
+	if (srv->cb)
+		srv->cb(srv, sess, OWFD_RTSP_SERVER_CLOSE, srv->data);
+
+	owfd_rtsp_ctrl_close(sess->ctrl);
+	owfd_rtsp_ctrl_set_wheel(sess->ctrl, NULL);
+
+	if (!srv->dispatching)
+		session_reap(srv);
+}
@@ -31,6 +31,69 @@
 #include "shared.h"
 #include "rtsp.h"
 
+/*
+ * Character Classes
+ * Each byte is either part of a token, white-space (which includes CTLs and
+ * all non-ASCII bytes), a separator (which forms a token on its own) or a
+ * double-quote which starts a quoted token.
+ */
+
+enum {
+	CC_TOKEN,
+	CC_SPACE,
+	CC_SEP,
+	CC_QUOTE,
+};
+
+static const unsigned char char_class[256] = {
+	[0 ... 31] = CC_SPACE,
+	[' '] = CC_SPACE,
+	['"'] = CC_QUOTE,
+	['('] = CC_SEP,
+	[')'] = CC_SEP,
+	['['] = CC_SEP,
+	[']'] = CC_SEP,
+	['{'] = CC_SEP,
+	['}'] = CC_SEP,
+	['<'] = CC_SEP,
+	['>'] = CC_SEP,
+	['@'] = CC_SEP,
+	[','] = CC_SEP,
+	[';'] = CC_SEP,
+	[':'] = CC_SEP,
+	['\\'] = CC_SEP,
+	['/'] = CC_SEP,
+	['?'] = CC_SEP,
+	['='] = CC_SEP,
+	[127 ... 255] = CC_SPACE,
+};
+
+#define CLASS(_c) (char_class[(unsigned char)(_c)])
+
+static char unescape_char(char c)
+{
+	switch (c) {
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	case 'a':
+		return '\a';
+	case 'f':
+		return '\f';
+	case 'v':
+		return '\v';
+	case 'b':
+		return '\b';
+	case 'e':
+		return 0x1b;	/* ESC */
+	default:
+		return c;
+	}
+}
+
 ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 {
 	char *t, *dst, c, prev, last_c;
@@ -66,31 +129,11 @@ ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 
 		if (quoted) {
 			if (escaped) {
-				if (c == '\\') {
-					*dst++ = '\\';
-				} else if (c == '"') {
-					*dst++ = '"';
-				} else if (c == 'n') {
-					*dst++ = '\n';
-				} else if (c == 'r') {
-					*dst++ = '\r';
-				} else if (c == 't') {
-					*dst++ = '\t';
-				} else if (c == 'a') {
-					*dst++ = '\a';
-				} else if (c == 'f') {
-					*dst++ = '\f';
-				} else if (c == 'v') {
-					*dst++ = '\v';
-				} else if (c == 'b') {
-					*dst++ = '\b';
-				} else if (c == 'e') {
-					*dst++ = 0x1b;	/* ESC */
-				} else if (c == '0' || c == 0) {
+				if (c == '0' || c == 0) {
 					/* drop binary zero escape "\0" */
 					--dst;
 				} else {
-					*dst++ = c;
+					*dst++ = unescape_char(c);
 				}
 
 				escaped = 0;
@@ -109,7 +152,8 @@ ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 				}
 			}
 		} else {
-			if (c == '"') {
+			switch (CLASS(c)) {
+			case CC_QUOTE:
 				if (prev) {
 					*dst++ = 0;
 					++num;
@@ -118,30 +162,8 @@ ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 				quoted = 1;
 				escaped = 0;
 				last_c = 0;
-			} else if (c == 0) {
-				/* skip */
-			} else if (c == ' ') {
-				if (prev) {
-					*dst++ = 0;
-					++num;
-				}
-				last_c = 0;
-			} else if (c == '(' ||
-				   c == ')' ||
-				   c == '[' ||
-				   c == ']' ||
-				   c == '{' ||
-				   c == '}' ||
-				   c == '<' ||
-				   c == '>' ||
-				   c == '@' ||
-				   c == ',' ||
-				   c == ';' ||
-				   c == ':' ||
-				   c == '\\' ||
-				   c == '/' ||
-				   c == '?' ||
-				   c == '=') {
+				break;
+			case CC_SEP:
 				if (prev) {
 					*dst++ = 0;
 					++num;
@@ -151,15 +173,18 @@ ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 				*dst++ = 0;
 				++num;
 				last_c = 0;
-			} else if (c <= 31 || c == 127) {
-				/* ignore CTLs */
+				break;
+			case CC_SPACE:
+				/* ignore white-space and CTLs */
 				if (prev) {
 					*dst++ = 0;
 					++num;
 				}
 				last_c = 0;
-			} else {
+				break;
+			default:
 				*dst++ = c;
+				break;
 			}
 		}
 	}
@@ -174,3 +199,132 @@ ssize_t owfd_rtsp_tokenize(const char *line, char **out)
 	*out = t;
 	return num;
 }
+
+/*
+ * Span Tokenizer
+ * Same tokenization as owfd_rtsp_tokenize() but without any allocation. Tokens
+ * are returned as offset/length into @line. Quoted tokens cover the raw data
+ * between the quotes (escape sequences included) and have @quoted set. Use
+ * owfd_rtsp_token_unescape() to decode them. Unlike owfd_rtsp_tokenize(),
+ * @line does not have to be zero-terminated; binary zeros outside of quotes
+ * separate tokens.
+ */
+
+void owfd_rtsp_token_iter_init(struct owfd_rtsp_token_iter *iter,
+			       const char *line, size_t len)
+{
+	iter->line = line;
+	iter->len = len;
+	iter->pos = 0;
+}
+
+bool owfd_rtsp_token_next(struct owfd_rtsp_token_iter *iter,
+			  struct owfd_rtsp_token *tok)
+{
+	const char *line = iter->line;
+	size_t pos = iter->pos, len = iter->len, start;
+
+	while (pos < len && CLASS(line[pos]) == CC_SPACE)
+		++pos;
+
+	if (pos >= len) {
+		iter->pos = len;
+		return false;
+	}
+
+	start = pos;
+	tok->quoted = false;
+
+	switch (CLASS(line[pos])) {
+	case CC_QUOTE:
+		start = ++pos;
+		while (pos < len && line[pos] != '"') {
+			if (line[pos] == '\\' && pos + 1 < len)
+				++pos;
+			++pos;
+		}
+
+		tok->quoted = true;
+		tok->off = start;
+		tok->len = pos - start;
+
+		/* skip closing quote, if any */
+		if (pos < len)
+			++pos;
+		break;
+	case CC_SEP:
+		tok->off = start;
+		tok->len = 1;
+		++pos;
+		break;
+	default:
+		while (pos < len && CLASS(line[pos]) == CC_TOKEN)
+			++pos;
+
+		tok->off = start;
+		tok->len = pos - start;
+		break;
+	}
+
+	iter->pos = pos;
+	return true;
+}
+
+/*
+ * Tokenize @line into @toks, which has room for @max tokens. Returns the total
+ * number of tokens in @line, which might be bigger than @max. In that case,
+ * only the first @max tokens are stored.
+ */
+size_t owfd_rtsp_tokenize_spans(const char *line, size_t len,
+				struct owfd_rtsp_token *toks, size_t max)
+{
+	struct owfd_rtsp_token_iter iter;
+	struct owfd_rtsp_token tok;
+	size_t num = 0;
+
+	owfd_rtsp_token_iter_init(&iter, line, len);
+	while (owfd_rtsp_token_next(&iter, &tok)) {
+		if (num < max)
+			toks[num] = tok;
+		++num;
+	}
+
+	return num;
+}
+
+/*
+ * Copy token @tok of @line into @dst and decode escape sequences of quoted
+ * tokens. @dst needs room for @tok->len + 1 bytes, the result is always
+ * zero-terminated. Returns the length of the decoded token.
+ */
+size_t owfd_rtsp_token_unescape(const char *line,
+				const struct owfd_rtsp_token *tok, char *dst)
+{
+	const char *src = &line[tok->off];
+	size_t i, l = 0;
+	char c;
+
+	if (!tok->quoted) {
+		memcpy(dst, src, tok->len);
+		dst[tok->len] = 0;
+		return tok->len;
+	}
+
+	for (i = 0; i < tok->len; ++i) {
+		c = src[i];
+		if (c == '\\' && i + 1 < tok->len) {
+			c = src[++i];
+			/* drop binary zero escape "\0" */
+			if (c == '0' || c == 0)
+				continue;
+			c = unescape_char(c);
+		} else if (c == 0) {
+			continue;
+		}
+
+		dst[l++] = c;
+	}
+
+	dst[l] = 0;
+	return l;
+}
@@ -0,0 +1,602 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "shl_dlist.h"
+#include "shl_uring.h"
+#include "rtsp.h"
+#include "rtsp_internal.h"
+
+/*
+ * io_uring backend: Instead of polling its socket, a ctrl can run all I/O
+ * through an owfd_rtsp_uring. A multishot receive delivers incoming data in
+ * buffers the kernel picks from a buffer ring shared by all its ctrls, and
+ * queued output leaves via one SENDMSG request at a time. If the socket is
+ * full, that request completes with a short count or -EAGAIN; output is then
+ * blocked and a POLLOUT poll request is armed, and the rest is sent once it
+ * completes. An interrupted send (-EINTR) is retried right away. All
+ * requests of a dispatch are submitted with a single io_uring_enter(). The
+ * io_uring fd itself sits in the caller's epoll set.
+ * Requests keep the ctrl alive; its memory is only released once all of
+ * them completed.
+ */
+struct owfd_rtsp_uring {
+	struct shl_uring u;
+	struct shl_uring_bufs bufs;
+	owfd_rtsp_uring_cb cb;
+	void *data;
+	unsigned int dispatching;
+	size_t ops;
+	struct owfd_rtsp_uring_stats stats;
+};
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_BGID 0
+#define URING_BUFS 256
+#define URING_OWN_BUFS 16
+#define URING_BUF_SIZE 4096
+
+/* the low bits of the user data tell the request type, the rest the ctrl */
+enum uring_op {
+	URING_OP_POLL = 1,
+	URING_OP_RECV = 2,
+	URING_OP_SEND = 3,
+	URING_OP_POLLOUT = 4,
+	URING_OP_MASK = 7,
+};
+
+/* requests are submitted at the end of a dispatch, or right away otherwise */
+static int uring_flush(struct owfd_rtsp_uring *uring)
+{
+	int r;
+
+	if (uring->dispatching)
+		return 0;
+
+	r = shl_uring_submit(&uring->u, 0);
+	return r < 0 ? r : 0;
+}
+
+static struct io_uring_sqe *uring_sqe(struct owfd_rtsp_ctrl *ctrl,
+				      unsigned int op, unsigned int opcode)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = shl_uring_get_sqe(&ctrl->uring->u);
+	if (!sqe)
+		return NULL;
+
+	sqe->opcode = opcode;
+	sqe->fd = ctrl->fd;
+	sqe->user_data = (uintptr_t)ctrl | op;
+	++ctrl->uring_ops;
+	++ctrl->uring->ops;
+
+	return sqe;
+}
+
+/* a connecting socket becomes writable once it is connected */
+int ctrl_uring_poll(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe(ctrl, URING_OP_POLL, IORING_OP_POLL_ADD);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->poll32_events = POLLOUT;
+	return uring_flush(ctrl->uring);
+}
+
+static int uring_recv(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe(ctrl, URING_OP_RECV, IORING_OP_RECV);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	return uring_flush(ctrl->uring);
+}
+
+/* send everything queued (up to CTRL_IOV_MAX iovecs) as one request */
+int ctrl_uring_send(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct io_uring_sqe *sqe;
+	struct ctrl_send *s;
+	size_t i, n;
+	bool more;
+
+	/* while blocked, the POLLOUT request resumes sending */
+	if (ctrl->uring_sending || ctrl->out_blocked || !ctrl->connected ||
+	    shl_dlist_empty(&ctrl->out_list))
+		return 0;
+
+	if (!ctrl->uring_send) {
+		ctrl->uring_send = malloc(sizeof(*ctrl->uring_send));
+		if (!ctrl->uring_send)
+			return -ENOMEM;
+	}
+
+	s = ctrl->uring_send;
+	n = ctrl_out_peek(ctrl, s->vec, &more);
+	for (i = 0, s->len = 0; i < n; ++i)
+		s->len += s->vec[i].iov_len;
+
+	memset(&s->msg, 0, sizeof(s->msg));
+	s->msg.msg_iov = s->vec;
+	s->msg.msg_iovlen = n;
+
+	sqe = uring_sqe(ctrl, URING_OP_SEND, IORING_OP_SENDMSG);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->addr = (uintptr_t)&s->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+
+	ctrl->uring_sending = 1;
+	++ctrl->stats.writes;
+	return uring_flush(ctrl->uring);
+}
+
+/* cancel all requests on the socket; submitted now, before it is closed */
+void ctrl_uring_cancel(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!ctrl->uring_ops)
+		return;
+
+	sqe = shl_uring_get_sqe(&ctrl->uring->u);
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = ctrl->fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = 0;
+	shl_uring_submit(&ctrl->uring->u, 0);
+}
+
+static int uring_input(struct owfd_rtsp_ctrl *ctrl, char *buf, size_t len)
+{
+	int r;
+
+	if (ctrl->timeout_ms && ctrl->wheel)
+		ctrl->last_rx = shl_wheel_time(ctrl->wheel);
+	ctrl->stats.bytes_received += len;
+
+	if (ctrl->msg_cb) {
+		/* the decoder recovers from malformed messages */
+		r = owfd_rtsp_decoder_feed(ctrl->dec, buf, len);
+		if (r == -ENOMEM)
+			return r;
+	} else if (ctrl->cb) {
+		ctrl->cb(ctrl, buf, len, ctrl->data);
+	}
+
+	return ctrl->connected ? 0 : -EPIPE;
+}
+
+static int uring_recv_done(struct owfd_rtsp_ctrl *ctrl,
+			   const struct io_uring_cqe *cqe, bool last)
+{
+	struct owfd_rtsp_uring *uring = ctrl->uring;
+	uint16_t bid;
+	char *buf;
+	int r = 0;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = shl_uring_bufs_get(&uring->bufs, bid);
+		++uring->stats.recv_bufs;
+
+		if (cqe->res > 0)
+			r = uring_input(ctrl, buf, cqe->res);
+		shl_uring_bufs_put(&uring->bufs, bid);
+		if (r < 0)
+			return r;
+	}
+
+	if (!cqe->res)
+		return -EPIPE;
+	if (cqe->res < 0 && cqe->res != -ENOBUFS)
+		return cqe->res;
+
+	/* multishot receives stop if the kernel ran out of buffers */
+	if (last && owfd_rtsp_ctrl_is_open(ctrl)) {
+		++uring->stats.rearms;
+		return uring_recv(ctrl);
+	}
+
+	return 0;
+}
+
+/* the socket is full; block output until it becomes writable again */
+static int uring_wait_out(struct owfd_rtsp_ctrl *ctrl)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe(ctrl, URING_OP_POLLOUT, IORING_OP_POLL_ADD);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->poll32_events = POLLOUT;
+	ctrl_out_block(ctrl);
+	return uring_flush(ctrl->uring);
+}
+
+static int uring_send_done(struct owfd_rtsp_ctrl *ctrl, int res)
+{
+	/* the next request is sent when the completion handler uncorks */
+	if (res == -EINTR)
+		return 0;
+	if (res == -EAGAIN)
+		return uring_wait_out(ctrl);
+	if (res < 0)
+		return res;
+
+	ctrl->stats.bytes_sent += res;
+	ctrl_out_advance(ctrl, res);
+	if (shl_dlist_empty(&ctrl->out_list)) {
+		ctrl_out_unblock(ctrl);
+		return 0;
+	}
+
+	if ((size_t)res < ctrl->uring_send->len) {
+		++ctrl->stats.short_writes;
+		return uring_wait_out(ctrl);
+	}
+
+	return 0;
+}
+
+static int uring_writable(struct owfd_rtsp_ctrl *ctrl, int res)
+{
+	if (res < 0)
+		return res;
+	if (res & (POLLERR | POLLHUP))
+		return -EPIPE;
+
+	/* the uncork after this sends the rest of the queue */
+	ctrl->out_blocked = 0;
+	return 0;
+}
+
+static int uring_connected(struct owfd_rtsp_ctrl *ctrl, int res)
+{
+	int r;
+
+	if (res < 0)
+		return res;
+	if (res & (POLLERR | POLLHUP))
+		return -EPIPE;
+
+	r = ctrl_connect_done(ctrl);
+	if (r < 0)
+		return r;
+
+	return uring_recv(ctrl);
+}
+
+static void uring_complete(struct owfd_rtsp_uring *uring,
+			   const struct io_uring_cqe *cqe)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+	unsigned int op;
+	bool last;
+	int r;
+
+	++uring->stats.completions;
+	if (!cqe->user_data)
+		return;
+
+	ctrl = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+	op = cqe->user_data & URING_OP_MASK;
+	last = !(cqe->flags & IORING_CQE_F_MORE);
+	if (last) {
+		--ctrl->uring_ops;
+		--uring->ops;
+	}
+	if (op == URING_OP_SEND)
+		ctrl->uring_sending = 0;
+
+	/* late completions of a closed ctrl */
+	if (ctrl->freeing || !owfd_rtsp_ctrl_is_open(ctrl)) {
+		if (cqe->flags & IORING_CQE_F_BUFFER)
+			shl_uring_bufs_put(&uring->bufs,
+					   cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		if (op == URING_OP_SEND)
+			ctrl_out_flush(ctrl);
+		if (ctrl->freeing && !ctrl->uring_ops && !ctrl->own_uring)
+			ctrl_destroy(ctrl);
+		return;
+	}
+
+	/* callbacks may drop the last reference */
+	owfd_rtsp_ctrl_ref(ctrl);
+	owfd_rtsp_ctrl_cork(ctrl);
+
+	if (op == URING_OP_POLL)
+		r = uring_connected(ctrl, cqe->res);
+	else if (op == URING_OP_RECV)
+		r = uring_recv_done(ctrl, cqe, last);
+	else if (op == URING_OP_POLLOUT)
+		r = uring_writable(ctrl, cqe->res);
+	else
+		r = uring_send_done(ctrl, cqe->res);
+
+	if (r >= 0)
+		r = owfd_rtsp_ctrl_uncork(ctrl);
+	else
+		--ctrl->corked;
+	if (r < 0)
+		owfd_rtsp_ctrl_close(ctrl);
+	if (!owfd_rtsp_ctrl_is_open(ctrl) && uring->cb)
+		uring->cb(uring, ctrl->tag, uring->data);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+
+static size_t uring_reap(struct owfd_rtsp_uring *uring)
+{
+	struct io_uring_cqe *cqe, c;
+	size_t n = 0;
+
+	while ((cqe = shl_uring_peek(&uring->u))) {
+		/* handlers may submit, which can post new completions */
+		c = *cqe;
+		shl_uring_seen(&uring->u);
+		uring_complete(uring, &c);
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Multishot receives came after provided-buffer rings. Kernels without them
+ * fail the request with -EINVAL, others complete it with 0 on a socket whose
+ * peer is gone, which also ends the multishot.
+ */
+static int uring_probe(struct owfd_rtsp_uring *uring)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int r, fds[2];
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	if (r < 0)
+		return -errno;
+	close(fds[1]);
+
+	sqe = shl_uring_get_sqe(&uring->u);
+	if (!sqe) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fds[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = 0;
+
+	while (!(cqe = shl_uring_peek(&uring->u))) {
+		r = shl_uring_submit(&uring->u, 1);
+		if (r < 0)
+			goto out;
+	}
+
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+		shl_uring_bufs_put(&uring->bufs,
+				   cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+	r = cqe->res == -EINVAL ? -EINVAL : 0;
+	shl_uring_seen(&uring->u);
+
+out:
+	close(fds[0]);
+	return r;
+}
+
+static int uring_create(struct owfd_rtsp_uring **out, unsigned int bufs,
+		        owfd_rtsp_uring_cb cb, void *data)
+{
+	struct owfd_rtsp_uring *uring;
+	int r;
+
+	uring = calloc(1, sizeof(*uring));
+	if (!uring)
+		return -ENOMEM;
+	uring->cb = cb;
+	uring->data = data;
+
+	r = shl_uring_init(&uring->u, URING_ENTRIES, URING_CQ_ENTRIES);
+	if (r < 0)
+		goto err_free;
+
+	r = shl_uring_bufs_init(&uring->u, &uring->bufs, URING_BGID, bufs,
+				URING_BUF_SIZE);
+	if (r < 0)
+		goto err_uring;
+
+	r = uring_probe(uring);
+	if (r < 0)
+		goto err_bufs;
+
+	*out = uring;
+	return 0;
+
+err_bufs:
+	shl_uring_bufs_destroy(&uring->u, &uring->bufs);
+err_uring:
+	shl_uring_destroy(&uring->u);
+err_free:
+	free(uring);
+	return r;
+}
+
+/*
+ * Create an io_uring instance for the backend. Returns -ENOSYS, -EPERM or
+ * -EINVAL if io_uring, or one of the features used, is not available; callers
+ * then keep using epoll. @cb is called for each ctrl that it closed due to
+ * errors or hangups, with the ctrl's epoll tag.
+ */
+int owfd_rtsp_uring_new(struct owfd_rtsp_uring **out, owfd_rtsp_uring_cb cb,
+			void *data)
+{
+	return uring_create(out, URING_BUFS, cb, data);
+}
+
+/*
+ * All ctrls using @uring must be closed. Their remaining requests are waited
+ * for, so ctrls that were unreferenced already are released, too.
+ */
+void owfd_rtsp_uring_free(struct owfd_rtsp_uring *uring)
+{
+	if (!uring)
+		return;
+
+	++uring->dispatching;
+	while (uring->ops > 0) {
+		if (shl_uring_submit(&uring->u, 1) < 0)
+			break;
+		uring_reap(uring);
+	}
+
+	shl_uring_bufs_destroy(&uring->u, &uring->bufs);
+	shl_uring_destroy(&uring->u);
+	free(uring);
+}
+
+/* becomes readable whenever completions are ready */
+int owfd_rtsp_uring_get_fd(struct owfd_rtsp_uring *uring)
+{
+	return uring->u.fd;
+}
+
+/*
+ * Handle all completions and submit the requests they caused. Requests that
+ * complete right away are handled in the same call, so a round trip with the
+ * peer usually costs one io_uring_enter(). Returns the number of completions
+ * handled or a negative error code.
+ */
+int owfd_rtsp_uring_dispatch(struct owfd_rtsp_uring *uring)
+{
+	size_t n = 0, rounds;
+	int r = 0;
+
+	++uring->dispatching;
+	for (rounds = 0; rounds < 4; ++rounds) {
+		n += uring_reap(uring);
+		if (shl_uring_overflow(&uring->u))
+			continue;
+		if (!shl_uring_pending(&uring->u))
+			break;
+
+		r = shl_uring_submit(&uring->u, 0);
+		if (r < 0)
+			break;
+	}
+	--uring->dispatching;
+
+	/* requests queued by the last round */
+	if (r >= 0)
+		r = shl_uring_submit(&uring->u, 0);
+
+	return r < 0 ? r : (int)n;
+}
+
+void owfd_rtsp_uring_get_stats(struct owfd_rtsp_uring *uring,
+			       struct owfd_rtsp_uring_stats *stats)
+{
+	*stats = uring->stats;
+	stats->enters = uring->u.enters;
+}
+
+/*
+ * Run I/O of @ctrl through @uring, which the caller dispatches, instead of
+ * epoll. If @uring is NULL, a standalone ctrl creates one of its own on its
+ * epoll fd. Only possible while the ctrl is closed; on errors, the ctrl keeps
+ * using epoll.
+ */
+int owfd_rtsp_ctrl_set_uring(struct owfd_rtsp_ctrl *ctrl,
+			     struct owfd_rtsp_uring *uring)
+{
+	struct epoll_event ev;
+	int r;
+
+	if (ctrl->uring)
+		return -EALREADY;
+	if (owfd_rtsp_ctrl_is_open(ctrl))
+		return -EBUSY;
+
+	if (uring) {
+		ctrl->uring = uring;
+		return 0;
+	}
+
+	if (ctrl->shared)
+		return -EINVAL;
+
+	r = uring_create(&uring, URING_OWN_BUFS, NULL, NULL);
+	if (r < 0)
+		return r;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &ctrl->uring;
+
+	r = epoll_ctl(ctrl->efd, EPOLL_CTL_ADD, owfd_rtsp_uring_get_fd(uring),
+		      &ev);
+	if (r < 0) {
+		r = -errno;
+		owfd_rtsp_uring_free(uring);
+		return r;
+	}
+
+	ctrl->uring = uring;
+	ctrl->own_uring = 1;
+	return 0;
+}
+
+struct owfd_rtsp_uring *owfd_rtsp_ctrl_get_uring(struct owfd_rtsp_ctrl *ctrl)
+{
+	return ctrl->uring;
+}
@@ -0,0 +1,529 @@
+/*
+ * SHL - Segmented buffer chain
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Segmented buffer chain
+ * Each segment stores data in [start, end) of its payload. All segments but
+ * the last one that contains data are full (end == cap), so appending always
+ * continues in the "fill" segment. shl_chain_reserve() may link empty
+ * segments behind it, which shl_chain_commit() fills or releases again.
+ * @cap is the payload size, unless shl_chain_reserve_contig() sealed the
+ * segment early because the requested span did not fit anymore.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "shl_chain.h"
+#include "shl_dlist.h"
+
+struct chain_seg {
+	struct shl_dlist list;
+	size_t start;
+	size_t end;
+	size_t cap;
+	size_t size;
+	char data[];
+};
+
+#define SEG_DATA (SHL_CHAIN_SEG_SIZE - offsetof(struct chain_seg, data))
+
+#define seg_entry(_l) shl_dlist_entry((_l), struct chain_seg, list)
+
+/*
+ * Each thread has its own default pool, so chains need no locking as long as
+ * they are only used by the thread that initialized them. Pools cache up to
+ * 256KiB of idle segments by default. Threads should call
+ * shl_chain_pool_trim() on their default pool before they exit.
+ */
+static __thread struct shl_chain_pool default_pool;
+
+struct shl_chain_pool *shl_chain_pool_default(void)
+{
+	if (!default_pool.free.next) {
+		shl_dlist_init(&default_pool.free);
+		default_pool.high = 64;
+	}
+
+	return &default_pool;
+}
+
+/*
+ * Set the high-water mark of @pool. Idle segments above @high are freed when
+ * they are returned to the pool. Any excess is released right away.
+ */
+void shl_chain_pool_set_high(struct shl_chain_pool *pool, size_t high)
+{
+	pool->high = high;
+	shl_chain_pool_trim(pool, high);
+}
+
+/* free idle segments of @pool until at most @keep are left */
+void shl_chain_pool_trim(struct shl_chain_pool *pool, size_t keep)
+{
+	struct chain_seg *seg;
+
+	while (pool->num_free > keep) {
+		seg = seg_entry(shl_dlist_first(&pool->free));
+		shl_dlist_unlink(&seg->list);
+		--pool->num_free;
+		free(seg);
+	}
+}
+
+static struct chain_seg *pool_get(struct shl_chain_pool *pool)
+{
+	struct chain_seg *seg;
+
+	if (!shl_dlist_empty(&pool->free)) {
+		seg = seg_entry(shl_dlist_first(&pool->free));
+		shl_dlist_unlink(&seg->list);
+		--pool->num_free;
+	} else {
+		seg = malloc(SHL_CHAIN_SEG_SIZE);
+		if (!seg)
+			return NULL;
+	}
+
+	++pool->num_used;
+	seg->start = 0;
+	seg->end = 0;
+	seg->cap = SEG_DATA;
+	seg->size = SEG_DATA;
+	return seg;
+}
+
+/* segments bigger than the default are allocated directly, never cached */
+static struct chain_seg *pool_get_size(struct shl_chain_pool *pool,
+				       size_t size)
+{
+	struct chain_seg *seg;
+
+	if (size <= SEG_DATA)
+		return pool_get(pool);
+
+	seg = malloc(offsetof(struct chain_seg, data) + size);
+	if (!seg)
+		return NULL;
+
+	++pool->num_used;
+	seg->start = 0;
+	seg->end = 0;
+	seg->cap = size;
+	seg->size = size;
+	return seg;
+}
+
+static void pool_put(struct shl_chain_pool *pool, struct chain_seg *seg)
+{
+	--pool->num_used;
+
+	if (pool->num_free >= pool->high || seg->size != SEG_DATA) {
+		free(seg);
+	} else {
+		/* recently used segments are handed out first */
+		shl_dlist_link(&pool->free, &seg->list);
+		++pool->num_free;
+	}
+}
+
+/*
+ * Initialize an empty chain. Segments are taken from @pool, or the shared
+ * default pool if @pool is NULL. The pool must outlive the chain.
+ */
+void shl_chain_init(struct shl_chain *c, struct shl_chain_pool *pool)
+{
+	shl_dlist_init(&c->segs);
+	c->pool = pool ? : shl_chain_pool_default();
+	c->len = 0;
+}
+
+/* drop all data and return all segments to the pool */
+void shl_chain_clear(struct shl_chain *c)
+{
+	struct chain_seg *seg;
+
+	while (!shl_dlist_empty(&c->segs)) {
+		seg = seg_entry(shl_dlist_first(&c->segs));
+		shl_dlist_unlink(&seg->list);
+		pool_put(c->pool, seg);
+	}
+
+	c->len = 0;
+}
+
+/* return the segment that new data is appended to, NULL if there is none */
+static struct chain_seg *chain_fill(struct shl_chain *c)
+{
+	struct chain_seg *seg, *prev;
+
+	if (shl_dlist_empty(&c->segs))
+		return NULL;
+
+	/* skip empty segments linked by shl_chain_reserve() */
+	seg = seg_entry(shl_dlist_last(&c->segs));
+	while (!seg->end && seg->list.prev != &c->segs) {
+		prev = seg_entry(seg->list.prev);
+		if (prev->end == prev->cap)
+			break;
+		seg = prev;
+	}
+
+	return seg;
+}
+
+/* make sure at least @min bytes of free space are linked into the chain */
+static int chain_grow(struct shl_chain *c, size_t min)
+{
+	struct chain_seg *seg;
+	size_t room = 0;
+
+	if (!shl_dlist_empty(&c->segs)) {
+		seg = seg_entry(shl_dlist_last(&c->segs));
+		room = seg->cap - seg->end;
+	}
+
+	while (room < min) {
+		seg = pool_get(c->pool);
+		if (!seg)
+			return -ENOMEM;
+
+		shl_dlist_link_tail(&c->segs, &seg->list);
+		room += SEG_DATA;
+	}
+
+	return 0;
+}
+
+/* release empty segments at the tail, but keep the last one for new data */
+static void chain_release(struct shl_chain *c)
+{
+	struct chain_seg *seg;
+
+	while (c->segs.prev != c->segs.next) {
+		seg = seg_entry(shl_dlist_last(&c->segs));
+		if (seg->end)
+			break;
+
+		shl_dlist_unlink(&seg->list);
+		pool_put(c->pool, seg);
+	}
+}
+
+/*
+ * Append @len bytes from @buf to the chain. Existing data is never moved, new
+ * segments are linked as needed. Returns -ENOMEM on OOM, 0 on success. The
+ * chain is unchanged on failure.
+ */
+int shl_chain_push(struct shl_chain *c, const void *buf, size_t len)
+{
+	struct iovec vec = { (void*)buf, len };
+
+	return shl_chain_pushv(c, &vec, 1);
+}
+
+/* append the data of @n iovecs in @vec, all or nothing like shl_chain_push() */
+int shl_chain_pushv(struct shl_chain *c, const struct iovec *vec, size_t n)
+{
+	return shl_chain_pushv_skip(c, vec, n, 0);
+}
+
+/*
+ * Like shl_chain_pushv() but without the first @skip bytes of @vec, e.g. the
+ * part of a message that was already written elsewhere.
+ */
+int shl_chain_pushv_skip(struct shl_chain *c, const struct iovec *vec,
+			 size_t n, size_t skip)
+{
+	struct shl_dlist *iter;
+	struct chain_seg *seg;
+	const char *b;
+	size_t i, l, len;
+	int r;
+
+	len = 0;
+	for (i = 0; i < n; ++i)
+		len += vec[i].iov_len;
+	if (len <= skip)
+		return 0;
+
+	r = chain_grow(c, len - skip);
+	if (r < 0) {
+		chain_release(c);
+		return r;
+	}
+
+	seg = chain_fill(c);
+	iter = &seg->list;
+	for (i = 0; i < n; ++i) {
+		b = vec[i].iov_base;
+		len = vec[i].iov_len;
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+		b += skip;
+		len -= skip;
+		skip = 0;
+
+		while (len > 0) {
+			seg = seg_entry(iter);
+			l = seg->cap - seg->end;
+			if (!l) {
+				iter = iter->next;
+				continue;
+			}
+			if (l > len)
+				l = len;
+
+			memcpy(&seg->data[seg->end], b, l);
+			seg->end += l;
+			c->len += l;
+			b += l;
+			len -= l;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Reserve room for at least @min bytes of new data and return the free space
+ * in @vec, which must have room for @max iovecs. Returns the number of iovecs
+ * filled or -ENOMEM on OOM. @max must be big enough to cover @min bytes
+ * (@min / 4000 + 2 is always sufficient). Data written there is appended
+ * by shl_chain_commit(). No other operation may be called in between.
+ */
+int shl_chain_reserve(struct shl_chain *c, size_t min, struct iovec *vec,
+		      size_t max)
+{
+	struct shl_dlist *iter;
+	struct chain_seg *seg;
+	size_t n;
+	int r;
+
+	r = chain_grow(c, min ? min : 1);
+	if (r < 0)
+		return r;
+
+	seg = chain_fill(c);
+	iter = &seg->list;
+	for (n = 0; n < max && iter != &c->segs; iter = iter->next) {
+		seg = seg_entry(iter);
+		if (seg->end == seg->cap)
+			continue;
+
+		vec[n].iov_base = &seg->data[seg->end];
+		vec[n].iov_len = seg->cap - seg->end;
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Reserve @len contiguous bytes at the end of the chain and return a pointer
+ * to them, or NULL on OOM. If the fill segment has less room left, it is
+ * sealed and a new segment is linked, bigger than the default if needed.
+ * Data written there is appended by shl_chain_commit().
+ */
+void *shl_chain_reserve_contig(struct shl_chain *c, size_t len)
+{
+	struct chain_seg *seg = NULL;
+
+	chain_release(c);
+	if (!shl_dlist_empty(&c->segs)) {
+		seg = seg_entry(shl_dlist_last(&c->segs));
+		if (seg->cap - seg->end >= len)
+			return &seg->data[seg->end];
+
+		if (seg->end) {
+			seg->cap = seg->end;
+		} else {
+			shl_dlist_unlink(&seg->list);
+			pool_put(c->pool, seg);
+		}
+	}
+
+	seg = pool_get_size(c->pool, len);
+	if (!seg)
+		return NULL;
+
+	shl_dlist_link_tail(&c->segs, &seg->list);
+	return seg->data;
+}
+
+/*
+ * Append @len bytes that were written into the space returned by
+ * shl_chain_reserve(). Reserved segments that stay empty are released.
+ */
+void shl_chain_commit(struct shl_chain *c, size_t len)
+{
+	struct chain_seg *seg;
+	struct shl_dlist *iter;
+	size_t l;
+
+	seg = chain_fill(c);
+	if (!seg)
+		return;
+
+	for (iter = &seg->list; len > 0 && iter != &c->segs;
+	     iter = iter->next) {
+		seg = seg_entry(iter);
+		l = seg->cap - seg->end;
+		if (l > len)
+			l = len;
+
+		seg->end += l;
+		c->len += l;
+		len -= l;
+	}
+
+	chain_release(c);
+}
+
+/*
+ * Fill up to @max iovecs in @vec with the data of the chain, starting at the
+ * front. Returns the number of iovecs filled, 0 if the chain is empty. @vec
+ * may be NULL to count the segments with data.
+ */
+size_t shl_chain_peek(struct shl_chain *c, struct iovec *vec, size_t max)
+{
+	struct shl_dlist *iter;
+	struct chain_seg *seg;
+	size_t n = 0;
+
+	shl_dlist_for_each(iter, &c->segs) {
+		seg = seg_entry(iter);
+		if (seg->end == seg->start)
+			break;
+		if (vec) {
+			if (n >= max)
+				break;
+			vec[n].iov_base = &seg->data[seg->start];
+			vec[n].iov_len = seg->end - seg->start;
+		}
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Copy up to @len bytes from the front of the chain into @dst without
+ * removing them. Returns the number of bytes copied.
+ */
+size_t shl_chain_read(struct shl_chain *c, void *dst, size_t len)
+{
+	struct shl_dlist *iter;
+	struct chain_seg *seg;
+	char *d = dst;
+	size_t l;
+
+	shl_dlist_for_each(iter, &c->segs) {
+		if (!len)
+			break;
+
+		seg = seg_entry(iter);
+		l = seg->end - seg->start;
+		if (l > len)
+			l = len;
+
+		memcpy(d, &seg->data[seg->start], l);
+		d += l;
+		len -= l;
+	}
+
+	return d - (char*)dst;
+}
+
+/*
+ * Remove @len bytes from the front of the chain. Drained segments go back to
+ * the pool, only the last one is kept for new data. Removing more bytes than
+ * available is safe.
+ */
+void shl_chain_pull(struct shl_chain *c, size_t len)
+{
+	struct chain_seg *seg;
+	size_t l;
+
+	while (!shl_dlist_empty(&c->segs)) {
+		seg = seg_entry(shl_dlist_first(&c->segs));
+		l = seg->end - seg->start;
+		if (l > len)
+			l = len;
+
+		seg->start += l;
+		c->len -= l;
+		len -= l;
+
+		if (seg->start < seg->end)
+			break;
+
+		if (c->segs.next == c->segs.prev) {
+			seg->start = 0;
+			seg->end = 0;
+			seg->cap = seg->size;
+			break;
+		}
+
+		shl_dlist_unlink(&seg->list);
+		pool_put(c->pool, seg);
+	}
+}
+
+/*
+ * Read from @fd directly into free segments of the chain, with room for at
+ * least @min bytes. Returns the number of bytes read (0 on EOF) or a negative
+ * error code. Nothing is retried on EAGAIN or EINTR.
+ */
+ssize_t shl_chain_read_fd(struct shl_chain *c, int fd, size_t min)
+{
+	struct iovec vec[SHL_CHAIN_IOV_MAX];
+	ssize_t l;
+	int n;
+
+	n = shl_chain_reserve(c, min, vec, SHL_CHAIN_IOV_MAX);
+	if (n < 0)
+		return n;
+
+	l = readv(fd, vec, n);
+	if (l < 0) {
+		l = -errno;
+		shl_chain_commit(c, 0);
+		return l;
+	}
+
+	shl_chain_commit(c, l);
+	return l;
+}
+
+/*
+ * Write data from the front of the chain to @fd and remove it from the chain.
+ * Returns the number of bytes written or a negative error code.
+ */
+ssize_t shl_chain_write_fd(struct shl_chain *c, int fd)
+{
+	struct iovec vec[SHL_CHAIN_IOV_MAX];
+	ssize_t l;
+	size_t n;
+
+	n = shl_chain_peek(c, vec, SHL_CHAIN_IOV_MAX);
+	if (!n)
+		return 0;
+
+	l = writev(fd, vec, n);
+	if (l < 0)
+		return -errno;
+
+	shl_chain_pull(c, l);
+	return l;
+}
@@ -0,0 +1,75 @@
+/*
+ * SHL - Segmented buffer chain
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Segmented buffer chain
+ * A byte-queue stored in a list of fixed-size segments. Appending never moves
+ * existing data and drained segments are returned to a segment pool, which is
+ * shared by all chains of a thread unless a private pool is passed to
+ * shl_chain_init(). Pools cache at most @high idle segments, everything above
+ * is freed. Neither chains nor pools are locked.
+ */
+
+#ifndef SHL_CHAIN_H
+#define SHL_CHAIN_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "shl_dlist.h"
+
+/* allocation size of a single segment, including its header */
+#define SHL_CHAIN_SEG_SIZE 4096
+
+/* maximum number of iovecs used for a single readv()/writev() */
+#define SHL_CHAIN_IOV_MAX 16
+
+struct shl_chain_pool {
+	struct shl_dlist free;
+	size_t num_free;
+	size_t num_used;
+	size_t high;
+};
+
+#define SHL_CHAIN_POOL_INIT(_pool, _high) \
+	{ SHL_DLIST_INIT((_pool).free), 0, 0, (_high) }
+
+struct shl_chain {
+	struct shl_dlist segs;
+	struct shl_chain_pool *pool;
+	size_t len;
+};
+
+struct shl_chain_pool *shl_chain_pool_default(void);
+void shl_chain_pool_set_high(struct shl_chain_pool *pool, size_t high);
+void shl_chain_pool_trim(struct shl_chain_pool *pool, size_t keep);
+
+void shl_chain_init(struct shl_chain *c, struct shl_chain_pool *pool);
+void shl_chain_clear(struct shl_chain *c);
+
+int shl_chain_push(struct shl_chain *c, const void *buf, size_t len);
+int shl_chain_pushv(struct shl_chain *c, const struct iovec *vec, size_t n);
+int shl_chain_pushv_skip(struct shl_chain *c, const struct iovec *vec,
+			 size_t n, size_t skip);
+int shl_chain_reserve(struct shl_chain *c, size_t min, struct iovec *vec,
+		      size_t max);
+void *shl_chain_reserve_contig(struct shl_chain *c, size_t len);
+void shl_chain_commit(struct shl_chain *c, size_t len);
+size_t shl_chain_peek(struct shl_chain *c, struct iovec *vec, size_t max);
+size_t shl_chain_read(struct shl_chain *c, void *dst, size_t len);
+void shl_chain_pull(struct shl_chain *c, size_t len);
+ssize_t shl_chain_read_fd(struct shl_chain *c, int fd, size_t min);
+ssize_t shl_chain_write_fd(struct shl_chain *c, int fd);
+
+static inline size_t shl_chain_length(struct shl_chain *c)
+{
+	return c->len;
+}
+
+#endif  /* SHL_CHAIN_H */
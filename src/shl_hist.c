@@ -0,0 +1,87 @@
+/*
+ * SHL - Log-linear histogram
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl_hist.h"
+
+void shl_hist_init(struct shl_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/* add all values recorded in @src to @dst */
+void shl_hist_merge(struct shl_hist *dst, const struct shl_hist *src)
+{
+	size_t i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+
+	for (i = 0; i < SHL_HIST_BUCKETS; ++i)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/* largest value that is recorded in bucket @idx */
+uint64_t shl_hist_bucket_max(unsigned int idx)
+{
+	unsigned int g, e;
+
+	if (idx < SHL_HIST_SUB)
+		return idx;
+	if (idx >= SHL_HIST_BUCKETS - 1)
+		return UINT64_MAX;
+
+	g = idx / SHL_HIST_SUB;
+	e = g + SHL_HIST_SUB_BITS - 1;
+	return (((uint64_t)(SHL_HIST_SUB + idx % SHL_HIST_SUB) + 1) <<
+		(e - SHL_HIST_SUB_BITS)) - 1;
+}
+
+/*
+ * Value below which a fraction @q (0.0 to 1.0) of all recorded values lies.
+ * The upper bound of the bucket it falls into is returned, but never more
+ * than the largest recorded value. Returns 0 for empty histograms.
+ */
+uint64_t shl_hist_quantile(const struct shl_hist *h, double q)
+{
+	uint64_t rank, seen, v;
+	size_t i;
+
+	if (!h->count)
+		return 0;
+	if (q <= 0.0)
+		return h->min;
+	if (q >= 1.0)
+		return h->max;
+
+	/* the smallest value with at least @rank values at or below it */
+	rank = q * h->count;
+	if (rank < q * h->count || !rank)
+		++rank;
+
+	for (i = 0, seen = 0; i < SHL_HIST_BUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	v = shl_hist_bucket_max(i);
+	if (v > h->max)
+		v = h->max;
+	if (v < h->min)
+		v = h->min;
+	return v;
+}
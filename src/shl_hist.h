@@ -0,0 +1,73 @@
+/*
+ * SHL - Log-linear histogram
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Log-linear histogram
+ * Values below SHL_HIST_SUB get a bucket each. Above that, every power of two
+ * is split into SHL_HIST_SUB equal buckets, so any value is recorded with a
+ * relative error below 1/SHL_HIST_SUB (as in HDR histograms). Values from
+ * 2^SHL_HIST_MAX_BITS on all land in the last bucket; minimum, maximum and
+ * sum are kept exactly. Recording is a handful of instructions and never
+ * allocates.
+ */
+
+#ifndef SHL_HIST_H
+#define SHL_HIST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SHL_HIST_SUB_BITS 3
+#define SHL_HIST_SUB (1 << SHL_HIST_SUB_BITS)
+#define SHL_HIST_MAX_BITS 32
+#define SHL_HIST_BUCKETS \
+	((SHL_HIST_MAX_BITS - SHL_HIST_SUB_BITS + 1) * SHL_HIST_SUB)
+
+struct shl_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint32_t buckets[SHL_HIST_BUCKETS];
+};
+
+void shl_hist_init(struct shl_hist *h);
+void shl_hist_merge(struct shl_hist *dst, const struct shl_hist *src);
+uint64_t shl_hist_quantile(const struct shl_hist *h, double q);
+uint64_t shl_hist_bucket_max(unsigned int idx);
+
+static inline unsigned int shl_hist_bucket(uint64_t v)
+{
+	unsigned int e;
+
+	if (v < SHL_HIST_SUB)
+		return v;
+	if (v >> SHL_HIST_MAX_BITS)
+		return SHL_HIST_BUCKETS - 1;
+
+	/* exponent selects the group, the next bits the bucket within it */
+	e = 63 - __builtin_clzll(v);
+	return (e - SHL_HIST_SUB_BITS + 1) * SHL_HIST_SUB +
+	       ((v >> (e - SHL_HIST_SUB_BITS)) & (SHL_HIST_SUB - 1));
+}
+
+static inline void shl_hist_add(struct shl_hist *h, uint64_t v)
+{
+	++h->buckets[shl_hist_bucket(v)];
+	if (!h->count++ || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->sum += v;
+}
+
+static inline uint64_t shl_hist_mean(const struct shl_hist *h)
+{
+	return h->count ? h->sum / h->count : 0;
+}
+
+#endif  /* SHL_HIST_H */
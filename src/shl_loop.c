@@ -0,0 +1,366 @@
+/*
+ * SHL - Event loop
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include "shl_dlist.h"
+#include "shl_loop.h"
+#include "shl_wheel.h"
+
+static void wheel_fn(struct shl_loop_io *io, uint32_t events, void *data)
+{
+	struct shl_loop *loop = data;
+
+	shl_wheel_dispatch(&loop->wheel);
+}
+
+int shl_loop_init(struct shl_loop *loop)
+{
+	int r;
+
+	memset(loop, 0, sizeof(*loop));
+	loop->sfd = -1;
+	sigemptyset(&loop->sigmask);
+	shl_dlist_init(&loop->signals);
+	shl_dlist_init(&loop->defers);
+
+	loop->efd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->efd < 0)
+		return -errno;
+
+	r = shl_wheel_init(&loop->wheel, SHL_LOOP_TICK, SHL_WHEEL_TIMERFD);
+	if (r < 0)
+		goto err_efd;
+
+	shl_loop_io_init(&loop->wheel_io, shl_wheel_get_fd(&loop->wheel),
+			 wheel_fn, loop);
+	r = shl_loop_io_add(loop, &loop->wheel_io, EPOLLIN);
+	if (r < 0)
+		goto err_wheel;
+
+	return 0;
+
+err_wheel:
+	shl_wheel_destroy(&loop->wheel);
+err_efd:
+	close(loop->efd);
+	loop->efd = -1;
+	return r;
+}
+
+/*
+ * Sources still registered are dropped without being called. Blocked signals
+ * stay blocked.
+ */
+void shl_loop_destroy(struct shl_loop *loop)
+{
+	struct shl_loop_signal *sig;
+	struct shl_loop_defer *d;
+
+	if (loop->efd < 0)
+		return;
+
+	while (!shl_dlist_empty(&loop->signals)) {
+		sig = shl_dlist_first_entry(&loop->signals,
+					    struct shl_loop_signal, list);
+		shl_dlist_unlink(&sig->list);
+	}
+
+	while (!shl_dlist_empty(&loop->defers)) {
+		d = shl_dlist_first_entry(&loop->defers, struct shl_loop_defer,
+					  list);
+		shl_dlist_unlink(&d->list);
+	}
+
+	if (loop->sfd >= 0)
+		close(loop->sfd);
+	loop->sfd = -1;
+	shl_wheel_destroy(&loop->wheel);
+	close(loop->efd);
+	loop->efd = -1;
+}
+
+/* the epoll fd, for nesting the whole loop into a foreign one */
+int shl_loop_get_fd(struct shl_loop *loop)
+{
+	return loop->efd;
+}
+
+static void defer_run(struct shl_loop *loop)
+{
+	struct shl_dlist todo;
+	struct shl_loop_defer *d;
+
+	/* defers queued by callbacks wait for the next iteration */
+	shl_dlist_init(&todo);
+	while (!shl_dlist_empty(&loop->defers)) {
+		d = shl_dlist_first_entry(&loop->defers, struct shl_loop_defer,
+					  list);
+		shl_dlist_unlink(&d->list);
+		shl_dlist_link_tail(&todo, &d->list);
+	}
+
+	while (!shl_dlist_empty(&todo)) {
+		d = shl_dlist_first_entry(&todo, struct shl_loop_defer, list);
+		shl_dlist_unlink(&d->list);
+		d->cb(d, d->data);
+	}
+}
+
+/*
+ * Wait up to @timeout milliseconds (-1 for ever) for events and run the
+ * callbacks of all sources that are ready, followed by queued defers. Must
+ * not be called from callbacks. Returns the number of events or a negative
+ * error code.
+ */
+int shl_loop_dispatch(struct shl_loop *loop, int timeout)
+{
+	struct shl_loop_io *io;
+	int n;
+
+	if (!shl_dlist_empty(&loop->defers))
+		timeout = 0;
+
+	++loop->wakeups;
+	n = epoll_wait(loop->efd, loop->evs, SHL_LOOP_EVENTS, timeout);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			return -errno;
+		n = 0;
+	} else if (n > SHL_LOOP_EVENTS) {
+		n = SHL_LOOP_EVENTS;
+	}
+
+	loop->ev_num = n;
+	for (loop->ev_cur = 0; loop->ev_cur < loop->ev_num; ++loop->ev_cur) {
+		io = loop->evs[loop->ev_cur].data.ptr;
+		if (io)
+			io->cb(io, loop->evs[loop->ev_cur].events, io->data);
+	}
+	loop->ev_num = 0;
+	loop->ev_cur = 0;
+
+	defer_run(loop);
+
+	return n;
+}
+
+/*
+ * Dispatch until shl_loop_exit() is called. Returns the exit code or a
+ * negative error code if dispatching fails.
+ */
+int shl_loop_run(struct shl_loop *loop)
+{
+	int r;
+
+	loop->exiting = false;
+	while (!loop->exiting) {
+		r = shl_loop_dispatch(loop, -1);
+		if (r < 0)
+			return r;
+	}
+
+	return loop->exit_code;
+}
+
+/* the current iteration is finished before shl_loop_run() returns */
+void shl_loop_exit(struct shl_loop *loop, int code)
+{
+	loop->exiting = true;
+	loop->exit_code = code;
+}
+
+void shl_loop_io_init(struct shl_loop_io *io, int fd, shl_loop_io_cb cb,
+		      void *data)
+{
+	memset(io, 0, sizeof(*io));
+	io->fd = fd;
+	io->cb = cb;
+	io->data = data;
+}
+
+int shl_loop_io_add(struct shl_loop *loop, struct shl_loop_io *io,
+		    uint32_t events)
+{
+	struct epoll_event ev;
+	int r;
+
+	if (io->active)
+		return -EALREADY;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = io;
+
+	r = epoll_ctl(loop->efd, EPOLL_CTL_ADD, io->fd, &ev);
+	if (r < 0)
+		return -errno;
+
+	io->events = events;
+	io->active = true;
+	return 0;
+}
+
+int shl_loop_io_update(struct shl_loop *loop, struct shl_loop_io *io,
+		       uint32_t events)
+{
+	struct epoll_event ev;
+	int r;
+
+	if (!io->active)
+		return -EINVAL;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = io;
+
+	r = epoll_ctl(loop->efd, EPOLL_CTL_MOD, io->fd, &ev);
+	if (r < 0)
+		return -errno;
+
+	io->events = events;
+	return 0;
+}
+
+/* may be called from any callback, @io can be freed right afterwards */
+void shl_loop_io_del(struct shl_loop *loop, struct shl_loop_io *io)
+{
+	int i;
+
+	if (!io->active)
+		return;
+
+	epoll_ctl(loop->efd, EPOLL_CTL_DEL, io->fd, NULL);
+	io->active = false;
+
+	/* drop events that were fetched but not dispatched, yet */
+	for (i = loop->ev_cur + 1; i < loop->ev_num; ++i)
+		if (loop->evs[i].data.ptr == io)
+			loop->evs[i].data.ptr = NULL;
+}
+
+static void signal_fn(struct shl_loop_io *io, uint32_t events, void *data)
+{
+	struct shl_loop *loop = data;
+	struct signalfd_siginfo info;
+	struct shl_dlist *i, *t;
+	struct shl_loop_signal *sig;
+	ssize_t l;
+
+	while (1) {
+		l = read(loop->sfd, &info, sizeof(info));
+		if (l != sizeof(info))
+			break;
+
+		shl_dlist_for_each_safe(i, t, &loop->signals) {
+			sig = shl_dlist_entry(i, struct shl_loop_signal, list);
+			if (sig->signo == (int)info.ssi_signo)
+				sig->cb(sig, &info, sig->data);
+		}
+	}
+}
+
+void shl_loop_signal_init(struct shl_loop_signal *sig, int signo,
+			  shl_loop_signal_cb cb, void *data)
+{
+	memset(sig, 0, sizeof(*sig));
+	sig->signo = signo;
+	sig->cb = cb;
+	sig->data = data;
+}
+
+/*
+ * Block the signal of @sig and watch for it. The signalfd is created with the
+ * first handler.
+ */
+int shl_loop_signal_add(struct shl_loop *loop, struct shl_loop_signal *sig)
+{
+	sigset_t mask;
+	int r, fd;
+
+	if (sig->list.next)
+		return -EALREADY;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, sig->signo);
+	r = sigprocmask(SIG_BLOCK, &mask, NULL);
+	if (r < 0)
+		return -errno;
+
+	mask = loop->sigmask;
+	sigaddset(&mask, sig->signo);
+	fd = signalfd(loop->sfd, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	if (loop->sfd < 0) {
+		shl_loop_io_init(&loop->signal_io, fd, signal_fn, loop);
+		r = shl_loop_io_add(loop, &loop->signal_io, EPOLLIN);
+		if (r < 0) {
+			close(fd);
+			return r;
+		}
+		loop->sfd = fd;
+	}
+
+	loop->sigmask = mask;
+	shl_dlist_link_tail(&loop->signals, &sig->list);
+	return 0;
+}
+
+void shl_loop_signal_del(struct shl_loop *loop, struct shl_loop_signal *sig)
+{
+	struct shl_dlist *i;
+	struct shl_loop_signal *s;
+
+	if (!sig->list.next)
+		return;
+
+	shl_dlist_unlink(&sig->list);
+
+	shl_dlist_for_each(i, &loop->signals) {
+		s = shl_dlist_entry(i, struct shl_loop_signal, list);
+		if (s->signo == sig->signo)
+			return;
+	}
+
+	/* the signal stays blocked, but is no longer read */
+	sigdelset(&loop->sigmask, sig->signo);
+	signalfd(loop->sfd, &loop->sigmask, 0);
+}
+
+void shl_loop_defer_init(struct shl_loop_defer *d, shl_loop_defer_cb cb,
+			 void *data)
+{
+	memset(d, 0, sizeof(*d));
+	d->cb = cb;
+	d->data = data;
+}
+
+/* queue @d to run once at the end of the current iteration */
+void shl_loop_defer_add(struct shl_loop *loop, struct shl_loop_defer *d)
+{
+	if (shl_loop_defer_pending(d))
+		return;
+
+	shl_dlist_link_tail(&loop->defers, &d->list);
+}
+
+void shl_loop_defer_del(struct shl_loop *loop, struct shl_loop_defer *d)
+{
+	if (!shl_loop_defer_pending(d))
+		return;
+
+	shl_dlist_unlink(&d->list);
+}
@@ -0,0 +1,148 @@
+/*
+ * SHL - Event loop
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Event loop
+ * A single epoll fd that all modules of a program register their sources
+ * into. Each source carries its own callback, so a wakeup costs exactly one
+ * epoll_wait() and every event goes straight to its handler without probing
+ * other modules first.
+ * Sources are intrusive and never allocated by the loop:
+ *  - io: a file descriptor with epoll events
+ *  - timers: shl_wheel_timers on the wheel of the loop, which is driven by a
+ *    single timerfd
+ *  - signals: handlers for signals read from a signalfd; any number of
+ *    handlers may watch the same signal
+ *  - defers: one-shot callbacks that run at the end of the current iteration.
+ *    While any is queued, the loop does not sleep. A defer that re-queues
+ *    itself runs whenever the loop is idle.
+ * Sources may be added and removed from any callback. A removed io source
+ * receives no further events, even if more were already fetched.
+ */
+
+#ifndef SHL_LOOP_H
+#define SHL_LOOP_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "shl_dlist.h"
+#include "shl_wheel.h"
+
+#define SHL_LOOP_EVENTS 64
+#define SHL_LOOP_TICK 10
+
+struct shl_loop;
+struct shl_loop_io;
+struct shl_loop_signal;
+struct shl_loop_defer;
+
+typedef void (*shl_loop_io_cb) (struct shl_loop_io *io, uint32_t events,
+				void *data);
+typedef void (*shl_loop_signal_cb) (struct shl_loop_signal *sig,
+				    const struct signalfd_siginfo *info,
+				    void *data);
+typedef void (*shl_loop_defer_cb) (struct shl_loop_defer *d, void *data);
+
+struct shl_loop_io {
+	int fd;
+	uint32_t events;
+	bool active;
+	shl_loop_io_cb cb;
+	void *data;
+};
+
+struct shl_loop_signal {
+	struct shl_dlist list;
+	int signo;
+	shl_loop_signal_cb cb;
+	void *data;
+};
+
+struct shl_loop_defer {
+	struct shl_dlist list;
+	shl_loop_defer_cb cb;
+	void *data;
+};
+
+struct shl_loop {
+	int efd;
+	uint64_t wakeups;		/* epoll_wait() calls */
+
+	struct shl_wheel wheel;
+	struct shl_loop_io wheel_io;
+
+	int sfd;
+	sigset_t sigmask;
+	struct shl_loop_io signal_io;
+	struct shl_dlist signals;
+
+	struct shl_dlist defers;
+
+	/* events of the running dispatch */
+	struct epoll_event evs[SHL_LOOP_EVENTS];
+	int ev_cur;
+	int ev_num;
+
+	bool exiting;
+	int exit_code;
+};
+
+int shl_loop_init(struct shl_loop *loop);
+void shl_loop_destroy(struct shl_loop *loop);
+int shl_loop_get_fd(struct shl_loop *loop);
+
+int shl_loop_dispatch(struct shl_loop *loop, int timeout);
+int shl_loop_run(struct shl_loop *loop);
+void shl_loop_exit(struct shl_loop *loop, int code);
+
+void shl_loop_io_init(struct shl_loop_io *io, int fd, shl_loop_io_cb cb,
+		      void *data);
+int shl_loop_io_add(struct shl_loop *loop, struct shl_loop_io *io,
+		    uint32_t events);
+int shl_loop_io_update(struct shl_loop *loop, struct shl_loop_io *io,
+		       uint32_t events);
+void shl_loop_io_del(struct shl_loop *loop, struct shl_loop_io *io);
+
+void shl_loop_signal_init(struct shl_loop_signal *sig, int signo,
+			  shl_loop_signal_cb cb, void *data);
+int shl_loop_signal_add(struct shl_loop *loop, struct shl_loop_signal *sig);
+void shl_loop_signal_del(struct shl_loop *loop, struct shl_loop_signal *sig);
+
+void shl_loop_defer_init(struct shl_loop_defer *d, shl_loop_defer_cb cb,
+			 void *data);
+void shl_loop_defer_add(struct shl_loop *loop, struct shl_loop_defer *d);
+void shl_loop_defer_del(struct shl_loop *loop, struct shl_loop_defer *d);
+
+static inline bool shl_loop_defer_pending(struct shl_loop_defer *d)
+{
+	return d->list.next != NULL;
+}
+
+/* timers use the wheel of the loop, see shl_wheel_add() */
+static inline struct shl_wheel *shl_loop_get_wheel(struct shl_loop *loop)
+{
+	return &loop->wheel;
+}
+
+static inline void shl_loop_timer_add(struct shl_loop *loop,
+				      struct shl_wheel_timer *t,
+				      uint64_t msec)
+{
+	shl_wheel_add(&loop->wheel, t, msec);
+}
+
+static inline void shl_loop_timer_del(struct shl_loop *loop,
+				      struct shl_wheel_timer *t)
+{
+	shl_wheel_del(&loop->wheel, t);
+}
+
+#endif  /* SHL_LOOP_H */
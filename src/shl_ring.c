@@ -12,11 +12,121 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/uio.h>
+#include <unistd.h>
 #include "shl_ring.h"
 
 #define RING_MASK(_r, _v) ((_v) & ((_r)->size - 1))
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/*
+ * Mirrored rings map the same memfd twice, back to back. Anything written
+ * past the end of the first mapping shows up at the start of the ring, so
+ * every readable or writable region is a single contiguous span.
+ */
+
+static int ring_memfd(void)
+{
+#ifdef __NR_memfd_create
+	int fd;
+
+	fd = syscall(__NR_memfd_create, "shl-ring", MFD_CLOEXEC);
+	if (fd >= 0)
+		return fd;
+	if (errno != ENOSYS && errno != EINVAL)
+		return -errno;
+#endif
+
+	return -EOPNOTSUPP;
+}
+
+/*
+ * Switch an empty ring-buffer to a mirrored backing. Any existing buffer is
+ * released. Returns -EOPNOTSUPP if memfds are not available, in which case
+ * the ring keeps working on plain heap memory. Other errors are returned as
+ * negative error codes, the ring is unchanged then, too.
+ */
+int shl_ring_mirror(struct shl_ring *r)
+{
+	int fd;
+
+	if (r->mirror)
+		return 0;
+	if (shl_ring_length(r))
+		return -EBUSY;
+
+	fd = ring_memfd();
+	if (fd < 0)
+		return fd;
+
+	shl_ring_clear(r);
+	r->fd = fd;
+	r->mirror = true;
+
+	return 0;
+}
+
+/*
+ * Resize a mirrored ring-buffer to @nsize, which must be a multiple of the
+ * page-size and bigger than the current size. The file is extended and
+ * mapped twice at a new address, so data doesn't move. Only if it wrapped
+ * around the old end, the smaller of both halves is copied so the data is
+ * consecutive again in the bigger ring.
+ */
+static int ring_resize_mirror(struct shl_ring *r, size_t nsize)
+{
+	char *buf, *p;
+	size_t l;
+	int err;
+
+	if (ftruncate(r->fd, nsize) < 0)
+		return -errno;
+
+	/* reserve address space for both mappings first */
+	buf = mmap(NULL, 2 * nsize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		   -1, 0);
+	if (buf == MAP_FAILED)
+		return -ENOMEM;
+
+	p = mmap(buf, nsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 r->fd, 0);
+	if (p == MAP_FAILED)
+		goto err_unmap;
+
+	p = mmap(&buf[nsize], nsize, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, r->fd, 0);
+	if (p == MAP_FAILED)
+		goto err_unmap;
+
+	if (r->end < r->start) {
+		l = r->size - r->start;
+		if (r->end <= l) {
+			memcpy(&buf[r->size], buf, r->end);
+			r->end += r->size;
+		} else {
+			memcpy(&buf[nsize - l], &buf[r->start], l);
+			r->start = nsize - l;
+		}
+	}
+
+	if (r->buf)
+		munmap(r->buf, 2 * r->size);
+	r->buf = buf;
+	r->size = nsize;
+
+	return 0;
+
+err_unmap:
+	err = -errno;
+	munmap(buf, 2 * nsize);
+	return err;
+}
+
 /*
  * Resize ring-buffer to size @nsize. @nsize must be a power-of-2, otherwise
  * ring operations will behave incorrectly.
@@ -25,6 +135,9 @@ static int ring_resize(struct shl_ring *r, size_t nsize)
 {
 	char *buf;
 
+	if (r->mirror)
+		return ring_resize_mirror(r, nsize);
+
 	buf = malloc(nsize);
 	if (!buf)
 		return -ENOMEM;
@@ -99,6 +212,10 @@ static int ring_grow(struct shl_ring *r, size_t add)
 	if (len <= r->size)
 		return -ENOMEM;
 
+	/* mappings must cover full pages */
+	if (r->mirror && len < (size_t)sysconf(_SC_PAGESIZE))
+		len = sysconf(_SC_PAGESIZE);
+
 	return ring_resize(r, len);
 }
 
@@ -108,39 +225,85 @@ static int ring_grow(struct shl_ring *r, size_t add)
  */
 int shl_ring_push(struct shl_ring *r, const char *u8, size_t len)
 {
-	int err;
+	struct iovec vec[2];
 	size_t l;
+	int n;
+
+	n = shl_ring_reserve(r, len, vec);
+	if (n < 0)
+		return n;
+
+	l = vec[0].iov_len;
+	if (l > len)
+		l = len;
+
+	memcpy(vec[0].iov_base, u8, l);
+	if (len > l)
+		memcpy(vec[1].iov_base, &u8[l], len - l);
+
+	shl_ring_commit(r, len);
+	return 0;
+}
+
+/*
+ * Reserve room for at least @min bytes of new data and return pointers to the
+ * free space of the ring-buffer in @vec, which must be an array of 2 iovec
+ * objects. All free space is returned, which might be more than @min. Data
+ * can be written there directly (eg., via readv()) and is appended to the
+ * buffer by shl_ring_commit(). Returns the number of iovec objects that were
+ * filled (1 or 2, always 1 for mirrored rings) or -ENOMEM on OOM.
+ */
+int shl_ring_reserve(struct shl_ring *r, size_t min, struct iovec *vec)
+{
+	int err;
 
-	err = ring_grow(r, len);
+	/* make sure we have a buffer even if @min is 0 */
+	err = ring_grow(r, min ? min : 1);
 	if (err < 0)
 		return err;
 
-	if (r->start <= r->end) {
-		l = r->size - r->end;
-		if (l > len)
-			l = len;
+	/* one byte always stays unused to tell "full" from "empty" */
+	if (r->mirror) {
+		vec[0].iov_base = &r->buf[r->end];
+		vec[0].iov_len = RING_MASK(r, r->start - r->end - 1);
+		return 1;
+	}
 
-		memcpy(&r->buf[r->end], u8, l);
-		r->end = RING_MASK(r, r->end + l);
+	if (r->end < r->start) {
+		vec[0].iov_base = &r->buf[r->end];
+		vec[0].iov_len = r->start - r->end - 1;
+		return 1;
+	}
 
-		len -= l;
-		u8 += l;
+	vec[0].iov_base = &r->buf[r->end];
+	vec[0].iov_len = r->size - r->end;
+	if (!r->start) {
+		--vec[0].iov_len;
+		return 1;
 	}
 
-	if (!len)
-		return 0;
+	vec[1].iov_base = r->buf;
+	vec[1].iov_len = r->start - 1;
 
-	memcpy(&r->buf[r->end], u8, len);
-	r->end = RING_MASK(r, r->end + len);
+	return vec[1].iov_len ? 2 : 1;
+}
 
-	return 0;
+/*
+ * Append @len bytes that were written into the space returned by
+ * shl_ring_reserve(). @len must not exceed the reserved space and no other
+ * operation that adds data must be called in between.
+ */
+void shl_ring_commit(struct shl_ring *r, size_t len)
+{
+	r->end = RING_MASK(r, r->end + len);
 }
 
 /*
  * Get data pointers for current ring-buffer data. @vec must be an array of 2
  * iovec objects. They are filled according to the data available in the
  * ring-buffer. 0, 1 or 2 is returned according to the number of iovec objects
- * that were filled (0 meaning buffer is empty).
+ * that were filled (0 meaning buffer is empty). Mirrored rings never need
+ * the second iovec.
  *
  * Hint: "struct iovec" is defined in <sys/uio.h> and looks like this:
  *     struct iovec {
@@ -156,6 +319,12 @@ size_t shl_ring_peek(struct shl_ring *r, struct iovec *vec)
 			vec[0].iov_len = r->end - r->start;
 		}
 		return 1;
+	} else if (r->end < r->start && r->mirror) {
+		if (vec) {
+			vec[0].iov_base = &r->buf[r->start];
+			vec[0].iov_len = r->size - r->start + r->end;
+		}
+		return 1;
 	} else if (r->end < r->start) {
 		if (vec) {
 			vec[0].iov_base = &r->buf[r->start];
@@ -204,7 +373,14 @@ void shl_ring_flush(struct shl_ring *r)
 
 void shl_ring_clear(struct shl_ring *r)
 {
-	free(r->buf);
+	if (r->mirror) {
+		if (r->buf)
+			munmap(r->buf, 2 * r->size);
+		close(r->fd);
+	} else {
+		free(r->buf);
+	}
+
 	memset(r, 0, sizeof(*r));
 }
 
@@ -250,3 +426,50 @@ char *shl_ring_copy(struct shl_ring *r, size_t *len)
 
 	return b;
 }
+
+/*
+ * Read from @fd directly into the ring-buffer. Room for at least @min bytes is
+ * reserved, but as much as fits into the free space is read. Returns the
+ * number of bytes read (0 on EOF) or a negative error code. EAGAIN and EINTR
+ * are returned as -EAGAIN and -EINTR, nothing is retried.
+ */
+ssize_t shl_ring_read_fd(struct shl_ring *r, int fd, size_t min)
+{
+	struct iovec vec[2];
+	ssize_t l;
+	int n;
+
+	n = shl_ring_reserve(r, min, vec);
+	if (n < 0)
+		return n;
+
+	l = readv(fd, vec, n);
+	if (l < 0)
+		return -errno;
+
+	shl_ring_commit(r, l);
+	return l;
+}
+
+/*
+ * Write as much data as possible from the ring-buffer to @fd and remove it
+ * from the buffer. Returns the number of bytes written or a negative error
+ * code (see shl_ring_read_fd()).
+ */
+ssize_t shl_ring_write_fd(struct shl_ring *r, int fd)
+{
+	struct iovec vec[2];
+	ssize_t l;
+	size_t n;
+
+	n = shl_ring_peek(r, vec);
+	if (!n)
+		return 0;
+
+	l = writev(fd, vec, n);
+	if (l < 0)
+		return -errno;
+
+	shl_ring_pull(r, l);
+	return l;
+}
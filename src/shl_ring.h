@@ -13,8 +13,10 @@
 #define SHL_RING_H
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <sys/uio.h>
 
 struct shl_ring {
@@ -22,11 +24,20 @@ struct shl_ring {
 	size_t size;
 	size_t start;
 	size_t end;
+
+	/* mirrored rings map @fd twice, @buf spans 2 * @size bytes */
+	int fd;
+	bool mirror;
 };
 
+int shl_ring_mirror(struct shl_ring *r);
 int shl_ring_push(struct shl_ring *r, const char *u8, size_t len);
 size_t shl_ring_peek(struct shl_ring *r, struct iovec *vec);
 char *shl_ring_copy(struct shl_ring *r, size_t *len);
+int shl_ring_reserve(struct shl_ring *r, size_t min, struct iovec *vec);
+void shl_ring_commit(struct shl_ring *r, size_t len);
+ssize_t shl_ring_read_fd(struct shl_ring *r, int fd, size_t min);
+ssize_t shl_ring_write_fd(struct shl_ring *r, int fd);
 void shl_ring_pull(struct shl_ring *r, size_t len);
 void shl_ring_flush(struct shl_ring *r);
 void shl_ring_clear(struct shl_ring *r);
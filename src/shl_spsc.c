@@ -0,0 +1,291 @@
+/*
+ * SHL - Single-producer/single-consumer ring buffer
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * SPSC ring buffer
+ * @head and @tail count all bytes ever pushed/popped, so "head - tail" is the
+ * fill level and "head == tail" means empty without sacrificing a byte. The
+ * producer publishes data with a release-store of @head, which pairs with the
+ * acquire-load in the consumer (and vice versa for @tail).
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "shl_spsc.h"
+
+#define SPSC_MASK(_q, _v) ((_v) & ((_q)->size - 1))
+
+/*
+ * Initialize @q with a buffer of @size bytes, rounded up to a power of 2.
+ * Returns 0 on success or a negative error code.
+ */
+int shl_spsc_init(struct shl_spsc *q, size_t size, unsigned int flags)
+{
+	size_t s;
+
+	if (!size)
+		return -EINVAL;
+
+	for (s = 1; s < size; s <<= 1) {
+		if (!(s << 1))
+			return -EINVAL;
+	}
+
+	memset(q, 0, sizeof(*q));
+	q->size = s;
+	q->efd = -1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+
+	q->buf = malloc(s);
+	if (!q->buf)
+		return -ENOMEM;
+
+	if (flags & SHL_SPSC_WAKEUP) {
+		q->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (q->efd < 0) {
+			free(q->buf);
+			q->buf = NULL;
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+void shl_spsc_destroy(struct shl_spsc *q)
+{
+	if (q->efd >= 0)
+		close(q->efd);
+	free(q->buf);
+	q->buf = NULL;
+	q->efd = -1;
+}
+
+/* eventfd that becomes readable when data arrives, -1 without wakeups */
+int shl_spsc_get_fd(struct shl_spsc *q)
+{
+	return q->efd;
+}
+
+/* split @len bytes at ring position @pos into at most 2 iovecs */
+static size_t spsc_vec(struct shl_spsc *q, size_t pos, size_t len,
+		       struct iovec *vec)
+{
+	size_t idx = SPSC_MASK(q, pos), l;
+
+	if (!len)
+		return 0;
+
+	l = q->size - idx;
+	if (l >= len) {
+		vec[0].iov_base = &q->buf[idx];
+		vec[0].iov_len = len;
+		return 1;
+	}
+
+	vec[0].iov_base = &q->buf[idx];
+	vec[0].iov_len = l;
+	vec[1].iov_base = q->buf;
+	vec[1].iov_len = len - l;
+	return 2;
+}
+
+/* free space as seen by the producer, reloads @tail if less than @want */
+static size_t spsc_room(struct shl_spsc *q, size_t head, size_t want)
+{
+	size_t room;
+
+	room = q->size - (head - q->tail_cache);
+	if (room < want) {
+		q->tail_cache = atomic_load_explicit(&q->tail,
+						     memory_order_acquire);
+		room = q->size - (head - q->tail_cache);
+	}
+
+	return room;
+}
+
+/*
+ * Return all free space in @vec (array of 2 iovecs) if at least @min bytes
+ * are free. Returns the number of iovecs filled, 0 if there is not enough
+ * room. Data written there is published by shl_spsc_commit().
+ */
+size_t shl_spsc_reserve(struct shl_spsc *q, size_t min, struct iovec *vec)
+{
+	size_t head, room;
+
+	head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	room = spsc_room(q, head, min ? min : 1);
+	if (room < min)
+		return 0;
+
+	return spsc_vec(q, head, room, vec);
+}
+
+/*
+ * Publish @len bytes written into the space returned by shl_spsc_reserve().
+ * If the consumer had already drained the ring, it is woken up.
+ */
+void shl_spsc_commit(struct shl_spsc *q, size_t len)
+{
+	uint64_t v = 1;
+	size_t head;
+	ssize_t l;
+
+	if (!len)
+		return;
+
+	head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	atomic_store_explicit(&q->head, head + len, memory_order_release);
+
+	if (q->efd < 0)
+		return;
+
+	/* pairs with the fence in shl_spsc_consume() */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->tail, memory_order_relaxed) == head) {
+		/* EAGAIN means the counter is saturated, so it is readable */
+		l = write(q->efd, &v, sizeof(v));
+		(void)l;
+	}
+}
+
+/*
+ * Copy up to @len bytes from @buf into the ring and publish them. Returns the
+ * number of bytes pushed, which is less than @len if the ring is full.
+ */
+size_t shl_spsc_push(struct shl_spsc *q, const void *buf, size_t len)
+{
+	struct iovec vec = { (void*)buf, len };
+
+	return shl_spsc_pushv(q, &vec, 1);
+}
+
+/*
+ * Batch version of shl_spsc_push(). All @n buffers are copied in order and
+ * published at once, the consumer sees them as a single chunk of data. Stops
+ * when the ring is full; returns the number of bytes pushed.
+ */
+size_t shl_spsc_pushv(struct shl_spsc *q, const struct iovec *vec, size_t n)
+{
+	size_t head, room, len, i, l, idx, sum;
+	const char *b;
+
+	len = 0;
+	for (i = 0; i < n; ++i)
+		len += vec[i].iov_len;
+
+	head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	room = spsc_room(q, head, len);
+	if (len > room)
+		len = room;
+
+	sum = 0;
+	for (i = 0; i < n && sum < len; ++i) {
+		b = vec[i].iov_base;
+		l = vec[i].iov_len;
+		if (l > len - sum)
+			l = len - sum;
+
+		while (l > 0) {
+			idx = SPSC_MASK(q, head + sum);
+			room = q->size - idx;
+			if (room > l)
+				room = l;
+
+			memcpy(&q->buf[idx], b, room);
+			b += room;
+			l -= room;
+			sum += room;
+		}
+	}
+
+	shl_spsc_commit(q, len);
+	return len;
+}
+
+/*
+ * Return pointers to the available data in @vec (array of 2 iovecs). Returns
+ * the number of iovecs filled, 0 if the ring is empty. Data stays in the ring
+ * until shl_spsc_consume() is called.
+ */
+size_t shl_spsc_peek(struct shl_spsc *q, struct iovec *vec)
+{
+	size_t tail;
+
+	tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	if (q->head_cache == tail)
+		q->head_cache = atomic_load_explicit(&q->head,
+						     memory_order_acquire);
+
+	return spsc_vec(q, tail, q->head_cache - tail, vec);
+}
+
+/* release @len bytes at the front of the ring back to the producer */
+void shl_spsc_consume(struct shl_spsc *q, size_t len)
+{
+	size_t tail;
+
+	if (!len)
+		return;
+
+	tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	atomic_store_explicit(&q->tail, tail + len, memory_order_release);
+
+	/*
+	 * If the ring looks empty now, the next peek must not miss data the
+	 * producer committed without waking us up; see shl_spsc_commit().
+	 */
+	if (q->efd >= 0)
+		atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * Copy up to @len bytes from the ring into @buf and remove them. Returns the
+ * number of bytes copied, 0 if the ring is empty.
+ */
+size_t shl_spsc_pop(struct shl_spsc *q, void *buf, size_t len)
+{
+	struct iovec vec[2];
+	size_t n, l, sum;
+	char *b = buf;
+
+	n = shl_spsc_peek(q, vec);
+	sum = 0;
+	if (n > 0) {
+		l = vec[0].iov_len < len ? vec[0].iov_len : len;
+		memcpy(b, vec[0].iov_base, l);
+		sum += l;
+	}
+	if (n > 1 && sum < len) {
+		l = vec[1].iov_len < len - sum ? vec[1].iov_len : len - sum;
+		memcpy(&b[sum], vec[1].iov_base, l);
+		sum += l;
+	}
+
+	shl_spsc_consume(q, sum);
+	return sum;
+}
+
+/* clear a pending wakeup; call before draining the ring */
+void shl_spsc_ack(struct shl_spsc *q)
+{
+	uint64_t v;
+	ssize_t l;
+
+	if (q->efd >= 0) {
+		l = read(q->efd, &v, sizeof(v));
+		(void)l;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * SHL - Single-producer/single-consumer ring buffer
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * SPSC ring buffer
+ * A fixed-size byte ring that one thread writes to and another thread reads
+ * from, without any locks. The producer owns @head, the consumer owns @tail.
+ * Both are free-running counters on separate cache-lines, each side caches
+ * the other side's counter and only reloads it when it runs out of room or
+ * data.
+ * With SHL_SPSC_WAKEUP, an eventfd is signalled whenever data is committed
+ * to an empty ring, so consumers can sleep in poll(). Consumers must call
+ * shl_spsc_ack() before draining the ring after a wakeup.
+ * Producer functions must only be called from one thread, consumer functions
+ * only from one (other) thread. Objects should be aligned to
+ * SHL_SPSC_CACHELINE, which static and stack objects are automatically.
+ */
+
+#ifndef SHL_SPSC_H
+#define SHL_SPSC_H
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SHL_SPSC_CACHELINE 64
+
+enum shl_spsc_flags {
+	SHL_SPSC_WAKEUP			= 0x01,
+};
+
+struct shl_spsc {
+	char *buf;
+	size_t size;
+	int efd;
+
+	/* producer side */
+	atomic_size_t head __attribute__((aligned(SHL_SPSC_CACHELINE)));
+	size_t tail_cache;
+
+	/* consumer side */
+	atomic_size_t tail __attribute__((aligned(SHL_SPSC_CACHELINE)));
+	size_t head_cache;
+} __attribute__((aligned(SHL_SPSC_CACHELINE)));
+
+int shl_spsc_init(struct shl_spsc *q, size_t size, unsigned int flags);
+void shl_spsc_destroy(struct shl_spsc *q);
+int shl_spsc_get_fd(struct shl_spsc *q);
+
+/* producer */
+size_t shl_spsc_reserve(struct shl_spsc *q, size_t min, struct iovec *vec);
+void shl_spsc_commit(struct shl_spsc *q, size_t len);
+size_t shl_spsc_push(struct shl_spsc *q, const void *buf, size_t len);
+size_t shl_spsc_pushv(struct shl_spsc *q, const struct iovec *vec, size_t n);
+
+/* consumer */
+size_t shl_spsc_peek(struct shl_spsc *q, struct iovec *vec);
+void shl_spsc_consume(struct shl_spsc *q, size_t len);
+size_t shl_spsc_pop(struct shl_spsc *q, void *buf, size_t len);
+void shl_spsc_ack(struct shl_spsc *q);
+
+#endif  /* SHL_SPSC_H */
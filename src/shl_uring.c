@@ -0,0 +1,303 @@
+/*
+ * SHL - io_uring helpers
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "shl_uring.h"
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int submit, unsigned int wait,
+		       unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int op, void *arg,
+			  unsigned int num)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, num);
+}
+
+/*
+ * Create a ring with room for @entries SQEs and @cq_entries completions (0
+ * for the kernel default). Returns -ENOSYS or -EPERM if io_uring is not
+ * available.
+ */
+int shl_uring_init(struct shl_uring *u, unsigned int entries,
+		   unsigned int cq_entries)
+{
+	struct io_uring_params p;
+	unsigned int *sq_array, i;
+	int r;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	if (cq_entries) {
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+	}
+
+	u->fd = uring_setup(entries, &p);
+	if (u->fd < 0)
+		return -errno;
+	u->features = p.features;
+
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (u->features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_size > u->sq_size)
+			u->sq_size = u->cq_size;
+		u->cq_size = u->sq_size;
+	}
+
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) {
+		r = -errno;
+		goto err_fd;
+	}
+
+	if (u->features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, u->fd,
+				 IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) {
+			r = -errno;
+			goto err_sq;
+		}
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		r = -errno;
+		goto err_cq;
+	}
+
+	u->sq_head = (void*)((char*)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (void*)((char*)u->sq_ptr + p.sq_off.tail);
+	u->sq_flags = (void*)((char*)u->sq_ptr + p.sq_off.flags);
+	u->sq_mask = *(unsigned int*)((char*)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sqe_tail = *u->sq_tail;
+
+	/* SQEs are always used in order, so the index array is fixed */
+	sq_array = (void*)((char*)u->sq_ptr + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; ++i)
+		sq_array[i] = i;
+
+	u->cq_head = (void*)((char*)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (void*)((char*)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = *(unsigned int*)((char*)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (void*)((char*)u->cq_ptr + p.cq_off.cqes);
+
+	return 0;
+
+err_cq:
+	if (u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_size);
+err_sq:
+	munmap(u->sq_ptr, u->sq_size);
+err_fd:
+	close(u->fd);
+	u->fd = -1;
+	return r;
+}
+
+/* closing the ring cancels all requests still in flight */
+void shl_uring_destroy(struct shl_uring *u)
+{
+	if (u->fd < 0)
+		return;
+
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_size);
+	munmap(u->sq_ptr, u->sq_size);
+	close(u->fd);
+	u->fd = -1;
+}
+
+/*
+ * Return a cleared SQE. If the submission queue is full, pending SQEs are
+ * submitted first. Returns NULL if that fails.
+ */
+struct io_uring_sqe *shl_uring_get_sqe(struct shl_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	if (shl_uring_pending(u) >= u->sq_entries) {
+		shl_uring_submit(u, 0);
+		if (shl_uring_pending(u) >= u->sq_entries)
+			return NULL;
+	}
+
+	sqe = &u->sqes[u->sqe_tail & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	++u->sqe_tail;
+
+	return sqe;
+}
+
+/*
+ * Pass all pending SQEs to the kernel and wait for at least @wait
+ * completions. Returns the number of SQEs submitted or a negative error code.
+ */
+int shl_uring_submit(struct shl_uring *u, unsigned int wait)
+{
+	unsigned int n;
+	int r;
+
+	__atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+	n = shl_uring_pending(u);
+	if (!n && !wait)
+		return 0;
+
+	++u->enters;
+	r = uring_enter(u->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+	if (r < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+			return 0;
+		return -errno;
+	}
+
+	return r;
+}
+
+/* oldest unseen completion, or NULL */
+struct io_uring_cqe *shl_uring_peek(struct shl_uring *u)
+{
+	unsigned int head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &u->cqes[head & u->cq_mask];
+}
+
+void shl_uring_seen(struct shl_uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Completions that did not fit into the queue are held back by the kernel
+ * until the next io_uring_enter() with GETEVENTS. Returns true if there are
+ * any; call shl_uring_submit(u, 0) after emptying the queue to flush them.
+ */
+bool shl_uring_overflow(struct shl_uring *u)
+{
+	unsigned int flags;
+
+	flags = __atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE);
+	if (!(flags & IORING_SQ_CQ_OVERFLOW))
+		return false;
+
+	++u->enters;
+	uring_enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS);
+	return true;
+}
+
+/*
+ * Register @entries (a power of 2) buffers of @size bytes each as buffer
+ * group @bgid. Requests with IOSQE_BUFFER_SELECT take a buffer from it; its
+ * index is in the upper bits of the completion flags and it must be passed
+ * back via shl_uring_bufs_put() once consumed.
+ */
+int shl_uring_bufs_init(struct shl_uring *u, struct shl_uring_bufs *b,
+			uint16_t bgid, unsigned int entries,
+			unsigned int size)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+	int r;
+
+	if (!entries || (entries & (entries - 1)) || entries > 32768)
+		return -EINVAL;
+
+	memset(b, 0, sizeof(*b));
+	b->entries = entries;
+	b->size = size;
+	b->bgid = bgid;
+
+	b->br_size = entries * sizeof(struct io_uring_buf);
+	b->br = mmap(NULL, b->br_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b->br == MAP_FAILED)
+		return -ENOMEM;
+
+	b->mem = malloc((size_t)entries * size);
+	if (!b->mem) {
+		r = -ENOMEM;
+		goto err_br;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)b->br;
+	reg.ring_entries = entries;
+	reg.bgid = bgid;
+
+	r = uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+	if (r < 0) {
+		r = -errno;
+		goto err_mem;
+	}
+
+	for (i = 0; i < entries; ++i)
+		shl_uring_bufs_put(b, i);
+
+	return 0;
+
+err_mem:
+	free(b->mem);
+err_br:
+	munmap(b->br, b->br_size);
+	b->br = NULL;
+	return r;
+}
+
+void shl_uring_bufs_destroy(struct shl_uring *u, struct shl_uring_bufs *b)
+{
+	struct io_uring_buf_reg reg;
+
+	if (!b->br)
+		return;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = b->bgid;
+	uring_register(u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+	free(b->mem);
+	munmap(b->br, b->br_size);
+	b->br = NULL;
+}
+
+void shl_uring_bufs_put(struct shl_uring_bufs *b, uint16_t bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &b->br->bufs[b->tail & (b->entries - 1)];
+	buf->addr = (uintptr_t)shl_uring_bufs_get(b, bid);
+	buf->len = b->size;
+	buf->bid = bid;
+
+	__atomic_store_n(&b->br->tail, ++b->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,91 @@
+/*
+ * SHL - io_uring helpers
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * io_uring helpers
+ * A minimal wrapper around the raw io_uring syscalls, so no external library
+ * is needed. It maps the submission and completion queues, hands out SQEs,
+ * submits them and walks completions. Provided-buffer rings let the kernel
+ * pick receive buffers itself, so multishot receives need no buffer per
+ * socket.
+ * Only a single thread may use a ring at a time.
+ */
+
+#ifndef SHL_URING_H
+#define SHL_URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct shl_uring {
+	int fd;
+	unsigned int features;
+	uint64_t enters;
+
+	/* submission queue; @sqe_tail runs ahead of the shared tail */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_flags;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sqe_tail;
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+struct shl_uring_bufs {
+	struct io_uring_buf_ring *br;
+	char *mem;
+	size_t br_size;
+	unsigned int entries;
+	unsigned int size;
+	uint16_t bgid;
+	uint16_t tail;
+};
+
+int shl_uring_init(struct shl_uring *u, unsigned int entries,
+		   unsigned int cq_entries);
+void shl_uring_destroy(struct shl_uring *u);
+
+struct io_uring_sqe *shl_uring_get_sqe(struct shl_uring *u);
+int shl_uring_submit(struct shl_uring *u, unsigned int wait);
+struct io_uring_cqe *shl_uring_peek(struct shl_uring *u);
+void shl_uring_seen(struct shl_uring *u);
+bool shl_uring_overflow(struct shl_uring *u);
+
+int shl_uring_bufs_init(struct shl_uring *u, struct shl_uring_bufs *b,
+			uint16_t bgid, unsigned int entries,
+			unsigned int size);
+void shl_uring_bufs_destroy(struct shl_uring *u, struct shl_uring_bufs *b);
+void shl_uring_bufs_put(struct shl_uring_bufs *b, uint16_t bid);
+
+/* SQEs that were not passed to the kernel, yet */
+static inline unsigned int shl_uring_pending(struct shl_uring *u)
+{
+	return u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static inline void *shl_uring_bufs_get(struct shl_uring_bufs *b,
+				       uint16_t bid)
+{
+	return b->mem + (size_t)bid * b->size;
+}
+
+#endif  /* SHL_URING_H */
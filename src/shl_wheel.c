@@ -0,0 +1,351 @@
+/*
+ * SHL - Hierarchical timer wheel
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Hierarchical timer wheel
+ * All times are kept in ticks. @now is the last tick that was processed. A
+ * timer with "expires - now" below 64^(L+1) ticks is stored on level L in slot
+ * "(expires >> 6L) & 63". Level-L slot S is cascaded when @now enters the next
+ * block of 64^L ticks whose index ends in S, which is never later than the
+ * block the timer expires in. Level 0 is run one slot per tick.
+ * shl_wheel_advance() does not step through idle ticks: the @pending bitmaps
+ * tell which tick the next slot is due at, so it jumps straight there.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "shl_dlist.h"
+#include "shl_wheel.h"
+
+#define WHEEL_MASK (SHL_WHEEL_SLOTS - 1)
+#define WHEEL_NONE ((unsigned int)-1)
+
+/* ticks covered by a single slot of level @_l */
+#define WHEEL_SPAN(_l) (1ULL << (SHL_WHEEL_BITS * (_l)))
+
+/* farthest tick a timer can be stored at */
+#define WHEEL_MAX (WHEEL_SPAN(SHL_WHEEL_LEVELS) - 1)
+
+#define timer_entry(_l) shl_dlist_entry((_l), struct shl_wheel_timer, list)
+
+static uint64_t mono_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000ULL;
+}
+
+static uint64_t ror64(uint64_t v, unsigned int r)
+{
+	r &= 63;
+	return r ? (v >> r) | (v << (64 - r)) : v;
+}
+
+/*
+ * Initialize @w with a resolution of @tick_ms milliseconds. Returns 0 on
+ * success or a negative error code.
+ */
+int shl_wheel_init(struct shl_wheel *w, unsigned int tick_ms,
+		   unsigned int flags)
+{
+	size_t i;
+
+	if (!tick_ms)
+		return -EINVAL;
+
+	memset(w, 0, sizeof(*w));
+	w->tick_ms = tick_ms;
+	w->fd = -1;
+	for (i = 0; i < SHL_WHEEL_LEVELS * SHL_WHEEL_SLOTS; ++i)
+		shl_dlist_init(&w->slots[i]);
+
+	if (flags & SHL_WHEEL_TIMERFD) {
+		w->fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_CLOEXEC | TFD_NONBLOCK);
+		if (w->fd < 0)
+			return -errno;
+
+		/* wheel time starts at 0, one tick in the past */
+		w->base_ms = mono_ms() - tick_ms;
+		w->now = 1;
+	}
+
+	return 0;
+}
+
+/* close the timerfd; timers still armed are dropped without being run */
+void shl_wheel_destroy(struct shl_wheel *w)
+{
+	struct shl_wheel_timer *t;
+	size_t i;
+
+	for (i = 0; i < SHL_WHEEL_LEVELS * SHL_WHEEL_SLOTS; ++i) {
+		while (!shl_dlist_empty(&w->slots[i])) {
+			t = timer_entry(w->slots[i].next);
+			shl_dlist_unlink(&t->list);
+			t->slot = WHEEL_NONE;
+		}
+	}
+
+	if (w->fd >= 0)
+		close(w->fd);
+	w->fd = -1;
+	w->count = 0;
+	memset(w->pending, 0, sizeof(w->pending));
+}
+
+/* timerfd of @w, -1 without SHL_WHEEL_TIMERFD */
+int shl_wheel_get_fd(struct shl_wheel *w)
+{
+	return w->fd;
+}
+
+void shl_wheel_timer_init(struct shl_wheel_timer *t, shl_wheel_cb cb,
+			  void *data)
+{
+	memset(t, 0, sizeof(*t));
+	t->slot = WHEEL_NONE;
+	t->cb = cb;
+	t->data = data;
+}
+
+static void wheel_link(struct shl_wheel *w, struct shl_wheel_timer *t)
+{
+	uint64_t e = t->expires, delta;
+	unsigned int l, idx;
+
+	if (e <= w->now) {
+		/* cascaded timers that are due right now */
+		l = 0;
+		idx = w->now & WHEEL_MASK;
+	} else {
+		delta = e - w->now;
+		if (delta > WHEEL_MAX) {
+			e = w->now + WHEEL_MAX;
+			delta = WHEEL_MAX;
+		}
+
+		for (l = 0; l < SHL_WHEEL_LEVELS - 1; ++l) {
+			if (delta < WHEEL_SPAN(l + 1))
+				break;
+		}
+
+		idx = (e >> (SHL_WHEEL_BITS * l)) & WHEEL_MASK;
+	}
+
+	t->slot = l * SHL_WHEEL_SLOTS + idx;
+	shl_dlist_link_tail(&w->slots[t->slot], &t->list);
+	w->pending[l] |= 1ULL << idx;
+}
+
+static void wheel_unlink(struct shl_wheel *w, struct shl_wheel_timer *t)
+{
+	unsigned int slot = t->slot;
+
+	shl_dlist_unlink(&t->list);
+	if (shl_dlist_empty(&w->slots[slot]))
+		w->pending[slot / SHL_WHEEL_SLOTS] &=
+					~(1ULL << (slot & WHEEL_MASK));
+	t->slot = WHEEL_NONE;
+}
+
+/* first tick after @now at which a non-empty slot is due, or UINT64_MAX */
+static uint64_t wheel_next_tick(struct shl_wheel *w)
+{
+	uint64_t next = UINT64_MAX, block, tick;
+	unsigned int l, shift;
+
+	for (l = 0; l < SHL_WHEEL_LEVELS; ++l) {
+		if (!w->pending[l])
+			continue;
+
+		shift = SHL_WHEEL_BITS * l;
+		block = w->now >> shift;
+		block += 1 + __builtin_ctzll(ror64(w->pending[l], block + 1));
+		tick = block << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void wheel_arm(struct shl_wheel *w, uint64_t tick)
+{
+	struct itimerspec spec;
+	uint64_t ms;
+
+	ms = w->base_ms + tick * w->tick_ms;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = ms / 1000;
+	spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+
+	if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &spec, NULL) >= 0)
+		w->armed = tick;
+}
+
+/*
+ * Current time in ms on the scale of shl_wheel_now(). Unlike the latter, this
+ * reads the clock in SHL_WHEEL_TIMERFD mode.
+ */
+uint64_t shl_wheel_time(struct shl_wheel *w)
+{
+	if (w->fd < 0)
+		return shl_wheel_now(w);
+
+	return mono_ms() - w->base_ms;
+}
+
+/*
+ * Arm @t to expire in @msec milliseconds, rounded up to full ticks. If @t is
+ * already armed, it is moved. The callback runs from shl_wheel_advance() or
+ * shl_wheel_dispatch(), @t is no longer armed at that point.
+ */
+void shl_wheel_add(struct shl_wheel *w, struct shl_wheel_timer *t,
+		   uint64_t msec)
+{
+	uint64_t ticks, now;
+
+	if (shl_wheel_timer_pending(t)) {
+		wheel_unlink(w, t);
+		--w->count;
+	}
+
+	ticks = (msec + w->tick_ms - 1) / w->tick_ms;
+	if (!ticks)
+		ticks = 1;
+
+	/* @now lags behind between dispatches, count from the real time */
+	now = shl_wheel_time(w) / w->tick_ms;
+	if (now < w->now)
+		now = w->now;
+
+	t->expires = now + ticks;
+	wheel_link(w, t);
+	++w->count;
+
+	/* the timerfd is only reprogrammed if this timer is due first */
+	if (w->fd >= 0 && (!w->armed || t->expires < w->armed))
+		wheel_arm(w, t->expires);
+}
+
+void shl_wheel_del(struct shl_wheel *w, struct shl_wheel_timer *t)
+{
+	if (!shl_wheel_timer_pending(t))
+		return;
+
+	wheel_unlink(w, t);
+	--w->count;
+}
+
+static void wheel_cascade(struct shl_wheel *w, unsigned int l,
+			  unsigned int idx)
+{
+	struct shl_dlist *slot = &w->slots[l * SHL_WHEEL_SLOTS + idx];
+	struct shl_wheel_timer *t;
+
+	/* timers never land in the slot they come from */
+	while (!shl_dlist_empty(slot)) {
+		t = timer_entry(slot->next);
+		wheel_unlink(w, t);
+		wheel_link(w, t);
+	}
+}
+
+static size_t wheel_expire(struct shl_wheel *w)
+{
+	struct shl_dlist *slot = &w->slots[w->now & WHEEL_MASK];
+	struct shl_wheel_timer *t;
+	size_t n = 0;
+
+	/* re-armed timers never land in the current slot */
+	while (!shl_dlist_empty(slot)) {
+		t = timer_entry(slot->next);
+		wheel_unlink(w, t);
+		--w->count;
+		++n;
+		t->cb(t, t->data);
+	}
+
+	return n;
+}
+
+/*
+ * Move the wheel time forward to @msec and run all timers that expired until
+ * then, in order. Returns the number of timers run.
+ */
+size_t shl_wheel_advance(struct shl_wheel *w, uint64_t msec)
+{
+	uint64_t target = msec / w->tick_ms, next;
+	unsigned int l;
+	size_t n = 0;
+
+	while (w->now < target) {
+		next = wheel_next_tick(w);
+		if (next > target) {
+			w->now = target;
+			break;
+		}
+
+		w->now = next;
+		for (l = 1; l < SHL_WHEEL_LEVELS; ++l) {
+			if (w->now & (WHEEL_SPAN(l) - 1))
+				break;
+			wheel_cascade(w, l, (w->now >> (SHL_WHEEL_BITS * l)) &
+					    WHEEL_MASK);
+		}
+
+		n += wheel_expire(w);
+	}
+
+	return n;
+}
+
+/*
+ * Run expired timers of a SHL_WHEEL_TIMERFD wheel and program the timerfd for
+ * the next one. Returns the number of timers run or a negative error code.
+ */
+int shl_wheel_dispatch(struct shl_wheel *w)
+{
+	uint64_t v, next;
+	ssize_t l;
+	size_t n;
+
+	if (w->fd < 0)
+		return -EINVAL;
+
+	l = read(w->fd, &v, sizeof(v));
+	(void)l;
+	w->armed = 0;
+
+	n = shl_wheel_advance(w, mono_ms() - w->base_ms);
+
+	next = wheel_next_tick(w);
+	if (next != UINT64_MAX && (!w->armed || next < w->armed))
+		wheel_arm(w, next);
+
+	return n;
+}
+
+/* milliseconds from shl_wheel_now() until the next slot is due, -1 if idle */
+int64_t shl_wheel_next(struct shl_wheel *w)
+{
+	uint64_t next;
+
+	next = wheel_next_tick(w);
+	if (next == UINT64_MAX)
+		return -1;
+
+	return (next - w->now) * w->tick_ms;
+}
@@ -0,0 +1,96 @@
+/*
+ * SHL - Hierarchical timer wheel
+ *
+ * Copyright (c) 2011-2013 David Herrmann <dh.herrmann@gmail.com>
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Hierarchical timer wheel
+ * Timers are kept in SHL_WHEEL_LEVELS wheels of SHL_WHEEL_SLOTS slots each.
+ * Level 0 covers the next 64 ticks with one slot per tick, each higher level
+ * covers 64 times the range of the level below. Arming, re-arming and
+ * cancelling a timer is O(1); timers on higher levels are moved down
+ * ("cascaded") once their slot comes up. Timers further away than the top
+ * level can hold are parked in its last slot and re-sorted when it cascades.
+ * Timers are intrusive, a wheel never allocates memory for them.
+ * With SHL_WHEEL_TIMERFD, the wheel follows CLOCK_MONOTONIC and programs a
+ * single timerfd for its next expiry; call shl_wheel_dispatch() whenever it
+ * becomes readable. Otherwise time only moves via shl_wheel_advance().
+ */
+
+#ifndef SHL_WHEEL_H
+#define SHL_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "shl_dlist.h"
+
+#define SHL_WHEEL_LEVELS 4
+#define SHL_WHEEL_BITS 6
+#define SHL_WHEEL_SLOTS (1 << SHL_WHEEL_BITS)
+
+enum shl_wheel_flags {
+	SHL_WHEEL_TIMERFD		= 0x01,
+};
+
+struct shl_wheel_timer;
+
+typedef void (*shl_wheel_cb) (struct shl_wheel_timer *t, void *data);
+
+struct shl_wheel_timer {
+	struct shl_dlist list;
+	uint64_t expires;
+	unsigned int slot;
+	shl_wheel_cb cb;
+	void *data;
+};
+
+struct shl_wheel {
+	uint64_t now;
+	unsigned int tick_ms;
+	size_t count;
+
+	uint64_t pending[SHL_WHEEL_LEVELS];
+	struct shl_dlist slots[SHL_WHEEL_LEVELS * SHL_WHEEL_SLOTS];
+
+	/* timerfd mode; @armed is the programmed tick, 0 if disarmed */
+	int fd;
+	uint64_t base_ms;
+	uint64_t armed;
+};
+
+int shl_wheel_init(struct shl_wheel *w, unsigned int tick_ms,
+		   unsigned int flags);
+void shl_wheel_destroy(struct shl_wheel *w);
+int shl_wheel_get_fd(struct shl_wheel *w);
+
+void shl_wheel_timer_init(struct shl_wheel_timer *t, shl_wheel_cb cb,
+			  void *data);
+void shl_wheel_add(struct shl_wheel *w, struct shl_wheel_timer *t,
+		   uint64_t msec);
+void shl_wheel_del(struct shl_wheel *w, struct shl_wheel_timer *t);
+
+size_t shl_wheel_advance(struct shl_wheel *w, uint64_t msec);
+int shl_wheel_dispatch(struct shl_wheel *w);
+int64_t shl_wheel_next(struct shl_wheel *w);
+uint64_t shl_wheel_time(struct shl_wheel *w);
+
+static inline bool shl_wheel_timer_pending(struct shl_wheel_timer *t)
+{
+	return t->list.next != NULL;
+}
+
+/* wheel time in ms, as of the last shl_wheel_advance() */
+static inline uint64_t shl_wheel_now(struct shl_wheel *w)
+{
+	return w->now * w->tick_ms;
+}
+
+static inline size_t shl_wheel_count(struct shl_wheel *w)
+{
+	return w->count;
+}
+
+#endif  /* SHL_WHEEL_H */
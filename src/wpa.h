@@ -37,16 +37,22 @@ extern "C" {
 /* wpa ctrl */
 
 struct owfd_wpa_ctrl;
+struct shl_loop;
 
 typedef void (*owfd_wpa_ctrl_cb) (struct owfd_wpa_ctrl *wpa, void *buf,
 				  size_t len, void *data);
+typedef void (*owfd_wpa_ctrl_error_cb) (struct owfd_wpa_ctrl *wpa, int error,
+					void *data);
 
 int owfd_wpa_ctrl_new(struct owfd_wpa_ctrl **out);
+int owfd_wpa_ctrl_new_loop(struct owfd_wpa_ctrl **out, struct shl_loop *loop);
 void owfd_wpa_ctrl_ref(struct owfd_wpa_ctrl *wpa);
 void owfd_wpa_ctrl_unref(struct owfd_wpa_ctrl *wpa);
 
 void owfd_wpa_ctrl_set_data(struct owfd_wpa_ctrl *wpa, void *data);
 void *owfd_wpa_ctrl_get_data(struct owfd_wpa_ctrl *wpa);
+void owfd_wpa_ctrl_set_error_cb(struct owfd_wpa_ctrl *wpa,
+				owfd_wpa_ctrl_error_cb cb);
 
 int owfd_wpa_ctrl_open(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
 		       owfd_wpa_ctrl_cb cb);
@@ -33,16 +33,17 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 #include "shared.h"
+#include "shl_loop.h"
 #include "wpa.h"
 
 #define CTRL_PATH_TEMPLATE "/tmp/openwfd-wpa-ctrl-%d-%lu-XXXXXX"
 #define REQ_REPLY_MAX 512
+#define PING_INTERVAL 10000
 
 #ifndef UNIX_PATH_MAX
 #  define UNIX_PATH_MAX (sizeof(((struct sockaddr_un*)0)->sun_path))
@@ -52,14 +53,20 @@ struct owfd_wpa_ctrl {
 	unsigned long ref;
 	void *data;
 	sigset_t mask;
-	int efd;
-	int tfd;
+	struct shl_loop *loop;
+	struct shl_wheel_timer ping;
+	owfd_wpa_ctrl_error_cb error_cb;
+	int error;
 
 	int req_fd;
+	struct shl_loop_io req_io;
 	char req_name[UNIX_PATH_MAX];
 	int ev_fd;
+	struct shl_loop_io ev_io;
 	char ev_name[UNIX_PATH_MAX];
 	owfd_wpa_ctrl_cb cb;
+
+	unsigned int own_loop : 1;
 };
 
 static int wpa_request(int fd, const void *cmd, size_t cmd_len,
@@ -67,57 +74,76 @@ static int wpa_request(int fd, const void *cmd, size_t cmd_len,
 		       const sigset_t *mask);
 static int wpa_request_ok(int fd, const void *cmd, size_t cmd_len, int64_t *t,
 			  const sigset_t *mask);
+static void ping_fn(struct shl_wheel_timer *t, void *data);
 
-int owfd_wpa_ctrl_new(struct owfd_wpa_ctrl **out)
+static struct owfd_wpa_ctrl *wpa_alloc(void)
 {
 	struct owfd_wpa_ctrl *wpa;
-	struct epoll_event ev;
-	int r;
 
 	wpa = calloc(1, sizeof(*wpa));
 	if (!wpa)
-		return -ENOMEM;
+		return NULL;
 	wpa->ref = 1;
-	wpa->efd = -1;
-	wpa->tfd = -1;
 	wpa->req_fd = -1;
 	wpa->ev_fd = -1;
 	sigemptyset(&wpa->mask);
+	shl_wheel_timer_init(&wpa->ping, ping_fn, wpa);
 
-	wpa->efd = epoll_create1(EPOLL_CLOEXEC);
-	if (wpa->efd < 0) {
-		r = -errno;
-		goto err_wpa;
-	}
+	return wpa;
+}
 
-	wpa->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-	if (wpa->tfd < 0) {
-		r = -errno;
-		goto err_efd;
-	}
+int owfd_wpa_ctrl_new(struct owfd_wpa_ctrl **out)
+{
+	struct owfd_wpa_ctrl *wpa;
+	int r;
 
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLHUP | EPOLLERR | EPOLLIN;
-	ev.data.ptr = &wpa->tfd;
+	wpa = wpa_alloc();
+	if (!wpa)
+		return -ENOMEM;
 
-	r = epoll_ctl(wpa->efd, EPOLL_CTL_ADD, wpa->tfd, &ev);
-	if (r < 0) {
-		r = -errno;
-		goto err_tfd;
+	wpa->loop = malloc(sizeof(*wpa->loop));
+	if (!wpa->loop) {
+		r = -ENOMEM;
+		goto err_wpa;
 	}
 
+	r = shl_loop_init(wpa->loop);
+	if (r < 0)
+		goto err_loop;
+
+	wpa->own_loop = 1;
 	*out = wpa;
 	return 0;
 
-err_tfd:
-	close(wpa->tfd);
-err_efd:
-	close(wpa->efd);
+err_loop:
+	free(wpa->loop);
 err_wpa:
 	free(wpa);
 	return r;
 }
 
+/*
+ * Register the sockets and the PING timer of the ctrl on @loop instead of a
+ * loop of its own. @loop dispatches them and must outlive the ctrl;
+ * owfd_wpa_ctrl_dispatch() cannot be used. Errors are reported through the
+ * callback set with owfd_wpa_ctrl_set_error_cb().
+ */
+int owfd_wpa_ctrl_new_loop(struct owfd_wpa_ctrl **out, struct shl_loop *loop)
+{
+	struct owfd_wpa_ctrl *wpa;
+
+	if (!loop)
+		return -EINVAL;
+
+	wpa = wpa_alloc();
+	if (!wpa)
+		return -ENOMEM;
+
+	wpa->loop = loop;
+	*out = wpa;
+	return 0;
+}
+
 void owfd_wpa_ctrl_ref(struct owfd_wpa_ctrl *wpa)
 {
 	if (!wpa || !wpa->ref)
@@ -132,8 +158,10 @@ void owfd_wpa_ctrl_unref(struct owfd_wpa_ctrl *wpa)
 		return;
 
 	owfd_wpa_ctrl_close(wpa);
-	close(wpa->tfd);
-	close(wpa->efd);
+	if (wpa->own_loop) {
+		shl_loop_destroy(wpa->loop);
+		free(wpa->loop);
+	}
 	free(wpa);
 }
 
@@ -147,6 +175,16 @@ void *owfd_wpa_ctrl_get_data(struct owfd_wpa_ctrl *wpa)
 	return wpa->data;
 }
 
+/*
+ * @cb is called with the ctrl data whenever the connection fails while being
+ * dispatched; the ctrl is already closed at that point.
+ */
+void owfd_wpa_ctrl_set_error_cb(struct owfd_wpa_ctrl *wpa,
+				owfd_wpa_ctrl_error_cb cb)
+{
+	wpa->error_cb = cb;
+}
+
 static int bind_socket(int fd, char *name)
 {
 	static unsigned long counter;
@@ -218,10 +256,9 @@ static int connect_socket(int fd, const char *ctrl_path)
 }
 
 static int open_socket(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
-		       void *data, char *name)
+		       struct shl_loop_io *io, shl_loop_io_cb cb, char *name)
 {
 	int fd, r;
-	struct epoll_event ev;
 
 	fd = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
 	if (fd < 0)
@@ -235,14 +272,10 @@ static int open_socket(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
 	if (r < 0)
 		goto err_name;
 
-	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLHUP | EPOLLERR | EPOLLIN;
-	ev.data.ptr = data;
-	r = epoll_ctl(wpa->efd, EPOLL_CTL_ADD, fd, &ev);
-	if (r < 0) {
-		r = -errno;
+	shl_loop_io_init(io, fd, cb, wpa);
+	r = shl_loop_io_add(wpa->loop, io, EPOLLHUP | EPOLLERR | EPOLLIN);
+	if (r < 0)
 		goto err_name;
-	}
 
 	return fd;
 
@@ -253,32 +286,16 @@ err_fd:
 	return r;
 }
 
-static void close_socket(struct owfd_wpa_ctrl *wpa, int fd, char *name)
+static void close_socket(struct owfd_wpa_ctrl *wpa, struct shl_loop_io *io,
+			 char *name)
 {
-	epoll_ctl(wpa->efd, EPOLL_CTL_DEL, fd, NULL);
+	shl_loop_io_del(wpa->loop, io);
 	unlink(name);
-	close(fd);
+	close(io->fd);
 }
 
-static int arm_timer(struct owfd_wpa_ctrl *wpa, int64_t usecs)
-{
-	struct itimerspec spec;
-	int r;
-
-	us_to_timespec(&spec.it_value, usecs);
-	spec.it_interval = spec.it_value;
-
-	r = timerfd_settime(wpa->tfd, 0, &spec, NULL);
-	if (r < 0)
-		return -errno;
-
-	return 0;
-}
-
-static void disarm_timer(struct owfd_wpa_ctrl *wpa)
-{
-	arm_timer(wpa, 0);
-}
+static void ev_fn(struct shl_loop_io *io, uint32_t events, void *data);
+static void req_fn(struct shl_loop_io *io, uint32_t events, void *data);
 
 int owfd_wpa_ctrl_open(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
 		       owfd_wpa_ctrl_cb cb)
@@ -289,18 +306,13 @@ int owfd_wpa_ctrl_open(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
 	if (owfd_wpa_ctrl_is_open(wpa))
 		return -EALREADY;
 
-	/* 10s PING timer for timeouts */
-	r = arm_timer(wpa, 10000000LL);
-	if (r < 0)
-		return r;
-
-	wpa->req_fd = open_socket(wpa, ctrl_path, &wpa->req_fd, wpa->req_name);
-	if (wpa->req_fd < 0) {
-		r = wpa->req_fd;
-		goto err_timer;
-	}
+	wpa->req_fd = open_socket(wpa, ctrl_path, &wpa->req_io, req_fn,
+				  wpa->req_name);
+	if (wpa->req_fd < 0)
+		return wpa->req_fd;
 
-	wpa->ev_fd = open_socket(wpa, ctrl_path, &wpa->ev_fd, wpa->ev_name);
+	wpa->ev_fd = open_socket(wpa, ctrl_path, &wpa->ev_io, ev_fn,
+				 wpa->ev_name);
 	if (wpa->ev_fd < 0) {
 		r = wpa->ev_fd;
 		goto err_req;
@@ -310,19 +322,20 @@ int owfd_wpa_ctrl_open(struct owfd_wpa_ctrl *wpa, const char *ctrl_path,
 	if (r < 0)
 		goto err_ev;
 
+	/* PING timer for timeouts */
+	shl_loop_timer_add(wpa->loop, &wpa->ping, PING_INTERVAL);
+
 	wpa->cb = cb;
 	return 0;
 
 err_ev:
 	t = 0;
 	wpa_request(wpa->ev_fd, "DETACH", 6, NULL, NULL, &t, &wpa->mask);
-	close_socket(wpa, wpa->ev_fd, wpa->ev_name);
+	close_socket(wpa, &wpa->ev_io, wpa->ev_name);
 	wpa->ev_fd = -1;
 err_req:
-	close_socket(wpa, wpa->req_fd, wpa->req_name);
+	close_socket(wpa, &wpa->req_io, wpa->req_name);
 	wpa->req_fd = -1;
-err_timer:
-	disarm_timer(wpa);
 	return r;
 }
 
@@ -336,13 +349,13 @@ void owfd_wpa_ctrl_close(struct owfd_wpa_ctrl *wpa)
 	t = 0;
 	wpa_request(wpa->ev_fd, "DETACH", 6, NULL, NULL, &t, &wpa->mask);
 
-	close_socket(wpa, wpa->ev_fd, wpa->ev_name);
+	close_socket(wpa, &wpa->ev_io, wpa->ev_name);
 	wpa->ev_fd = -1;
 
-	close_socket(wpa, wpa->req_fd, wpa->req_name);
+	close_socket(wpa, &wpa->req_io, wpa->req_name);
 	wpa->req_fd = -1;
 
-	disarm_timer(wpa);
+	shl_loop_timer_del(wpa->loop, &wpa->ping);
 	wpa->cb = NULL;
 }
 
@@ -353,7 +366,7 @@ bool owfd_wpa_ctrl_is_open(struct owfd_wpa_ctrl *wpa)
 
 int owfd_wpa_ctrl_get_fd(struct owfd_wpa_ctrl *wpa)
 {
-	return wpa->efd;
+	return shl_loop_get_fd(wpa->loop);
 }
 
 void owfd_wpa_ctrl_set_sigmask(struct owfd_wpa_ctrl *wpa, const sigset_t *mask)
@@ -361,6 +374,19 @@ void owfd_wpa_ctrl_set_sigmask(struct owfd_wpa_ctrl *wpa, const sigset_t *mask)
 	memcpy(&wpa->mask, mask, sizeof(sigset_t));
 }
 
+/* close the ctrl on fatal errors, unless a callback closed it already */
+static void wpa_fail(struct owfd_wpa_ctrl *wpa, int error)
+{
+	if (!owfd_wpa_ctrl_is_open(wpa))
+		return;
+
+	owfd_wpa_ctrl_close(wpa);
+	if (!wpa->error)
+		wpa->error = error;
+	if (wpa->error_cb)
+		wpa->error_cb(wpa, error, wpa->data);
+}
+
 static int read_ev(struct owfd_wpa_ctrl *wpa)
 {
 	char buf[REQ_REPLY_MAX + 1];
@@ -391,21 +417,24 @@ static int read_ev(struct owfd_wpa_ctrl *wpa)
 	return 0;
 }
 
-static int dispatch_ev(struct owfd_wpa_ctrl *wpa, const struct epoll_event *e)
+static void ev_fn(struct shl_loop_io *io, uint32_t events, void *data)
 {
-	int r;
+	struct owfd_wpa_ctrl *wpa = data;
+	int r = 0;
+
+	/* callbacks may drop the last reference */
+	owfd_wpa_ctrl_ref(wpa);
 
-	if (e->events & EPOLLIN) {
+	if (events & EPOLLIN)
 		r = read_ev(wpa);
-		if (r < 0)
-			return r;
-	}
 
 	/* handle HUP/ERR last so we drain input first */
-	if (e->events & (EPOLLHUP | EPOLLERR))
-		return -EPIPE;
+	if (r >= 0 && (events & (EPOLLHUP | EPOLLERR)))
+		r = -EPIPE;
+	if (r < 0)
+		wpa_fail(wpa, r);
 
-	return 0;
+	owfd_wpa_ctrl_unref(wpa);
 }
 
 static int read_req(struct owfd_wpa_ctrl *wpa)
@@ -431,107 +460,67 @@ static int read_req(struct owfd_wpa_ctrl *wpa)
 	return 0;
 }
 
-static int dispatch_req(struct owfd_wpa_ctrl *wpa, const struct epoll_event *e)
+static void req_fn(struct shl_loop_io *io, uint32_t events, void *data)
 {
-	int r;
+	struct owfd_wpa_ctrl *wpa = data;
+	int r = 0;
+
+	owfd_wpa_ctrl_ref(wpa);
 
-	if (e->events & EPOLLIN) {
+	if (events & EPOLLIN)
 		r = read_req(wpa);
-		if (r < 0)
-			return r;
-	}
 
-	/* handle HUP/ERR last so we drain input first */
-	if (e->events & (EPOLLHUP | EPOLLERR))
-		return -EPIPE;
+	if (r >= 0 && (events & (EPOLLHUP | EPOLLERR)))
+		r = -EPIPE;
+	if (r < 0)
+		wpa_fail(wpa, r);
 
-	return 0;
+	owfd_wpa_ctrl_unref(wpa);
 }
 
-static int read_tfd(struct owfd_wpa_ctrl *wpa)
+/*
+ * Send a PING request whenever the timer expires. If the wpa_supplicant
+ * doesn't respond in a timely manner, the connection failed.
+ */
+static void ping_fn(struct shl_wheel_timer *t, void *data)
 {
-	ssize_t l;
-	uint64_t exp;
-	int r;
+	struct owfd_wpa_ctrl *wpa = data;
 	char buf[10];
 	size_t len = sizeof(buf);
+	int r;
 
-	/* Send PING request if the timer expires. If the wpa_supplicant
-	 * doesn't respond in a timely manner, return an error. */
-
-	l = read(wpa->tfd, &exp, sizeof(exp));
-	if (l < 0 && errno != EAGAIN && errno != EINTR) {
-		return -errno;
-	} else if (l == sizeof(exp)) {
-		r = wpa_request(wpa->req_fd, "PING", 4, buf, &len, NULL,
-				&wpa->mask);
-		if (r < 0)
-			return r;
-		if (len != 5 || strncmp(buf, "PONG\n", 5))
-			return -ETIMEDOUT;
-	}
-
-	return 0;
-}
-
-static int dispatch_tfd(struct owfd_wpa_ctrl *wpa, const struct epoll_event *e)
-{
-	int r = 0;
-
-	/* Remove tfd from epoll-set on HUP/ERR. This shouldn't happen, but if
-	 * it does, just stop receiving events from it. */
-	if (e->events & (EPOLLHUP | EPOLLERR)) {
-		r = -EFAULT;
-		goto error;
-	}
+	shl_loop_timer_add(wpa->loop, t, PING_INTERVAL);
 
-	if (e->events & (EPOLLIN)) {
-		r = read_tfd(wpa);
-		if (r < 0)
-			goto error;
-	}
+	owfd_wpa_ctrl_ref(wpa);
 
-	return 0;
+	r = wpa_request(wpa->req_fd, "PING", 4, buf, &len, NULL, &wpa->mask);
+	if (r >= 0 && (len != 5 || strncmp(buf, "PONG\n", 5)))
+		r = -ETIMEDOUT;
+	if (r < 0)
+		wpa_fail(wpa, r);
 
-error:
-	epoll_ctl(wpa->efd, EPOLL_CTL_DEL, wpa->tfd, NULL);
-	return r;
+	owfd_wpa_ctrl_unref(wpa);
 }
 
+/*
+ * Dispatch the loop of a ctrl created with owfd_wpa_ctrl_new(). Returns the
+ * error that closed the ctrl, if any.
+ */
 int owfd_wpa_ctrl_dispatch(struct owfd_wpa_ctrl *wpa, int timeout)
 {
-	struct epoll_event ev[2], *e;
-	int r, n, i;
-	const size_t max = sizeof(ev) / sizeof(*ev);
+	int r;
 
 	if (!owfd_wpa_ctrl_is_open(wpa))
 		return -ENODEV;
+	if (!wpa->own_loop)
+		return -EOPNOTSUPP;
 
-	n = epoll_wait(wpa->efd, ev, max, timeout);
-	if (n < 0) {
-		if (errno == EAGAIN || errno == EINTR)
-			return 0;
-		else
-			return -errno;
-	} else if (n > max) {
-		n = max;
-	}
-
-	r = 0;
-	for (i = 0; i < n; ++i) {
-		e = &ev[i];
-		if (e->data.ptr == &wpa->ev_fd)
-			r = dispatch_ev(wpa, e);
-		else if (e->data.ptr == &wpa->req_fd)
-			r = dispatch_req(wpa, e);
-		else if (e->data.ptr == &wpa->tfd)
-			r = dispatch_tfd(wpa, e);
-
-		if (r < 0)
-			break;
-	}
+	wpa->error = 0;
+	r = shl_loop_dispatch(wpa->loop, timeout);
+	if (r < 0)
+		return r;
 
-	return r;
+	return wpa->error;
 }
 
 static int timed_send(int fd, const void *cmd, size_t cmd_len,
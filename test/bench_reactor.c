@@ -0,0 +1,257 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Reactor Benchmark
+ * Runs an owfd_rtsp_reactor pool with a growing number of threads. Client
+ * processes (one per reactor thread) keep one OPTIONS request in flight on
+ * each of their connections and the reactors answer them.
+ * Reports round-trips per second for each thread count. Clients run on the
+ * same machine, so numbers stop scaling once the clients are CPU-bound.
+ *
+ * Usage: bench_reactor [max threads] [connections] [requests per connection]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtsp.h"
+
+static const char req[] = "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+static const char res[] = "RTSP/1.0 200 OK\r\nCSeq: 1\r\n\r\n";
+
+#define RES_LEN (sizeof(res) - 1)
+
+struct conn {
+	int fd;
+	size_t sent;
+	size_t done;
+	size_t partial;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fail(const char *what, int err)
+{
+	fprintf(stderr, "bench_reactor: %s: %s\n", what, strerror(err));
+	exit(1);
+}
+
+static void server_msg(struct owfd_rtsp_ctrl *ctrl,
+		       struct owfd_rtsp_msg *msg, void *data)
+{
+	owfd_rtsp_ctrl_send(ctrl, res, RES_LEN);
+}
+
+static void server_event(struct owfd_rtsp_server *srv,
+			 struct owfd_rtsp_session *sess,
+			 unsigned int event, void *data)
+{
+	if (event == OWFD_RTSP_SERVER_CONNECT)
+		owfd_rtsp_ctrl_set_msg_cb(owfd_rtsp_session_get_ctrl(sess),
+					  server_msg);
+}
+
+static void conn_send(struct conn *c)
+{
+	if (write(c->fd, req, sizeof(req) - 1) != sizeof(req) - 1)
+		fail("write", errno);
+	++c->sent;
+}
+
+/* one client process: @num connections with @count round-trips each */
+static void client(const struct sockaddr_in6 *addr, size_t num,
+		   size_t count, int ready, int go)
+{
+	struct epoll_event ev, evs[64];
+	struct conn *conns, *c;
+	char buf[RES_LEN * 4];
+	size_t i, left;
+	ssize_t l;
+	int efd, n, j;
+
+	conns = calloc(num, sizeof(*conns));
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (!conns || efd < 0)
+		fail("client", ENOMEM);
+
+	for (i = 0; i < num; ++i) {
+		c = &conns[i];
+		c->fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (c->fd < 0)
+			fail("socket", errno);
+		if (connect(c->fd, (struct sockaddr*)addr, sizeof(*addr)) < 0)
+			fail("connect", errno);
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+			fail("epoll", errno);
+	}
+
+	/* wait until all clients are connected */
+	if (write(ready, "r", 1) != 1 || read(go, buf, 1) != 0)
+		fail("pipe", EPIPE);
+
+	for (i = 0; i < num; ++i)
+		conn_send(&conns[i]);
+
+	for (left = num; left > 0; ) {
+		n = epoll_wait(efd, evs, 64, -1);
+		if (n < 0 && errno != EINTR)
+			fail("epoll", errno);
+
+		for (j = 0; j < n; ++j) {
+			c = evs[j].data.ptr;
+			l = read(c->fd, buf, sizeof(buf));
+			if (l <= 0)
+				fail("read", l ? errno : EPIPE);
+
+			c->partial += l;
+			while (c->partial >= RES_LEN) {
+				c->partial -= RES_LEN;
+				++c->done;
+			}
+
+			if (c->done == count)
+				--left;
+			else if (c->sent == c->done)
+				conn_send(c);
+		}
+	}
+
+	for (i = 0; i < num; ++i)
+		close(conns[i].fd);
+	close(efd);
+	free(conns);
+}
+
+static double run(unsigned int threads, size_t conns, size_t count)
+{
+	struct owfd_rtsp_reactor *pool;
+	struct sockaddr_in6 addr;
+	int r, ready[2], go[2];
+	unsigned int i;
+	uint64_t start;
+	pid_t pid;
+	char c;
+
+	r = owfd_rtsp_reactor_new(&pool, threads, server_event, NULL);
+	if (r < 0)
+		fail("reactor", -r);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	r = owfd_rtsp_reactor_listen(pool, &addr);
+	if (r < 0)
+		fail("listen", -r);
+	owfd_rtsp_reactor_get_addr(pool, &addr);
+
+	r = owfd_rtsp_reactor_start(pool);
+	if (r < 0)
+		fail("start", -r);
+
+	if (pipe(ready) < 0 || pipe(go) < 0)
+		fail("pipe", errno);
+
+	for (i = 0; i < threads; ++i) {
+		pid = fork();
+		if (pid < 0)
+			fail("fork", errno);
+		if (!pid) {
+			close(go[1]);
+			client(&addr, conns / threads, count, ready[1],
+			       go[0]);
+			_exit(0);
+		}
+	}
+
+	for (i = 0; i < threads; ++i) {
+		if (read(ready[0], &c, 1) != 1)
+			fail("pipe", EPIPE);
+	}
+
+	/* closing @go starts all clients at once */
+	start = now();
+	close(go[1]);
+	while (wait(NULL) > 0)
+		;
+	start = now() - start;
+
+	close(go[0]);
+	close(ready[0]);
+	close(ready[1]);
+	owfd_rtsp_reactor_free(pool);
+
+	return (double)(conns / threads) * threads * count / (start / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int max = 8, threads;
+	size_t conns = 256, count = 1000;
+	long cpus;
+
+	if (argc > 1)
+		max = atoi(argv[1]);
+	if (argc > 2)
+		conns = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		count = strtoul(argv[3], NULL, 10);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	printf("%ld cpus, %zu connections, %zu requests each\n", cpus,
+	       conns, count);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (threads = 1; threads <= max; threads *= 2) {
+		if (conns < threads)
+			break;
+
+		printf("threads %2u: %10.0f msgs/s\n", threads,
+		       run(threads, conns, count));
+		fflush(stdout);
+	}
+
+	return 0;
+}
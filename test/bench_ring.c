@@ -0,0 +1,237 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Ring-buffer Benchmark
+ * Moves RTSP-sized messages through a pipe, once via stack buffers plus
+ * shl_ring_push()/shl_ring_copy() (as rtsp_ctrl and the decoder used to do)
+ * and once via shl_ring_reserve()/shl_ring_commit() and the fd helpers, on
+ * plain and on mirrored rings (see shl_ring_mirror()).
+ * Reports time per message and the number of bytes copied in user-space.
+ *
+ * Usage: bench_ring [messages]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "shl_ring.h"
+
+#define BATCH 64
+
+static const char fmt[] =
+	"RTSP/1.0 200 OK\r\n"
+	"CSeq: %u\r\n"
+	"Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n"
+	"Public: org.wfa.wfd1.0, SETUP, TEARDOWN, PLAY, PAUSE, "
+	"GET_PARAMETER, SET_PARAMETER\r\n"
+	"\r\n";
+
+struct result {
+	uint64_t nsec;
+	uint64_t copied;
+	uint64_t bytes;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "bench_ring: %s: %m\n", msg);
+	exit(1);
+}
+
+static void run_copy(int *fds, unsigned int num, struct result *res)
+{
+	struct shl_ring out, in;
+	char buf[4096], *c;
+	unsigned int i, j;
+	size_t l, pending;
+	ssize_t n;
+	int len;
+
+	memset(&out, 0, sizeof(out));
+	memset(&in, 0, sizeof(in));
+
+	for (i = 0; i < num; i += BATCH) {
+		for (j = i; j < i + BATCH && j < num; ++j) {
+			len = snprintf(buf, sizeof(buf), fmt, j);
+			if (shl_ring_push(&out, buf, len) < 0)
+				die("push");
+			res->copied += len;
+			res->bytes += len;
+		}
+
+		pending = 0;
+		while (shl_ring_length(&out)) {
+			n = shl_ring_write_fd(&out, fds[1]);
+			if (n < 0)
+				die("write");
+			pending += n;
+
+			while (pending > 0) {
+				n = read(fds[0], buf, sizeof(buf));
+				if (n <= 0)
+					die("read");
+				if (shl_ring_push(&in, buf, n) < 0)
+					die("push");
+				res->copied += n;
+				pending -= n;
+			}
+		}
+
+		/* consumers glued wrapped data back together */
+		l = shl_ring_length(&in);
+		c = shl_ring_copy(&in, &l);
+		if (!c)
+			die("copy");
+		res->copied += l;
+		shl_ring_pull(&in, l);
+		free(c);
+	}
+
+	shl_ring_clear(&out);
+	shl_ring_clear(&in);
+}
+
+static void run_reserve(int *fds, unsigned int num, struct result *res,
+			bool mirror)
+{
+	struct shl_ring out, in;
+	struct iovec vec[2];
+	char buf[4096];
+	unsigned int i, j;
+	size_t pending;
+	ssize_t n;
+	int len;
+
+	memset(&out, 0, sizeof(out));
+	memset(&in, 0, sizeof(in));
+
+	if (mirror && (shl_ring_mirror(&out) < 0 || shl_ring_mirror(&in) < 0))
+		die("mirror");
+
+	for (i = 0; i < num; i += BATCH) {
+		for (j = i; j < i + BATCH && j < num; ++j) {
+			if (shl_ring_reserve(&out, 512, vec) < 0)
+				die("reserve");
+
+			/* format in place, fall back if it does not fit */
+			len = snprintf(vec[0].iov_base, vec[0].iov_len, fmt, j);
+			if (len < 0)
+				die("snprintf");
+			if ((size_t)len < vec[0].iov_len) {
+				shl_ring_commit(&out, len);
+			} else {
+				len = snprintf(buf, sizeof(buf), fmt, j);
+				if (shl_ring_push(&out, buf, len) < 0)
+					die("push");
+				res->copied += len;
+			}
+			res->bytes += len;
+		}
+
+		pending = 0;
+		while (shl_ring_length(&out)) {
+			n = shl_ring_write_fd(&out, fds[1]);
+			if (n < 0)
+				die("write");
+			pending += n;
+
+			while (pending > 0) {
+				n = shl_ring_read_fd(&in, fds[0], 4096);
+				if (n <= 0)
+					die("read");
+				pending -= n;
+			}
+		}
+
+		/* consumers parse the ring in place (see shl_ring_peek()) */
+		shl_ring_pull(&in, shl_ring_length(&in));
+	}
+
+	shl_ring_clear(&out);
+	shl_ring_clear(&in);
+}
+
+static void report(const char *name, unsigned int num,
+		   const struct result *res)
+{
+	printf("%-8s %10u msgs %8.1f ns/msg %8.1f bytes copied/msg "
+	       "(%.2f per byte sent)\n",
+	       name, num, (double)res->nsec / num,
+	       (double)res->copied / num,
+	       (double)res->copied / res->bytes);
+}
+
+int main(int argc, char **argv)
+{
+	struct result res;
+	unsigned int num = 200000;
+	uint64_t start;
+	int fds[2];
+
+	if (argc > 1)
+		num = strtoul(argv[1], NULL, 10);
+	if (!num)
+		num = 1;
+
+	if (pipe(fds) < 0)
+		die("pipe");
+
+	memset(&res, 0, sizeof(res));
+	start = now();
+	run_copy(fds, num, &res);
+	res.nsec = now() - start;
+	report("copy", num, &res);
+
+	memset(&res, 0, sizeof(res));
+	start = now();
+	run_reserve(fds, num, &res, false);
+	res.nsec = now() - start;
+	report("reserve", num, &res);
+
+	memset(&res, 0, sizeof(res));
+	start = now();
+	run_reserve(fds, num, &res, true);
+	res.nsec = now() - start;
+	report("mirror", num, &res);
+
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
@@ -0,0 +1,453 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Session Benchmark
+ * Runs synthetic Wifi-Display sessions between pairs of source and sink
+ * controllers on a single shl_loop. Each round of a session walks through the
+ * messages M1 to M16, one request in flight at a time, initiated by whichever
+ * side sends it in a real session. The controllers are connected with
+ * owfd_rtsp_ctrl_open_pair(), either over AF_UNIX sockets or through the
+ * in-memory pipe, which leaves the kernel out entirely.
+ * Prints one JSON object per transport with messages per second, heap
+ * allocations per message and round-trip latency, so results can be compared
+ * across commits. A warm-up round is not counted.
+ *
+ * Usage: bench_rtsp [mem|socket|all] [sessions] [rounds]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rtsp.h"
+#include "shl_hist.h"
+#include "shl_loop.h"
+
+enum role {
+	SOURCE,
+	SINK,
+};
+
+#define SESSION_ID "5f3a1c02;timeout=30"
+
+/* one request of the script and the reply of the other side */
+struct step {
+	unsigned int from;
+	unsigned int method;
+	const char *uri;
+	const char *header;
+	const char *value;
+	const char *body;
+	const char *reply_header;
+	const char *reply_value;
+	const char *reply_body;
+};
+
+#define URI "rtsp://localhost/wfd1.0"
+#define STREAM_URI "rtsp://localhost/wfd1.0/streamid=0"
+
+static const struct step script[] = {
+	/* M1, M2: capability exchange */
+	{ SOURCE, OWFD_RTSP_METHOD_OPTIONS, "*",
+	  "Require", "org.wfa.wfd1.0", NULL,
+	  "Public", "org.wfa.wfd1.0, GET_PARAMETER, SET_PARAMETER", NULL },
+	{ SINK, OWFD_RTSP_METHOD_OPTIONS, "*",
+	  "Require", "org.wfa.wfd1.0", NULL,
+	  "Public", "org.wfa.wfd1.0, SETUP, TEARDOWN, PLAY, PAUSE, "
+		    "GET_PARAMETER, SET_PARAMETER", NULL },
+	/* M3, M4: parameters */
+	{ SOURCE, OWFD_RTSP_METHOD_GET_PARAMETER, URI,
+	  NULL, NULL,
+	  "wfd_video_formats\r\n"
+	  "wfd_audio_codecs\r\n"
+	  "wfd_client_rtp_ports\r\n",
+	  NULL, NULL,
+	  "wfd_video_formats: 00 00 02 10 0001ffff 1fffffff 00001fff 00 0000 "
+	  "0000 10 none none\r\n"
+	  "wfd_audio_codecs: AAC 00000001 00\r\n"
+	  "wfd_client_rtp_ports: RTP/AVP/UDP;unicast 1991 0 mode=play\r\n" },
+	{ SOURCE, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL,
+	  "wfd_video_formats: 00 00 02 10 00000001 00000000 00000000 00 0000 "
+	  "0000 10 none none\r\n"
+	  "wfd_audio_codecs: AAC 00000001 00\r\n"
+	  "wfd_presentation_URL: " STREAM_URI " none\r\n"
+	  "wfd_client_rtp_ports: RTP/AVP/UDP;unicast 1991 0 mode=play\r\n",
+	  NULL, NULL, NULL },
+	/* M5, M6, M7: trigger and establish the stream */
+	{ SOURCE, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_trigger_method: SETUP\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SETUP, STREAM_URI,
+	  "Transport", "RTP/AVP/UDP;unicast;client_port=1991", NULL,
+	  "Transport", "RTP/AVP/UDP;unicast;client_port=1991;"
+		       "server_port=19000", NULL },
+	{ SINK, OWFD_RTSP_METHOD_PLAY, STREAM_URI,
+	  NULL, NULL, NULL,
+	  NULL, NULL, NULL },
+	/* M9 to M15: pause, routing, standby, IDR and UIBC */
+	{ SINK, OWFD_RTSP_METHOD_PAUSE, STREAM_URI,
+	  NULL, NULL, NULL,
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_route: primary\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_connector_type: 05\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_standby\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_idr_request\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL,
+	  "wfd_uibc_capability: input_category_list=GENERIC;"
+	  "generic_cap_list=Keyboard, Mouse;hidc_cap_list=none;port=none\r\n",
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_SET_PARAMETER, URI,
+	  NULL, NULL, "wfd_uibc_setting: enable\r\n",
+	  NULL, NULL, NULL },
+	/* M16: keep-alive, M8: end of the session */
+	{ SOURCE, OWFD_RTSP_METHOD_GET_PARAMETER, URI,
+	  NULL, NULL, NULL,
+	  NULL, NULL, NULL },
+	{ SINK, OWFD_RTSP_METHOD_TEARDOWN, STREAM_URI,
+	  NULL, NULL, NULL,
+	  NULL, NULL, NULL },
+};
+
+#define STEPS (sizeof(script) / sizeof(*script))
+
+/* the step that opens the stream; later requests carry the session */
+#define SETUP_STEP 5
+
+struct session {
+	struct owfd_rtsp_ctrl *ctrl[2];
+	struct owfd_rtsp_msg_builder req[2];
+	struct owfd_rtsp_msg_builder res[2];
+	size_t step;
+	size_t left;
+	uint64_t sent;
+};
+
+static struct shl_loop loop;
+static struct shl_hist latency;
+static size_t active;
+static uint64_t exchanges;
+
+/*
+ * Heap allocations are counted by wrapping the allocator of glibc. The
+ * sanitizers bring their own, so counting is off in those builds.
+ */
+#ifndef __SANITIZE_ADDRESS__
+
+#define COUNT_ALLOCS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static bool counting;
+static uint64_t allocs;
+
+__attribute__((visibility("default")))
+void *malloc(size_t size)
+{
+	if (counting)
+		++allocs;
+	return __libc_malloc(size);
+}
+
+__attribute__((visibility("default")))
+void *calloc(size_t n, size_t size)
+{
+	if (counting)
+		++allocs;
+	return __libc_calloc(n, size);
+}
+
+__attribute__((visibility("default")))
+void *realloc(void *p, size_t size)
+{
+	if (counting)
+		++allocs;
+	return __libc_realloc(p, size);
+}
+
+#else
+
+#define COUNT_ALLOCS 0
+
+static bool counting;
+static uint64_t allocs;
+
+#endif
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fail(const char *what, int err)
+{
+	fprintf(stderr, "bench_rtsp: %s: %s\n", what, strerror(err));
+	exit(1);
+}
+
+static void step_send(struct session *s);
+
+static void step_reply(struct owfd_rtsp_ctrl *ctrl,
+		       struct owfd_rtsp_msg *reply, int error, void *data)
+{
+	struct session *s = data;
+
+	if (error < 0)
+		fail("request", -error);
+	if (reply->status != 200)
+		fail("reply", EPROTO);
+
+	shl_hist_add(&latency, now() - s->sent);
+	++exchanges;
+
+	if (++s->step < STEPS) {
+		step_send(s);
+	} else if (--s->left > 0) {
+		s->step = 0;
+		step_send(s);
+	} else if (!--active) {
+		shl_loop_exit(&loop, 0);
+	}
+}
+
+static void step_send(struct session *s)
+{
+	const struct step *st = &script[s->step];
+	struct owfd_rtsp_msg_builder *b = &s->req[st->from];
+	int r;
+
+	owfd_rtsp_msg_builder_set_session(b, s->step > SETUP_STEP ?
+					  SESSION_ID : NULL);
+	r = owfd_rtsp_msg_builder_request(b, st->method, st->uri);
+	if (r < 0)
+		fail("build", -r);
+	if (st->header)
+		owfd_rtsp_msg_builder_header(b, st->header, st->value);
+	if (st->body)
+		owfd_rtsp_msg_builder_body(b, st->body, strlen(st->body));
+
+	s->sent = now();
+	r = owfd_rtsp_ctrl_request(s->ctrl[st->from], b, 0, step_reply, s);
+	if (r < 0)
+		fail("request", -r);
+}
+
+/* the responder of the current step answers every request it gets */
+static void session_msg(struct owfd_rtsp_ctrl *ctrl,
+			struct owfd_rtsp_msg *msg, void *data)
+{
+	struct session *s = data;
+	const struct step *st = &script[s->step];
+	unsigned int to = ctrl == s->ctrl[SOURCE] ? SOURCE : SINK;
+	struct owfd_rtsp_msg_builder *b = &s->res[to];
+	int r;
+
+	if (msg->type != OWFD_RTSP_MSG_REQUEST || msg->method != st->method)
+		fail("script", EPROTO);
+
+	owfd_rtsp_msg_builder_set_session(b, s->step >= SETUP_STEP ?
+					  SESSION_ID : NULL);
+	r = owfd_rtsp_msg_builder_response(b, 200, NULL, msg->cseq);
+	if (r < 0)
+		fail("build", -r);
+	if (st->reply_header)
+		owfd_rtsp_msg_builder_header(b, st->reply_header,
+					     st->reply_value);
+	if (st->reply_body)
+		owfd_rtsp_msg_builder_body(b, st->reply_body,
+					   strlen(st->reply_body));
+
+	r = owfd_rtsp_ctrl_send_msg(ctrl, b);
+	if (r < 0)
+		fail("send", -r);
+}
+
+static void session_error(struct owfd_rtsp_ctrl *ctrl, int error, void *data)
+{
+	fail("session", -error);
+}
+
+static void session_open(struct session *s, unsigned int mode)
+{
+	unsigned int i;
+	int r;
+
+	memset(s, 0, sizeof(*s));
+
+	for (i = 0; i < 2; ++i) {
+		r = owfd_rtsp_ctrl_new_loop(&s->ctrl[i], &loop);
+		if (r < 0)
+			fail("ctrl", -r);
+
+		owfd_rtsp_ctrl_set_data(s->ctrl[i], s);
+		owfd_rtsp_ctrl_set_error_cb(s->ctrl[i], session_error);
+		r = owfd_rtsp_ctrl_set_msg_cb(s->ctrl[i], session_msg);
+		if (r < 0)
+			fail("ctrl", -r);
+
+		owfd_rtsp_msg_builder_init(&s->req[i]);
+		owfd_rtsp_msg_builder_init(&s->res[i]);
+		owfd_rtsp_msg_builder_set_content_type(&s->req[i],
+						       "text/parameters");
+		owfd_rtsp_msg_builder_set_content_type(&s->res[i],
+						       "text/parameters");
+	}
+
+	r = owfd_rtsp_ctrl_open_pair(s->ctrl[SOURCE], s->ctrl[SINK], mode,
+				     NULL);
+	if (r < 0)
+		fail("open", -r);
+}
+
+static void session_close(struct session *s)
+{
+	owfd_rtsp_ctrl_unref(s->ctrl[SOURCE]);
+	owfd_rtsp_ctrl_unref(s->ctrl[SINK]);
+}
+
+/* run @rounds rounds of the script on all sessions at once */
+static void run_rounds(struct session *sessions, size_t num, size_t rounds)
+{
+	size_t i;
+	int r;
+
+	active = num;
+	for (i = 0; i < num; ++i) {
+		sessions[i].step = 0;
+		sessions[i].left = rounds;
+		step_send(&sessions[i]);
+	}
+
+	r = shl_loop_run(&loop);
+	if (r < 0)
+		fail("loop", -r);
+}
+
+static void run(const char *name, unsigned int mode, size_t num,
+		size_t rounds)
+{
+	struct session *sessions;
+	uint64_t start, wakeups, msgs;
+	double secs;
+	size_t i;
+	int r;
+
+	r = shl_loop_init(&loop);
+	if (r < 0)
+		fail("loop", -r);
+
+	sessions = calloc(num, sizeof(*sessions));
+	if (!sessions)
+		fail("sessions", ENOMEM);
+	for (i = 0; i < num; ++i)
+		session_open(&sessions[i], mode);
+
+	/* grows all buffers and caches to their steady-state size */
+	run_rounds(sessions, num, 1);
+
+	shl_hist_init(&latency);
+	exchanges = 0;
+	allocs = 0;
+	wakeups = loop.wakeups;
+
+	counting = true;
+	start = now();
+	run_rounds(sessions, num, rounds);
+	start = now() - start;
+	counting = false;
+
+	/* every exchange is a request and its response */
+	msgs = exchanges * 2;
+	secs = start / 1e9;
+
+	printf("{\"transport\": \"%s\", \"sessions\": %zu, \"rounds\": %zu, "
+	       "\"msgs\": %" PRIu64 ", \"seconds\": %.6f, "
+	       "\"msgs_per_sec\": %.0f, ",
+	       name, num, rounds, msgs, secs, msgs / secs);
+	if (COUNT_ALLOCS)
+		printf("\"allocs_per_msg\": %.4f, ", (double)allocs / msgs);
+	else
+		printf("\"allocs_per_msg\": null, ");
+	printf("\"wakeups\": %" PRIu64 ", \"latency_ns\": {\"p50\": %" PRIu64
+	       ", \"p99\": %" PRIu64 ", \"max\": %" PRIu64 "}}\n",
+	       loop.wakeups - wakeups, shl_hist_quantile(&latency, 0.5),
+	       shl_hist_quantile(&latency, 0.99), latency.max);
+	fflush(stdout);
+
+	for (i = 0; i < num; ++i)
+		session_close(&sessions[i]);
+	free(sessions);
+	shl_loop_destroy(&loop);
+}
+
+int main(int argc, char **argv)
+{
+	const char *transport = "all";
+	size_t num = 64, rounds = 1000;
+	bool all;
+
+	if (argc > 1)
+		transport = argv[1];
+	if (argc > 2)
+		num = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		rounds = strtoul(argv[3], NULL, 10);
+
+	if (!num || !rounds) {
+		fprintf(stderr, "usage: bench_rtsp [mem|socket|all] "
+			"[sessions] [rounds]\n");
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	all = !strcmp(transport, "all");
+	if (all || !strcmp(transport, "mem"))
+		run("mem", OWFD_RTSP_CTRL_PAIR_MEM, num, rounds);
+	if (all || !strcmp(transport, "socket"))
+		run("socket", OWFD_RTSP_CTRL_PAIR_SOCKET, num, rounds);
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP Server Benchmark
+ * A child process opens many loopback connections to an owfd_rtsp_server,
+ * which serves all of them from a single epoll loop. Once every session is
+ * established, the child sends one OPTIONS request on each connection and
+ * waits for all replies.
+ * Reports the accept rate, memory per idle session, the cost of a dispatch
+ * with all sessions idle and the request rate across all sessions.
+ *
+ * Usage: bench_server [sessions]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtsp.h"
+
+/* connections the client opens before it waits for the server */
+#define BATCH 1024
+
+static const char req[] = "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+static const char res[] = "RTSP/1.0 200 OK\r\nCSeq: 1\r\n\r\n";
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fail(const char *what, int err)
+{
+	fprintf(stderr, "bench_server: %s: %s\n", what, strerror(err));
+	exit(1);
+}
+
+static size_t raise_nofile(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+		return 1024;
+
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+	getrlimit(RLIMIT_NOFILE, &rl);
+	return rl.rlim_cur;
+}
+
+static void server_msg(struct owfd_rtsp_ctrl *ctrl,
+		       struct owfd_rtsp_msg *msg, void *data)
+{
+	owfd_rtsp_ctrl_send(ctrl, res, sizeof(res) - 1);
+}
+
+static void server_event(struct owfd_rtsp_server *srv,
+			 struct owfd_rtsp_session *sess,
+			 unsigned int event, void *data)
+{
+	if (event == OWFD_RTSP_SERVER_CONNECT)
+		owfd_rtsp_ctrl_set_msg_cb(owfd_rtsp_session_get_ctrl(sess),
+					  server_msg);
+}
+
+/* client side: @up signals the server, @down is waited on */
+static void client(const struct sockaddr_in6 *addr, size_t num, int up,
+		   int down)
+{
+	char buf[sizeof(res)];
+	size_t i, l;
+	ssize_t r;
+	int *fds;
+	char c;
+
+	fds = calloc(num, sizeof(*fds));
+	if (!fds)
+		fail("client", ENOMEM);
+
+	for (i = 0; i < num; ++i) {
+		fds[i] = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fds[i] < 0)
+			fail("socket", errno);
+		if (connect(fds[i], (struct sockaddr*)addr, sizeof(*addr)) < 0)
+			fail("connect", errno);
+
+		/* let the server drain its accept queue */
+		if ((i + 1) % BATCH == 0 || i + 1 == num) {
+			c = 'b';
+			if (write(up, &c, 1) != 1 || read(down, &c, 1) != 1)
+				fail("pipe", EPIPE);
+		}
+	}
+
+	/* wait for the server to measure idle dispatches */
+	if (read(down, &c, 1) != 1)
+		fail("pipe", EPIPE);
+
+	for (i = 0; i < num; ++i) {
+		if (write(fds[i], req, sizeof(req) - 1) != sizeof(req) - 1)
+			fail("write", errno);
+	}
+
+	for (i = 0; i < num; ++i) {
+		for (l = 0; l < sizeof(res) - 1; l += r) {
+			r = read(fds[i], &buf[l], sizeof(res) - 1 - l);
+			if (r <= 0)
+				fail("read", r ? errno : EPIPE);
+		}
+	}
+
+	c = 'd';
+	if (write(up, &c, 1) != 1)
+		fail("pipe", EPIPE);
+
+	for (i = 0; i < num; ++i)
+		close(fds[i]);
+	free(fds);
+}
+
+int main(int argc, char **argv)
+{
+	struct owfd_rtsp_server_stats stats;
+	struct owfd_rtsp_server *srv;
+	struct sockaddr_in6 addr;
+	uint64_t start, accept_nsec, idle_nsec, req_nsec;
+	size_t num = 10000, max, i, target;
+	int r, up[2], down[2];
+	pid_t pid;
+	ssize_t l;
+	char c;
+
+	if (argc > 1)
+		num = strtoul(argv[1], NULL, 10);
+
+	/* both processes hold one fd per session */
+	max = raise_nofile();
+	if (num + 64 > max) {
+		num = max - 64;
+		fprintf(stderr, "bench_server: limited to %zu sessions\n", num);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	r = owfd_rtsp_server_new(&srv, server_event);
+	if (r < 0)
+		fail("server", -r);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	r = owfd_rtsp_server_listen(srv, &addr);
+	if (r < 0)
+		fail("listen", -r);
+	r = owfd_rtsp_server_get_addr(srv, &addr);
+	if (r < 0)
+		fail("listen", -r);
+
+	if (pipe(up) < 0 || pipe(down) < 0)
+		fail("pipe", errno);
+
+	pid = fork();
+	if (pid < 0)
+		fail("fork", errno);
+	if (!pid) {
+		/* the epoll fd is shared with the parent, leave it alone */
+		client(&addr, num, up[1], down[0]);
+		_exit(0);
+	}
+
+	/* accept all sessions, batch by batch */
+	start = now();
+	for (target = 0; target < num; ) {
+		if (read(up[0], &c, 1) != 1)
+			fail("client", EPIPE);
+
+		target += BATCH;
+		if (target > num)
+			target = num;
+
+		do {
+			r = owfd_rtsp_server_dispatch(srv, 100);
+			if (r < 0)
+				fail("dispatch", -r);
+			owfd_rtsp_server_get_stats(srv, &stats);
+		} while (stats.sessions < target);
+
+		c = 'a';
+		if (write(down[1], &c, 1) != 1)
+			fail("pipe", EPIPE);
+	}
+	accept_nsec = now() - start;
+
+	/* let all sessions see their connect event */
+	for (i = 0; i < num / 64 + 16; ++i)
+		owfd_rtsp_server_dispatch(srv, 0);
+
+	/* all sessions idle */
+	start = now();
+	for (i = 0; i < 1000; ++i)
+		owfd_rtsp_server_dispatch(srv, 0);
+	idle_nsec = (now() - start) / 1000;
+
+	owfd_rtsp_server_get_stats(srv, &stats);
+	printf("sessions:       %zu (peak %zu)\n", stats.sessions,
+	       stats.peak_sessions);
+	printf("accept:         %.0f sessions/s\n",
+	       num / (accept_nsec / 1e9));
+	printf("memory:         %zu bytes/session\n",
+	       stats.sessions ? stats.memory / stats.sessions : 0);
+	printf("idle dispatch:  %.3f us\n", idle_nsec / 1e3);
+
+	/* one request per session */
+	c = 'r';
+	if (write(down[1], &c, 1) != 1)
+		fail("pipe", EPIPE);
+
+	fcntl(up[0], F_SETFL, O_NONBLOCK);
+	start = now();
+	do {
+		r = owfd_rtsp_server_dispatch(srv, 10);
+		if (r < 0)
+			fail("dispatch", -r);
+		l = read(up[0], &c, 1);
+	} while (l != 1);
+	req_nsec = now() - start;
+
+	printf("requests:       %.0f req/s across %zu sessions\n",
+	       num / (req_nsec / 1e9), num);
+
+	waitpid(pid, NULL, 0);
+	owfd_rtsp_server_unref(srv);
+	return 0;
+}
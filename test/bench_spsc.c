@@ -0,0 +1,179 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * SPSC Ring Benchmark
+ * A producer thread pushes data through a shl_spsc ring to a consumer thread
+ * which reads it in place. Both threads are pinned to separate CPUs if
+ * possible. Reports throughput in GB/s for several chunk sizes.
+ *
+ * Usage: bench_spsc [GiB per run] [producer cpu] [consumer cpu]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl_spsc.h"
+
+#define RING_SIZE (1024 * 1024)
+
+struct run {
+	struct shl_spsc q;
+	uint64_t total;
+	size_t chunk;
+	int cpu;
+	uint64_t sum;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *producer(void *data)
+{
+	struct run *run = data;
+	char *buf;
+	uint64_t pos = 0;
+	size_t n, l;
+
+	pin(run->cpu);
+
+	buf = malloc(run->chunk);
+	if (!buf)
+		abort();
+	memset(buf, 0x5a, run->chunk);
+
+	while (pos < run->total) {
+		l = run->chunk;
+		if (l > run->total - pos)
+			l = run->total - pos;
+
+		n = shl_spsc_push(&run->q, buf, l);
+		if (!n)
+			sched_yield();
+		pos += n;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void consume(struct run *run, int cpu)
+{
+	struct iovec vec[2];
+	uint64_t pos = 0, sum = 0;
+	size_t i, j, n;
+	const unsigned char *b;
+
+	pin(cpu);
+
+	while (pos < run->total) {
+		n = shl_spsc_peek(&run->q, vec);
+		if (!n) {
+			sched_yield();
+			continue;
+		}
+
+		/* touch every cache-line so the data really moves */
+		for (i = 0; i < n; ++i) {
+			b = vec[i].iov_base;
+			for (j = 0; j < vec[i].iov_len; j += 64)
+				sum += b[j];
+			pos += vec[i].iov_len;
+			shl_spsc_consume(&run->q, vec[i].iov_len);
+		}
+	}
+
+	run->sum = sum;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t chunks[] = { 64, 512, 4096, 65536 };
+	struct run run;
+	pthread_t t;
+	uint64_t start, nsec;
+	double gib = 1;
+	int pcpu = 0, ccpu = 1, r;
+	size_t i;
+
+	if (argc > 1)
+		gib = strtod(argv[1], NULL);
+	if (argc > 2)
+		pcpu = atoi(argv[2]);
+	if (argc > 3)
+		ccpu = atoi(argv[3]);
+
+	for (i = 0; i < sizeof(chunks) / sizeof(*chunks); ++i) {
+		memset(&run, 0, sizeof(run));
+		run.total = gib * 1024 * 1024 * 1024;
+		run.chunk = chunks[i];
+		run.cpu = pcpu;
+
+		r = shl_spsc_init(&run.q, RING_SIZE, 0);
+		if (r < 0) {
+			fprintf(stderr, "bench_spsc: init: %s\n", strerror(-r));
+			return 1;
+		}
+
+		start = now();
+		r = pthread_create(&t, NULL, producer, &run);
+		if (r) {
+			fprintf(stderr, "bench_spsc: thread: %s\n",
+				strerror(r));
+			return 1;
+		}
+		consume(&run, ccpu);
+		pthread_join(t, NULL);
+		nsec = now() - start;
+
+		printf("chunk %6zu: %8.3f GB/s (%" PRIu64 " bytes in %.3f s)\n",
+		       run.chunk, (double)run.total / nsec,
+		       run.total, nsec / 1e9);
+
+		shl_spsc_destroy(&run.q);
+	}
+
+	return 0;
+}
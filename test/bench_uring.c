@@ -0,0 +1,259 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * RTSP io_uring Benchmark
+ * A client thread talks to an owfd_rtsp_ctrl over loopback TCP, with the
+ * ctrl on level-triggered epoll, on edge-triggered epoll (OWFD_RTSP_CTRL_EDGE)
+ * and on an io_uring ring. In ping-pong mode the
+ * client waits for each reply before it sends the next request, in pipelined
+ * mode it writes DEPTH requests at once.
+ * Reports syscalls per message on the ctrl side (epoll_wait(), read(),
+ * sendmsg() and epoll_ctl() calls, or io_uring_enter() calls) and the round
+ * trip latency seen by the client.
+ *
+ * Usage: bench_uring [messages]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtsp.h"
+
+/* requests in flight in pipelined mode */
+#define DEPTH 16
+
+static const char req[] = "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+static const char res[] = "RTSP/1.0 200 OK\r\nCSeq: 1\r\n\r\n";
+
+struct client {
+	pthread_t thread;
+	struct sockaddr_in6 addr;
+	size_t num;
+	size_t depth;
+	uint64_t *lat;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fail(const char *what, int err)
+{
+	fprintf(stderr, "bench_uring: %s: %s\n", what, strerror(err));
+	exit(1);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static void *client_fn(void *data)
+{
+	struct client *c = data;
+	char out[DEPTH * sizeof(req)], in[DEPTH * sizeof(res)];
+	size_t i, j, len, want;
+	uint64_t start;
+	ssize_t l;
+	int fd, set;
+
+	fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		fail("socket", errno);
+	set = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &set, sizeof(set));
+	if (connect(fd, (struct sockaddr*)&c->addr, sizeof(c->addr)) < 0)
+		fail("connect", errno);
+
+	for (j = 0; j < c->depth; ++j)
+		memcpy(&out[j * (sizeof(req) - 1)], req, sizeof(req) - 1);
+	want = c->depth * (sizeof(res) - 1);
+
+	for (i = 0; i < c->num; i += c->depth) {
+		start = now();
+		len = c->depth * (sizeof(req) - 1);
+		if (write(fd, out, len) != (ssize_t)len)
+			fail("write", errno);
+
+		for (len = 0; len < want; len += l) {
+			l = read(fd, &in[len], want - len);
+			if (l <= 0)
+				fail("read", l ? errno : EPIPE);
+		}
+		c->lat[i / c->depth] = now() - start;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void server_msg(struct owfd_rtsp_ctrl *ctrl,
+		       struct owfd_rtsp_msg *msg, void *data)
+{
+	owfd_rtsp_ctrl_send(ctrl, res, sizeof(res) - 1);
+}
+
+enum mode {
+	MODE_EPOLL,
+	MODE_EDGE,
+	MODE_URING,
+};
+
+static void run(const char *name, unsigned int mode, size_t num,
+		size_t depth)
+{
+	struct owfd_rtsp_uring_stats rstats;
+	struct owfd_rtsp_ctrl_stats stats;
+	struct owfd_rtsp_ctrl *ctrl;
+	struct sockaddr_in6 addr;
+	struct client c;
+	socklen_t alen;
+	uint64_t waits = 0, calls, start, nsec;
+	size_t rounds;
+	int r, lfd, fd, set;
+
+	lfd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0)
+		fail("socket", errno);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	alen = sizeof(addr);
+	if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 1) < 0 ||
+	    getsockname(lfd, (struct sockaddr*)&addr, &alen) < 0)
+		fail("listen", errno);
+
+	rounds = (num + depth - 1) / depth;
+	memset(&c, 0, sizeof(c));
+	c.addr = addr;
+	c.num = rounds * depth;
+	c.depth = depth;
+	c.lat = calloc(rounds, sizeof(*c.lat));
+	if (!c.lat)
+		fail("client", ENOMEM);
+
+	r = pthread_create(&c.thread, NULL, client_fn, &c);
+	if (r)
+		fail("thread", r);
+
+	fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		fail("accept", errno);
+	close(lfd);
+	set = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &set, sizeof(set));
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	if (r < 0)
+		fail("ctrl", -r);
+	if (mode == MODE_EDGE)
+		owfd_rtsp_ctrl_set_flags(ctrl, OWFD_RTSP_CTRL_EDGE);
+	if (mode == MODE_URING) {
+		r = owfd_rtsp_ctrl_set_uring(ctrl, NULL);
+		if (r < 0) {
+			printf("%-10s io_uring not available (%s)\n", name,
+			       strerror(-r));
+			owfd_rtsp_ctrl_unref(ctrl);
+			close(fd);
+			pthread_join(c.thread, NULL);
+			free(c.lat);
+			return;
+		}
+	}
+	owfd_rtsp_ctrl_set_msg_cb(ctrl, server_msg);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fd, NULL);
+	if (r < 0)
+		fail("open", -r);
+
+	/* each dispatch is one epoll_wait(); the client hangs up when done */
+	start = now();
+	while (owfd_rtsp_ctrl_is_open(ctrl)) {
+		owfd_rtsp_ctrl_dispatch(ctrl, -1);
+		++waits;
+	}
+	nsec = now() - start;
+	pthread_join(c.thread, NULL);
+
+	/* with io_uring, sends are requests and not syscalls of their own */
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	calls = waits + stats.reads + stats.polls;
+	if (mode == MODE_URING) {
+		owfd_rtsp_uring_get_stats(owfd_rtsp_ctrl_get_uring(ctrl),
+					  &rstats);
+		calls += rstats.enters;
+	} else {
+		calls += stats.writes;
+	}
+
+	qsort(c.lat, rounds, sizeof(*c.lat), cmp_u64);
+	printf("%-10s %8.2f syscalls/msg  %9.0f msg/s  p50 %6.1f us  p99 %6.1f us\n",
+	       name, (double)calls / c.num, c.num / (nsec / 1e9),
+	       c.lat[rounds / 2] / 1e3, c.lat[rounds * 99 / 100] / 1e3);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	free(c.lat);
+}
+
+int main(int argc, char **argv)
+{
+	size_t num = 20000;
+
+	if (argc > 1)
+		num = strtoul(argv[1], NULL, 10);
+	if (num < DEPTH)
+		num = DEPTH;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("ping-pong, %zu messages\n", num);
+	run("epoll", MODE_EPOLL, num, 1);
+	run("epoll-et", MODE_EDGE, num, 1);
+	run("io_uring", MODE_URING, num, 1);
+
+	printf("pipelined (depth %d), %zu messages\n", DEPTH, num);
+	run("epoll", MODE_EPOLL, num, DEPTH);
+	run("epoll-et", MODE_EDGE, num, DEPTH);
+	run("io_uring", MODE_URING, num, DEPTH);
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Timer-wheel Benchmark
+ * Arms one timer per simulated session with a keepalive-like timeout, re-arms
+ * every timer as if traffic arrived, cancels a quarter of them and finally
+ * advances the wheel until all remaining timers ran.
+ * Reports time per operation.
+ *
+ * Usage: bench_wheel [timers]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "shl_wheel.h"
+
+static uint64_t fired;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "bench_wheel: %s\n", msg);
+	exit(1);
+}
+
+static void timer_fn(struct shl_wheel_timer *t, void *data)
+{
+	++fired;
+}
+
+static void report(const char *name, unsigned int num, uint64_t nsec)
+{
+	printf("%-8s %10u timers %8.1f ns/timer\n", name, num,
+	       (double)nsec / num);
+}
+
+int main(int argc, char **argv)
+{
+	struct shl_wheel_timer *timers;
+	struct shl_wheel w;
+	unsigned int num = 1000000, i, seed = 1;
+	uint64_t start;
+
+	if (argc > 1)
+		num = strtoul(argv[1], NULL, 10);
+	if (!num)
+		num = 1;
+
+	timers = calloc(num, sizeof(*timers));
+	if (!timers)
+		die("out of memory");
+	if (shl_wheel_init(&w, 1, 0) < 0)
+		die("cannot init wheel");
+
+	for (i = 0; i < num; ++i)
+		shl_wheel_timer_init(&timers[i], timer_fn, NULL);
+
+	/* timeouts spread over 1s to 60s, like session timers */
+	start = now();
+	for (i = 0; i < num; ++i) {
+		seed = seed * 1103515245 + 12345;
+		shl_wheel_add(&w, &timers[i], 1000 + (seed >> 8) % 59000);
+	}
+	report("arm", num, now() - start);
+
+	start = now();
+	for (i = 0; i < num; ++i) {
+		seed = seed * 1103515245 + 12345;
+		shl_wheel_add(&w, &timers[i], 1000 + (seed >> 8) % 59000);
+	}
+	report("re-arm", num, now() - start);
+
+	start = now();
+	for (i = 0; i < num; i += 4)
+		shl_wheel_del(&w, &timers[i]);
+	report("cancel", (num + 3) / 4, now() - start);
+
+	start = now();
+	shl_wheel_advance(&w, 60000);
+	report("expire", num - (num + 3) / 4, now() - start);
+
+	if (fired != num - (num + 3) / 4 || shl_wheel_count(&w))
+		die("timers lost");
+
+	shl_wheel_destroy(&w);
+	free(timers);
+	return 0;
+}
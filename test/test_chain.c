@@ -0,0 +1,261 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unistd.h>
+#include "shl_chain.h"
+#include "test_common.h"
+
+/* verify @c contains exactly @len bytes of @buf */
+static void chain_expect(struct shl_chain *c, const char *buf, size_t len)
+{
+	struct iovec vec[64];
+	static char tmp[65536];
+	size_t n, i, l;
+
+	ck_assert(shl_chain_length(c) == len);
+	ck_assert(len <= sizeof(tmp));
+	ck_assert(shl_chain_read(c, tmp, sizeof(tmp)) == len);
+	ck_assert(!len || !memcmp(tmp, buf, len));
+
+	n = shl_chain_peek(c, vec, 64);
+	ck_assert(n == shl_chain_peek(c, NULL, 0));
+	for (i = 0, l = 0; i < n; ++i) {
+		ck_assert(vec[i].iov_len > 0);
+		ck_assert(!memcmp(vec[i].iov_base, &buf[l], vec[i].iov_len));
+		l += vec[i].iov_len;
+	}
+	ck_assert(l == len);
+}
+
+START_TEST(test_chain_push)
+{
+	struct shl_chain_pool pool = SHL_CHAIN_POOL_INIT(pool, 4);
+	struct shl_chain c;
+	struct iovec vec[2];
+	char buf[50000];
+	size_t i, off;
+	int r;
+
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 3;
+
+	shl_chain_init(&c, &pool);
+	chain_expect(&c, NULL, 0);
+
+	/* data is appended, never moved */
+	r = shl_chain_push(&c, buf, 100);
+	ck_assert(!r);
+	ck_assert(shl_chain_peek(&c, vec, 2) == 1);
+	r = shl_chain_push(&c, &buf[100], 10000);
+	ck_assert(!r);
+	ck_assert(shl_chain_peek(&c, &vec[1], 1) == 1);
+	ck_assert(vec[0].iov_base == vec[1].iov_base);
+	chain_expect(&c, buf, 10100);
+	ck_assert(pool.num_used == 3);
+
+	/* pulling returns drained segments to the pool */
+	off = 0;
+	for (i = 1; off < 10100; i += 113) {
+		shl_chain_pull(&c, i);
+		off += i;
+		if (off > 10100)
+			off = 10100;
+		chain_expect(&c, &buf[off], 10100 - off);
+	}
+	ck_assert(pool.num_used == 1);
+	ck_assert(pool.num_free == 2);
+
+	/* the pool caches at most @high idle segments */
+	r = shl_chain_push(&c, buf, sizeof(buf));
+	ck_assert(!r);
+	chain_expect(&c, buf, sizeof(buf));
+	ck_assert(!pool.num_free);
+	shl_chain_clear(&c);
+	ck_assert(!pool.num_used);
+	ck_assert(pool.num_free == 4);
+	chain_expect(&c, NULL, 0);
+
+	/* skipped bytes may end anywhere within the iovecs */
+	vec[0].iov_base = buf;
+	vec[0].iov_len = 100;
+	vec[1].iov_base = &buf[100];
+	vec[1].iov_len = 5000;
+	for (off = 0; off <= 5100; off += 50) {
+		r = shl_chain_pushv_skip(&c, vec, 2, off);
+		ck_assert(!r);
+		chain_expect(&c, &buf[off], 5100 - off);
+		shl_chain_clear(&c);
+	}
+
+	shl_chain_pool_set_high(&pool, 1);
+	ck_assert(pool.num_free == 1);
+	shl_chain_pool_trim(&pool, 0);
+	ck_assert(!pool.num_free);
+}
+END_TEST
+
+START_TEST(test_chain_reserve)
+{
+	struct shl_chain_pool pool = SHL_CHAIN_POOL_INIT(pool, 16);
+	struct shl_chain c;
+	struct iovec vec[8];
+	char buf[20000], *p;
+	size_t i, j, l, sum;
+	int n, r;
+
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 7;
+
+	shl_chain_init(&c, &pool);
+
+	for (i = 0; i < 5000; i += 333) {
+		shl_chain_clear(&c);
+		r = shl_chain_push(&c, buf, i);
+		ck_assert(!r);
+
+		n = shl_chain_reserve(&c, 10000, vec, 8);
+		ck_assert(n > 0);
+		for (j = 0, sum = 0; j < (size_t)n; ++j)
+			sum += vec[j].iov_len;
+		ck_assert(sum >= 10000);
+
+		/* commit less than reserved */
+		for (j = 0, l = 0; l < 6000; ++j) {
+			if (vec[j].iov_len > 6000 - l)
+				vec[j].iov_len = 6000 - l;
+			memcpy(vec[j].iov_base, &buf[i + l], vec[j].iov_len);
+			l += vec[j].iov_len;
+		}
+
+		shl_chain_commit(&c, 6000);
+		chain_expect(&c, buf, i + 6000);
+	}
+
+	/* unused reserved segments are released again */
+	shl_chain_clear(&c);
+	n = shl_chain_reserve(&c, 10000, vec, 8);
+	ck_assert(n >= 3);
+	ck_assert(pool.num_used == (size_t)n);
+	shl_chain_commit(&c, 0);
+	ck_assert(pool.num_used == 1);
+	chain_expect(&c, NULL, 0);
+
+	/* contiguous space fits into the current segment if possible */
+	shl_chain_clear(&c);
+	shl_chain_pool_trim(&pool, 0);
+	r = shl_chain_push(&c, buf, 100);
+	ck_assert(!r);
+	p = shl_chain_reserve_contig(&c, 200);
+	ck_assert(!!p);
+	ck_assert(pool.num_used == 1);
+	memcpy(p, &buf[100], 200);
+	shl_chain_commit(&c, 200);
+	chain_expect(&c, buf, 300);
+
+	/* otherwise the segment is sealed and a bigger one is linked */
+	p = shl_chain_reserve_contig(&c, 15000);
+	ck_assert(!!p);
+	memcpy(p, &buf[300], 15000);
+	shl_chain_commit(&c, 15000);
+	ck_assert(shl_chain_peek(&c, vec, 8) == 2);
+	ck_assert(vec[0].iov_len == 300);
+	ck_assert(vec[1].iov_len == 15000);
+	chain_expect(&c, buf, 15300);
+
+	r = shl_chain_push(&c, &buf[15300], 10);
+	ck_assert(!r);
+	chain_expect(&c, buf, 15310);
+	ck_assert(pool.num_used == 3);
+
+	/* oversized segments are not cached */
+	shl_chain_clear(&c);
+	ck_assert(!pool.num_used);
+	ck_assert(pool.num_free == 2);
+
+	shl_chain_clear(&c);
+	shl_chain_pool_trim(&pool, 0);
+}
+END_TEST
+
+START_TEST(test_chain_fd)
+{
+	struct shl_chain in, out;
+	char buf[30000];
+	size_t i, total;
+	ssize_t l;
+	int fds[2], r;
+
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 11;
+
+	shl_chain_init(&in, NULL);
+	shl_chain_init(&out, NULL);
+
+	r = pipe(fds);
+	ck_assert(!r);
+
+	for (i = 0; i < 10; ++i) {
+		r = shl_chain_push(&out, buf, sizeof(buf));
+		ck_assert(!r);
+
+		for (total = 0; total < sizeof(buf); total += l) {
+			l = shl_chain_write_fd(&out, fds[1]);
+			ck_assert(l > 0);
+
+			while (shl_chain_length(&in) < total + l) {
+				r = shl_chain_read_fd(&in, fds[0], 1000);
+				ck_assert(r > 0);
+			}
+		}
+
+		ck_assert(!shl_chain_length(&out));
+		ck_assert(shl_chain_write_fd(&out, fds[1]) == 0);
+		chain_expect(&in, buf, sizeof(buf));
+		shl_chain_pull(&in, sizeof(buf));
+	}
+
+	close(fds[1]);
+	ck_assert(shl_chain_read_fd(&in, fds[0], 1000) == 0);
+	close(fds[0]);
+	ck_assert(shl_chain_read_fd(&in, fds[0], 1000) == -EBADF);
+	chain_expect(&in, NULL, 0);
+
+	shl_chain_clear(&in);
+	shl_chain_clear(&out);
+}
+END_TEST
+
+TEST_DEFINE_CASE(chain)
+	TEST(test_chain_push)
+	TEST(test_chain_reserve)
+	TEST(test_chain_fd)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(chain,
+		TEST_CASE(chain),
+		TEST_END
+	)
+)
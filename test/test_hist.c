@@ -0,0 +1,112 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "shl_hist.h"
+#include "test_common.h"
+
+START_TEST(test_hist_buckets)
+{
+	uint64_t v;
+	unsigned int i;
+
+	/* small values are exact */
+	for (i = 0; i < SHL_HIST_SUB; ++i) {
+		ck_assert(shl_hist_bucket(i) == i);
+		ck_assert(shl_hist_bucket_max(i) == i);
+	}
+
+	/* buckets are contiguous and each one ends where the next begins */
+	for (i = 0; i < SHL_HIST_BUCKETS - 1; ++i) {
+		v = shl_hist_bucket_max(i);
+		ck_assert(shl_hist_bucket(v) == i);
+		ck_assert(shl_hist_bucket(v + 1) == i + 1);
+	}
+
+	ck_assert(shl_hist_bucket(UINT64_MAX) == SHL_HIST_BUCKETS - 1);
+	ck_assert(shl_hist_bucket(1ULL << SHL_HIST_MAX_BITS) ==
+		  SHL_HIST_BUCKETS - 1);
+
+	/* the relative error stays below 1/SHL_HIST_SUB */
+	for (v = SHL_HIST_SUB; v < (1ULL << 30); v = v * 3 + 1) {
+		i = shl_hist_bucket(v);
+		ck_assert(shl_hist_bucket_max(i) - v <= v / SHL_HIST_SUB);
+	}
+}
+END_TEST
+
+START_TEST(test_hist_quantile)
+{
+	struct shl_hist h, h2;
+	uint64_t v;
+	unsigned int i;
+
+	shl_hist_init(&h);
+	ck_assert(!shl_hist_quantile(&h, 0.5));
+	ck_assert(!shl_hist_mean(&h));
+
+	for (i = 1; i <= 1000; ++i)
+		shl_hist_add(&h, i);
+
+	ck_assert(h.count == 1000);
+	ck_assert(h.min == 1);
+	ck_assert(h.max == 1000);
+	ck_assert(shl_hist_mean(&h) == 500);
+	ck_assert(shl_hist_quantile(&h, 0.0) == 1);
+	ck_assert(shl_hist_quantile(&h, 1.0) == 1000);
+
+	v = shl_hist_quantile(&h, 0.5);
+	ck_assert(v >= 500 && v <= 500 + 500 / SHL_HIST_SUB);
+	v = shl_hist_quantile(&h, 0.99);
+	ck_assert(v >= 990 && v <= 1000);
+
+	/* a single outlier shows up in the tail only */
+	shl_hist_init(&h2);
+	for (i = 0; i < 99; ++i)
+		shl_hist_add(&h2, 10);
+	shl_hist_add(&h2, 1000000);
+	ck_assert(shl_hist_quantile(&h2, 0.5) == 10);
+	ck_assert(shl_hist_quantile(&h2, 0.99) == 10);
+	ck_assert(shl_hist_quantile(&h2, 0.999) >= 1000000);
+	ck_assert(shl_hist_quantile(&h2, 0.999) == h2.max);
+
+	shl_hist_merge(&h, &h2);
+	ck_assert(h.count == 1100);
+	ck_assert(h.min == 1);
+	ck_assert(h.max == 1000000);
+}
+END_TEST
+
+TEST_DEFINE_CASE(hist)
+	TEST(test_hist_buckets)
+	TEST(test_hist_quantile)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(hist,
+		TEST_CASE(hist),
+		TEST_END
+	)
+)
@@ -0,0 +1,309 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "shl_loop.h"
+#include "test_common.h"
+
+struct lio {
+	struct shl_loop_io io;
+	struct shl_loop *loop;
+	struct lio *victim;
+	unsigned int calls;
+	uint32_t events;
+};
+
+static void lio_fn(struct shl_loop_io *io, uint32_t events, void *data)
+{
+	struct lio *l = data;
+	char buf[16];
+
+	++l->calls;
+	l->events = events;
+	ck_assert(read(io->fd, buf, sizeof(buf)) > 0);
+
+	if (l->victim)
+		shl_loop_io_del(l->loop, &l->victim->io);
+}
+
+START_TEST(test_loop_io)
+{
+	struct shl_loop loop;
+	struct lio a, b;
+	int r, pa[2], pb[2];
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+	ck_assert(shl_loop_get_fd(&loop) >= 0);
+
+	ck_assert(pipe(pa) >= 0);
+	ck_assert(pipe(pb) >= 0);
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	a.loop = &loop;
+	b.loop = &loop;
+	shl_loop_io_init(&a.io, pa[0], lio_fn, &a);
+	shl_loop_io_init(&b.io, pb[0], lio_fn, &b);
+	r = shl_loop_io_add(&loop, &a.io, EPOLLIN);
+	ck_assert(r >= 0);
+	r = shl_loop_io_add(&loop, &a.io, EPOLLIN);
+	ck_assert(r == -EALREADY);
+	r = shl_loop_io_add(&loop, &b.io, EPOLLIN);
+	ck_assert(r >= 0);
+
+	/* nothing ready */
+	r = shl_loop_dispatch(&loop, 0);
+	ck_assert(r == 0);
+	ck_assert(loop.wakeups == 1);
+
+	/* both sources are served by a single wakeup */
+	ck_assert(write(pa[1], "a", 1) == 1);
+	ck_assert(write(pb[1], "b", 1) == 1);
+	r = shl_loop_dispatch(&loop, 1000);
+	ck_assert(r == 2);
+	ck_assert(loop.wakeups == 2);
+	ck_assert(a.calls == 1 && a.events == EPOLLIN);
+	ck_assert(b.calls == 1 && b.events == EPOLLIN);
+
+	/* sources removed by callbacks get no events fetched earlier */
+	a.victim = &b;
+	b.victim = &a;
+	ck_assert(write(pa[1], "a", 1) == 1);
+	ck_assert(write(pb[1], "b", 1) == 1);
+	r = shl_loop_dispatch(&loop, 1000);
+	ck_assert(r == 2);
+	ck_assert(a.calls + b.calls == 3);
+	ck_assert(!a.io.active || !b.io.active);
+
+	/* updated sources follow their new events */
+	a.victim = NULL;
+	b.victim = NULL;
+	shl_loop_io_del(&loop, &a.io);
+	shl_loop_io_del(&loop, &b.io);
+	r = shl_loop_io_update(&loop, &a.io, EPOLLIN);
+	ck_assert(r == -EINVAL);
+	r = shl_loop_io_add(&loop, &a.io, EPOLLIN);
+	ck_assert(r >= 0);
+	r = shl_loop_io_update(&loop, &a.io, 0);
+	ck_assert(r >= 0);
+	ck_assert(write(pa[1], "a", 1) == 1);
+	r = shl_loop_dispatch(&loop, 0);
+	ck_assert(r == 0);
+	r = shl_loop_io_update(&loop, &a.io, EPOLLIN);
+	ck_assert(r >= 0);
+	a.calls = 0;
+	r = shl_loop_dispatch(&loop, 0);
+	ck_assert(r == 1);
+	ck_assert(a.calls == 1);
+
+	shl_loop_destroy(&loop);
+	close(pa[0]);
+	close(pa[1]);
+	close(pb[0]);
+	close(pb[1]);
+}
+END_TEST
+
+static unsigned int timer_calls;
+
+static void timer_fn(struct shl_wheel_timer *t, void *data)
+{
+	++timer_calls;
+}
+
+START_TEST(test_loop_timer)
+{
+	struct shl_loop loop;
+	struct shl_wheel_timer t;
+	uint64_t start;
+	int r, i;
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	timer_calls = 0;
+	shl_wheel_timer_init(&t, timer_fn, NULL);
+	shl_loop_timer_add(&loop, &t, 20);
+	start = shl_wheel_time(shl_loop_get_wheel(&loop));
+
+	for (i = 0; i < 100 && !timer_calls; ++i) {
+		r = shl_loop_dispatch(&loop, 1000);
+		ck_assert(r >= 0);
+	}
+	ck_assert(timer_calls == 1);
+	ck_assert(shl_wheel_time(shl_loop_get_wheel(&loop)) >= start + 20);
+
+	/* cancelled timers never run */
+	shl_loop_timer_add(&loop, &t, 10);
+	shl_loop_timer_del(&loop, &t);
+	r = shl_loop_dispatch(&loop, 50);
+	ck_assert(r >= 0);
+	ck_assert(timer_calls == 1);
+
+	shl_loop_destroy(&loop);
+}
+END_TEST
+
+struct lsig {
+	struct shl_loop_signal sig;
+	unsigned int calls;
+};
+
+static void lsig_fn(struct shl_loop_signal *sig,
+		    const struct signalfd_siginfo *info, void *data)
+{
+	struct lsig *s = data;
+
+	ck_assert(info->ssi_signo == SIGUSR1);
+	++s->calls;
+}
+
+START_TEST(test_loop_signal)
+{
+	struct shl_loop loop;
+	struct lsig a, b;
+	int r;
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	shl_loop_signal_init(&a.sig, SIGUSR1, lsig_fn, &a);
+	shl_loop_signal_init(&b.sig, SIGUSR1, lsig_fn, &b);
+	r = shl_loop_signal_add(&loop, &a.sig);
+	ck_assert(r >= 0);
+	r = shl_loop_signal_add(&loop, &b.sig);
+	ck_assert(r >= 0);
+	r = shl_loop_signal_add(&loop, &b.sig);
+	ck_assert(r == -EALREADY);
+
+	/* all handlers of a signal run */
+	ck_assert(raise(SIGUSR1) == 0);
+	r = shl_loop_dispatch(&loop, 1000);
+	ck_assert(r == 1);
+	ck_assert(a.calls == 1 && b.calls == 1);
+
+	shl_loop_signal_del(&loop, &a.sig);
+	ck_assert(raise(SIGUSR1) == 0);
+	r = shl_loop_dispatch(&loop, 1000);
+	ck_assert(r == 1);
+	ck_assert(a.calls == 1 && b.calls == 2);
+
+	/* without handlers, the signal stays pending but is not read */
+	shl_loop_signal_del(&loop, &b.sig);
+	ck_assert(raise(SIGUSR1) == 0);
+	r = shl_loop_dispatch(&loop, 0);
+	ck_assert(r == 0);
+
+	/* consume it again so it does not leak into other tests */
+	r = shl_loop_signal_add(&loop, &a.sig);
+	ck_assert(r >= 0);
+	r = shl_loop_dispatch(&loop, 1000);
+	ck_assert(r == 1);
+	ck_assert(a.calls == 2);
+
+	shl_loop_destroy(&loop);
+}
+END_TEST
+
+struct ldefer {
+	struct shl_loop_defer d;
+	struct shl_loop *loop;
+	unsigned int calls;
+	unsigned int rearm;
+};
+
+static void ldefer_fn(struct shl_loop_defer *d, void *data)
+{
+	struct ldefer *l = data;
+
+	ck_assert(!shl_loop_defer_pending(d));
+	++l->calls;
+
+	if (l->calls < l->rearm)
+		shl_loop_defer_add(l->loop, d);
+	else if (l->rearm)
+		shl_loop_exit(l->loop, 7);
+}
+
+START_TEST(test_loop_defer)
+{
+	struct shl_loop loop;
+	struct ldefer a;
+	int r;
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	memset(&a, 0, sizeof(a));
+	a.loop = &loop;
+	shl_loop_defer_init(&a.d, ldefer_fn, &a);
+
+	/* queued defers do not let the loop sleep */
+	shl_loop_defer_add(&loop, &a.d);
+	shl_loop_defer_add(&loop, &a.d);
+	ck_assert(shl_loop_defer_pending(&a.d));
+	r = shl_loop_dispatch(&loop, -1);
+	ck_assert(r == 0);
+	ck_assert(a.calls == 1);
+
+	shl_loop_defer_add(&loop, &a.d);
+	shl_loop_defer_del(&loop, &a.d);
+	r = shl_loop_dispatch(&loop, 0);
+	ck_assert(r == 0);
+	ck_assert(a.calls == 1);
+
+	/* re-queued defers run once per iteration until the loop exits */
+	a.calls = 0;
+	a.rearm = 5;
+	loop.wakeups = 0;
+	shl_loop_defer_add(&loop, &a.d);
+	r = shl_loop_run(&loop);
+	ck_assert(r == 7);
+	ck_assert(a.calls == 5);
+	ck_assert(loop.wakeups == 5);
+
+	shl_loop_destroy(&loop);
+}
+END_TEST
+
+TEST_DEFINE_CASE(loop)
+	TEST(test_loop_io)
+	TEST(test_loop_timer)
+	TEST(test_loop_signal)
+	TEST(test_loop_defer)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(loop,
+		TEST_CASE(loop),
+		TEST_END
+	)
+)
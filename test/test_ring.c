@@ -0,0 +1,263 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unistd.h>
+#include "shl_ring.h"
+#include "test_common.h"
+
+/* verify @r contains exactly @len bytes of @buf */
+static void ring_expect(struct shl_ring *r, const char *buf, size_t len)
+{
+	struct iovec vec[2];
+	size_t n, l;
+
+	ck_assert(shl_ring_length(r) == len);
+
+	n = shl_ring_peek(r, vec);
+	if (!len) {
+		ck_assert(n == 0);
+		return;
+	}
+
+	ck_assert(n == 1 || n == 2);
+	l = vec[0].iov_len;
+	ck_assert(l <= len);
+	ck_assert(!memcmp(vec[0].iov_base, buf, l));
+	if (n > 1) {
+		ck_assert(l + vec[1].iov_len == len);
+		ck_assert(!memcmp(vec[1].iov_base, &buf[l], len - l));
+	} else {
+		ck_assert(l == len);
+	}
+}
+
+START_TEST(test_ring_push)
+{
+	struct shl_ring r;
+	char buf[10000], *c;
+	size_t i, l;
+	int ret;
+
+	memset(&r, 0, sizeof(r));
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i;
+
+	ring_expect(&r, NULL, 0);
+
+	/* grow from empty and across the wrap-around point */
+	for (i = 1; i < 100; ++i) {
+		ret = shl_ring_push(&r, buf, i * 37);
+		ck_assert(!ret);
+		ring_expect(&r, buf, i * 37);
+
+		l = i * 37;
+		c = shl_ring_copy(&r, &l);
+		ck_assert(!!c && l == i * 37 && !memcmp(c, buf, l));
+		free(c);
+
+		shl_ring_pull(&r, i * 37 - 1);
+		ring_expect(&r, &buf[i * 37 - 1], 1);
+		shl_ring_pull(&r, 10);
+		ring_expect(&r, NULL, 0);
+	}
+
+	ret = shl_ring_push(&r, buf, sizeof(buf));
+	ck_assert(!ret);
+	ring_expect(&r, buf, sizeof(buf));
+	ck_assert(r.size == 16384);
+
+	shl_ring_flush(&r);
+	ring_expect(&r, NULL, 0);
+	shl_ring_clear(&r);
+	ck_assert(!r.buf && !r.size);
+}
+END_TEST
+
+START_TEST(test_ring_reserve)
+{
+	struct shl_ring r;
+	struct iovec vec[2];
+	char buf[5000];
+	size_t i, j, l, sum;
+	int n;
+
+	memset(&r, 0, sizeof(r));
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 3;
+
+	for (i = 0; i < 4096; i += 71) {
+		/* move start/end to @i, then reserve */
+		shl_ring_flush(&r);
+		shl_ring_push(&r, buf, i);
+		shl_ring_pull(&r, i);
+
+		shl_ring_push(&r, buf, 100);
+
+		n = shl_ring_reserve(&r, 1000, vec);
+		ck_assert(n == 1 || n == 2);
+
+		/* all free space minus the "end == start" byte is returned */
+		sum = vec[0].iov_len + (n > 1 ? vec[1].iov_len : 0);
+		ck_assert(sum == r.size - 100 - 1);
+		ck_assert(sum >= 1000);
+
+		l = 0;
+		for (j = 0; j < (size_t)n && l < 1000; ++j) {
+			if (vec[j].iov_len > 1000 - l)
+				vec[j].iov_len = 1000 - l;
+			memcpy(vec[j].iov_base, &buf[100 + l], vec[j].iov_len);
+			l += vec[j].iov_len;
+		}
+
+		shl_ring_commit(&r, 1000);
+		ring_expect(&r, buf, 1100);
+	}
+
+	/* reserving more than available grows the buffer */
+	n = shl_ring_reserve(&r, 4000, vec);
+	ck_assert(n == 1 || n == 2);
+	ck_assert(r.size == 8192);
+	ring_expect(&r, buf, 1100);
+
+	shl_ring_clear(&r);
+}
+END_TEST
+
+START_TEST(test_ring_fd)
+{
+	struct shl_ring in, out;
+	char buf[3000];
+	size_t i, total;
+	ssize_t l;
+	int fds[2], ret;
+
+	memset(&in, 0, sizeof(in));
+	memset(&out, 0, sizeof(out));
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 7;
+
+	ret = pipe(fds);
+	ck_assert(!ret);
+
+	/* move data through the pipe repeatedly so both rings wrap */
+	for (i = 0; i < 20; ++i) {
+		ret = shl_ring_push(&out, buf, sizeof(buf));
+		ck_assert(!ret);
+
+		l = shl_ring_write_fd(&out, fds[1]);
+		ck_assert(l == sizeof(buf));
+		ck_assert(!shl_ring_length(&out));
+		ck_assert(shl_ring_write_fd(&out, fds[1]) == 0);
+
+		for (total = 0; total < sizeof(buf); total += l) {
+			l = shl_ring_read_fd(&in, fds[0], 512);
+			ck_assert(l > 0);
+		}
+
+		ring_expect(&in, buf, sizeof(buf));
+		shl_ring_pull(&in, sizeof(buf));
+	}
+
+	close(fds[1]);
+	ck_assert(shl_ring_read_fd(&in, fds[0], 512) == 0);
+	close(fds[0]);
+	ck_assert(shl_ring_read_fd(&in, fds[0], 512) == -EBADF);
+
+	shl_ring_clear(&in);
+	shl_ring_clear(&out);
+}
+END_TEST
+
+START_TEST(test_ring_mirror)
+{
+	struct shl_ring r;
+	struct iovec vec[2];
+	char buf[20000];
+	size_t i, size;
+	int n, ret;
+
+	memset(&r, 0, sizeof(r));
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 5;
+
+	ret = shl_ring_mirror(&r);
+	if (ret == -EOPNOTSUPP)
+		return;
+	ck_assert(!ret);
+	ck_assert(r.mirror);
+
+	ret = shl_ring_push(&r, buf, 100);
+	ck_assert(!ret);
+	ck_assert(shl_ring_mirror(&r) == 0);
+	shl_ring_pull(&r, 100);
+	size = r.size;
+	ck_assert(size >= 4096);
+
+	/* data and free space stay contiguous wherever the ring wraps */
+	for (i = 0; i < size; i += 333) {
+		shl_ring_flush(&r);
+		shl_ring_push(&r, buf, i);
+		shl_ring_pull(&r, i);
+
+		ret = shl_ring_push(&r, buf, size - 1);
+		ck_assert(!ret);
+		ck_assert(r.size == size);
+		ck_assert(shl_ring_peek(&r, vec) == 1);
+		ck_assert(vec[0].iov_len == size - 1);
+		ck_assert(!memcmp(vec[0].iov_base, buf, size - 1));
+
+		shl_ring_pull(&r, size / 2);
+		n = shl_ring_reserve(&r, size / 2, vec);
+		ck_assert(n == 1);
+		ck_assert(vec[0].iov_len == size / 2);
+		memcpy(vec[0].iov_base, &buf[size - 1], size / 2);
+		shl_ring_commit(&r, size / 2);
+		ring_expect(&r, &buf[size / 2], size - 1);
+	}
+
+	/* growing keeps wrapped data intact */
+	ret = shl_ring_push(&r, &buf[size / 2 + size - 1], 3 * size);
+	ck_assert(!ret);
+	ck_assert(r.size > size);
+	ring_expect(&r, &buf[size / 2], 4 * size - 1);
+
+	shl_ring_clear(&r);
+	ck_assert(!r.buf && !r.size && !r.mirror);
+}
+END_TEST
+
+TEST_DEFINE_CASE(ring)
+	TEST(test_ring_push)
+	TEST(test_ring_reserve)
+	TEST(test_ring_fd)
+	TEST(test_ring_mirror)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(ring,
+		TEST_CASE(ring),
+		TEST_END
+	)
+)
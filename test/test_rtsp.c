@@ -23,6 +23,14 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <openwfd/wfd_defs.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "shl_loop.h"
+#include "shl_wheel.h"
 #include "test_common.h"
 
 static int received;
@@ -241,6 +249,710 @@ START_TEST(test_rtsp_decoder)
 }
 END_TEST
 
+static char *span_buf;
+
+static void test_rtsp_decoder_span_event(struct owfd_rtsp_decoder *dec,
+					 struct owfd_rtsp_msg *msg,
+					 void *data)
+{
+	size_t i;
+	char *p;
+
+	++received;
+
+	/* all lines and the body are stored back-to-back in one buffer */
+	p = msg->header[0];
+	for (i = 0; i < msg->header_num; ++i) {
+		ck_assert(msg->header[i] == p);
+		ck_assert(strlen(p) == msg->header_len[i]);
+		p += msg->header_len[i] + 1;
+	}
+	ck_assert(!msg->header[msg->header_num]);
+	ck_assert(!msg->body || msg->body == p);
+
+	/* the buffer is reused across messages */
+	if (span_buf)
+		ck_assert(span_buf == msg->header[0]);
+	span_buf = msg->header[0];
+
+	ck_assert(msg->header_num == 3);
+	ck_assert(!strcmp(msg->header[0], "some-head: buhu"));
+	ck_assert(!strcmp(msg->header[1], "content-length:10"));
+	ck_assert(!strcmp(msg->header[2], "more-header: bing-bung"));
+	ck_assert(msg->body_len == 10);
+	ck_assert(!strcmp(msg->body, "0123456789"));
+}
+
+START_TEST(test_rtsp_decoder_spans)
+{
+	struct owfd_rtsp_decoder *d;
+	int r, sent = 0;
+
+	received = 0;
+
+	r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_span_event);
+	ck_assert(r >= 0);
+
+	owfd_rtsp_decoder_set_flags(d, OWFD_RTSP_DECODER_SPANS);
+	ck_assert(owfd_rtsp_decoder_get_flags(d) == OWFD_RTSP_DECODER_SPANS);
+
+	FEED(d, "some-head: buhu\ncontent-length:10\r\nmore-header:  bing-\0bung \r\n\n0123456789");
+	++sent;
+	ck_assert(received == sent);
+
+	FEED(d, "  \t\n \t some-head: \n\t\r buhu     \ncontent-length:10\r\nmore-header:  bing-\0bung \r\n\n0123456789");
+	++sent;
+	ck_assert(received == sent);
+
+	FEED(d, "some-head: buhu\r\ncontent-length:10\r\n");
+	FEED(d, "more-header: bing-bung\r\n\r\n01234");
+	ck_assert(received == sent);
+	FEED(d, "56789");
+	++sent;
+	ck_assert(received == sent);
+
+	owfd_rtsp_decoder_free(d);
+}
+END_TEST
+
+static char chunk_out[4096];
+static size_t chunk_len;
+
+static void test_rtsp_decoder_chunk_event(struct owfd_rtsp_decoder *dec,
+					  struct owfd_rtsp_msg *msg,
+					  void *data)
+{
+	size_t i;
+
+	/* serialize message so we can compare different feed patterns */
+	for (i = 0; i < msg->header_num; ++i) {
+		ck_assert(chunk_len + msg->header_len[i] + 1 < sizeof(chunk_out));
+		memcpy(&chunk_out[chunk_len], msg->header[i],
+		       msg->header_len[i]);
+		chunk_len += msg->header_len[i];
+		chunk_out[chunk_len++] = '\n';
+	}
+
+	ck_assert(chunk_len + msg->body_len + 1 < sizeof(chunk_out));
+	if (msg->body) {
+		memcpy(&chunk_out[chunk_len], msg->body, msg->body_len);
+		chunk_len += msg->body_len;
+	}
+	chunk_out[chunk_len++] = '|';
+}
+
+START_TEST(test_rtsp_decoder_chunked)
+{
+	static const char msg[] =
+		"GET_PARAMETER rtsp://localhost/wfd1.0 RTSP/1.0\r\n"
+		"CSeq: 2\r\n"
+		"Content-Type: text/parameters\r\n"
+		"Some-Quoted-Header-With-A-Rather-Long-Name: \"quoted \\\" \\\\\" "
+		"\"string with\r\n \\\"escapes\\\\\\\" and new-lines\"\r\n"
+		"Content-Length: 126\r\n"
+		"\r\n"
+		"wfd_video_formats\r\n"
+		"wfd_audio_codecs\r\n"
+		"wfd_client_rtp_ports\r\n"
+		"wfd_content_protection\r\n"
+		"wfd_uibc_capability\r\n"
+		"wfd_3d_video_formats\r\n"
+		"  \r\n"
+		"OPTIONS * RTSP/1.0\r\n"
+		"Require: org.wfa.wfd1.0\r\n"
+		"CSeq: 3\r\n\r\n";
+	const size_t len = sizeof(msg) - 1;
+	char ref[sizeof(chunk_out)];
+	struct owfd_rtsp_decoder *d;
+	size_t ref_len, i, j;
+	unsigned int flags;
+	int r;
+
+	for (flags = 0; flags <= OWFD_RTSP_DECODER_SPANS; ++flags) {
+		r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_chunk_event);
+		ck_assert(r >= 0);
+		owfd_rtsp_decoder_set_flags(d, flags);
+
+		/* reference: everything in one go */
+		chunk_len = 0;
+		feed(d, msg, len);
+		memcpy(ref, chunk_out, chunk_len);
+		ref_len = chunk_len;
+		ck_assert(!memcmp(ref, "GET_PARAMETER", 13));
+		ck_assert(memmem(ref, ref_len, "|OPTIONS * RTSP/1.0\n", 20));
+
+		/* split at each position */
+		for (i = 1; i < len; ++i) {
+			chunk_len = 0;
+			feed(d, msg, i);
+			feed(d, &msg[i], len - i);
+			ck_assert(chunk_len == ref_len);
+			ck_assert(!memcmp(chunk_out, ref, ref_len));
+		}
+
+		/* byte by byte */
+		chunk_len = 0;
+		for (j = 0; j < len; ++j)
+			feed(d, &msg[j], 1);
+		ck_assert(chunk_len == ref_len);
+		ck_assert(!memcmp(chunk_out, ref, ref_len));
+
+		owfd_rtsp_decoder_free(d);
+	}
+}
+END_TEST
+
+/* feed via reserve/commit in chunks of at most @chunk bytes */
+static void commit_feed(struct owfd_rtsp_decoder *d, const char *buf,
+			size_t len, size_t chunk)
+{
+	struct iovec vec[2];
+	size_t l, n, i;
+	int r, num;
+
+	while (len > 0) {
+		num = owfd_rtsp_decoder_reserve(d, chunk, vec);
+		ck_assert(num == 1 || num == 2);
+		ck_assert(vec[0].iov_len + (num > 1 ? vec[1].iov_len : 0) >=
+			  chunk);
+
+		l = len < chunk ? len : chunk;
+		len -= l;
+		n = 0;
+		for (i = 0; i < (size_t)num && n < l; ++i) {
+			if (vec[i].iov_len > l - n)
+				vec[i].iov_len = l - n;
+			memcpy(vec[i].iov_base, &buf[n], vec[i].iov_len);
+			n += vec[i].iov_len;
+		}
+
+		ck_assert(n == l);
+		r = owfd_rtsp_decoder_commit(d, l);
+		ck_assert(r == 0);
+		buf += l;
+	}
+}
+
+START_TEST(test_rtsp_decoder_commit)
+{
+	static const char msg[] =
+		"SET_PARAMETER rtsp://localhost/wfd1.0 RTSP/1.0\r\n"
+		"CSeq: 4\r\n"
+		"Content-Type: text/parameters\r\n"
+		"Content-Length: 31\r\n"
+		"\r\n"
+		"wfd_trigger_method: SETUP\r\n"
+		"  \r\n"
+		"RTSP/1.0 200 OK\r\n"
+		"CSeq: 4\r\n\r\n";
+	const size_t len = sizeof(msg) - 1;
+	char ref[sizeof(chunk_out)];
+	struct owfd_rtsp_decoder *d;
+	size_t ref_len, i, j;
+	unsigned int flags;
+	int r;
+
+	for (flags = 0; flags <= (OWFD_RTSP_DECODER_SPANS |
+				  OWFD_RTSP_DECODER_MIRROR); ++flags) {
+		r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_chunk_event);
+		ck_assert(r >= 0);
+		owfd_rtsp_decoder_set_flags(d, flags);
+
+		chunk_len = 0;
+		feed(d, msg, len);
+		memcpy(ref, chunk_out, chunk_len);
+		ref_len = chunk_len;
+		ck_assert(memmem(ref, ref_len, "|RTSP/1.0 200 OK\n", 17));
+
+		/* commit sizes shift the wrap-around point of the ring */
+		for (i = 1; i <= len; ++i) {
+			chunk_len = 0;
+			for (j = 0; j < 4; ++j)
+				commit_feed(d, msg, len, i);
+			ck_assert(chunk_len == 4 * ref_len);
+			for (j = 0; j < 4; ++j)
+				ck_assert(!memcmp(&chunk_out[j * ref_len], ref,
+						  ref_len));
+		}
+
+		owfd_rtsp_decoder_free(d);
+	}
+}
+END_TEST
+
+static unsigned int stream_heads, stream_ends;
+static size_t stream_len;
+static const char *stream_feed;
+static size_t stream_feed_len;
+static char stream_body[65536];
+
+static void test_rtsp_decoder_stream_head(struct owfd_rtsp_decoder *dec,
+					  struct owfd_rtsp_msg *msg,
+					  void *data)
+{
+	ck_assert(stream_heads == stream_ends);
+	ck_assert(msg->header_num == 2);
+	ck_assert(!strcmp(msg->header[0], "PUT /stream RTSP/1.0"));
+	ck_assert(!msg->body);
+	ck_assert(msg->body_len == sizeof(stream_body));
+	++stream_heads;
+	stream_len = 0;
+}
+
+static void test_rtsp_decoder_stream_body(struct owfd_rtsp_decoder *dec,
+					  struct owfd_rtsp_msg *msg,
+					  const void *buf, size_t len,
+					  void *data)
+{
+	const char *b = buf;
+
+	ck_assert(stream_heads == stream_ends + 1);
+	ck_assert(len > 0);
+	ck_assert(stream_len + len <= sizeof(stream_body));
+
+	/* chunks of more than one byte must point into the fed buffer */
+	if (len > 1)
+		ck_assert(b >= stream_feed &&
+			  b + len <= stream_feed + stream_feed_len);
+
+	ck_assert(!memcmp(&stream_body[stream_len], buf, len));
+	stream_len += len;
+}
+
+static void test_rtsp_decoder_stream_end(struct owfd_rtsp_decoder *dec,
+					 struct owfd_rtsp_msg *msg,
+					 void *data)
+{
+	ck_assert(stream_heads == stream_ends + 1);
+	ck_assert(stream_len == sizeof(stream_body));
+	++stream_ends;
+}
+
+static void stream_feed_all(struct owfd_rtsp_decoder *d, const char *buf,
+			    size_t len, size_t chunk)
+{
+	size_t i, l;
+
+	for (i = 0; i < len; i += l) {
+		l = len - i;
+		if (l > chunk)
+			l = chunk;
+
+		stream_feed = &buf[i];
+		stream_feed_len = l;
+		feed(d, &buf[i], l);
+	}
+}
+
+START_TEST(test_rtsp_decoder_stream)
+{
+	static const char *heads[] = {
+		"PUT /stream RTSP/1.0\r\nContent-Length: 65536\r\n\r\n",
+		"PUT /stream RTSP/1.0\nContent-Length: 65536\n\n",
+		"PUT /stream RTSP/1.0\rContent-Length: 65536\r\r",
+	};
+	static const size_t chunks[] = { 1, 7, 1000, 100000 };
+	struct owfd_rtsp_decoder *d;
+	size_t i, j, k, hlen;
+	unsigned int flags;
+	char *buf;
+	int r;
+
+	for (i = 0; i < sizeof(stream_body); ++i)
+		stream_body[i] = i * 7 + (i >> 8);
+
+	buf = malloc(2 * (64 + sizeof(stream_body)));
+	ck_assert(!!buf);
+
+	for (flags = 0; flags <= OWFD_RTSP_DECODER_SPANS; ++flags) {
+		for (i = 0; i < sizeof(heads) / sizeof(*heads); ++i) {
+			/* two messages back-to-back */
+			hlen = strlen(heads[i]);
+			memcpy(buf, heads[i], hlen);
+			memcpy(&buf[hlen], stream_body, sizeof(stream_body));
+			memcpy(&buf[hlen + sizeof(stream_body)], buf,
+			       hlen + sizeof(stream_body));
+
+			for (j = 0; j < sizeof(chunks) / sizeof(*chunks); ++j) {
+				r = owfd_rtsp_decoder_new(&d, NULL);
+				ck_assert(r >= 0);
+				owfd_rtsp_decoder_set_flags(d, flags);
+				owfd_rtsp_decoder_set_stream(d,
+					test_rtsp_decoder_stream_head,
+					test_rtsp_decoder_stream_body,
+					test_rtsp_decoder_stream_end);
+
+				stream_heads = 0;
+				stream_ends = 0;
+				k = 2 * (hlen + sizeof(stream_body));
+				stream_feed_all(d, buf, k, chunks[j]);
+				ck_assert(stream_heads == 2);
+				ck_assert(stream_ends == 2);
+
+				/* bodies never went through the input buffer */
+				ck_assert(owfd_rtsp_decoder_get_memory(d) <
+					  sizeof(stream_body));
+
+				owfd_rtsp_decoder_free(d);
+			}
+		}
+	}
+
+	free(buf);
+}
+END_TEST
+
+static void test_rtsp_decoder_known_event(struct owfd_rtsp_decoder *dec,
+					  struct owfd_rtsp_msg *msg,
+					  void *data)
+{
+	const char *v;
+	size_t l;
+
+	ck_assert(msg->cseq == 17);
+	ck_assert(msg->known[OWFD_RTSP_HEADER_CSEQ].line == 3);
+
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_CSEQ, &l);
+	ck_assert(v && l == 2 && !strncmp(v, "17", 2));
+
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_SESSION, &l);
+	ck_assert(v && l == 14 && !strcmp(v, "12345678;to=30"));
+
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_CONTENT_TYPE, &l);
+	ck_assert(v && !strcmp(v, "text/parameters") && l == 15);
+
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_TRANSPORT, &l);
+	ck_assert(v && !strcmp(v, "RTP/AVP/UDP;unicast"));
+
+	/* first occurrence wins */
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_REQUIRE, &l);
+	ck_assert(v && !strcmp(v, "org.wfa.wfd1.0"));
+
+	/* empty value */
+	v = owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_ACCEPT, &l);
+	ck_assert(v && l == 0 && !*v);
+
+	ck_assert(!owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_PUBLIC,
+					    &l));
+	ck_assert(!owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_UNKNOWN,
+					    &l));
+	ck_assert(!owfd_rtsp_msg_get_header(msg, OWFD_RTSP_HEADER_CNT, &l));
+
+	++received;
+}
+
+START_TEST(test_rtsp_decoder_known)
+{
+	static const char *names[] = {
+		[OWFD_RTSP_HEADER_ACCEPT] = "Accept",
+		[OWFD_RTSP_HEADER_ALLOW] = "Allow",
+		[OWFD_RTSP_HEADER_CONTENT_ENCODING] = "Content-Encoding",
+		[OWFD_RTSP_HEADER_CONTENT_LENGTH] = "Content-Length",
+		[OWFD_RTSP_HEADER_CONTENT_TYPE] = "Content-Type",
+		[OWFD_RTSP_HEADER_CSEQ] = "CSeq",
+		[OWFD_RTSP_HEADER_DATE] = "Date",
+		[OWFD_RTSP_HEADER_PUBLIC] = "Public",
+		[OWFD_RTSP_HEADER_RANGE] = "Range",
+		[OWFD_RTSP_HEADER_REQUIRE] = "Require",
+		[OWFD_RTSP_HEADER_RTP_INFO] = "RTP-Info",
+		[OWFD_RTSP_HEADER_SERVER] = "Server",
+		[OWFD_RTSP_HEADER_SESSION] = "Session",
+		[OWFD_RTSP_HEADER_TRANSPORT] = "Transport",
+		[OWFD_RTSP_HEADER_UNSUPPORTED] = "Unsupported",
+		[OWFD_RTSP_HEADER_USER_AGENT] = "User-Agent",
+		[OWFD_RTSP_HEADER_WWW_AUTHENTICATE] = "WWW-Authenticate",
+	};
+	struct owfd_rtsp_decoder *d;
+	unsigned int i, flags;
+	int r;
+
+	for (i = 1; i < OWFD_RTSP_HEADER_CNT; ++i)
+		ck_assert(owfd_rtsp_header_lookup(names[i],
+						  strlen(names[i])) == i);
+
+	ck_assert(!owfd_rtsp_header_lookup("", 0));
+	ck_assert(!owfd_rtsp_header_lookup("cseqq", 5));
+	ck_assert(!owfd_rtsp_header_lookup("csek", 4));
+	ck_assert(!owfd_rtsp_header_lookup("x-session", 9));
+	ck_assert(!owfd_rtsp_header_lookup("content-lengt", 13));
+
+	for (flags = 0; flags <= OWFD_RTSP_DECODER_SPANS; ++flags) {
+		received = 0;
+
+		r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_known_event);
+		ck_assert(r >= 0);
+		owfd_rtsp_decoder_set_flags(d, flags);
+
+		FEED(d, "SETUP rtsp://localhost/wfd1.0/streamid=0 RTSP/1.0\r\n"
+			"Require: org.wfa.wfd1.0\r\n"
+			"CSeq:  17\r\n"
+			"session : 12345678;to=30\r\n"
+			"X-Unknown: foo\r\n"
+			"Accept:\r\n"
+			"TRANSPORT: RTP/AVP/UDP;unicast\r\n"
+			"Require: other\r\n"
+			"Content-Type: text/parameters\r\n"
+			"Content-Length: 4\r\n\r\n"
+			"body");
+		ck_assert(received == 1);
+
+		owfd_rtsp_decoder_free(d);
+	}
+}
+END_TEST
+
+static struct owfd_rtsp_msg start_msg;
+static char start_uri[128];
+static char start_phrase[128];
+
+static void test_rtsp_decoder_start_event(struct owfd_rtsp_decoder *dec,
+					  struct owfd_rtsp_msg *msg,
+					  void *data)
+{
+	start_msg = *msg;
+	start_msg.header = NULL;
+	start_msg.header_len = NULL;
+	start_uri[0] = 0;
+	if (msg->uri_len < sizeof(start_uri)) {
+		memcpy(start_uri, msg->header[0] + msg->uri, msg->uri_len);
+		start_uri[msg->uri_len] = 0;
+	}
+
+	strncpy(start_phrase, msg->header[0] + msg->phrase,
+		sizeof(start_phrase) - 1);
+
+	++received;
+}
+
+static void start_line(struct owfd_rtsp_decoder *d, const char *line,
+		       unsigned int type, unsigned int method,
+		       const char *uri, unsigned int status,
+		       unsigned int major, unsigned int minor)
+{
+	received = 0;
+	feed(d, line, strlen(line));
+	FEED(d, "\r\nCSeq: 1\r\n\r\n");
+	ck_assert(received == 1);
+
+	ck_assert(start_msg.type == type);
+	ck_assert(start_msg.method == method);
+	ck_assert(start_msg.status == status);
+	if (type != OWFD_RTSP_MSG_UNKNOWN) {
+		ck_assert(start_msg.major == major);
+		ck_assert(start_msg.minor == minor);
+	}
+	if (uri)
+		ck_assert(!strcmp(start_uri, uri));
+	ck_assert(start_msg.cseq == 1);
+}
+
+START_TEST(test_rtsp_decoder_start_line)
+{
+	struct owfd_rtsp_decoder *d;
+	unsigned int i;
+	int r;
+
+	for (i = 1; i < OWFD_RTSP_METHOD_CNT; ++i)
+		ck_assert(owfd_rtsp_method_lookup(owfd_rtsp_method_name(i),
+				strlen(owfd_rtsp_method_name(i))) == i);
+	ck_assert(!owfd_rtsp_method_name(OWFD_RTSP_METHOD_UNKNOWN));
+	ck_assert(!owfd_rtsp_method_name(OWFD_RTSP_METHOD_CNT));
+	ck_assert(!owfd_rtsp_method_lookup("options", 7));
+	ck_assert(!owfd_rtsp_method_lookup("SETUPS", 6));
+
+	r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_start_event);
+	ck_assert(r >= 0);
+
+	start_line(d, "OPTIONS * RTSP/1.0", OWFD_RTSP_MSG_REQUEST,
+		   OWFD_RTSP_METHOD_OPTIONS, "*", 0, 1, 0);
+	start_line(d, "GET_PARAMETER rtsp://localhost/wfd1.0 RTSP/1.0",
+		   OWFD_RTSP_MSG_REQUEST, OWFD_RTSP_METHOD_GET_PARAMETER,
+		   "rtsp://localhost/wfd1.0", 0, 1, 0);
+	start_line(d, "SETUP  rtsp://x/streamid=0\tRTSP/2.10",
+		   OWFD_RTSP_MSG_REQUEST, OWFD_RTSP_METHOD_SETUP,
+		   "rtsp://x/streamid=0", 0, 2, 10);
+	start_line(d, "FOO * RTSP/1.0", OWFD_RTSP_MSG_REQUEST,
+		   OWFD_RTSP_METHOD_UNKNOWN, "*", 0, 1, 0);
+	start_line(d, "RTSP/1.0 200 OK", OWFD_RTSP_MSG_RESPONSE,
+		   OWFD_RTSP_METHOD_UNKNOWN, "", 200, 1, 0);
+	ck_assert(!strcmp(start_phrase, "OK"));
+	start_line(d, "RTSP/1.0 404", OWFD_RTSP_MSG_RESPONSE,
+		   OWFD_RTSP_METHOD_UNKNOWN, "", 404, 1, 0);
+	ck_assert(!strcmp(start_phrase, ""));
+	start_line(d, "RTSP/1.0 451 Parameter Not Understood",
+		   OWFD_RTSP_MSG_RESPONSE, OWFD_RTSP_METHOD_UNKNOWN, "",
+		   451, 1, 0);
+	ck_assert(!strcmp(start_phrase,
+			  "Parameter Not Understood"));
+
+	/* malformed start lines */
+	start_line(d, "RTSP/1.0 20 OK", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "RTSP/1.0 2000", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "RTSP/x 200 OK", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "OPTIONS *", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "OPTIONS * HTTP/1.1", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "OPTIONS * RTSP/1.0 x", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+	start_line(d, "OPTIONS", OWFD_RTSP_MSG_UNKNOWN,
+		   OWFD_RTSP_METHOD_UNKNOWN, NULL, 0, 0, 0);
+
+	owfd_rtsp_decoder_free(d);
+}
+END_TEST
+
+static void test_rtsp_decoder_limits_event(struct owfd_rtsp_decoder *dec,
+					   struct owfd_rtsp_msg *msg,
+					   void *data)
+{
+	ck_assert(msg->type == OWFD_RTSP_MSG_REQUEST);
+	ck_assert(msg->method == OWFD_RTSP_METHOD_OPTIONS);
+	ck_assert(msg->cseq == 2);
+	ck_assert(msg->body_len == 4);
+	ck_assert(!memcmp(msg->body, "body", 4));
+	++received;
+}
+
+static void limits(const struct owfd_rtsp_decoder_limits *lim,
+		   const char *bad)
+{
+	static const char good[] =
+		"OPTIONS * RTSP/1.0\r\n"
+		"CSeq: 2\r\n"
+		"Content-Length: 4\r\n"
+		"\r\n"
+		"body";
+	struct owfd_rtsp_decoder_limits l;
+	struct owfd_rtsp_decoder *d;
+	size_t len, i;
+	unsigned int flags, errors;
+	char *buf;
+	int r;
+
+	len = strlen(bad);
+	buf = malloc(len + sizeof(good));
+	ck_assert(!!buf);
+	memcpy(buf, bad, len);
+	memcpy(&buf[len], good, sizeof(good));
+	len += sizeof(good) - 1;
+
+	for (flags = 0; flags <= OWFD_RTSP_DECODER_SPANS; ++flags) {
+		r = owfd_rtsp_decoder_new(&d, test_rtsp_decoder_limits_event);
+		ck_assert(r >= 0);
+		owfd_rtsp_decoder_set_flags(d, flags);
+		owfd_rtsp_decoder_set_limits(d, lim);
+		owfd_rtsp_decoder_get_limits(d, &l);
+		ck_assert(!memcmp(&l, lim, sizeof(l)));
+
+		/* the good message alone passes */
+		received = 0;
+		r = owfd_rtsp_decoder_feed(d, good, sizeof(good) - 1);
+		ck_assert(r == 0);
+		ck_assert(received == 1);
+
+		/* bad message is rejected, the following one still passes */
+		received = 0;
+		r = owfd_rtsp_decoder_feed(d, buf, len);
+		ck_assert(r == -EMSGSIZE);
+		ck_assert(received == 1);
+
+		/* same byte by byte */
+		received = 0;
+		errors = 0;
+		for (i = 0; i < len; ++i) {
+			r = owfd_rtsp_decoder_feed(d, &buf[i], 1);
+			if (r == -EMSGSIZE)
+				++errors;
+			else
+				ck_assert(r == 0);
+		}
+		ck_assert(errors == 1);
+		ck_assert(received == 1);
+
+		owfd_rtsp_decoder_free(d);
+	}
+
+	free(buf);
+}
+
+START_TEST(test_rtsp_decoder_limits)
+{
+	struct owfd_rtsp_decoder_limits lim;
+	char *big, cl[512], msg[1024];
+	int len;
+
+	big = malloc(70000);
+	ck_assert(!!big);
+	memcpy(big, "OPTIONS * RTSP/1.0\r\nX-Long: ", 28);
+	memset(&big[28], 'x', 70000 - 28 - 5);
+	memcpy(&big[70000 - 5], "\r\n\r\n", 5);
+
+	/* overlong line (with body that must be skipped) */
+	memset(&lim, 0, sizeof(lim));
+	lim.max_line = 64;
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "Content-Length: 6\r\n"
+		     "X-Long: 0123456789012345678901234567890123456789"
+		     "01234567890123456789\r\n"
+		     "\r\n"
+		     "012345");
+	limits(&lim, big);
+
+	/* overlong content-length lines still frame the skipped body */
+	len = sprintf(cl, "Content-Length:%*s\r\n\t%0*d\r\n", 150, "",
+		      100, 9);
+	ck_assert(len > 128);
+	sprintf(msg, "OPTIONS * RTSP/1.0\r\n%s\r\nA\r\n\r\nBCDE", cl);
+	limits(&lim, msg);
+	sprintf(msg, "OPTIONS * RTSP/1.0\r\n"
+		     "X-Long: 0123456789012345678901234567890123456789"
+		     "01234567890123456789\r\n"
+		     "%s\r\nA\r\n\r\nBCDE", cl);
+	limits(&lim, msg);
+
+	/* too many headers */
+	memset(&lim, 0, sizeof(lim));
+	lim.max_headers = 4;
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "A: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\n"
+		     "Content-Length: 3\r\n"
+		     "\r\n"
+		     "abc");
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "Content-Length: 3\r\n"
+		     "A: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\n"
+		     "\r\n"
+		     "abc");
+
+	/* body too big, rejected before the body is read */
+	memset(&lim, 0, sizeof(lim));
+	lim.max_body = 10;
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "Content-Length: 11\r\n"
+		     "\r\n"
+		     "01234567890");
+
+	/* message too big, both via headers and via body */
+	memset(&lim, 0, sizeof(lim));
+	lim.max_msg = 80;
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "Content-Length: 50\r\n"
+		     "\r\n"
+		     "01234567890123456789012345678901234567890123456789");
+	limits(&lim, "OPTIONS * RTSP/1.0\r\n"
+		     "A: 0123456789012345678901234567890123456789\r\n"
+		     "B: 0123456789012345678901234567890123456789\r\n"
+		     "\r\n");
+	limits(&lim, big);
+
+	free(big);
+}
+END_TEST
+
 static void tokenize(const char *line, const char *expect, size_t len,
 		     size_t num)
 {
@@ -284,14 +996,1650 @@ START_TEST(test_rtsp_tokenizer)
 }
 END_TEST
 
+/* compare span tokenizer against owfd_rtsp_tokenize() */
+static void tokenize_spans(const char *line)
+{
+	struct owfd_rtsp_token toks[64], tok;
+	struct owfd_rtsp_token_iter iter;
+	char *t, *s, buf[256];
+	size_t len, num, i, l;
+	ssize_t n;
+
+	len = strlen(line);
+	n = owfd_rtsp_tokenize(line, &t);
+	ck_assert(n >= 0);
+
+	num = owfd_rtsp_tokenize_spans(line, len, toks, 64);
+	ck_assert(num == (size_t)n);
+
+	s = t;
+	for (i = 0; i < num; ++i) {
+		ck_assert(toks[i].len < sizeof(buf));
+		l = owfd_rtsp_token_unescape(line, &toks[i], buf);
+		ck_assert(l == strlen(s));
+		ck_assert(!strcmp(buf, s));
+		s += strlen(s) + 1;
+	}
+
+	/* iterator yields the same, truncated arrays still count all */
+	owfd_rtsp_token_iter_init(&iter, line, len);
+	for (i = 0; owfd_rtsp_token_next(&iter, &tok); ++i) {
+		ck_assert(i < num);
+		ck_assert(tok.off == toks[i].off);
+		ck_assert(tok.len == toks[i].len);
+		ck_assert(tok.quoted == toks[i].quoted);
+	}
+	ck_assert(i == num);
+	ck_assert(!owfd_rtsp_token_next(&iter, &tok));
+
+	if (num > 1)
+		ck_assert(owfd_rtsp_tokenize_spans(line, len, toks, 1) == num);
+
+	free(t);
+}
+
+START_TEST(test_rtsp_tokenizer_spans)
+{
+	struct owfd_rtsp_token toks[4];
+	char buf[16];
+
+	tokenize_spans("");
+	tokenize_spans("asdf");
+	tokenize_spans("asdf\"\"asdf");
+	tokenize_spans("asdf\"asdf\"asdf");
+	tokenize_spans("\"asdf\"");
+	tokenize_spans("\"\\n\\\\\\r\"");
+	tokenize_spans("\"\\\"\"");
+	tokenize_spans("content-length:   100");
+	tokenize_spans("content-args: (50+10)");
+	tokenize_spans("  \t a\x01" "b\x7f" "c\xff" "d  ");
+	tokenize_spans("wfd_video_formats: 00 00 02 10 0001FFFF 1FFFFFFF "
+		       "00000FFF 00 0000 0000 00 none none");
+	tokenize_spans("wfd_client_rtp_ports: RTP/AVP/UDP;unicast 19000 0 "
+		       "mode=play");
+	tokenize_spans("Session: 12345678;timeout=30");
+	tokenize_spans("x=\"quoted \\\"string\\\" with \\e\\a\" y");
+	tokenize_spans("a{b}c[d]e<f>g@h,i?j\\k/l");
+
+	/* not zero-terminated, binary zero separates */
+	ck_assert(owfd_rtsp_tokenize_spans("ab\0cd:ef", 8, toks, 4) == 4);
+	ck_assert(toks[0].off == 0 && toks[0].len == 2);
+	ck_assert(toks[1].off == 3 && toks[1].len == 2);
+	ck_assert(toks[2].off == 5 && toks[2].len == 1);
+	ck_assert(toks[3].off == 6 && toks[3].len == 2);
+	ck_assert(owfd_rtsp_tokenize_spans("abcdef", 3, toks, 4) == 1);
+	ck_assert(toks[0].len == 3);
+
+	/* unterminated quote and escaped zero */
+	ck_assert(owfd_rtsp_tokenize_spans("\"ab\\0c", 6, toks, 4) == 1);
+	ck_assert(toks[0].quoted && toks[0].off == 1 && toks[0].len == 5);
+	ck_assert(owfd_rtsp_token_unescape("\"ab\\0c", &toks[0], buf) == 3);
+	ck_assert(!strcmp(buf, "abc"));
+}
+END_TEST
+
 TEST_DEFINE_CASE(decoder)
 	TEST(test_rtsp_decoder)
+	TEST(test_rtsp_decoder_spans)
+	TEST(test_rtsp_decoder_chunked)
+	TEST(test_rtsp_decoder_commit)
+	TEST(test_rtsp_decoder_stream)
+	TEST(test_rtsp_decoder_known)
+	TEST(test_rtsp_decoder_start_line)
+	TEST(test_rtsp_decoder_limits)
 	TEST(test_rtsp_tokenizer)
+	TEST(test_rtsp_tokenizer_spans)
+TEST_END_CASE
+
+START_TEST(test_rtsp_params)
+{
+	static const char body[] =
+		"wfd_audio_codecs: LPCM 00000003 00, AAC 0000000F 02\r\n"
+		"wfd_video_formats: 00 00 02 10 0001FFFF 1FFFFFFF 00000FFF 00 "
+			"0000 0000 00 none none, 01 08 000000ff 00000000 "
+			"00000000 01 0000 0000 00 0780 0438\r\n"
+		"wfd_3d_video_formats: none\r\n"
+		"x_vendor_param: foo\r\n"
+		"  WFD_Client_RTP_Ports : RTP/AVP/UDP;unicast 19000 0 mode=play\r\n"
+		"wfd_content_protection\r\n"
+		"\r\n"
+		"wfd_audio_codecs: none\r\n"
+		"wfd_uibc_capability: none";
+	struct owfd_rtsp_params p;
+	struct owfd_rtsp_video_formats vf;
+	struct owfd_rtsp_audio_codecs ac;
+	struct owfd_rtsp_client_rtp_ports rp;
+	const char *v;
+	unsigned int i;
+	size_t l;
+	int r;
+
+	for (i = 1; i < OWFD_RTSP_PARAM_CNT; ++i)
+		ck_assert(owfd_rtsp_param_lookup(owfd_rtsp_param_name(i),
+				strlen(owfd_rtsp_param_name(i))) == i);
+	ck_assert(!owfd_rtsp_param_name(OWFD_RTSP_PARAM_UNKNOWN));
+	ck_assert(!owfd_rtsp_param_lookup("wfd_video_format", 16));
+	ck_assert(!owfd_rtsp_param_lookup("wfd_video_formatss", 18));
+
+	r = owfd_rtsp_params_parse(&p, body, sizeof(body) - 1);
+	ck_assert(r >= 0);
+	ck_assert(p.unknown == 1);
+
+	ck_assert(owfd_rtsp_params_has(&p, OWFD_RTSP_PARAM_VIDEO_FORMATS));
+	ck_assert(owfd_rtsp_params_has(&p, OWFD_RTSP_PARAM_CONTENT_PROTECTION));
+	ck_assert(!owfd_rtsp_params_has(&p, OWFD_RTSP_PARAM_ROUTE));
+	ck_assert(!owfd_rtsp_params_has(&p, OWFD_RTSP_PARAM_CNT));
+
+	v = owfd_rtsp_params_get(&p, OWFD_RTSP_PARAM_CONTENT_PROTECTION, &l);
+	ck_assert(v && l == 0);
+	v = owfd_rtsp_params_get(&p, OWFD_RTSP_PARAM_UIBC_CAPABILITY, &l);
+	ck_assert(v && l == 4 && !memcmp(v, "none", 4));
+	v = owfd_rtsp_params_get(&p, OWFD_RTSP_PARAM_3D_VIDEO_FORMATS, &l);
+	ck_assert(v && l == 4 && !memcmp(v, "none", 4));
+
+	r = owfd_rtsp_params_get_video_formats(&p, &vf);
+	ck_assert(r == 0);
+	ck_assert(!vf.none);
+	ck_assert(vf.codec_num == 2);
+	ck_assert(vf.codecs[0].profile ==
+				OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_PROFILE_CHP);
+	ck_assert(vf.codecs[0].level ==
+				OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_H264_LEVEL_4_2);
+	ck_assert(vf.codecs[0].cea_modes == 0x0001ffff);
+	ck_assert(vf.codecs[0].vesa_modes == 0x1fffffff);
+	ck_assert(vf.codecs[0].hh_modes == 0x00000fff);
+	ck_assert(vf.codecs[0].max_hres == 0 && vf.codecs[0].max_vres == 0);
+	ck_assert(vf.codecs[1].cea_modes &
+			OPENWFD_WFD_IE_SUB_VIDEO_FORMATS_CEA_1920_1080_P30);
+	ck_assert(vf.codecs[1].latency == 1);
+	ck_assert(vf.codecs[1].max_hres == 1920);
+	ck_assert(vf.codecs[1].max_vres == 1080);
+
+	/* first occurrence wins */
+	r = owfd_rtsp_params_get_audio_codecs(&p, &ac);
+	ck_assert(r == 0);
+	ck_assert(ac.lpcm_modes ==
+		  (OPENWFD_WFD_IE_SUB_AUDIO_FORMATS_LPCM_2C_16_44100 |
+		   OPENWFD_WFD_IE_SUB_AUDIO_FORMATS_LPCM_2C_16_48000));
+	ck_assert(ac.aac_modes == 0xf && ac.aac_latency == 2);
+	ck_assert(!ac.ac3_modes);
+
+	r = owfd_rtsp_params_get_client_rtp_ports(&p, &rp);
+	ck_assert(r == 0);
+	ck_assert(rp.transport == OWFD_RTSP_RTP_UDP);
+	ck_assert(rp.port0 == 19000 && rp.port1 == 0 && rp.play);
+
+	/* missing and malformed values */
+	r = owfd_rtsp_params_parse(&p, "wfd_video_formats: none\n"
+				   "wfd_audio_codecs: MP3 00000001 00\n"
+				   "wfd_client_rtp_ports: RTP/AVP/UDP;unicast "
+				   "70000 0 mode=play\n", 118);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_params_get_video_formats(&p, &vf);
+	ck_assert(r == 0 && vf.none && !vf.codec_num);
+	r = owfd_rtsp_params_get_audio_codecs(&p, &ac);
+	ck_assert(r == -EINVAL);
+	r = owfd_rtsp_params_get_client_rtp_ports(&p, &rp);
+	ck_assert(r == -EINVAL);
+
+	r = owfd_rtsp_params_parse(&p, "wfd_video_formats: 00 00 04 10 "
+				   "0001FFFF 1FFFFFFF 00000FFF 00 0000 0000 "
+				   "00 none\n", 79);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_params_get_video_formats(&p, &vf);
+	ck_assert(r == -EINVAL);
+	r = owfd_rtsp_params_get_audio_codecs(&p, &ac);
+	ck_assert(r == -ENOENT);
+}
+END_TEST
+
+static unsigned int ctrl_connects;
+static unsigned int ctrl_msgs;
+
+static void test_rtsp_ctrl_event(struct owfd_rtsp_ctrl *ctrl,
+				 char *buf, size_t len, void *data)
+{
+	/* only the connect notification is raw */
+	ck_assert(!buf && !len);
+	++ctrl_connects;
+}
+
+static void test_rtsp_ctrl_msg(struct owfd_rtsp_ctrl *ctrl,
+			       struct owfd_rtsp_msg *msg, void *data)
+{
+	ck_assert(data == &ctrl_msgs);
+	ck_assert(msg->type == OWFD_RTSP_MSG_REQUEST);
+	ck_assert(msg->method == OWFD_RTSP_METHOD_OPTIONS);
+	ck_assert(msg->cseq == ctrl_msgs + 1);
+	++ctrl_msgs;
+}
+
+START_TEST(test_rtsp_ctrl_decoder)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+	char buf[64 * 64];
+	size_t i, len, n;
+	int r, fds[2];
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_set_data(ctrl, &ctrl_msgs);
+
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_ctrl_msg);
+	ck_assert(r >= 0);
+	ck_assert(!!owfd_rtsp_ctrl_get_decoder(ctrl));
+
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+
+	/* many small messages, written in odd-sized pieces */
+	len = 0;
+	for (i = 0; i < 64; ++i)
+		len += sprintf(&buf[len], "OPTIONS * RTSP/1.0\r\nCSeq: %zu\r\n\r\n",
+			       i + 1);
+
+	ctrl_connects = 0;
+	ctrl_msgs = 0;
+	for (i = 0; i < len; i += n) {
+		n = len - i < 333 ? len - i : 333;
+		ck_assert(write(fds[1], &buf[i], n) == (ssize_t)n);
+
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+		ck_assert(r >= 0);
+	}
+
+	for (i = 0; i < 8 && ctrl_msgs < 64; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+		ck_assert(r >= 0);
+	}
+
+	ck_assert(ctrl_connects == 1);
+	ck_assert(ctrl_msgs == 64);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+}
+END_TEST
+
+static unsigned int ctrl_frees;
+
+static void test_rtsp_ctrl_free(void *buf)
+{
+	++ctrl_frees;
+	free(buf);
+}
+
+START_TEST(test_rtsp_ctrl_send)
+{
+	static char big[1024 * 1024];
+	struct owfd_rtsp_ctrl_stats stats, stats2;
+	struct owfd_rtsp_ctrl *ctrl;
+	struct iovec vec[3];
+	char *buf, *out;
+	size_t i, len, pos;
+	ssize_t l;
+	int r, fds[2], size;
+
+	for (i = 0; i < sizeof(big); ++i)
+		big[i] = 'a' + i % 26;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	size = 4096;
+	r = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+
+	/* queued before the connection is up */
+	r = owfd_rtsp_ctrl_send(ctrl, "1:", 2);
+	ck_assert(r >= 0);
+
+	ctrl_connects = 0;
+	ctrl_frees = 0;
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+	ck_assert(r >= 0);
+	ck_assert(ctrl_connects == 1);
+
+	/* owned buffers are passed through, copies and iovecs in between */
+	buf = malloc(sizeof(big));
+	ck_assert(!!buf);
+	memcpy(buf, big, sizeof(big));
+	r = owfd_rtsp_ctrl_send_owned(ctrl, buf, sizeof(big),
+				      test_rtsp_ctrl_free);
+	ck_assert(r >= 0);
+	ck_assert(!ctrl_frees);
+
+	vec[0].iov_base = "2:";
+	vec[0].iov_len = 2;
+	vec[1].iov_base = big;
+	vec[1].iov_len = 10000;
+	vec[2].iov_base = "3:";
+	vec[2].iov_len = 2;
+	r = owfd_rtsp_ctrl_send_iov(ctrl, vec, 3);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_sendf(ctrl, "%d:", 4);
+	ck_assert(r >= 0);
+
+	buf = strdup("5:");
+	ck_assert(!!buf);
+	r = owfd_rtsp_ctrl_send_owned(ctrl, buf, 2, test_rtsp_ctrl_free);
+	ck_assert(r >= 0);
+
+	len = 2 + sizeof(big) + 2 + 10000 + 2 + 2 + 2;
+	out = malloc(len + 1);
+	ck_assert(!!out);
+
+	for (pos = 0; pos < len; ) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+
+		l = recv(fds[1], &out[pos], len + 1 - pos, MSG_DONTWAIT);
+		ck_assert(l > 0 || errno == EAGAIN);
+		if (l > 0)
+			pos += l;
+	}
+
+	ck_assert(pos == len);
+	ck_assert(ctrl_frees == 2);
+	ck_assert(!memcmp(out, "1:", 2));
+	ck_assert(!memcmp(&out[2], big, sizeof(big)));
+	pos = 2 + sizeof(big);
+	ck_assert(!memcmp(&out[pos], "2:", 2));
+	ck_assert(!memcmp(&out[pos + 2], big, 10000));
+	ck_assert(!memcmp(&out[pos + 10002], "3:4:5:", 6));
+
+	/* with an empty queue, data is written directly */
+	r = owfd_rtsp_ctrl_send(ctrl, "6:", 2);
+	ck_assert(r >= 0);
+	ck_assert(read(fds[1], out, len) == 2);
+	ck_assert(!memcmp(out, "6:", 2));
+
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(stats.bytes_sent == len + 2);
+	ck_assert(stats.short_writes > 0);
+	ck_assert(stats.writes >= stats.short_writes + stats.stalls);
+
+	/* corked sends go out with a single call */
+	owfd_rtsp_ctrl_cork(ctrl);
+	for (i = 0; i < 3; ++i) {
+		r = owfd_rtsp_ctrl_sendf(ctrl, "%zu:", i + 7);
+		ck_assert(r >= 0);
+	}
+	ck_assert(recv(fds[1], out, len, MSG_DONTWAIT) < 0);
+	r = owfd_rtsp_ctrl_uncork(ctrl);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats2);
+	ck_assert(stats2.writes == stats.writes + 1);
+	ck_assert(read(fds[1], out, len) == 6);
+	ck_assert(!memcmp(out, "7:8:9:", 6));
+
+	/* formatted sends larger than the free space of the queue */
+	r = owfd_rtsp_ctrl_sendf(ctrl, "%.*s", 9000, big);
+	ck_assert(r >= 0);
+	for (pos = 0; pos < 9000; ) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+
+		l = recv(fds[1], &out[pos], len + 1 - pos, MSG_DONTWAIT);
+		ck_assert(l > 0 || errno == EAGAIN);
+		if (l > 0)
+			pos += l;
+	}
+	ck_assert(pos == 9000);
+	ck_assert(!memcmp(out, big, 9000));
+
+	/* closing drops queued buffers */
+	buf = malloc(sizeof(big));
+	ck_assert(!!buf);
+	r = owfd_rtsp_ctrl_send_owned(ctrl, buf, sizeof(big),
+				      test_rtsp_ctrl_free);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_close(ctrl);
+	ck_assert(ctrl_frees == 3);
+
+	free(out);
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+}
+END_TEST
+
+/* concatenate the message of @b and compare it to @str */
+static void builder_expect(struct owfd_rtsp_msg_builder *b, const char *str)
+{
+	struct iovec *vec;
+	char buf[4096];
+	size_t i, l;
+	int n;
+
+	n = owfd_rtsp_msg_builder_finish(b, &vec);
+	ck_assert(n > 0);
+
+	for (i = 0, l = 0; i < (size_t)n; ++i) {
+		ck_assert(l + vec[i].iov_len < sizeof(buf));
+		memcpy(&buf[l], vec[i].iov_base, vec[i].iov_len);
+		l += vec[i].iov_len;
+	}
+	buf[l] = 0;
+
+	ck_assert(!strcmp(buf, str));
+}
+
+START_TEST(test_rtsp_builder)
+{
+	struct owfd_rtsp_msg_builder b;
+	struct owfd_rtsp_ctrl *ctrl;
+	struct iovec *vec;
+	char buf[256];
+	const char *msg;
+	int r, fds[2], i;
+
+	owfd_rtsp_msg_builder_init(&b);
+
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_OPTIONS, "*");
+	ck_assert(!r);
+	ck_assert(b.msg_cseq == 1);
+	owfd_rtsp_msg_builder_header(&b, "Require", "org.wfa.wfd1.0");
+	builder_expect(&b, "OPTIONS * RTSP/1.0\r\n"
+			   "CSeq: 1\r\n"
+			   "Require: org.wfa.wfd1.0\r\n"
+			   "\r\n");
+
+	/* cached headers, the content type is only sent with a body */
+	owfd_rtsp_msg_builder_set_session(&b, "12345678");
+	owfd_rtsp_msg_builder_set_content_type(&b, "text/parameters");
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_SET_PARAMETER,
+					  "rtsp://localhost/wfd1.0");
+	ck_assert(!r);
+	ck_assert(b.msg_cseq == 2);
+	owfd_rtsp_msg_builder_body(&b, "wfd_trigger_method: PLAY\r\n", 26);
+	builder_expect(&b, "SET_PARAMETER rtsp://localhost/wfd1.0 RTSP/1.0\r\n"
+			   "CSeq: 2\r\n"
+			   "Session: 12345678\r\n"
+			   "Content-Type: text/parameters\r\n"
+			   "Content-Length: 26\r\n"
+			   "\r\n"
+			   "wfd_trigger_method: PLAY\r\n");
+
+	r = owfd_rtsp_msg_builder_response(&b, 200, NULL, 1234567890);
+	ck_assert(!r);
+	builder_expect(&b, "RTSP/1.0 200 OK\r\n"
+			   "CSeq: 1234567890\r\n"
+			   "Session: 12345678\r\n"
+			   "\r\n");
+
+	owfd_rtsp_msg_builder_set_session(&b, NULL);
+	r = owfd_rtsp_msg_builder_response(&b, 455, NULL, 0);
+	ck_assert(!r);
+	builder_expect(&b, "RTSP/1.0 455 Method Not Valid in This State\r\n"
+			   "CSeq: 0\r\n"
+			   "\r\n");
+	r = owfd_rtsp_msg_builder_response(&b, 299, NULL, 3);
+	ck_assert(!r);
+	builder_expect(&b, "RTSP/1.0 299 Unknown\r\nCSeq: 3\r\n\r\n");
+
+	/* invalid input and overflows */
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_UNKNOWN, "*");
+	ck_assert(r == -EINVAL);
+	r = owfd_rtsp_msg_builder_response(&b, 99, "Foo", 3);
+	ck_assert(r == -EINVAL);
+	ck_assert(b.cseq == 3);
+
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_PLAY, "*");
+	ck_assert(!r);
+	for (i = 0; i < OWFD_RTSP_BUILDER_IOV_MAX; ++i)
+		owfd_rtsp_msg_builder_header(&b, "X", "Y");
+	r = owfd_rtsp_msg_builder_finish(&b, &vec);
+	ck_assert(r == -ENOBUFS);
+
+	/* messages are sent as they are assembled */
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_TEARDOWN,
+					  "rtsp://localhost/wfd1.0");
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_send_msg(ctrl, &b);
+	ck_assert(r >= 0);
+
+	msg = "TEARDOWN rtsp://localhost/wfd1.0 RTSP/1.0\r\n"
+	      "CSeq: 4\r\n"
+	      "\r\n";
+	r = read(fds[1], buf, sizeof(buf));
+	ck_assert(r == (int)strlen(msg));
+	ck_assert(!memcmp(buf, msg, r));
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+}
+END_TEST
+
+static unsigned long reply_cseqs[4];
+static unsigned int reply_num;
+static unsigned int reply_other;
+static int reply_error;
+
+static void test_rtsp_reply_msg(struct owfd_rtsp_ctrl *ctrl,
+				struct owfd_rtsp_msg *msg, void *data)
+{
+	/* only responses nobody waits for end up here */
+	ck_assert(msg->type == OWFD_RTSP_MSG_RESPONSE);
+	++reply_other;
+}
+
+static void test_rtsp_reply(struct owfd_rtsp_ctrl *ctrl,
+			    struct owfd_rtsp_msg *reply, int error, void *data)
+{
+	if (error) {
+		ck_assert(!reply);
+		reply_error = error;
+		return;
+	}
+
+	ck_assert(reply->cseq == (unsigned long)data);
+	if (reply_num < 4)
+		reply_cseqs[reply_num] = reply->cseq;
+	++reply_num;
+}
+
+static void reply_send(int fd, unsigned long cseq)
+{
+	char buf[64];
+	int l;
+
+	l = sprintf(buf, "RTSP/1.0 200 OK\r\nCSeq: %lu\r\n\r\n", cseq);
+	ck_assert(write(fd, buf, l) == l);
+}
+
+static void reply_drain(int fd)
+{
+	char buf[4096];
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		/* empty */ ;
+}
+
+START_TEST(test_rtsp_ctrl_request)
+{
+	struct owfd_rtsp_msg_builder b;
+	struct owfd_rtsp_ctrl *ctrl;
+	unsigned long i, first;
+	char buf[512];
+	int r, fds[2];
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], NULL);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+	ck_assert(r >= 0);
+	ck_assert(owfd_rtsp_ctrl_is_connected(ctrl));
+
+	owfd_rtsp_msg_builder_init(&b);
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_OPTIONS, "*");
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 0, test_rtsp_reply, NULL);
+	ck_assert(r == -EINVAL);
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_reply_msg);
+	ck_assert(r >= 0);
+
+	/* three requests in flight, answered out of order */
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 1000, test_rtsp_reply, (void*)1);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 1000, test_rtsp_reply, (void*)1);
+	ck_assert(r == -EEXIST);
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_GET_PARAMETER,
+					  "rtsp://localhost/wfd1.0");
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 1000, test_rtsp_reply, (void*)2);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_SET_PARAMETER,
+					  "rtsp://localhost/wfd1.0");
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 30, test_rtsp_reply, (void*)3);
+	ck_assert(r >= 0);
+	ck_assert(owfd_rtsp_ctrl_get_pending(ctrl) == 3);
+
+	r = read(fds[1], buf, sizeof(buf));
+	ck_assert(r > 0);
+	ck_assert(!strncmp(buf, "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n", 29));
+	reply_drain(fds[1]);
+
+	reply_num = 0;
+	reply_other = 0;
+	reply_error = 0;
+	reply_send(fds[1], 2);
+	reply_send(fds[1], 99);
+	reply_send(fds[1], 1);
+	for (i = 0; i < 100 && reply_num < 2; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+	}
+	ck_assert(reply_num == 2);
+	ck_assert(reply_cseqs[0] == 2 && reply_cseqs[1] == 1);
+	ck_assert(reply_other == 1);
+	ck_assert(owfd_rtsp_ctrl_get_pending(ctrl) == 1);
+
+	/* the last one is never answered */
+	for (i = 0; i < 100 && !reply_error; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+	}
+	ck_assert(reply_error == -ETIMEDOUT);
+	ck_assert(!owfd_rtsp_ctrl_get_pending(ctrl));
+
+	/* many requests grow the table, responses arrive in reverse */
+	first = b.cseq;
+	for (i = 0; i < 1000; ++i) {
+		r = owfd_rtsp_msg_builder_request(&b,
+						  OWFD_RTSP_METHOD_GET_PARAMETER,
+						  "rtsp://localhost/wfd1.0");
+		ck_assert(!r);
+		r = owfd_rtsp_ctrl_request(ctrl, &b, 0, test_rtsp_reply,
+					   (void*)b.msg_cseq);
+		ck_assert(r >= 0);
+		if (!(i % 64))
+			reply_drain(fds[1]);
+	}
+	ck_assert(owfd_rtsp_ctrl_get_pending(ctrl) == 1000);
+	ck_assert(owfd_rtsp_ctrl_cancel(ctrl, first + 500) >= 0);
+	ck_assert(owfd_rtsp_ctrl_cancel(ctrl, first + 500) == -ENOENT);
+
+	reply_num = 0;
+	for (i = 1000; i-- > 0; ) {
+		reply_send(fds[1], first + i);
+		if (!(i % 64)) {
+			reply_drain(fds[1]);
+			r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+			ck_assert(r >= 0);
+		}
+	}
+	for (i = 0; i < 100 && owfd_rtsp_ctrl_get_pending(ctrl); ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+	}
+	ck_assert(reply_num == 999);
+	ck_assert(reply_other == 2);
+
+	/* closing fails pending requests */
+	r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_OPTIONS, "*");
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_request(ctrl, &b, 0, test_rtsp_reply, NULL);
+	ck_assert(r >= 0);
+	reply_error = 0;
+	owfd_rtsp_ctrl_close(ctrl);
+	ck_assert(reply_error == -EPIPE);
+	ck_assert(!owfd_rtsp_ctrl_get_pending(ctrl));
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_rtsp_ctrl_stats)
+{
+	static char big[64 * 1024];
+	struct owfd_rtsp_ctrl_stats stats;
+	struct owfd_rtsp_ctrl_rtt rtt;
+	struct owfd_rtsp_msg_builder b;
+	struct owfd_rtsp_ctrl *ctrl;
+	char buf[2048];
+	unsigned long i;
+	int r, fds[2], size;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	size = 4096;
+	r = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_reply_msg);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], NULL);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+	ck_assert(r >= 0);
+
+	/* round trips are recorded per method */
+	owfd_rtsp_msg_builder_init(&b);
+	reply_num = 0;
+	reply_other = 0;
+	for (i = 1; i <= 3; ++i) {
+		r = owfd_rtsp_msg_builder_request(&b, OWFD_RTSP_METHOD_OPTIONS,
+						  "*");
+		ck_assert(!r);
+		r = owfd_rtsp_ctrl_request(ctrl, &b, 0, test_rtsp_reply,
+					   (void*)i);
+		ck_assert(r >= 0);
+	}
+
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(stats.requests == 3);
+	ck_assert(stats.msgs_sent == 3);
+	ck_assert(stats.pending == 3);
+
+	usleep(1000);
+	reply_drain(fds[1]);
+	for (i = 1; i <= 3; ++i)
+		reply_send(fds[1], i);
+	reply_send(fds[1], 99);
+	for (i = 0; i < 100 && reply_other < 1; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+	}
+	ck_assert(reply_num == 3);
+
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(stats.replies == 3);
+	ck_assert(stats.msgs_received == 4);
+	ck_assert(stats.bytes_received > 4 * 20);
+	ck_assert(!stats.pending);
+	ck_assert(!stats.timeouts);
+
+	r = owfd_rtsp_ctrl_get_rtt(ctrl, OWFD_RTSP_METHOD_OPTIONS, &rtt);
+	ck_assert(r >= 0);
+	ck_assert(rtt.count == 3);
+	ck_assert(rtt.min >= 1000);
+	ck_assert(rtt.min <= rtt.p50 && rtt.p50 <= rtt.p99);
+	ck_assert(rtt.p99 <= rtt.max);
+	r = owfd_rtsp_ctrl_get_rtt(ctrl, OWFD_RTSP_METHOD_PLAY, &rtt);
+	ck_assert(r >= 0);
+	ck_assert(!rtt.count);
+	r = owfd_rtsp_ctrl_get_rtt(ctrl, OWFD_RTSP_METHOD_CNT, &rtt);
+	ck_assert(r == -EINVAL);
+
+	/* a slow reader shows up as queued output and blocked time */
+	r = owfd_rtsp_ctrl_send(ctrl, big, sizeof(big));
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(stats.out_queued > 0);
+	ck_assert(stats.out_peak >= stats.out_queued);
+
+	usleep(1000);
+	for (i = 0; i < 1000 && stats.out_queued; ++i) {
+		reply_drain(fds[1]);
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 10);
+		ck_assert(r >= 0);
+		owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	}
+	ck_assert(!stats.out_queued);
+	ck_assert(stats.out_peak > 0);
+	ck_assert(stats.blocked_usec >= 1000);
+
+	/* text export, truncated like snprintf() */
+	r = owfd_rtsp_ctrl_format_stats(ctrl, buf, sizeof(buf));
+	ck_assert(r > 0 && r < (int)sizeof(buf));
+	ck_assert(!!strstr(buf, "requests: sent=3 replies=3 timeouts=0"));
+	ck_assert(!!strstr(buf, "rtt OPTIONS: count=3 "));
+	ck_assert(!strstr(buf, "rtt PLAY"));
+	ck_assert(owfd_rtsp_ctrl_format_stats(ctrl, buf, 8) == r);
+	ck_assert(strlen(buf) == 7);
+	ck_assert(owfd_rtsp_ctrl_format_stats(ctrl, NULL, 0) == r);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+}
+END_TEST
+
+static unsigned int server_connects;
+static unsigned int server_closes;
+
+static void test_rtsp_server_msg(struct owfd_rtsp_ctrl *ctrl,
+				 struct owfd_rtsp_msg *msg, void *data)
+{
+	struct owfd_rtsp_msg_builder b;
+	int r;
+
+	owfd_rtsp_msg_builder_init(&b);
+	r = owfd_rtsp_msg_builder_response(&b, 200, NULL, msg->cseq);
+	ck_assert(!r);
+	r = owfd_rtsp_ctrl_send_msg(ctrl, &b);
+	ck_assert(r >= 0);
+}
+
+static void test_rtsp_server_event(struct owfd_rtsp_server *srv,
+				   struct owfd_rtsp_session *sess,
+				   unsigned int event, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = owfd_rtsp_session_get_ctrl(sess);
+	int r;
+
+	ck_assert(data == &server_connects);
+
+	if (event == OWFD_RTSP_SERVER_CONNECT) {
+		ck_assert(owfd_rtsp_ctrl_is_open(ctrl));
+		r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_server_msg);
+		ck_assert(r >= 0);
+		++server_connects;
+	} else {
+		ck_assert(event == OWFD_RTSP_SERVER_CLOSE);
+		++server_closes;
+	}
+}
+
+static void server_run(unsigned int flags)
+{
+	static const char req[] = "OPTIONS * RTSP/1.0\r\nCSeq: 7\r\n\r\n";
+	static const char res[] = "RTSP/1.0 200 OK\r\nCSeq: 7\r\n\r\n";
+	struct owfd_rtsp_server_stats stats;
+	struct owfd_rtsp_server *srv;
+	struct sockaddr_in6 addr;
+	char buf[128];
+	int r, fds[5], i;
+	ssize_t l;
+
+	r = owfd_rtsp_server_new(&srv, test_rtsp_server_event);
+	ck_assert(r >= 0);
+	owfd_rtsp_server_set_data(srv, &server_connects);
+	owfd_rtsp_server_set_max_sessions(srv, 4);
+	owfd_rtsp_server_set_flags(srv, flags);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	r = owfd_rtsp_server_listen(srv, &addr);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_server_listen(srv, &addr);
+	ck_assert(r == -EALREADY);
+	r = owfd_rtsp_server_get_addr(srv, &addr);
+	ck_assert(r >= 0);
+	ck_assert(addr.sin6_port != 0);
+
+	/* one connection more than allowed */
+	for (i = 0; i < 5; ++i) {
+		fds[i] = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		ck_assert(fds[i] >= 0);
+		r = connect(fds[i], (struct sockaddr*)&addr, sizeof(addr));
+		ck_assert(r >= 0);
+	}
+
+	server_connects = 0;
+	server_closes = 0;
+	for (i = 0; i < 100; ++i) {
+		owfd_rtsp_server_get_stats(srv, &stats);
+		if (stats.accepted + stats.rejected == 5)
+			break;
+		r = owfd_rtsp_server_dispatch(srv, 100);
+		ck_assert(r >= 0);
+	}
+
+	ck_assert(server_connects == 4);
+	ck_assert(stats.accepted == 4);
+	ck_assert(stats.rejected == 1);
+	ck_assert(stats.sessions == 4);
+	ck_assert(stats.memory > 0);
+
+	/* all sessions are served by the same loop */
+	for (i = 0; i < 4; ++i)
+		ck_assert(write(fds[i], req, sizeof(req) - 1) ==
+			  sizeof(req) - 1);
+
+	for (i = 0; i < 4; ++i) {
+		for (l = 0; l < (ssize_t)sizeof(res) - 1; ) {
+			r = owfd_rtsp_server_dispatch(srv, 100);
+			ck_assert(r >= 0);
+			r = recv(fds[i], &buf[l], sizeof(buf) - l,
+				 MSG_DONTWAIT);
+			ck_assert(r > 0 || errno == EAGAIN);
+			if (r > 0)
+				l += r;
+		}
+		ck_assert(l == sizeof(res) - 1);
+		ck_assert(!memcmp(buf, res, l));
+	}
+
+	/* the rejected connection was closed */
+	ck_assert(read(fds[4], buf, sizeof(buf)) <= 0);
+	close(fds[4]);
+
+	/* hangups close the session */
+	close(fds[0]);
+	for (i = 0; i < 100 && !server_closes; ++i) {
+		r = owfd_rtsp_server_dispatch(srv, 100);
+		ck_assert(r >= 0);
+	}
+	ck_assert(server_closes == 1);
+	owfd_rtsp_server_get_stats(srv, &stats);
+	ck_assert(stats.sessions == 3);
+	ck_assert(stats.closed == 1);
+	ck_assert(stats.peak_sessions == 4);
+
+	owfd_rtsp_server_unref(srv);
+	ck_assert(server_closes == 4);
+	for (i = 1; i < 4; ++i) {
+		ck_assert(read(fds[i], buf, sizeof(buf)) == 0);
+		close(fds[i]);
+	}
+}
+
+START_TEST(test_rtsp_server)
+{
+	server_run(0);
+}
+END_TEST
+
+START_TEST(test_rtsp_server_edge)
+{
+	server_run(OWFD_RTSP_SERVER_EDGE);
+}
+END_TEST
+
+/* falls back to epoll without io_uring, so this passes either way */
+START_TEST(test_rtsp_server_uring)
+{
+	server_run(OWFD_RTSP_SERVER_URING);
+}
+END_TEST
+
+START_TEST(test_rtsp_ctrl_edge)
+{
+	static char big[256 * 1024];
+	struct owfd_rtsp_ctrl_stats stats;
+	struct owfd_rtsp_ctrl *ctrl;
+	char *buf;
+	size_t i, len, pos;
+	ssize_t l;
+	int r, fds[2], size;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	size = 4096;
+	r = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_set_data(ctrl, &ctrl_msgs);
+	r = owfd_rtsp_ctrl_set_flags(ctrl, OWFD_RTSP_CTRL_EDGE);
+	ck_assert(r >= 0);
+	ck_assert(owfd_rtsp_ctrl_get_flags(ctrl) == OWFD_RTSP_CTRL_EDGE);
+	owfd_rtsp_ctrl_set_budget(ctrl, 4096, 0);
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_ctrl_msg);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_set_flags(ctrl, 0);
+	ck_assert(r == -EBUSY);
+
+	/* more input than a single wakeup may read, written at once */
+	buf = malloc(512 * 64);
+	ck_assert(!!buf);
+	len = 0;
+	for (i = 0; i < 512; ++i)
+		len += sprintf(&buf[len], "OPTIONS * RTSP/1.0\r\nCSeq: %zu\r\n\r\n",
+			       i + 1);
+	ck_assert(write(fds[1], buf, len) == (ssize_t)len);
+	free(buf);
+
+	ctrl_connects = 0;
+	ctrl_msgs = 0;
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+	ck_assert(r >= 0);
+	ck_assert(ctrl_msgs > 0 && ctrl_msgs < 512);
+	ck_assert(owfd_rtsp_ctrl_is_pending(ctrl));
+
+	/* the rest is read without further edges */
+	for (i = 0; i < 100 && ctrl_msgs < 512; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+		ck_assert(r >= 0);
+	}
+	ck_assert(ctrl_msgs == 512);
+	ck_assert(ctrl_connects == 1);
+
+	/* sends need no epoll_ctl(), neither direct nor queued ones */
+	for (i = 0; i < sizeof(big); ++i)
+		big[i] = 'a' + i % 26;
+	r = owfd_rtsp_ctrl_send(ctrl, big, sizeof(big));
+	ck_assert(r >= 0);
+
+	buf = malloc(sizeof(big) + 1);
+	ck_assert(!!buf);
+	for (pos = 0; pos < sizeof(big); ) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+
+		l = recv(fds[1], &buf[pos], sizeof(big) + 1 - pos,
+			 MSG_DONTWAIT);
+		ck_assert(l > 0 || errno == EAGAIN);
+		if (l > 0)
+			pos += l;
+	}
+	ck_assert(pos == sizeof(big));
+	ck_assert(!memcmp(buf, big, sizeof(big)));
+	free(buf);
+
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(!stats.polls);
+	ck_assert(stats.budget_stops > 0);
+	ck_assert(stats.stalls + stats.short_writes > 0);
+
+	/* hangups are still seen */
+	close(fds[1]);
+	for (i = 0; i < 100 && owfd_rtsp_ctrl_is_open(ctrl); ++i)
+		owfd_rtsp_ctrl_dispatch(ctrl, 100);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+END_TEST
+
+static int ctrl_error;
+
+static void test_rtsp_ctrl_error(struct owfd_rtsp_ctrl *ctrl, int error,
+				 void *data)
+{
+	ck_assert(error < 0);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+	ctrl_error = error;
+}
+
+START_TEST(test_rtsp_ctrl_loop)
+{
+	struct shl_loop loop;
+	struct owfd_rtsp_ctrl *ctrl;
+	char *buf, reply[64];
+	size_t i, len;
+	uint64_t wakeups;
+	ssize_t l;
+	int r, fds[2];
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new_loop(&ctrl, &loop);
+	ck_assert(r >= 0);
+	ck_assert(owfd_rtsp_ctrl_get_fd(ctrl) == shl_loop_get_fd(&loop));
+	owfd_rtsp_ctrl_set_data(ctrl, &ctrl_msgs);
+	owfd_rtsp_ctrl_set_error_cb(ctrl, test_rtsp_ctrl_error);
+	r = owfd_rtsp_ctrl_set_flags(ctrl, OWFD_RTSP_CTRL_EDGE);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_set_budget(ctrl, 4096, 0);
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_ctrl_msg);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+
+	/* the loop is driven by its owner only */
+	r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+	ck_assert(r == -EOPNOTSUPP);
+
+	buf = malloc(512 * 64);
+	ck_assert(!!buf);
+	len = 0;
+	for (i = 0; i < 512; ++i)
+		len += sprintf(&buf[len], "OPTIONS * RTSP/1.0\r\nCSeq: %zu\r\n\r\n",
+			       i + 1);
+	ck_assert(write(fds[1], buf, len) == (ssize_t)len);
+	free(buf);
+
+	/* one budget per wakeup, the rest is picked up by a defer */
+	ctrl_connects = 0;
+	ctrl_msgs = 0;
+	r = shl_loop_dispatch(&loop, 100);
+	ck_assert(r >= 0);
+	ck_assert(ctrl_connects == 1);
+	ck_assert(ctrl_msgs > 0 && ctrl_msgs < 512);
+	ck_assert(owfd_rtsp_ctrl_is_pending(ctrl));
+
+	/* no further edges come, each wakeup returns right away */
+	wakeups = loop.wakeups;
+	for (i = 0; i < 100 && ctrl_msgs < 512; ++i) {
+		len = ctrl_msgs;
+		r = shl_loop_dispatch(&loop, 1000);
+		ck_assert(r >= 0);
+		ck_assert(ctrl_msgs > len);
+	}
+	ck_assert(ctrl_msgs == 512);
+	ck_assert(loop.wakeups - wakeups == i);
+
+	/* sends go out directly and timers share the wheel of the loop */
+	r = owfd_rtsp_ctrl_send(ctrl, "RTSP/1.0 200 OK\r\n\r\n", 19);
+	ck_assert(r >= 0);
+	l = read(fds[1], reply, sizeof(reply));
+	ck_assert(l == 19);
+
+	r = owfd_rtsp_ctrl_set_timeout(ctrl, 20);
+	ck_assert(r >= 0);
+	ck_assert(shl_wheel_count(shl_loop_get_wheel(&loop)) == 1);
+
+	/* the timeout closes the ctrl and reports it */
+	ctrl_error = 0;
+	for (i = 0; i < 100 && owfd_rtsp_ctrl_is_open(ctrl); ++i)
+		shl_loop_dispatch(&loop, 100);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+	ck_assert(ctrl_error == -ETIMEDOUT);
+	ck_assert(!shl_wheel_count(shl_loop_get_wheel(&loop)));
+
+	/* hangups close it, too */
+	close(fds[1]);
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+	close(fds[1]);
+
+	ctrl_error = 0;
+	for (i = 0; i < 100 && owfd_rtsp_ctrl_is_open(ctrl); ++i)
+		shl_loop_dispatch(&loop, 100);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+	ck_assert(ctrl_error == -EPIPE);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	shl_loop_destroy(&loop);
+}
+END_TEST
+
+START_TEST(test_rtsp_ctrl_pair)
+{
+	static const unsigned int modes[] = {
+		OWFD_RTSP_CTRL_PAIR_SOCKET,
+		OWFD_RTSP_CTRL_PAIR_MEM,
+	};
+	struct shl_loop loop;
+	struct owfd_rtsp_ctrl *a, *b, *c;
+	char *buf;
+	size_t i, j, len;
+	int r;
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	buf = malloc(512 * 64);
+	ck_assert(!!buf);
+	len = 0;
+	for (i = 0; i < 512; ++i)
+		len += sprintf(&buf[len], "OPTIONS * RTSP/1.0\r\nCSeq: %zu\r\n\r\n",
+			       i + 1);
+
+	for (j = 0; j < sizeof(modes) / sizeof(*modes); ++j) {
+		r = owfd_rtsp_ctrl_new_loop(&a, &loop);
+		ck_assert(r >= 0);
+		r = owfd_rtsp_ctrl_new_loop(&b, &loop);
+		ck_assert(r >= 0);
+		owfd_rtsp_ctrl_set_data(b, &ctrl_msgs);
+		owfd_rtsp_ctrl_set_error_cb(b, test_rtsp_ctrl_error);
+
+		/* in-memory pipes resume from their defer, like edge mode */
+		if (modes[j] == OWFD_RTSP_CTRL_PAIR_MEM)
+			owfd_rtsp_ctrl_set_budget(b, 4096, 0);
+		r = owfd_rtsp_ctrl_set_msg_cb(b, test_rtsp_ctrl_msg);
+		ck_assert(r >= 0);
+
+		r = owfd_rtsp_ctrl_open_pair(a, a, modes[j],
+					     test_rtsp_ctrl_event);
+		ck_assert(r == -EINVAL);
+		r = owfd_rtsp_ctrl_open_pair(a, b, modes[j],
+					     test_rtsp_ctrl_event);
+		ck_assert(r >= 0);
+		r = owfd_rtsp_ctrl_open_pair(a, b, modes[j],
+					     test_rtsp_ctrl_event);
+		ck_assert(r == -EALREADY);
+
+		ctrl_connects = 0;
+		for (i = 0; i < 100 && ctrl_connects < 2; ++i)
+			shl_loop_dispatch(&loop, 100);
+		ck_assert(ctrl_connects == 2);
+
+		r = owfd_rtsp_ctrl_send(a, buf, len);
+		ck_assert(r >= 0);
+
+		/* whatever was sent before the hangup is still delivered */
+		owfd_rtsp_ctrl_close(a);
+		ck_assert(!owfd_rtsp_ctrl_is_open(a));
+
+		ctrl_msgs = 0;
+		ctrl_error = 0;
+		for (i = 0; i < 100 && owfd_rtsp_ctrl_is_open(b); ++i)
+			shl_loop_dispatch(&loop, 100);
+		ck_assert(ctrl_msgs == 512);
+		ck_assert(!owfd_rtsp_ctrl_is_open(b));
+		ck_assert(ctrl_error == -EPIPE);
+
+		owfd_rtsp_ctrl_unref(b);
+		owfd_rtsp_ctrl_unref(a);
+	}
+
+	/* in-memory pipes are driven by defers of a loop */
+	r = owfd_rtsp_ctrl_new(&c);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_new_loop(&a, &loop);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_pair(a, c, OWFD_RTSP_CTRL_PAIR_MEM,
+				     test_rtsp_ctrl_event);
+	ck_assert(r == -EOPNOTSUPP);
+	r = owfd_rtsp_ctrl_open_pair(a, c, -1, test_rtsp_ctrl_event);
+	ck_assert(r == -EINVAL);
+	owfd_rtsp_ctrl_unref(a);
+	owfd_rtsp_ctrl_unref(c);
+
+	free(buf);
+	shl_loop_destroy(&loop);
+}
+END_TEST
+
+START_TEST(test_rtsp_ctrl_uring)
+{
+	static char big[256 * 1024];
+	struct owfd_rtsp_uring_stats rstats;
+	struct owfd_rtsp_ctrl_stats stats;
+	struct owfd_rtsp_ctrl *ctrl;
+	char buf[64 * 64], *out;
+	size_t i, len, n, pos;
+	ssize_t l;
+	int r, fds[2], size;
+
+	for (i = 0; i < sizeof(big); ++i)
+		big[i] = 'a' + i % 26;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	size = 4096;
+	r = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_set_data(ctrl, &ctrl_msgs);
+
+	/* nothing to test without io_uring */
+	r = owfd_rtsp_ctrl_set_uring(ctrl, NULL);
+	if (r < 0) {
+		owfd_rtsp_ctrl_unref(ctrl);
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	ck_assert(!!owfd_rtsp_ctrl_get_uring(ctrl));
+	r = owfd_rtsp_ctrl_set_uring(ctrl, NULL);
+	ck_assert(r == -EALREADY);
+
+	r = owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_ctrl_msg);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], test_rtsp_ctrl_event);
+	ck_assert(r >= 0);
+
+	/* requests arrive through the multishot receive */
+	len = 0;
+	for (i = 0; i < 64; ++i)
+		len += sprintf(&buf[len], "OPTIONS * RTSP/1.0\r\nCSeq: %zu\r\n\r\n",
+			       i + 1);
+
+	ctrl_connects = 0;
+	ctrl_msgs = 0;
+	for (i = 0; i < len; i += n) {
+		n = len - i < 333 ? len - i : 333;
+		ck_assert(write(fds[1], &buf[i], n) == (ssize_t)n);
+
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 0);
+		ck_assert(r >= 0);
+	}
+
+	for (i = 0; i < 100 && ctrl_msgs < 64; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+	}
+
+	ck_assert(ctrl_connects == 1);
+	ck_assert(ctrl_msgs == 64);
+
+	/* large sends complete in pieces, in order */
+	out = malloc(sizeof(big));
+	ck_assert(!!out);
+	ctrl_frees = 0;
+	r = owfd_rtsp_ctrl_send(ctrl, "1:", 2);
+	ck_assert(r >= 0);
+	memcpy(out, big, sizeof(big));
+	r = owfd_rtsp_ctrl_send_owned(ctrl, out, sizeof(big),
+				      test_rtsp_ctrl_free);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_send(ctrl, "2:", 2);
+	ck_assert(r >= 0);
+
+	len = 2 + sizeof(big) + 2;
+	out = malloc(len + 1);
+	ck_assert(!!out);
+	for (pos = 0; pos < len; ) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 100);
+		ck_assert(r >= 0);
+
+		l = recv(fds[1], &out[pos], len + 1 - pos, MSG_DONTWAIT);
+		ck_assert(l > 0 || errno == EAGAIN);
+		if (l > 0)
+			pos += l;
+	}
+
+	for (i = 0; i < 100 && !ctrl_frees; ++i) {
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 10);
+		ck_assert(r >= 0);
+	}
+
+	ck_assert(pos == len);
+	ck_assert(ctrl_frees == 1);
+	ck_assert(!memcmp(out, "1:", 2));
+	ck_assert(!memcmp(&out[2], big, sizeof(big)));
+	ck_assert(!memcmp(&out[2 + sizeof(big)], "2:", 2));
+	free(out);
+
+	/* no read() or epoll_ctl() calls on the socket */
+	owfd_rtsp_ctrl_get_stats(ctrl, &stats);
+	ck_assert(stats.bytes_sent == len);
+	ck_assert(!stats.reads);
+	ck_assert(!stats.polls);
+	owfd_rtsp_uring_get_stats(owfd_rtsp_ctrl_get_uring(ctrl), &rstats);
+	ck_assert(rstats.enters > 0);
+	ck_assert(rstats.completions > 0);
+	ck_assert(rstats.recv_bufs > 0);
+
+	/* hangups close the ctrl */
+	close(fds[1]);
+	for (i = 0; i < 100 && owfd_rtsp_ctrl_is_open(ctrl); ++i)
+		owfd_rtsp_ctrl_dispatch(ctrl, 100);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+
+	owfd_rtsp_ctrl_unref(ctrl);
+}
+END_TEST
+
+static unsigned int timer_counts[2];
+
+static void test_rtsp_ctrl_timer(struct owfd_rtsp_ctrl *ctrl,
+				 unsigned int timer, void *data)
+{
+	ck_assert(data == timer_counts);
+	ck_assert(timer <= OWFD_RTSP_CTRL_TIMEOUT);
+	++timer_counts[timer];
+
+	/* sends from timer callbacks are corked */
+	if (timer == OWFD_RTSP_CTRL_KEEPALIVE)
+		ck_assert(owfd_rtsp_ctrl_sendf(ctrl, "ping") >= 0);
+}
+
+START_TEST(test_rtsp_ctrl_timers)
+{
+	struct owfd_rtsp_ctrl *ctrl;
+	struct shl_wheel w;
+	char buf[128];
+	int r, fds[2], efd;
+	ssize_t l;
+
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	ck_assert(efd >= 0);
+
+	/* shared ctrls run on the wheel of their owner */
+	r = owfd_rtsp_ctrl_new_shared(&ctrl, efd, NULL);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_set_keepalive(ctrl, 10);
+	ck_assert(r == -EINVAL);
+
+	r = shl_wheel_init(&w, 1, 0);
+	ck_assert(r >= 0);
+	owfd_rtsp_ctrl_set_wheel(ctrl, &w);
+	owfd_rtsp_ctrl_set_timer_cb(ctrl, test_rtsp_ctrl_timer, timer_counts);
+	r = owfd_rtsp_ctrl_set_keepalive(ctrl, 10);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_set_timeout(ctrl, 25);
+	ck_assert(r >= 0);
+	ck_assert(!shl_wheel_count(&w));
+
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], NULL);
+	ck_assert(r >= 0);
+	ck_assert(shl_wheel_count(&w) == 2);
+	r = owfd_rtsp_ctrl_dispatch_events(ctrl, EPOLLOUT);
+	ck_assert(r >= 0);
+
+	memset(timer_counts, 0, sizeof(timer_counts));
+	shl_wheel_advance(&w, 20);
+	ck_assert(timer_counts[OWFD_RTSP_CTRL_KEEPALIVE] == 2);
+	l = read(fds[1], buf, sizeof(buf));
+	ck_assert(l == 8 && !memcmp(buf, "pingping", 8));
+
+	/* incoming data postpones the timeout */
+	ck_assert(write(fds[1], "x", 1) == 1);
+	r = owfd_rtsp_ctrl_dispatch_events(ctrl, EPOLLIN);
+	ck_assert(r >= 0);
+	shl_wheel_advance(&w, 44);
+	ck_assert(!timer_counts[OWFD_RTSP_CTRL_TIMEOUT]);
+	shl_wheel_advance(&w, 45);
+	ck_assert(timer_counts[OWFD_RTSP_CTRL_TIMEOUT] == 1);
+	shl_wheel_advance(&w, 70);
+	ck_assert(timer_counts[OWFD_RTSP_CTRL_TIMEOUT] == 2);
+	ck_assert(timer_counts[OWFD_RTSP_CTRL_KEEPALIVE] == 7);
+
+	/* without a callback, timeouts close the ctrl */
+	owfd_rtsp_ctrl_set_timer_cb(ctrl, NULL, NULL);
+	r = owfd_rtsp_ctrl_set_keepalive(ctrl, 0);
+	ck_assert(r >= 0);
+	shl_wheel_advance(&w, 100);
+	ck_assert(!owfd_rtsp_ctrl_is_open(ctrl));
+	ck_assert(!shl_wheel_count(&w));
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	shl_wheel_destroy(&w);
+	close(fds[1]);
+
+	/* standalone ctrls dispatch their own wheel */
+	r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_new(&ctrl);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_open_tcp_fd(ctrl, fds[0], NULL);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_ctrl_set_timeout(ctrl, 30);
+	ck_assert(r >= 0);
+
+	for (r = 0; r >= 0; )
+		r = owfd_rtsp_ctrl_dispatch(ctrl, 1000);
+	ck_assert(r == -ENODEV);
+	ck_assert(read(fds[1], buf, sizeof(buf)) == 0);
+
+	owfd_rtsp_ctrl_unref(ctrl);
+	close(fds[1]);
+	close(efd);
+}
+END_TEST
+
+static unsigned int server_keepalives, server_timeouts;
+
+static void test_rtsp_server_timer_event(struct owfd_rtsp_server *srv,
+					 struct owfd_rtsp_session *sess,
+					 unsigned int event, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = owfd_rtsp_session_get_ctrl(sess);
+
+	if (event == OWFD_RTSP_SERVER_KEEPALIVE) {
+		++server_keepalives;
+		owfd_rtsp_ctrl_sendf(ctrl, "GET_PARAMETER rtsp://localhost/wfd1.0 RTSP/1.0\r\n"
+				     "CSeq: %u\r\n\r\n", server_keepalives);
+	} else if (event == OWFD_RTSP_SERVER_TIMEOUT) {
+		++server_timeouts;
+	} else if (event == OWFD_RTSP_SERVER_CLOSE) {
+		++server_closes;
+	}
+}
+
+START_TEST(test_rtsp_server_timeouts)
+{
+	struct owfd_rtsp_server *srv;
+	struct sockaddr_in6 addr;
+	char buf[256];
+	int r, fd, i;
+
+	r = owfd_rtsp_server_new(&srv, test_rtsp_server_timer_event);
+	ck_assert(r >= 0);
+	owfd_rtsp_server_set_timeouts(srv, 20, 100);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	r = owfd_rtsp_server_listen(srv, &addr);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_server_get_addr(srv, &addr);
+	ck_assert(r >= 0);
+
+	fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ck_assert(fd >= 0);
+	r = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+	ck_assert(r >= 0);
+
+	/* the peer never answers, so keepalives end in a timeout */
+	server_keepalives = 0;
+	server_timeouts = 0;
+	server_closes = 0;
+	for (i = 0; i < 100 && !server_closes; ++i) {
+		r = owfd_rtsp_server_dispatch(srv, 100);
+		ck_assert(r >= 0);
+	}
+
+	ck_assert(server_timeouts == 1);
+	ck_assert(server_closes == 1);
+	ck_assert(server_keepalives >= 2);
+	ck_assert(read(fd, buf, sizeof(buf)) > 0);
+
+	owfd_rtsp_server_unref(srv);
+	close(fd);
+}
+END_TEST
+
+static void test_rtsp_reactor_event(struct owfd_rtsp_server *srv,
+				    struct owfd_rtsp_session *sess,
+				    unsigned int event, void *data)
+{
+	struct owfd_rtsp_ctrl *ctrl = owfd_rtsp_session_get_ctrl(sess);
+
+	if (event == OWFD_RTSP_SERVER_CONNECT)
+		owfd_rtsp_ctrl_set_msg_cb(ctrl, test_rtsp_server_msg);
+}
+
+START_TEST(test_rtsp_reactor)
+{
+	static const char req[] = "OPTIONS * RTSP/1.0\r\nCSeq: 7\r\n\r\n";
+	static const char res[] = "RTSP/1.0 200 OK\r\nCSeq: 7\r\n\r\n";
+	struct owfd_rtsp_server_stats stats;
+	struct owfd_rtsp_reactor *pool;
+	struct sockaddr_in6 addr;
+	struct timeval tv = { 5, 0 };
+	char buf[128];
+	int r, fds[16], i;
+	ssize_t l;
+
+	r = owfd_rtsp_reactor_new(&pool, 3, test_rtsp_reactor_event, NULL);
+	ck_assert(r >= 0);
+	ck_assert(owfd_rtsp_reactor_get_threads(pool) == 3);
+	ck_assert(!!owfd_rtsp_reactor_get_server(pool, 2));
+	ck_assert(!owfd_rtsp_reactor_get_server(pool, 3));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_loopback;
+	r = owfd_rtsp_reactor_listen(pool, &addr);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_reactor_get_addr(pool, &addr);
+	ck_assert(r >= 0);
+
+	r = owfd_rtsp_reactor_start(pool);
+	ck_assert(r >= 0);
+	r = owfd_rtsp_reactor_start(pool);
+	ck_assert(r == -EALREADY);
+
+	for (i = 0; i < 16; ++i) {
+		fds[i] = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		ck_assert(fds[i] >= 0);
+		r = setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv,
+			       sizeof(tv));
+		ck_assert(r >= 0);
+		r = connect(fds[i], (struct sockaddr*)&addr, sizeof(addr));
+		ck_assert(r >= 0);
+		ck_assert(write(fds[i], req, sizeof(req) - 1) ==
+			  sizeof(req) - 1);
+	}
+
+	for (i = 0; i < 16; ++i) {
+		for (l = 0; l < (ssize_t)sizeof(res) - 1; l += r) {
+			r = read(fds[i], &buf[l], sizeof(res) - 1 - l);
+			ck_assert(r > 0);
+		}
+		ck_assert(!memcmp(buf, res, l));
+	}
+
+	r = owfd_rtsp_reactor_stop(pool);
+	ck_assert(r >= 0);
+	owfd_rtsp_reactor_get_stats(pool, &stats);
+	ck_assert(stats.accepted == 16);
+	ck_assert(stats.sessions == 16);
+
+	/* sessions are served again by new threads */
+	r = owfd_rtsp_reactor_start(pool);
+	ck_assert(r >= 0);
+
+	for (i = 0; i < 16; ++i) {
+		ck_assert(write(fds[i], req, sizeof(req) - 1) ==
+			  sizeof(req) - 1);
+		for (l = 0; l < (ssize_t)sizeof(res) - 1; l += r) {
+			r = read(fds[i], &buf[l], sizeof(res) - 1 - l);
+			ck_assert(r > 0);
+		}
+		ck_assert(!memcmp(buf, res, l));
+	}
+
+	r = owfd_rtsp_reactor_stop(pool);
+	ck_assert(r >= 0);
+
+	owfd_rtsp_reactor_free(pool);
+	for (i = 0; i < 16; ++i) {
+		ck_assert(read(fds[i], buf, sizeof(buf)) == 0);
+		close(fds[i]);
+	}
+}
+END_TEST
+
+TEST_DEFINE_CASE(ctrl)
+	TEST(test_rtsp_ctrl_decoder)
+	TEST(test_rtsp_ctrl_send)
+	TEST(test_rtsp_builder)
+	TEST(test_rtsp_ctrl_request)
+	TEST(test_rtsp_ctrl_stats)
+	TEST(test_rtsp_ctrl_timers)
+	TEST(test_rtsp_ctrl_edge)
+	TEST(test_rtsp_ctrl_loop)
+	TEST(test_rtsp_ctrl_pair)
+	TEST(test_rtsp_ctrl_uring)
+	TEST(test_rtsp_server)
+	TEST(test_rtsp_server_edge)
+	TEST(test_rtsp_server_uring)
+	TEST(test_rtsp_server_timeouts)
+	TEST(test_rtsp_reactor)
+TEST_END_CASE
+
+TEST_DEFINE_CASE(params)
+	TEST(test_rtsp_params)
 TEST_END_CASE
 
 TEST_DEFINE(
 	TEST_SUITE(rtsp,
 		TEST_CASE(decoder),
+		TEST_CASE(params),
+		TEST_CASE(ctrl),
 		TEST_END
 	)
 )
@@ -0,0 +1,231 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "shl_spsc.h"
+#include "test_common.h"
+
+START_TEST(test_spsc_basic)
+{
+	struct shl_spsc q;
+	struct iovec vec[2];
+	char buf[5000], out[5000];
+	size_t i, n;
+	int r;
+
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = i * 13;
+
+	r = shl_spsc_init(&q, 3000, 0);
+	ck_assert(!r);
+	ck_assert(q.size == 4096);
+	ck_assert(shl_spsc_get_fd(&q) < 0);
+	ck_assert(!shl_spsc_peek(&q, vec));
+	ck_assert(!shl_spsc_pop(&q, out, sizeof(out)));
+
+	/* the whole buffer can be filled, no byte is wasted */
+	ck_assert(shl_spsc_push(&q, buf, sizeof(buf)) == 4096);
+	ck_assert(!shl_spsc_push(&q, buf, 1));
+	ck_assert(!shl_spsc_reserve(&q, 1, vec));
+	ck_assert(shl_spsc_pop(&q, out, sizeof(out)) == 4096);
+	ck_assert(!memcmp(out, buf, 4096));
+
+	/* move the wrap-around point through the buffer */
+	for (i = 0; i < 4096; i += 97) {
+		ck_assert(shl_spsc_push(&q, buf, 97) == 97);
+		ck_assert(shl_spsc_pop(&q, out, 97) == 97);
+
+		n = shl_spsc_reserve(&q, 4000, vec);
+		ck_assert(n == 1 || n == 2);
+		ck_assert(vec[0].iov_len + (n > 1 ? vec[1].iov_len : 0) ==
+			  4096);
+		memcpy(vec[0].iov_base, buf, vec[0].iov_len);
+		if (n > 1)
+			memcpy(vec[1].iov_base, &buf[vec[0].iov_len],
+			       vec[1].iov_len);
+		shl_spsc_commit(&q, 4096);
+
+		n = shl_spsc_peek(&q, vec);
+		ck_assert(n == 1 || n == 2);
+		ck_assert(!memcmp(vec[0].iov_base, buf, vec[0].iov_len));
+		shl_spsc_consume(&q, vec[0].iov_len);
+		ck_assert(shl_spsc_pop(&q, out, sizeof(out)) ==
+			  4096 - vec[0].iov_len);
+		ck_assert(!shl_spsc_peek(&q, vec));
+	}
+
+	shl_spsc_destroy(&q);
+}
+END_TEST
+
+#define SPSC_TOTAL (16 * 1024 * 1024)
+
+static void *spsc_producer(void *data)
+{
+	static char buf[3][700];
+	struct shl_spsc *q = data;
+	struct iovec vec[3];
+	size_t i, j, n, len, pos = 0;
+
+	for (i = 0; pos < SPSC_TOTAL; ++i) {
+		/* batches of three chunks with varying lengths */
+		for (j = 0; j < 3; ++j) {
+			len = (i * 7 + j * 131) % 700;
+			if (len > SPSC_TOTAL - pos)
+				len = SPSC_TOTAL - pos;
+			for (n = 0; n < len; ++n)
+				buf[j][n] = (char)(pos + n);
+
+			vec[j].iov_base = buf[j];
+			vec[j].iov_len = len;
+			pos += len;
+		}
+
+		/* retry with the remainder until the whole batch is in */
+		j = 0;
+		while (j < 3) {
+			n = shl_spsc_pushv(q, &vec[j], 3 - j);
+			while (j < 3 && n >= vec[j].iov_len)
+				n -= vec[j++].iov_len;
+			if (j < 3) {
+				vec[j].iov_base = (char*)vec[j].iov_base + n;
+				vec[j].iov_len -= n;
+				if (!n)
+					sched_yield();
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* read everything the producer sends and verify it, returns wakeup count */
+static size_t spsc_consume_all(struct shl_spsc *q)
+{
+	struct pollfd pfd;
+	struct iovec vec[2];
+	size_t pos = 0, wakeups = 0, i, j, n;
+	const char *b;
+	int r;
+
+	while (pos < SPSC_TOTAL) {
+		n = shl_spsc_peek(q, vec);
+		if (!n) {
+			if (shl_spsc_get_fd(q) < 0) {
+				sched_yield();
+				continue;
+			}
+
+			pfd.fd = shl_spsc_get_fd(q);
+			pfd.events = POLLIN;
+			r = poll(&pfd, 1, 10000);
+			ck_assert(r == 1);
+			shl_spsc_ack(q);
+			++wakeups;
+			continue;
+		}
+
+		for (i = 0; i < n; ++i) {
+			b = vec[i].iov_base;
+			for (j = 0; j < vec[i].iov_len; ++j) {
+				if (b[j] != (char)(pos + j))
+					break;
+			}
+			ck_assert(j == vec[i].iov_len);
+			pos += vec[i].iov_len;
+			shl_spsc_consume(q, vec[i].iov_len);
+		}
+	}
+
+	ck_assert(!shl_spsc_peek(q, vec));
+	return wakeups;
+}
+
+START_TEST(test_spsc_threaded)
+{
+	struct shl_spsc q;
+	pthread_t t;
+	int r;
+
+	r = shl_spsc_init(&q, 4096, 0);
+	ck_assert(!r);
+
+	r = pthread_create(&t, NULL, spsc_producer, &q);
+	ck_assert(!r);
+	spsc_consume_all(&q);
+	r = pthread_join(t, NULL);
+	ck_assert(!r);
+
+	shl_spsc_destroy(&q);
+}
+END_TEST
+
+START_TEST(test_spsc_wakeup)
+{
+	struct shl_spsc q;
+	struct pollfd pfd;
+	pthread_t t;
+	int r;
+
+	r = shl_spsc_init(&q, 4096, SHL_SPSC_WAKEUP);
+	ck_assert(!r);
+	ck_assert(shl_spsc_get_fd(&q) >= 0);
+
+	/* only the first push into an empty ring wakes up the consumer */
+	pfd.fd = shl_spsc_get_fd(&q);
+	pfd.events = POLLIN;
+	ck_assert(!poll(&pfd, 1, 0));
+	ck_assert(shl_spsc_push(&q, "abc", 3) == 3);
+	ck_assert(poll(&pfd, 1, 0) == 1);
+	shl_spsc_ack(&q);
+	ck_assert(shl_spsc_push(&q, "def", 3) == 3);
+	ck_assert(!poll(&pfd, 1, 0));
+	ck_assert(shl_spsc_pop(&q, (char[6]){ 0 }, 6) == 6);
+
+	r = pthread_create(&t, NULL, spsc_producer, &q);
+	ck_assert(!r);
+	spsc_consume_all(&q);
+	r = pthread_join(t, NULL);
+	ck_assert(!r);
+
+	shl_spsc_destroy(&q);
+}
+END_TEST
+
+TEST_DEFINE_CASE(spsc)
+	TEST(test_spsc_basic)
+	TEST(test_spsc_threaded)
+	TEST(test_spsc_wakeup)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(spsc,
+		TEST_CASE(spsc),
+		TEST_END
+	)
+)
@@ -0,0 +1,237 @@
+/*
+ * OpenWFD - Open-Source Wifi-Display Implementation
+ *
+ * Copyright (c) 2013 David Herrmann <dh.herrmann@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include "shl_wheel.h"
+#include "test_common.h"
+
+#define NUM 4096
+
+struct wtimer {
+	struct shl_wheel_timer t;
+	struct shl_wheel *w;
+	uint64_t due;
+	unsigned int fired;
+	bool rearm;
+};
+
+static void wtimer_cb(struct shl_wheel_timer *t, void *data)
+{
+	struct wtimer *wt = data;
+
+	/* timers run exactly at their tick, in order */
+	ck_assert(!shl_wheel_timer_pending(t));
+	ck_assert(shl_wheel_now(wt->w) == wt->due);
+	++wt->fired;
+
+	if (wt->rearm) {
+		wt->rearm = false;
+		wt->due += 7;
+		shl_wheel_add(wt->w, t, 7);
+	}
+}
+
+static unsigned int rnd(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) & 0xffffff;
+}
+
+START_TEST(test_wheel_basic)
+{
+	struct shl_wheel w;
+	struct wtimer t[3];
+	size_t i;
+	int r;
+
+	r = shl_wheel_init(&w, 0, 0);
+	ck_assert(r == -EINVAL);
+	r = shl_wheel_init(&w, 1, 0);
+	ck_assert(!r);
+	ck_assert(shl_wheel_get_fd(&w) < 0);
+	ck_assert(shl_wheel_next(&w) < 0);
+
+	for (i = 0; i < 3; ++i) {
+		shl_wheel_timer_init(&t[i].t, wtimer_cb, &t[i]);
+		t[i].w = &w;
+		t[i].fired = 0;
+		t[i].rearm = false;
+	}
+
+	t[0].due = 10;
+	shl_wheel_add(&w, &t[0].t, 10);
+	t[1].due = 100000;
+	shl_wheel_add(&w, &t[1].t, 100000);
+	t[2].due = 5;
+	shl_wheel_add(&w, &t[2].t, 5);
+	ck_assert(shl_wheel_count(&w) == 3);
+	ck_assert(shl_wheel_next(&w) == 5);
+
+	/* cancel and re-arm */
+	shl_wheel_del(&w, &t[2].t);
+	shl_wheel_del(&w, &t[2].t);
+	ck_assert(!shl_wheel_timer_pending(&t[2].t));
+	ck_assert(shl_wheel_count(&w) == 2);
+	t[0].due = 20;
+	shl_wheel_add(&w, &t[0].t, 20);
+	ck_assert(shl_wheel_count(&w) == 2);
+
+	ck_assert(shl_wheel_advance(&w, 19) == 0);
+	ck_assert(shl_wheel_advance(&w, 20) == 1);
+	ck_assert(t[0].fired == 1);
+
+	/* far timers are cascaded down */
+	ck_assert(shl_wheel_advance(&w, 99999) == 0);
+	t[1].rearm = true;
+	ck_assert(shl_wheel_advance(&w, 1000000) == 2);
+	ck_assert(t[1].fired == 2);
+	ck_assert(!shl_wheel_count(&w));
+
+	/* timers beyond the range of the top level */
+	t[2].due = shl_wheel_now(&w) + (1ULL << 30);
+	shl_wheel_add(&w, &t[2].t, 1ULL << 30);
+	ck_assert(shl_wheel_advance(&w, t[2].due - 1) == 0);
+	ck_assert(shl_wheel_advance(&w, t[2].due) == 1);
+
+	shl_wheel_destroy(&w);
+}
+END_TEST
+
+START_TEST(test_wheel_random)
+{
+	static struct wtimer t[NUM];
+	struct shl_wheel w;
+	unsigned int seed = 1, op;
+	uint64_t now, ms, fired, expected;
+	size_t i, j;
+	int r;
+
+	r = shl_wheel_init(&w, 1, 0);
+	ck_assert(!r);
+
+	for (i = 0; i < NUM; ++i) {
+		shl_wheel_timer_init(&t[i].t, wtimer_cb, &t[i]);
+		t[i].w = &w;
+		t[i].fired = 0;
+		t[i].rearm = false;
+	}
+
+	/* random arm, re-arm and cancel against a reference */
+	fired = 0;
+	expected = 0;
+	now = 0;
+	for (j = 0; j < 200; ++j) {
+		for (i = 0; i < NUM / 8; ++i) {
+			op = rnd(&seed);
+			r = op % NUM;
+			if (op & 0x100000) {
+				if (shl_wheel_timer_pending(&t[r].t))
+					shl_wheel_del(&w, &t[r].t);
+				continue;
+			}
+
+			/* mix of short, medium and very long timeouts */
+			ms = rnd(&seed);
+			if (op & 0x80000)
+				ms %= 100;
+			else if (op & 0x40000)
+				ms %= 300000;
+			ms += 1;
+
+			shl_wheel_add(&w, &t[r].t, ms);
+			t[r].due = now + ms;
+		}
+
+		now += rnd(&seed) % (j & 1 ? 5000 : 200);
+		for (i = 0; i < NUM; ++i) {
+			fired += t[i].fired;
+			t[i].fired = 0;
+			if (shl_wheel_timer_pending(&t[i].t) && t[i].due <= now)
+				++expected;
+		}
+
+		shl_wheel_advance(&w, now);
+		for (i = 0; i < NUM; ++i) {
+			fired += t[i].fired;
+			t[i].fired = 0;
+			ck_assert(!shl_wheel_timer_pending(&t[i].t) ||
+				  t[i].due > now);
+		}
+		ck_assert(fired == expected);
+	}
+
+	shl_wheel_destroy(&w);
+	ck_assert(!shl_wheel_count(&w));
+}
+END_TEST
+
+START_TEST(test_wheel_timerfd)
+{
+	struct shl_wheel w;
+	struct wtimer t;
+	struct pollfd pfd;
+	int r;
+
+	r = shl_wheel_init(&w, 1, SHL_WHEEL_TIMERFD);
+	ck_assert(!r);
+	ck_assert(shl_wheel_get_fd(&w) >= 0);
+
+	shl_wheel_timer_init(&t.t, wtimer_cb, &t);
+	t.w = &w;
+	t.fired = 0;
+	t.rearm = false;
+	shl_wheel_add(&w, &t.t, 20);
+	t.due = t.t.expires;
+
+	pfd.fd = shl_wheel_get_fd(&w);
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, 1000);
+	ck_assert(r == 1);
+
+	/* timers still run at their exact tick, even if dispatched late */
+	r = shl_wheel_dispatch(&w);
+	ck_assert(r == 1);
+	ck_assert(t.fired == 1);
+	ck_assert(!shl_wheel_count(&w));
+	ck_assert(shl_wheel_time(&w) >= t.due);
+
+	shl_wheel_destroy(&w);
+}
+END_TEST
+
+TEST_DEFINE_CASE(wheel)
+	TEST(test_wheel_basic)
+	TEST(test_wheel_random)
+	TEST(test_wheel_timerfd)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(wheel,
+		TEST_CASE(wheel),
+		TEST_END
+	)
+)
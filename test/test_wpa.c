@@ -23,6 +23,13 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shl_loop.h"
 #include "test_common.h"
 
 static void parse(struct owfd_wpa_event *ev, const char *event)
@@ -148,14 +155,134 @@ START_TEST(test_wpa_parser_payload)
 }
 END_TEST
 
+#define TEST_WPA_EVENT "<3>P2P-FIND-STOPPED"
+
+/* answers all requests with OK and sends an event after ATTACH */
+static void fake_wpa(int fd)
+{
+	struct sockaddr_un src;
+	struct pollfd pfd;
+	socklen_t len;
+	char buf[512];
+	ssize_t l;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 5000) == 1) {
+		len = sizeof(src);
+		l = recvfrom(fd, buf, sizeof(buf) - 1, 0,
+			     (struct sockaddr*)&src, &len);
+		if (l <= 0)
+			break;
+		buf[l] = 0;
+
+		sendto(fd, "OK\n", 3, 0, (struct sockaddr*)&src, len);
+		if (!strcmp(buf, "ATTACH"))
+			sendto(fd, TEST_WPA_EVENT, strlen(TEST_WPA_EVENT), 0,
+			       (struct sockaddr*)&src, len);
+		else if (!strcmp(buf, "DETACH"))
+			break;
+	}
+
+	_exit(0);
+}
+
+static unsigned int wpa_events;
+
+static void test_wpa_ctrl_event(struct owfd_wpa_ctrl *wpa, void *buf,
+				size_t len, void *data)
+{
+	ck_assert(data == &wpa_events);
+	ck_assert(len == strlen(TEST_WPA_EVENT));
+	ck_assert(!strcmp(buf, TEST_WPA_EVENT));
+	++wpa_events;
+}
+
+static void test_wpa_ctrl_error(struct owfd_wpa_ctrl *wpa, int error,
+				void *data)
+{
+	ck_assert_msg(0, "unexpected wpa error %d", error);
+}
+
+START_TEST(test_wpa_ctrl_loop)
+{
+	struct shl_loop loop;
+	struct owfd_wpa_ctrl *wpa;
+	struct sockaddr_un addr;
+	int r, i, fd;
+	pid_t pid;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path),
+		 "/tmp/openwfd-test-wpa-%d", (int)getpid());
+	unlink(addr.sun_path);
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	ck_assert(fd >= 0);
+	r = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	ck_assert(r >= 0);
+
+	pid = fork();
+	ck_assert(pid >= 0);
+	if (!pid)
+		fake_wpa(fd);
+	close(fd);
+
+	r = shl_loop_init(&loop);
+	ck_assert(r >= 0);
+
+	r = owfd_wpa_ctrl_new_loop(&wpa, &loop);
+	ck_assert(r >= 0);
+	owfd_wpa_ctrl_set_data(wpa, &wpa_events);
+	owfd_wpa_ctrl_set_error_cb(wpa, test_wpa_ctrl_error);
+	ck_assert(owfd_wpa_ctrl_get_fd(wpa) == shl_loop_get_fd(&loop));
+
+	r = owfd_wpa_ctrl_open(wpa, addr.sun_path, test_wpa_ctrl_event);
+	ck_assert(r >= 0);
+	ck_assert(owfd_wpa_ctrl_is_open(wpa));
+
+	/* the loop is driven by its owner only */
+	r = owfd_wpa_ctrl_dispatch(wpa, 0);
+	ck_assert(r == -EOPNOTSUPP);
+
+	/* events arrive through the shared loop */
+	wpa_events = 0;
+	for (i = 0; i < 10 && !wpa_events; ++i) {
+		r = shl_loop_dispatch(&loop, 1000);
+		ck_assert(r >= 0);
+	}
+	ck_assert(wpa_events == 1);
+
+	/* synchronous requests still work */
+	r = owfd_wpa_ctrl_request_ok(wpa, "SET some 1", 10, 1000);
+	ck_assert(r >= 0);
+
+	owfd_wpa_ctrl_close(wpa);
+	ck_assert(!owfd_wpa_ctrl_is_open(wpa));
+	ck_assert(!shl_wheel_count(shl_loop_get_wheel(&loop)));
+
+	owfd_wpa_ctrl_unref(wpa);
+	shl_loop_destroy(&loop);
+
+	ck_assert(waitpid(pid, NULL, 0) == pid);
+	unlink(addr.sun_path);
+}
+END_TEST
+
 TEST_DEFINE_CASE(parser)
 	TEST(test_wpa_parser)
 	TEST(test_wpa_parser_payload)
 TEST_END_CASE
 
+TEST_DEFINE_CASE(ctrl)
+	TEST(test_wpa_ctrl_loop)
+TEST_END_CASE
+
 TEST_DEFINE(
 	TEST_SUITE(wpa,
 		TEST_CASE(parser),
+		TEST_CASE(ctrl),
 		TEST_END
 	)
 )